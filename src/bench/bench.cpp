@@ -4,8 +4,15 @@
 
 #include "bench.h"
 
+#include <univalue.h>
+
+#include <algorithm>
+#include <fstream>
 #include <iostream>
 #include <iomanip>
+#include <math.h>
+#include <regex>
+#include <sstream>
 #include <sys/time.h>
 
 using namespace benchmark;
@@ -18,23 +25,143 @@ static double gettimedouble(void) {
     return tv.tv_usec * 0.000001 + tv.tv_sec;
 }
 
+/** Read the CPU cycle counter, or return 0 if there is none we know of. */
+static uint64_t getcycles(void) {
+#if defined(__i386__) || defined(__x86_64__)
+    uint32_t lo, hi;
+    __asm__ __volatile__ ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+#else
+    return 0;
+#endif
+}
+
 BenchRunner::BenchRunner(std::string name, BenchFunction func)
 {
     benchmarks.insert(std::make_pair(name, func));
 }
 
+static UniValue ResultToJSON(const Result& result)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("name", result.name));
+    obj.push_back(Pair("count", result.count));
+    obj.push_back(Pair("samples", (uint64_t)result.samples));
+    obj.push_back(Pair("min", result.min));
+    obj.push_back(Pair("max", result.max));
+    obj.push_back(Pair("average", result.average));
+    obj.push_back(Pair("median", result.median));
+    obj.push_back(Pair("p95", result.p95));
+    obj.push_back(Pair("stddev", result.stddev));
+    obj.push_back(Pair("cycles", result.cycles));
+    return obj;
+}
+
 void
-BenchRunner::RunAll(double elapsedTimeForOne)
+BenchRunner::RunAll(const std::string& filter, double elapsedTimeForOne, double warmup, const std::string& format)
 {
-    std::cout << "#Benchmark" << "," << "count" << "," << "min" << "," << "max" << "," << "average" << "\n";
+    const bool fJSON = format == "json";
+    std::regex reFilter(filter.empty() ? ".*" : filter);
+    UniValue results(UniValue::VARR);
+
+    if (!fJSON)
+        std::cout << "#Benchmark" << "," << "count" << "," << "min" << "," << "max" << "," << "average" << ","
+                  << "median" << "," << "p95" << "," << "stddev" << "," << "cycles" << "\n";
 
     for (std::map<std::string,BenchFunction>::iterator it = benchmarks.begin();
          it != benchmarks.end(); ++it) {
 
-        State state(it->first, elapsedTimeForOne);
+        if (!std::regex_search(it->first, reFilter))
+            continue;
+
+        State state(it->first, elapsedTimeForOne, warmup);
         BenchFunction& func = it->second;
         func(state);
+
+        // Benchmarks that cannot run on this machine never start timing.
+        const Result& result = state.result;
+        if (result.count == 0)
+            continue;
+
+        if (fJSON) {
+            results.push_back(ResultToJSON(result));
+        } else {
+            std::cout << std::fixed << std::setprecision(15) << result.name << "," << result.count << ","
+                      << result.min << "," << result.max << "," << result.average << ","
+                      << result.median << "," << result.p95 << "," << result.stddev << ","
+                      << std::setprecision(1) << result.cycles << std::endl;
+        }
+    }
+
+    if (fJSON) {
+        UniValue root(UniValue::VOBJ);
+        root.push_back(Pair("benchmarks", results));
+        std::cout << root.write(2) << "\n";
+    }
+}
+
+static bool ReadResults(const std::string& fileName, std::map<std::string, UniValue>& mapResults)
+{
+    std::ifstream file(fileName.c_str());
+    if (!file.good()) {
+        std::cerr << "Cannot open " << fileName << "\n";
+        return false;
     }
+    std::stringstream ss;
+    ss << file.rdbuf();
+    UniValue root;
+    if (!root.read(ss.str()) || !root["benchmarks"].isArray()) {
+        std::cerr << "Cannot parse " << fileName << "\n";
+        return false;
+    }
+    const UniValue& benchmarks = root["benchmarks"];
+    for (size_t i = 0; i < benchmarks.size(); i++)
+        mapResults[benchmarks[i]["name"].get_str()] = benchmarks[i];
+    return true;
+}
+
+int
+benchmark::CompareResults(const std::string& beforeFile, const std::string& afterFile, double threshold)
+{
+    std::map<std::string, UniValue> mapBefore, mapAfter;
+    if (!ReadResults(beforeFile, mapBefore) || !ReadResults(afterFile, mapAfter))
+        return -1;
+
+    int nRegressions = 0;
+    std::cout << "#Benchmark" << "," << "before" << "," << "after" << "," << "change%" << "," << "status" << "\n";
+    for (std::map<std::string, UniValue>::const_iterator it = mapAfter.begin(); it != mapAfter.end(); ++it) {
+        std::map<std::string, UniValue>::const_iterator itBefore = mapBefore.find(it->first);
+        if (itBefore == mapBefore.end()) {
+            std::cout << it->first << ",,,,new\n";
+            continue;
+        }
+        const UniValue& before = itBefore->second;
+        const UniValue& after = it->second;
+        double dBefore = before["median"].get_real();
+        double dAfter = after["median"].get_real();
+        double dChange = dBefore > 0 ? (dAfter - dBefore) / dBefore * 100 : 0;
+
+        // Require the change to stand out from the spread of the samples
+        // too, so that noisy benchmarks don't flap.
+        double dNoise = sqrt(pow(before["stddev"].get_real(), 2) / std::max<int64_t>(1, before["samples"].get_int64()) +
+                             pow(after["stddev"].get_real(), 2) / std::max<int64_t>(1, after["samples"].get_int64()));
+        bool fSignificant = fabs(dChange) >= threshold && fabs(dAfter - dBefore) > 2 * dNoise;
+
+        std::string strStatus;
+        if (fSignificant && dChange > 0) {
+            strStatus = "regression";
+            nRegressions++;
+        } else if (fSignificant) {
+            strStatus = "improvement";
+        }
+        std::cout << std::fixed << std::setprecision(15) << it->first << "," << dBefore << "," << dAfter << ","
+                  << std::setprecision(2) << dChange << "," << strStatus << "\n";
+    }
+    for (std::map<std::string, UniValue>::const_iterator it = mapBefore.begin(); it != mapBefore.end(); ++it) {
+        if (!mapAfter.count(it->first))
+            std::cout << it->first << ",,,,missing\n";
+    }
+    return nRegressions;
 }
 
 bool State::KeepRunning()
@@ -46,19 +173,32 @@ bool State::KeepRunning()
     double now;
     if (count == 0) {
         lastTime = beginTime = now = gettimedouble();
+        beginCycles = getcycles();
+        if (warmupEnd < 0)
+            warmupEnd = now + warmup;
     }
     else {
         now = gettimedouble();
         double elapsed = now - lastTime;
         double elapsedOne = elapsed * countMaskInv;
+        if (now < warmupEnd) {
+          // Still warming up: discard the timings so far.
+          count = 0;
+          samples.clear();
+          minTime = std::numeric_limits<double>::max();
+          maxTime = std::numeric_limits<double>::min();
+          return true;
+        }
         if (elapsedOne < minTime) minTime = elapsedOne;
         if (elapsedOne > maxTime) maxTime = elapsedOne;
+        samples.push_back(elapsedOne);
         if (elapsed*128 < maxElapsed) {
           // If the execution was much too fast (1/128th of maxElapsed), increase the count mask by 8x and restart timing.
           // The restart avoids including the overhead of this code in the measurement.
           countMask = ((countMask<<3)|7) & ((1LL<<60)-1);
           countMaskInv = 1./(countMask+1);
           count = 0;
+          samples.clear();
           minTime = std::numeric_limits<double>::max();
           maxTime = std::numeric_limits<double>::min();
           return true;
@@ -74,13 +214,30 @@ bool State::KeepRunning()
     lastTime = now;
     ++count;
 
-    if (now - beginTime < maxElapsed) return true; // Keep going
+    if (now - beginTime < maxElapsed || samples.empty()) return true; // Keep going
 
     --count;
 
-    // Output results
-    double average = (now-beginTime)/count;
-    std::cout << std::fixed << std::setprecision(15) << name << "," << count << "," << minTime << "," << maxTime << "," << average << "\n";
+    // Summarize; the samples are per-iteration times of each timed batch.
+    std::sort(samples.begin(), samples.end());
+    double sum = 0, sumSquares = 0;
+    for (size_t i = 0; i < samples.size(); i++)
+        sum += samples[i];
+    double mean = sum / samples.size();
+    for (size_t i = 0; i < samples.size(); i++)
+        sumSquares += (samples[i] - mean) * (samples[i] - mean);
+
+    uint64_t cycles = getcycles();
+    result.name = name;
+    result.count = count;
+    result.samples = samples.size();
+    result.min = minTime;
+    result.max = maxTime;
+    result.average = (now-beginTime)/count;
+    result.median = samples[samples.size() / 2];
+    result.p95 = samples[std::min(samples.size() - 1, (size_t)ceil(samples.size() * 0.95) - 1)];
+    result.stddev = samples.size() > 1 ? sqrt(sumSquares / (samples.size() - 1)) : 0;
+    result.cycles = cycles ? double(cycles - beginCycles) / count : 0;
 
     return false;
 }
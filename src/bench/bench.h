@@ -5,8 +5,12 @@
 #ifndef BITCOIN_BENCH_BENCH_H
 #define BITCOIN_BENCH_BENCH_H
 
+#include <limits>
 #include <map>
 #include <string>
+#include <vector>
+
+#include <stdint.h>
 
 #include <boost/function.hpp>
 #include <boost/preprocessor/cat.hpp>
@@ -36,19 +40,35 @@ BENCHMARK(CODE_TO_TIME);
  
 namespace benchmark {
 
+    /** Timings of one benchmark. Times are in seconds per iteration. */
+    struct Result {
+        std::string name;
+        int64_t count;
+        //! Number of timed batches the statistics are computed over
+        size_t samples;
+        double min, max, average, median, p95, stddev;
+        //! CPU cycles per iteration, 0 where no cycle counter is available
+        double cycles;
+    };
+
     class State {
         std::string name;
-        double maxElapsed;
-        double beginTime;
+        double maxElapsed, warmup;
+        double beginTime, warmupEnd;
         double lastTime, minTime, maxTime, countMaskInv;
+        uint64_t beginCycles;
         int64_t count;
         int64_t countMask;
+        std::vector<double> samples;
     public:
-        State(std::string _name, double _maxElapsed) : name(_name), maxElapsed(_maxElapsed), count(0) {
+        Result result;
+
+        State(std::string _name, double _maxElapsed, double _warmup = 0) : name(_name), maxElapsed(_maxElapsed), warmup(_warmup), warmupEnd(-1), count(0) {
             minTime = std::numeric_limits<double>::max();
             maxTime = std::numeric_limits<double>::min();
             countMask = 1;
             countMaskInv = 1./(countMask + 1);
+            result.count = 0;
         }
         bool KeepRunning();
     };
@@ -62,8 +82,21 @@ namespace benchmark {
     public:
         BenchRunner(std::string name, BenchFunction func);
 
-        static void RunAll(double elapsedTimeForOne=1.0);
+        /**
+         * Run every benchmark whose name matches the filter regex for at
+         * least elapsedTimeForOne seconds after warmup seconds, printing the
+         * results in format ("csv" or "json").
+         */
+        static void RunAll(const std::string& filter = "", double elapsedTimeForOne=1.0, double warmup=0, const std::string& format="csv");
     };
+
+    /**
+     * Compare two files written with -format=json, flagging the benchmarks
+     * whose median changed by at least threshold percent and by more than
+     * the noise in the samples. Returns the number of significant
+     * regressions, or -1 if a file could not be read.
+     */
+    int CompareResults(const std::string& beforeFile, const std::string& afterFile, double threshold);
 }
 
 // BENCHMARK(foo) expands to:  benchmark::BenchRunner bench_11foo("foo", foo);
@@ -6,16 +6,81 @@
 
 #include "key.h"
 #include "main.h"
+#include "pubkey.h"
 #include "util.h"
+#include "utilstrencodings.h"
+
+#include <iostream>
+#include <regex>
+
+static const double DEFAULT_BENCH_MIN_TIME = 1.0;
+static const double DEFAULT_BENCH_WARMUP = 0.0;
+static const char* DEFAULT_BENCH_FORMAT = "csv";
+static const double DEFAULT_BENCH_THRESHOLD = 5.0;
+
+static std::string HelpMessage()
+{
+    std::string strUsage = "Usage: bench_einsteinium [options]\n";
+    strUsage += "       bench_einsteinium -compare=<before.json> -compare=<after.json> [-threshold=<pct>]\n";
+    strUsage += HelpMessageGroup("Options:");
+    strUsage += HelpMessageOpt("-?", "This help message");
+    strUsage += HelpMessageOpt("-filter=<regex>", "Only run the benchmarks whose name matches <regex>");
+    strUsage += HelpMessageOpt("-min-time=<n>", strprintf("Time each benchmark for at least <n> seconds (default: %.1f)", DEFAULT_BENCH_MIN_TIME));
+    strUsage += HelpMessageOpt("-warmup=<n>", strprintf("Run each benchmark for <n> seconds before timing it (default: %.1f)", DEFAULT_BENCH_WARMUP));
+    strUsage += HelpMessageOpt("-format=<fmt>", strprintf("Print the results as csv or json (default: %s)", DEFAULT_BENCH_FORMAT));
+    strUsage += HelpMessageOpt("-compare=<file>", "Given twice, compare the medians in two -format=json result files instead of running benchmarks; exits with status 1 if any regressed significantly");
+    strUsage += HelpMessageOpt("-threshold=<pct>", strprintf("Smallest change in percent -compare reports as significant (default: %.1f)", DEFAULT_BENCH_THRESHOLD));
+    return strUsage;
+}
+
+static double GetDoubleArg(const std::string& strArg, double dDefault)
+{
+    double dValue;
+    if (!mapArgs.count(strArg) || !ParseDouble(mapArgs[strArg], &dValue))
+        return dDefault;
+    return dValue;
+}
 
 int
 main(int argc, char** argv)
 {
+    ParseParameters(argc, argv);
+    if (mapArgs.count("-?") || mapArgs.count("-h") || mapArgs.count("-help")) {
+        std::cout << HelpMessage();
+        return 0;
+    }
+
+    if (mapArgs.count("-compare")) {
+        const std::vector<std::string>& vFiles = mapMultiArgs["-compare"];
+        if (vFiles.size() != 2) {
+            std::cerr << "-compare needs to be given exactly twice\n";
+            return 2;
+        }
+        int nRegressions = benchmark::CompareResults(vFiles[0], vFiles[1], GetDoubleArg("-threshold", DEFAULT_BENCH_THRESHOLD));
+        return nRegressions < 0 ? 2 : (nRegressions > 0 ? 1 : 0);
+    }
+
+    std::string strFormat = GetArg("-format", DEFAULT_BENCH_FORMAT);
+    if (strFormat != "csv" && strFormat != "json") {
+        std::cerr << "Unknown -format: " << strFormat << "\n";
+        return 2;
+    }
+
+    std::string strFilter = GetArg("-filter", "");
+    try {
+        std::regex reFilter(strFilter);
+    } catch (const std::regex_error& e) {
+        std::cerr << "Invalid -filter: " << e.what() << "\n";
+        return 2;
+    }
+
     ECC_Start();
+    ECCVerifyHandle verifyHandle;
     SetupEnvironment();
     fPrintToDebugLog = false; // don't want to write to debug.log file
 
-    benchmark::BenchRunner::RunAll();
+    benchmark::BenchRunner::RunAll(strFilter, GetDoubleArg("-min-time", DEFAULT_BENCH_MIN_TIME),
+                                   GetDoubleArg("-warmup", DEFAULT_BENCH_WARMUP), strFormat);
 
     ECC_Stop();
 }
@@ -0,0 +1,167 @@
+// Copyright (c) 2017 The Einsteinium Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "arith_uint256.h"
+#include "chainparams.h"
+#include "coins.h"
+#include "consensus/consensus.h"
+#include "consensus/merkle.h"
+#include "consensus/validation.h"
+#include "key.h"
+#include "keystore.h"
+#include "main.h"
+#include "script/sign.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "version.h"
+
+#include <vector>
+
+/* Height of the synthetic block, well past the KGW era but before BIP34 */
+static const int BLOCK_HEIGHT = 60000;
+
+/**
+ * A synthetic block of about MAX_BLOCK_BASE_SIZE bytes, filled with signed
+ * one-in two-out P2PKH transactions, together with the chain it extends
+ * and a coins cache holding every output it spends.
+ */
+struct SyntheticBlock
+{
+    std::vector<CBlockIndex> chain;
+    std::vector<uint256> hashes;
+    CBlock block;
+    CCoinsView viewDummy;
+    CCoinsViewCache coins;
+
+    SyntheticBlock() : chain(BLOCK_HEIGHT + 1), hashes(BLOCK_HEIGHT + 1), coins(&viewDummy)
+    {
+        // Only the last entry stands for the synthetic block; the others
+        // just need distinct hashes.
+        const int64_t nTimeStart = 1390000000;
+        for (size_t i = 0; i < chain.size(); i++) {
+            hashes[i] = ArithToUint256(arith_uint256(i));
+            chain[i].phashBlock = &hashes[i];
+            chain[i].pprev = i ? &chain[i - 1] : NULL;
+            chain[i].nHeight = i;
+            chain[i].nTime = nTimeStart + i * 60;
+            chain[i].nVersion = 4;
+            chain[i].BuildSkip();
+        }
+        CBlockIndex* pindex = &chain.back();
+
+        CBasicKeyStore keystore;
+        CKey key;
+        key.MakeNewKey(true);
+        keystore.AddKey(key);
+        const CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+        CMutableTransaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vin[0].prevout.SetNull();
+        coinbase.vin[0].scriptSig = CScript() << BLOCK_HEIGHT << OP_0;
+        coinbase.vout.resize(1);
+        coinbase.vout[0].nValue = 0;
+        coinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        block.vtx.push_back(coinbase);
+
+        size_t nBlockSize = 1000;
+        for (uint32_t n = 0; ; n++) {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout = COutPoint(ArithToUint256(arith_uint256(n + 1)), 0);
+            tx.vout.resize(2);
+            tx.vout[0].nValue = tx.vout[1].nValue = COIN / 2 - 1000;
+            tx.vout[0].scriptPubKey = tx.vout[1].scriptPubKey = scriptPubKey;
+            SignSignature(keystore, scriptPubKey, tx, 0, COIN, SIGHASH_ALL);
+            nBlockSize += ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+            if (nBlockSize > MAX_BLOCK_BASE_SIZE)
+                break;
+            block.vtx.push_back(tx);
+
+            CCoinsModifier prevcoins = coins.ModifyCoins(tx.vin[0].prevout.hash);
+            prevcoins->nVersion = 1;
+            prevcoins->nHeight = 1;
+            prevcoins->vout.resize(1);
+            prevcoins->vout[0].nValue = COIN;
+            prevcoins->vout[0].scriptPubKey = scriptPubKey;
+        }
+
+        block.nVersion = pindex->nVersion;
+        block.hashPrevBlock = pindex->pprev->GetBlockHash();
+        block.nTime = pindex->nTime;
+        block.nBits = UintToArith256(Params().GetConsensus().powLimit).GetCompact();
+        block.hashMerkleRoot = BlockMerkleRoot(block);
+    }
+};
+
+static void CheckBlockSynthetic(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    SyntheticBlock synthetic;
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    while (state.KeepRunning()) {
+        CValidationState validationState;
+        assert(CheckBlock(synthetic.block, validationState, consensusParams, false, true));
+    }
+}
+
+/*
+ * ConnectBlock in fJustCheck mode, as used by TestBlockValidity. Script
+ * verification results are cached after the first iteration, as they are
+ * for blocks whose transactions were accepted to the mempool, so this
+ * mostly measures the UTXO work.
+ */
+static void ConnectBlockSynthetic(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    SyntheticBlock synthetic;
+    const CChainParams& chainparams = Params();
+    CBlockIndex* pindex = &synthetic.chain.back();
+    {
+        // CheckInputs looks the spend height up from the view's best block.
+        LOCK(cs_main);
+        mapBlockIndex[pindex->pprev->GetBlockHash()] = pindex->pprev;
+    }
+    while (state.KeepRunning()) {
+        LOCK(cs_main);
+        CCoinsViewCache view(&synthetic.coins);
+        view.SetBestBlock(synthetic.block.hashPrevBlock);
+        CValidationState validationState;
+        assert(ConnectBlock(synthetic.block, validationState, pindex, view, chainparams, true));
+    }
+    LOCK(cs_main);
+    mapBlockIndex.erase(pindex->pprev->GetBlockHash());
+    versionbitscache.Clear();
+}
+
+static void SerializeBlock(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    SyntheticBlock synthetic;
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream.reserve(MAX_BLOCK_BASE_SIZE);
+    while (state.KeepRunning()) {
+        stream.clear();
+        stream << synthetic.block;
+    }
+}
+
+static void DeserializeBlock(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    SyntheticBlock synthetic;
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << synthetic.block;
+    while (state.KeepRunning()) {
+        CDataStream copy(stream);
+        CBlock block;
+        copy >> block;
+    }
+}
+
+BENCHMARK(CheckBlockSynthetic);
+BENCHMARK(ConnectBlockSynthetic);
+BENCHMARK(SerializeBlock);
+BENCHMARK(DeserializeBlock);
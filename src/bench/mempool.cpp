@@ -0,0 +1,70 @@
+// Copyright (c) 2017 The Einsteinium Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "amount.h"
+#include "arith_uint256.h"
+#include "main.h"
+#include "txmempool.h"
+
+#include <list>
+#include <vector>
+
+/* Transactions per iteration, half of them in chains of CHAIN_LENGTH */
+static const unsigned int POOL_TXS = 2000;
+static const unsigned int CHAIN_LENGTH = 10;
+
+static void BuildTransactions(std::vector<CTransaction>& vtx)
+{
+    vtx.clear();
+    for (unsigned int n = 0; n < POOL_TXS; n++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << OP_1;
+        if (n < POOL_TXS / 2 && n % CHAIN_LENGTH != 0)
+            tx.vin[0].prevout = COutPoint(vtx.back().GetHash(), 0);
+        else
+            tx.vin[0].prevout = COutPoint(ArithToUint256(arith_uint256(n + 1)), 0);
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        tx.vout[0].nValue = COIN - n;
+        vtx.push_back(tx);
+    }
+}
+
+static void AddTransactions(CTxMemPool& pool, const std::vector<CTransaction>& vtx)
+{
+    for (unsigned int n = 0; n < vtx.size(); n++) {
+        const CTransaction& tx = vtx[n];
+        bool fNoInputsOf = n >= POOL_TXS / 2 || n % CHAIN_LENGTH == 0;
+        pool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, 1000 + n, 0, 0.0, 1, fNoInputsOf, COIN, false, 4, LockPoints()));
+    }
+}
+
+static void MempoolAddUnchecked(benchmark::State& state)
+{
+    std::vector<CTransaction> vtx;
+    BuildTransactions(vtx);
+    while (state.KeepRunning()) {
+        CTxMemPool pool((CFeeRate(DEFAULT_MIN_RELAY_TX_FEE)));
+        AddTransactions(pool, vtx);
+    }
+}
+
+/* Includes the cost of filling the pool, see MempoolAddUnchecked for that alone */
+static void MempoolRemoveForBlock(benchmark::State& state)
+{
+    std::vector<CTransaction> vtx;
+    BuildTransactions(vtx);
+    while (state.KeepRunning()) {
+        CTxMemPool pool((CFeeRate(DEFAULT_MIN_RELAY_TX_FEE)));
+        AddTransactions(pool, vtx);
+        std::list<CTransaction> conflicts;
+        pool.removeForBlock(vtx, 2, conflicts);
+        assert(pool.size() == 0);
+    }
+}
+
+BENCHMARK(MempoolAddUnchecked);
+BENCHMARK(MempoolRemoveForBlock);
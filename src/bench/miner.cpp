@@ -0,0 +1,94 @@
+// Copyright (c) 2017 The Einsteinium Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "arith_uint256.h"
+#include "chainparams.h"
+#include "consensus/validation.h"
+#include "main.h"
+#include "miner.h"
+#include "random.h"
+#include "txdb.h"
+#include "txmempool.h"
+#include "util.h"
+
+#include <boost/filesystem.hpp>
+
+/* Mempool size the template is built from */
+static const unsigned int MEMPOOL_TXS = 50000;
+
+/**
+ * A regtest chain holding only the genesis block, with in-memory block
+ * index and coins databases, and a mempool of MEMPOOL_TXS independent
+ * transactions whose inputs are all in pcoinsTip.
+ */
+struct RegtestMempoolSetup
+{
+    CCoinsViewDB *pcoinsdbview;
+    boost::filesystem::path pathTemp;
+
+    RegtestMempoolSetup()
+    {
+        SelectParams(CBaseChainParams::REGTEST);
+        const CChainParams& chainparams = Params();
+        ClearDatadirCache();
+        pathTemp = boost::filesystem::temp_directory_path() / strprintf("bench_einsteinium_%lu_%i", (unsigned long)GetTime(), (int)(GetRand(100000)));
+        boost::filesystem::create_directories(pathTemp);
+        mapArgs["-datadir"] = pathTemp.string();
+        pblocktree = new CBlockTreeDB(1 << 20, true);
+        pcoinsdbview = new CCoinsViewDB(1 << 23, true);
+        pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+        InitBlockIndex(chainparams);
+        CValidationState state;
+        ActivateBestChain(state, chainparams);
+
+        LOCK2(cs_main, mempool.cs);
+        for (unsigned int n = 0; n < MEMPOOL_TXS; n++) {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout = COutPoint(ArithToUint256(arith_uint256(n + 1)), 0);
+            tx.vout.resize(1);
+            tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+            CAmount nFee = 1000 + GetRand(100000);
+            tx.vout[0].nValue = COIN - nFee;
+
+            CCoinsModifier coins = pcoinsTip->ModifyCoins(tx.vin[0].prevout.hash);
+            coins->nVersion = 1;
+            coins->nHeight = 0;
+            coins->vout.resize(1);
+            coins->vout[0].nValue = COIN;
+            coins->vout[0].scriptPubKey = CScript() << OP_TRUE;
+
+            CTransaction txn(tx);
+            mempool.addUnchecked(txn.GetHash(), CTxMemPoolEntry(txn, nFee, GetTime(), 0.0, 1, true, COIN, false, 4, LockPoints()));
+        }
+    }
+
+    ~RegtestMempoolSetup()
+    {
+        UnloadBlockIndex();
+        delete pcoinsTip;
+        delete pcoinsdbview;
+        delete pblocktree;
+        pcoinsTip = NULL;
+        pblocktree = NULL;
+        boost::filesystem::remove_all(pathTemp);
+        mapArgs.erase("-datadir");
+        ClearDatadirCache();
+    }
+};
+
+static void CreateNewBlock(benchmark::State& state)
+{
+    RegtestMempoolSetup setup;
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    while (state.KeepRunning()) {
+        CBlockTemplate *pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
+        assert(pblocktemplate && pblocktemplate->block.vtx.size() > 1);
+        delete pblocktemplate;
+    }
+}
+
+BENCHMARK(CreateNewBlock);
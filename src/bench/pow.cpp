@@ -0,0 +1,50 @@
+// Copyright (c) 2017 The Einsteinium Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "arith_uint256.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "pow.h"
+#include "random.h"
+
+#include <vector>
+
+/* DigiShield replaces Kimoto Gravity Well from this height on */
+static const int DIGISHIELD_HEIGHT = 56000;
+
+/** A main chain of nBlocks entries with jittery timestamps and targets. */
+static void BuildChain(std::vector<CBlockIndex>& blocks, size_t nBlocks)
+{
+    const arith_uint256 bnPowLimit = UintToArith256(Params().GetConsensus().powLimit);
+    blocks.resize(nBlocks);
+    for (size_t i = 0; i < blocks.size(); i++) {
+        blocks[i].pprev = i ? &blocks[i - 1] : NULL;
+        blocks[i].nHeight = i;
+        blocks[i].nTime = i ? blocks[i - 1].nTime + 1 + insecure_rand() % 120 : 1390000000;
+        blocks[i].nBits = arith_uint256(bnPowLimit >> (8 + insecure_rand() % 8)).GetCompact();
+        blocks[i].BuildSkip();
+    }
+}
+
+static void GetNextWorkRequiredKGW(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    std::vector<CBlockIndex> blocks;
+    BuildChain(blocks, DIGISHIELD_HEIGHT - 1000);
+    while (state.KeepRunning())
+        GetNextWorkRequired(&blocks.back(), NULL, Params().GetConsensus());
+}
+
+static void GetNextWorkRequiredDigiShield(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    std::vector<CBlockIndex> blocks;
+    BuildChain(blocks, DIGISHIELD_HEIGHT + 1000);
+    while (state.KeepRunning())
+        GetNextWorkRequired(&blocks.back(), NULL, Params().GetConsensus());
+}
+
+BENCHMARK(GetNextWorkRequiredKGW);
+BENCHMARK(GetNextWorkRequiredDigiShield);
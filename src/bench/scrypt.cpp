@@ -0,0 +1,114 @@
+// Copyright (c) 2017 The Einsteinium Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include "bench.h"
+#include "crypto/scrypt.h"
+
+#include <vector>
+
+/* Number of headers hashed per iteration, a multiple of every lane count */
+static const size_t BATCH_SIZE = 16;
+
+static void ScryptGeneric(benchmark::State& state)
+{
+    std::vector<char> scratchpad(SCRYPT_SCRATCHPAD_SIZE);
+    char input[80] = {0};
+    char output[32];
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < BATCH_SIZE; i++) {
+            input[0] = i;
+            scrypt_1024_1_1_256_sp_generic(input, output, &scratchpad[0]);
+        }
+    }
+}
+
+#if defined(USE_SSE2)
+static void ScryptSSE2(benchmark::State& state)
+{
+    std::vector<char> scratchpad(SCRYPT_SCRATCHPAD_SIZE);
+    char input[80] = {0};
+    char output[32];
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < BATCH_SIZE; i++) {
+            input[0] = i;
+            scrypt_1024_1_1_256_sp_sse2(input, output, &scratchpad[0]);
+        }
+    }
+}
+
+BENCHMARK(ScryptSSE2);
+#endif
+
+/** Hash BATCH_SIZE headers through a LANES-wide kernel, if the CPU has the instructions for it. */
+template <size_t LANES>
+static void ScryptLanes(benchmark::State& state, void (*kernel)(const char *const [], char *const [], char *), bool fSupported)
+{
+    if (!fSupported)
+        return;
+    std::vector<char> scratchpad(LANES * 131072 + 63);
+    char inputs[BATCH_SIZE][80] = {{0}};
+    char outputs[BATCH_SIZE][32];
+    const char* input[BATCH_SIZE];
+    char* output[BATCH_SIZE];
+    for (size_t i = 0; i < BATCH_SIZE; i++) {
+        inputs[i][0] = i;
+        input[i] = inputs[i];
+        output[i] = outputs[i];
+    }
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < BATCH_SIZE; i += LANES)
+            kernel(&input[i], &output[i], &scratchpad[0]);
+    }
+}
+
+#if defined(ENABLE_SSE2)
+static void ScryptSSE2_4way(benchmark::State& state)
+{
+    ScryptLanes<4>(state, scrypt_1024_1_1_256_sp_sse2_4way, __builtin_cpu_supports("sse2"));
+}
+
+BENCHMARK(ScryptSSE2_4way);
+#endif
+
+#if defined(ENABLE_AVX2)
+static void ScryptAVX2_8way(benchmark::State& state)
+{
+    ScryptLanes<8>(state, scrypt_1024_1_1_256_sp_avx2_8way, __builtin_cpu_supports("avx2"));
+}
+
+BENCHMARK(ScryptAVX2_8way);
+#endif
+
+#if defined(ENABLE_AVX512)
+static void ScryptAVX512_16way(benchmark::State& state)
+{
+    ScryptLanes<16>(state, scrypt_1024_1_1_256_sp_avx512_16way, __builtin_cpu_supports("avx512f"));
+}
+
+BENCHMARK(ScryptAVX512_16way);
+#endif
+
+/* The batched API as used for header batches, with whatever kernel was detected */
+static void ScryptMulti(benchmark::State& state)
+{
+    scrypt_detect_multi();
+    char inputs[BATCH_SIZE][80] = {{0}};
+    char outputs[BATCH_SIZE][32];
+    const char* input[BATCH_SIZE];
+    char* output[BATCH_SIZE];
+    for (size_t i = 0; i < BATCH_SIZE; i++) {
+        inputs[i][0] = i;
+        input[i] = inputs[i];
+        output[i] = outputs[i];
+    }
+    while (state.KeepRunning())
+        scrypt_1024_1_1_256_multi(input, output, BATCH_SIZE);
+}
+
+BENCHMARK(ScryptGeneric);
+BENCHMARK(ScryptMulti);
@@ -5,6 +5,8 @@
 #ifndef BITCOIN_CHECKQUEUE_H
 #define BITCOIN_CHECKQUEUE_H
 
+#include "sync.h"
+
 #include <algorithm>
 #include <vector>
 
@@ -65,6 +67,10 @@ private:
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    //! Held by the one CCheckQueueControl that may use the queue at a time
+    CWaitableCriticalSection ControlMutex;
+    friend class CCheckQueueControl<T>;
+
     /** Internal function that does bulk of the verification work. */
     bool Loop(bool fMaster = false)
     {
@@ -183,8 +189,10 @@ private:
 public:
     CCheckQueueControl(CCheckQueue<T>* pqueueIn) : pqueue(pqueueIn), fDone(false)
     {
-        // passed queue is supposed to be unused, or NULL
+        // passed queue is supposed to be unused, or NULL; wait for any
+        // other control of it to finish first
         if (pqueue != NULL) {
+            ENTER_CRITICAL_SECTION(pqueue->ControlMutex);
             bool isIdle = pqueue->IsIdle();
             assert(isIdle);
         }
@@ -209,6 +217,8 @@ public:
     {
         if (!fDone)
             Wait();
+        if (pqueue != NULL)
+            LEAVE_CRITICAL_SECTION(pqueue->ControlMutex);
     }
 };
 
@@ -6,6 +6,7 @@
 
 #include "memusage.h"
 #include "random.h"
+#include "streams.h"
 
 #include <assert.h>
 
@@ -44,7 +45,7 @@ bool CCoins::Spend(uint32_t nPos)
 bool CCoinsView::GetCoins(const uint256 &txid, CCoins &coins) const { return false; }
 bool CCoinsView::HaveCoins(const uint256 &txid) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
-bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return false; }
+bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase) { return false; }
 CCoinsViewCursor *CCoinsView::Cursor() const { return 0; }
 
 
@@ -53,12 +54,15 @@ bool CCoinsViewBacked::GetCoins(const uint256 &txid, CCoins &coins) const { retu
 bool CCoinsViewBacked::HaveCoins(const uint256 &txid) const { return base->HaveCoins(txid); }
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) { base = &viewIn; }
-bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return base->BatchWrite(mapCoins, hashBlock); }
+bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase) { return base->BatchWrite(mapCoins, hashBlock, fErase); }
 CCoinsViewCursor *CCoinsViewBacked::Cursor() const { return base->Cursor(); }
 
 SaltedTxidHasher::SaltedTxidHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), cachedCoinsUsage(0) { }
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) :
+    CCoinsViewBacked(baseIn), hasModifier(false),
+    cacheCoins(0, SaltedTxidHasher(), std::equal_to<uint256>(), CCoinsMap::allocator_type(&cacheCoinsPool)),
+    cachedCoinsUsage(0), nClockHand(0) { }
 
 CCoinsViewCache::~CCoinsViewCache()
 {
@@ -69,15 +73,50 @@ size_t CCoinsViewCache::DynamicMemoryUsage() const {
     return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
 }
 
+size_t CCoinsViewCache::LiveMemoryUsage() const {
+    return DynamicMemoryUsage() - (cacheCoinsPool.BytesAllocated() - cacheCoinsPool.BytesInUse());
+}
+
+void CCoinsViewCache::Compact() {
+    const size_t nFree = cacheCoinsPool.BytesAllocated() - cacheCoinsPool.BytesInUse();
+    if (nFree <= cacheCoinsPool.BytesAllocated() / 4 || nFree < cacheCoinsPool.ChunkSize())
+        return;
+    // Erased entries are scattered over all chunks, so the pool can only
+    // shrink by moving the survivors out, releasing it, and moving them back.
+    std::vector<std::pair<uint256, CCoinsCacheEntry> > vEntries;
+    vEntries.reserve(cacheCoins.size());
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); ++it) {
+        vEntries.push_back(std::make_pair(it->first, CCoinsCacheEntry()));
+        CCoinsCacheEntry& entry = vEntries.back().second;
+        entry.coins.swap(it->second.coins);
+        entry.flags = it->second.flags;
+        entry.fUsed = it->second.fUsed;
+        entry.nBaseOutputs = it->second.nBaseOutputs;
+    }
+    cacheCoins.clear();
+    cacheCoinsPool.Release();
+    cacheCoins.rehash(vEntries.size());
+    for (size_t i = 0; i < vEntries.size(); i++) {
+        CCoinsCacheEntry& entry = cacheCoins.insert(std::make_pair(vEntries[i].first, CCoinsCacheEntry())).first->second;
+        entry.coins.swap(vEntries[i].second.coins);
+        entry.flags = vEntries[i].second.flags;
+        entry.fUsed = vEntries[i].second.fUsed;
+        entry.nBaseOutputs = vEntries[i].second.nBaseOutputs;
+    }
+}
+
 CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256 &txid) const {
     CCoinsMap::iterator it = cacheCoins.find(txid);
-    if (it != cacheCoins.end())
+    if (it != cacheCoins.end()) {
+        it->second.fUsed = true;
         return it;
+    }
     CCoins tmp;
     if (!base->GetCoins(txid, tmp))
         return cacheCoins.end();
     CCoinsMap::iterator ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry())).first;
     tmp.swap(ret->second.coins);
+    ret->second.nBaseOutputs = ret->second.coins.vout.size();
     if (ret->second.coins.IsPruned()) {
         // The parent only has an empty entry for this txid; we can consider our
         // version as fresh.
@@ -109,8 +148,10 @@ CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
             // The parent view only has a pruned entry for this; mark it as fresh.
             ret.first->second.flags = CCoinsCacheEntry::FRESH;
         }
+        ret.first->second.nBaseOutputs = ret.first->second.coins.vout.size();
     } else {
         cachedCoinUsage = ret.first->second.coins.DynamicMemoryUsage();
+        ret.first->second.fUsed = true;
     }
     // Assume that whenever ModifyCoins is called, the entry will be modified.
     ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
@@ -127,6 +168,9 @@ CCoinsModifier CCoinsViewCache::ModifyNewCoins(const uint256 &txid, bool coinbas
     ret.first->second.coins.Clear();
     if (!coinbase) {
         ret.first->second.flags = CCoinsCacheEntry::FRESH;
+    } else if (ret.second) {
+        // A duplicate coinbase replaces outputs the parent view may have.
+        ret.first->second.nBaseOutputs = CCoinsCacheEntry::UNKNOWN_OUTPUTS;
     }
     ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
     return CCoinsModifier(*this, ret.first, 0);
@@ -165,7 +209,7 @@ void CCoinsViewCache::SetBestBlock(const uint256 &hashBlockIn) {
     hashBlock = hashBlockIn;
 }
 
-bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn) {
+bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn, bool fErase) {
     assert(!hasModifier);
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) { // Ignore non-dirty entries (optimization).
@@ -177,9 +221,13 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                     // Otherwise we will need to create it in the parent
                     // and move the data up and mark it as dirty
                     CCoinsCacheEntry& entry = cacheCoins[it->first];
-                    entry.coins.swap(it->second.coins);
+                    if (fErase)
+                        entry.coins.swap(it->second.coins);
+                    else
+                        entry.coins = it->second.coins;
                     cachedCoinsUsage += entry.coins.DynamicMemoryUsage();
                     entry.flags = CCoinsCacheEntry::DIRTY;
+                    entry.nBaseOutputs = it->second.nBaseOutputs;
                     // We can mark it FRESH in the parent if it was FRESH in the child
                     // Otherwise it might have just been flushed from the parent's cache
                     // and already exist in the grandparent
@@ -197,14 +245,24 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                 } else {
                     // A normal modification.
                     cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
-                    itUs->second.coins.swap(it->second.coins);
+                    if (fErase)
+                        itUs->second.coins.swap(it->second.coins);
+                    else
+                        itUs->second.coins = it->second.coins;
                     cachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
                     itUs->second.flags |= CCoinsCacheEntry::DIRTY;
+                    // Outputs the child saw may have been added here since.
+                    if (it->second.nBaseOutputs > itUs->second.nBaseOutputs)
+                        itUs->second.nBaseOutputs = it->second.nBaseOutputs;
                 }
             }
         }
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (fErase) {
+            CCoinsMap::iterator itOld = it++;
+            mapCoins.erase(itOld);
+        } else {
+            ++it;
+        }
     }
     hashBlock = hashBlockIn;
     return true;
@@ -213,10 +271,69 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
 bool CCoinsViewCache::Flush() {
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
     cacheCoins.clear();
+    // Every node went back to the pool, so its chunks can go in one go.
+    cacheCoinsPool.Release();
     cachedCoinsUsage = 0;
     return fOk;
 }
 
+bool CCoinsViewCache::Sync() {
+    assert(!hasModifier);
+    if (!base->BatchWrite(cacheCoins, hashBlock, false)) {
+        // Keep the flags, so the next flush writes these entries again.
+        return false;
+    }
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end();) {
+        if (it->second.coins.IsPruned()) {
+            cachedCoinsUsage -= it->second.coins.DynamicMemoryUsage();
+            cacheCoins.erase(it++);
+        } else {
+            // The base has this entry now, so it is neither dirty nor fresh.
+            it->second.flags = 0;
+            it->second.nBaseOutputs = it->second.coins.vout.size();
+            ++it;
+        }
+    }
+    Compact();
+    return true;
+}
+
+size_t CCoinsViewCache::Evict(size_t nTargetUsage, size_t nMaxScan) {
+    assert(!hasModifier);
+    size_t nEvicted = 0;
+    size_t nScanned = 0;
+    const size_t nBuckets = cacheCoins.bucket_count();
+    std::vector<uint256> vEvict;
+    // The first time around the clock only clears the access bits, so two
+    // turns are enough to reach every unmodified entry. Erasing never
+    // rehashes, so the bucket count stays valid throughout. Freed nodes stay
+    // with the pool until Compact(), so count only the live ones meanwhile.
+    for (size_t nStep = 0; nStep < 2 * nBuckets && LiveMemoryUsage() > nTargetUsage; nStep++) {
+        if (nMaxScan && nScanned >= nMaxScan)
+            break;
+        nClockHand = (nClockHand + 1) % nBuckets;
+        for (CCoinsMap::local_iterator it = cacheCoins.begin(nClockHand); it != cacheCoins.end(nClockHand); ++it) {
+            nScanned++;
+            if (it->second.flags) // Modified entries must be written first.
+                continue;
+            if (it->second.fUsed) {
+                it->second.fUsed = false;
+                continue;
+            }
+            vEvict.push_back(it->first);
+        }
+        for (size_t i = 0; i < vEvict.size(); i++) {
+            CCoinsMap::iterator itEvict = cacheCoins.find(vEvict[i]);
+            cachedCoinsUsage -= itEvict->second.coins.DynamicMemoryUsage();
+            cacheCoins.erase(itEvict);
+            nEvicted++;
+        }
+        vEvict.clear();
+    }
+    Compact();
+    return nEvicted;
+}
+
 void CCoinsViewCache::Uncache(const uint256& hash)
 {
     CCoinsMap::iterator it = cacheCoins.find(hash);
@@ -291,6 +408,9 @@ CCoinsModifier::~CCoinsModifier()
 {
     assert(cache.hasModifier);
     cache.hasModifier = false;
+    // Remember outputs added meanwhile before trimming spent ones off.
+    if (it->second.coins.vout.size() > it->second.nBaseOutputs)
+        it->second.nBaseOutputs = it->second.coins.vout.size();
     it->second.coins.Cleanup();
     cache.cachedCoinsUsage -= cachedCoinUsage; // Subtract the old usage
     if ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
@@ -304,3 +424,61 @@ CCoinsModifier::~CCoinsModifier()
 CCoinsViewCursor::~CCoinsViewCursor()
 {
 }
+
+/** The bytes an unspent output is represented by in a CUTXOCommitment. */
+static CDataStream UTXOCommitmentElement(const uint256 &txid, const CCoins &coins, uint32_t n)
+{
+    assert(coins.IsAvailable(n));
+    uint32_t nCode = coins.nHeight * 2 + (coins.fCoinBase ? 1 : 0);
+    CDataStream ss(SER_GETHASH, 0);
+    ss << txid << VARINT(n) << VARINT(nCode) << coins.vout[n];
+    return ss;
+}
+
+void CUTXOCommitment::AddCoin(const uint256 &txid, const CCoins &coins, uint32_t n)
+{
+    CDataStream ss = UTXOCommitmentElement(txid, coins, n);
+    muhash.Insert((const unsigned char*)&ss[0], ss.size());
+    nTxOuts++;
+    nTotalAmount += coins.vout[n].nValue;
+}
+
+void CUTXOCommitment::RemoveCoin(const uint256 &txid, const CCoins &coins, uint32_t n)
+{
+    CDataStream ss = UTXOCommitmentElement(txid, coins, n);
+    muhash.Remove((const unsigned char*)&ss[0], ss.size());
+    nTxOuts--;
+    nTotalAmount -= coins.vout[n].nValue;
+}
+
+void CUTXOCommitment::AddCoins(const uint256 &txid, const CCoins &coins)
+{
+    for (uint32_t n = 0; n < coins.vout.size(); n++) {
+        if (coins.IsAvailable(n))
+            AddCoin(txid, coins, n);
+    }
+}
+
+void CUTXOCommitment::RemoveCoins(const uint256 &txid, const CCoins &coins)
+{
+    for (uint32_t n = 0; n < coins.vout.size(); n++) {
+        if (coins.IsAvailable(n))
+            RemoveCoin(txid, coins, n);
+    }
+}
+
+CUTXOCommitment& CUTXOCommitment::operator+=(const CUTXOCommitment &delta)
+{
+    muhash *= delta.muhash;
+    nTxOuts += delta.nTxOuts;
+    nTotalAmount += delta.nTotalAmount;
+    return *this;
+}
+
+uint256 CUTXOCommitment::GetHash() const
+{
+    MuHash3072 tmp = muhash;
+    uint256 hash;
+    tmp.Finalize(hash.begin());
+    return hash;
+}
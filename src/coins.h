@@ -8,6 +8,8 @@
 
 #include "compressor.h"
 #include "core_memusage.h"
+#include "crypto/muhash.h"
+#include "flatmap.h"
 #include "hash.h"
 #include "memusage.h"
 #include "serialize.h"
@@ -17,7 +19,6 @@
 #include <stdint.h>
 
 #include <boost/foreach.hpp>
-#include <boost/unordered_map.hpp>
 
 /** 
  * Pruned version of CTransaction: only retains metadata and unspent transaction outputs
@@ -288,16 +289,70 @@ struct CCoinsCacheEntry
 {
     CCoins coins; // The actual cached data.
     unsigned char flags;
+    bool fUsed; // Accessed since the eviction clock last passed this entry.
+    /**
+     * The parent view holds no outputs of this entry past this index, so
+     * those spent since can be erased from it without looking them up.
+     * Spending trims coins.vout, so it can be shorter.
+     */
+    uint32_t nBaseOutputs;
 
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
         FRESH = (1 << 1), // The parent view does not have this entry (or it is pruned).
     };
 
-    CCoinsCacheEntry() : coins(), flags(0) {}
+    //! nBaseOutputs of an entry that replaced whatever the parent view had
+    static const uint32_t UNKNOWN_OUTPUTS = 0xffffffff;
+
+    CCoinsCacheEntry() : coins(), flags(0), fUsed(true), nBaseOutputs(0) {}
 };
 
-typedef boost::unordered_map<uint256, CCoinsCacheEntry, SaltedTxidHasher> CCoinsMap;
+typedef flatmap<uint256, CCoinsCacheEntry, SaltedTxidHasher, std::equal_to<uint256>,
+                PoolAllocator<std::pair<const uint256, CCoinsCacheEntry> > > CCoinsMap;
+
+/**
+ * Commitment to a UTXO set that can be kept up to date output by output: a
+ * MuHash over all unspent outputs, along with their number and total value.
+ * Used as a delta, the counts may go negative.
+ */
+class CUTXOCommitment
+{
+public:
+    MuHash3072 muhash;
+    int64_t nTxOuts;
+    CAmount nTotalAmount;
+
+    CUTXOCommitment() : nTxOuts(0), nTotalAmount(0) {}
+
+    //! Add or remove the unspent output n of coins
+    void AddCoin(const uint256 &txid, const CCoins &coins, uint32_t n);
+    void RemoveCoin(const uint256 &txid, const CCoins &coins, uint32_t n);
+
+    //! Add or remove all unspent outputs of coins
+    void AddCoins(const uint256 &txid, const CCoins &coins);
+    void RemoveCoins(const uint256 &txid, const CCoins &coins);
+
+    //! Apply the changes collected in another commitment
+    CUTXOCommitment& operator+=(const CUTXOCommitment &delta);
+
+    //! The MuHash of the set (costs a modular inversion)
+    uint256 GetHash() const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        unsigned char state[MuHash3072::STATE_SIZE];
+        if (!ser_action.ForRead())
+            muhash.GetState(state);
+        READWRITE(FLATDATA(state));
+        if (ser_action.ForRead())
+            muhash.SetState(state);
+        READWRITE(nTxOuts);
+        READWRITE(nTotalAmount);
+    }
+};
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -335,8 +390,8 @@ public:
     virtual uint256 GetBestBlock() const;
 
     //! Do a bulk modification (multiple CCoins changes + BestBlock change).
-    //! The passed mapCoins can be modified.
-    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    //! The passed mapCoins can be modified, and is emptied if fErase is set.
+    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase = true);
 
     //! Get a cursor to iterate over the whole state
     virtual CCoinsViewCursor *Cursor() const;
@@ -358,7 +413,7 @@ public:
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
     void SetBackend(CCoinsView &viewIn);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase = true);
     CCoinsViewCursor *Cursor() const;
 };
 
@@ -398,11 +453,22 @@ protected:
      * declared as "const".  
      */
     mutable uint256 hashBlock;
+    /* Backs the nodes of cacheCoins, so it must be declared first. */
+    mutable PoolResource cacheCoinsPool;
     mutable CCoinsMap cacheCoins;
 
     /* Cached dynamic memory usage for the inner CCoins objects. */
     mutable size_t cachedCoinsUsage;
 
+    /* Bucket of cacheCoins the eviction clock continues from. */
+    size_t nClockHand;
+
+    /* Memory usage not counting the free blocks cacheCoinsPool holds on to. */
+    size_t LiveMemoryUsage() const;
+
+    /* Move the entries to fresh pool chunks if too much of the pool is free. */
+    void Compact();
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
     ~CCoinsViewCache();
@@ -412,7 +478,7 @@ public:
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
     void SetBestBlock(const uint256 &hashBlock);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase = true);
 
     /**
      * Check if we have the given tx already loaded in this cache.
@@ -453,6 +519,24 @@ public:
      */
     bool Flush();
 
+    /**
+     * Push the modifications applied to this cache to its base like Flush(),
+     * but keep the entries cached as unmodified so the cache stays warm.
+     * Spent entries are dropped, and the memory they took is returned. If the
+     * write fails, the cache is left as it was, with every modified entry
+     * still marked so.
+     */
+    bool Sync();
+
+    /**
+     * Drop unmodified entries until the cache uses at most nTargetUsage
+     * bytes, preferring entries that were not accessed recently (CLOCK).
+     * Inspects at most nMaxScan entries if nonzero. The pool is compacted
+     * afterwards if enough of it was freed. Returns the number of entries
+     * dropped.
+     */
+    size_t Evict(size_t nTargetUsage, size_t nMaxScan = 0);
+
     /**
      * Removes the transaction with the given hash from the cache, if it is
      * not modified.
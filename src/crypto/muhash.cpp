@@ -0,0 +1,189 @@
+// Copyright (c) 2017 The Einsteinium Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/muhash.h"
+
+#include "crypto/sha256.h"
+#include "crypto/sha512.h"
+
+#include <string.h>
+
+namespace
+{
+typedef Num3072::limb_t limb_t;
+typedef Num3072::double_limb_t double_limb_t;
+
+/** 2^3072 minus the prime. */
+const limb_t MAX_PRIME_DIFF = 1103717;
+const limb_t LIMB_MAX = ~(limb_t)0;
+}
+
+Num3072::Num3072(const unsigned char data[BYTE_SIZE])
+{
+    for (int i = 0; i < LIMBS; ++i) {
+        limbs[i] = 0;
+        for (int j = LIMB_SIZE / 8 - 1; j >= 0; --j)
+            limbs[i] = (limbs[i] << 8) | data[i * (LIMB_SIZE / 8) + j];
+    }
+    if (IsOverflow())
+        FullReduce();
+}
+
+void Num3072::SetToOne()
+{
+    limbs[0] = 1;
+    for (int i = 1; i < LIMBS; ++i)
+        limbs[i] = 0;
+}
+
+bool Num3072::IsOverflow() const
+{
+    if (limbs[0] <= LIMB_MAX - MAX_PRIME_DIFF)
+        return false;
+    for (int i = 1; i < LIMBS; ++i) {
+        if (limbs[i] != LIMB_MAX)
+            return false;
+    }
+    return true;
+}
+
+void Num3072::AddCarry(double_limb_t v)
+{
+    for (int i = 0; i < LIMBS && v; ++i) {
+        v += limbs[i];
+        limbs[i] = (limb_t)v;
+        v >>= LIMB_SIZE;
+    }
+    // Wrapping past 2^3072 is the same as adding the difference to the prime.
+    if (v) {
+        v = MAX_PRIME_DIFF;
+        for (int i = 0; i < LIMBS && v; ++i) {
+            v += limbs[i];
+            limbs[i] = (limb_t)v;
+            v >>= LIMB_SIZE;
+        }
+    }
+}
+
+void Num3072::FullReduce()
+{
+    // Subtract the prime by adding the difference and dropping the top bit.
+    double_limb_t v = MAX_PRIME_DIFF;
+    for (int i = 0; i < LIMBS; ++i) {
+        v += limbs[i];
+        limbs[i] = (limb_t)v;
+        v >>= LIMB_SIZE;
+    }
+}
+
+void Num3072::Multiply(const Num3072& a)
+{
+    limb_t t[2 * LIMBS];
+    memset(t, 0, sizeof(t));
+    for (int i = 0; i < LIMBS; ++i) {
+        limb_t carry = 0;
+        for (int j = 0; j < LIMBS; ++j) {
+            double_limb_t v = (double_limb_t)limbs[i] * a.limbs[j] + t[i + j] + carry;
+            t[i + j] = (limb_t)v;
+            carry = (limb_t)(v >> LIMB_SIZE);
+        }
+        t[i + LIMBS] = carry;
+    }
+
+    // t = low + high * 2^3072, which is low + high * MAX_PRIME_DIFF modulo the prime.
+    limb_t carry = 0;
+    for (int i = 0; i < LIMBS; ++i) {
+        double_limb_t v = (double_limb_t)t[i + LIMBS] * MAX_PRIME_DIFF + t[i] + carry;
+        limbs[i] = (limb_t)v;
+        carry = (limb_t)(v >> LIMB_SIZE);
+    }
+    AddCarry((double_limb_t)carry * MAX_PRIME_DIFF);
+    if (IsOverflow())
+        FullReduce();
+}
+
+Num3072 Num3072::GetInverse() const
+{
+    // Fermat: a^(p-2) is the inverse of a. All bits of p-2 are set except
+    // for some in the lowest limb.
+    const limb_t nLowLimb = LIMB_MAX - MAX_PRIME_DIFF - 1;
+    Num3072 ret;
+    for (int i = LIMBS - 1; i >= 0; --i) {
+        const limb_t nExp = i == 0 ? nLowLimb : LIMB_MAX;
+        for (int j = LIMB_SIZE - 1; j >= 0; --j) {
+            ret.Multiply(ret);
+            if ((nExp >> j) & 1)
+                ret.Multiply(*this);
+        }
+    }
+    return ret;
+}
+
+void Num3072::ToBytes(unsigned char out[BYTE_SIZE]) const
+{
+    for (int i = 0; i < LIMBS; ++i) {
+        for (int j = 0; j < LIMB_SIZE / 8; ++j)
+            out[i * (LIMB_SIZE / 8) + j] = (unsigned char)(limbs[i] >> (8 * j));
+    }
+}
+
+Num3072 MuHash3072::ToNum3072(const unsigned char* data, size_t len)
+{
+    unsigned char key[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data, len).Finalize(key);
+
+    // Stretch the 256 bit digest to 3072 bits.
+    unsigned char buf[Num3072::BYTE_SIZE];
+    for (unsigned char i = 0; i < Num3072::BYTE_SIZE / CSHA512::OUTPUT_SIZE; i++)
+        CSHA512().Write(key, sizeof(key)).Write(&i, 1).Finalize(buf + i * CSHA512::OUTPUT_SIZE);
+    return Num3072(buf);
+}
+
+MuHash3072& MuHash3072::Insert(const unsigned char* data, size_t len)
+{
+    numerator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(const unsigned char* data, size_t len)
+{
+    denominator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& mul)
+{
+    numerator.Multiply(mul.numerator);
+    denominator.Multiply(mul.denominator);
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator/=(const MuHash3072& div)
+{
+    numerator.Multiply(div.denominator);
+    denominator.Multiply(div.numerator);
+    return *this;
+}
+
+void MuHash3072::Finalize(unsigned char out[OUTPUT_SIZE])
+{
+    numerator.Multiply(denominator.GetInverse());
+    denominator.SetToOne();
+
+    unsigned char buf[Num3072::BYTE_SIZE];
+    numerator.ToBytes(buf);
+    CSHA256().Write(buf, sizeof(buf)).Finalize(out);
+}
+
+void MuHash3072::GetState(unsigned char out[STATE_SIZE]) const
+{
+    numerator.ToBytes(out);
+    denominator.ToBytes(out + Num3072::BYTE_SIZE);
+}
+
+void MuHash3072::SetState(const unsigned char in[STATE_SIZE])
+{
+    numerator = Num3072(in);
+    denominator = Num3072(in + Num3072::BYTE_SIZE);
+}
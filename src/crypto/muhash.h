@@ -0,0 +1,83 @@
+// Copyright (c) 2017 The Einsteinium Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** A number modulo the prime 2^3072 - 1103717. */
+class Num3072
+{
+public:
+    static const size_t BYTE_SIZE = 384;
+
+#ifdef __SIZEOF_INT128__
+    typedef uint64_t limb_t;
+    __extension__ typedef unsigned __int128 double_limb_t;
+    static const int LIMB_SIZE = 64;
+#else
+    typedef uint32_t limb_t;
+    typedef uint64_t double_limb_t;
+    static const int LIMB_SIZE = 32;
+#endif
+    static const int LIMBS = 3072 / LIMB_SIZE;
+
+    limb_t limbs[LIMBS];
+
+    Num3072() { SetToOne(); }
+    /** Load a little endian number, reducing it modulo the prime. */
+    explicit Num3072(const unsigned char data[BYTE_SIZE]);
+
+    void SetToOne();
+    void Multiply(const Num3072& a);
+    Num3072 GetInverse() const;
+    void ToBytes(unsigned char out[BYTE_SIZE]) const;
+
+private:
+    bool IsOverflow() const;
+    void FullReduce();
+    void AddCarry(double_limb_t v);
+};
+
+/**
+ * Hash of a set of byte strings that can be updated one element at a time,
+ * in any order (MuHash, see https://cseweb.ucsd.edu/~daniele/papers/IncHash.html).
+ *
+ * Each element is hashed to a number modulo a 3072 bit prime, and the set is
+ * the product of its elements. Removal multiplies a separate denominator so
+ * that no modular inverse is needed until the hash is finalized. Inserting
+ * and removing the same element cancel out, whatever happens in between.
+ */
+class MuHash3072
+{
+private:
+    Num3072 numerator;
+    Num3072 denominator;
+
+    static Num3072 ToNum3072(const unsigned char* data, size_t len);
+
+public:
+    static const size_t OUTPUT_SIZE = 32;
+    static const size_t STATE_SIZE = 2 * Num3072::BYTE_SIZE;
+
+    /** The hash of the empty set. */
+    MuHash3072() {}
+
+    MuHash3072& Insert(const unsigned char* data, size_t len);
+    MuHash3072& Remove(const unsigned char* data, size_t len);
+
+    /** Merge in (or take out) the elements of another set. */
+    MuHash3072& operator*=(const MuHash3072& mul);
+    MuHash3072& operator/=(const MuHash3072& div);
+
+    /** Hash the set into 32 bytes. Costs a modular inversion. */
+    void Finalize(unsigned char out[OUTPUT_SIZE]);
+
+    void GetState(unsigned char out[STATE_SIZE]) const;
+    void SetState(const unsigned char in[STATE_SIZE]);
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
@@ -0,0 +1,38 @@
+// Copyright (c) 2017 The Einsteinium Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/scrypt-multi.h"
+
+#include <immintrin.h>
+
+namespace {
+
+struct AVX2Ops
+{
+    typedef __m256i Vec;
+    static const int LANES = 8;
+
+    static inline Vec Add(Vec a, Vec b) { return _mm256_add_epi32(a, b); }
+    static inline Vec Xor(Vec a, Vec b) { return _mm256_xor_si256(a, b); }
+    template <int n>
+    static inline Vec Rotl(Vec a) { return _mm256_or_si256(_mm256_slli_epi32(a, n), _mm256_srli_epi32(a, 32 - n)); }
+
+    static inline void XorRows(Vec X[32], const Vec *V, Vec idx)
+    {
+        // Word k of lane l in row j lives at 32-bit offset (j * 32 + k) * 8 + l.
+        const __m256i row = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(idx, _mm256_set1_epi32(1023)), 8),
+                                             _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        for (int k = 0; k < 32; k++) {
+            const __m256i offset = _mm256_add_epi32(row, _mm256_set1_epi32(k * LANES));
+            X[k] = _mm256_xor_si256(X[k], _mm256_i32gather_epi32((const int *)V, offset, 4));
+        }
+    }
+};
+
+} // namespace
+
+void scrypt_1024_1_1_256_sp_avx2_8way(const char *const input[8], char *const output[8], char *scratchpad)
+{
+    scrypt_multi::scrypt_1024_1_1_256_lanes<AVX2Ops>(input, output, scratchpad);
+}
@@ -0,0 +1,38 @@
+// Copyright (c) 2017 The Einsteinium Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/scrypt-multi.h"
+
+#include <immintrin.h>
+
+namespace {
+
+struct AVX512Ops
+{
+    typedef __m512i Vec;
+    static const int LANES = 16;
+
+    static inline Vec Add(Vec a, Vec b) { return _mm512_add_epi32(a, b); }
+    static inline Vec Xor(Vec a, Vec b) { return _mm512_xor_si512(a, b); }
+    template <int n>
+    static inline Vec Rotl(Vec a) { return _mm512_rol_epi32(a, n); }
+
+    static inline void XorRows(Vec X[32], const Vec *V, Vec idx)
+    {
+        // Word k of lane l in row j lives at 32-bit offset (j * 32 + k) * 16 + l.
+        const __m512i row = _mm512_add_epi32(_mm512_slli_epi32(_mm512_and_si512(idx, _mm512_set1_epi32(1023)), 9),
+                                             _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+        for (int k = 0; k < 32; k++) {
+            const __m512i offset = _mm512_add_epi32(row, _mm512_set1_epi32(k * LANES));
+            X[k] = _mm512_xor_si512(X[k], _mm512_i32gather_epi32(offset, (const void *)V, 4));
+        }
+    }
+};
+
+} // namespace
+
+void scrypt_1024_1_1_256_sp_avx512_16way(const char *const input[16], char *const output[16], char *scratchpad)
+{
+    scrypt_multi::scrypt_1024_1_1_256_lanes<AVX512Ops>(input, output, scratchpad);
+}
@@ -0,0 +1,106 @@
+// Copyright (c) 2017 The Einsteinium Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_SCRYPT_MULTI_H
+#define BITCOIN_CRYPTO_SCRYPT_MULTI_H
+
+/**
+ * Lane-interleaved scrypt(1024,1,1) kernel shared by the SIMD translation
+ * units (scrypt-sse2-4way.cpp, scrypt-avx2.cpp, scrypt-avx512.cpp).
+ *
+ * Every vector register holds the same salsa20/8 state word for LANES
+ * independent inputs, so each instruction advances all lanes at once. Only
+ * include this from files built with the matching instruction set flags: it
+ * deliberately has internal linkage so that no instruction-set specific code
+ * can leak into the rest of the binary through the linker.
+ */
+
+#include "crypto/scrypt.h"
+
+#include <stdint.h>
+
+namespace {
+namespace scrypt_multi {
+
+template <typename Ops>
+inline void xor_salsa8(typename Ops::Vec B[16], const typename Ops::Vec Bx[16])
+{
+    typedef typename Ops::Vec Vec;
+    Vec x[16];
+    int i;
+
+    for (i = 0; i < 16; i++)
+        x[i] = B[i] = Ops::Xor(B[i], Bx[i]);
+
+#define QR(a, b, c, n) x[a] = Ops::Xor(x[a], Ops::template Rotl<n>(Ops::Add(x[b], x[c])))
+    for (i = 0; i < 8; i += 2) {
+        /* Operate on columns. */
+        QR( 4,  0, 12,  7); QR( 9,  5,  1,  7); QR(14, 10,  6,  7); QR( 3, 15, 11,  7);
+        QR( 8,  4,  0,  9); QR(13,  9,  5,  9); QR( 2, 14, 10,  9); QR( 7,  3, 15,  9);
+        QR(12,  8,  4, 13); QR( 1, 13,  9, 13); QR( 6,  2, 14, 13); QR(11,  7,  3, 13);
+        QR( 0, 12,  8, 18); QR( 5,  1, 13, 18); QR(10,  6,  2, 18); QR(15, 11,  7, 18);
+
+        /* Operate on rows. */
+        QR( 1,  0,  3,  7); QR( 6,  5,  4,  7); QR(11, 10,  9,  7); QR(12, 15, 14,  7);
+        QR( 2,  1,  0,  9); QR( 7,  6,  5,  9); QR( 8, 11, 10,  9); QR(13, 12, 15,  9);
+        QR( 3,  2,  1, 13); QR( 4,  7,  6, 13); QR( 9,  8, 11, 13); QR(14, 13, 12, 13);
+        QR( 0,  3,  2, 18); QR( 5,  4,  7, 18); QR(10,  9,  8, 18); QR(15, 14, 13, 18);
+    }
+#undef QR
+
+    for (i = 0; i < 16; i++)
+        B[i] = Ops::Add(B[i], x[i]);
+}
+
+/**
+ * Hash Ops::LANES 80-byte inputs. scratchpad must hold at least
+ * Ops::LANES * 131072 + 63 bytes.
+ */
+template <typename Ops>
+inline void scrypt_1024_1_1_256_lanes(const char *const input[], char *const output[], char *scratchpad)
+{
+    typedef typename Ops::Vec Vec;
+    static const int LANES = Ops::LANES;
+
+    uint8_t B[128];
+    union {
+        Vec v[32];
+        uint32_t u32[32][LANES];
+    } X;
+    Vec *V;
+    uint32_t i, k;
+    int l;
+
+    V = (Vec *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+
+    for (l = 0; l < LANES; l++) {
+        PBKDF2_SHA256((const uint8_t *)input[l], 80, (const uint8_t *)input[l], 80, 1, B, 128);
+        for (k = 0; k < 32; k++)
+            X.u32[k][l] = le32dec(&B[4 * k]);
+    }
+
+    for (i = 0; i < 1024; i++) {
+        for (k = 0; k < 32; k++)
+            V[i * 32 + k] = X.v[k];
+        xor_salsa8<Ops>(&X.v[0], &X.v[16]);
+        xor_salsa8<Ops>(&X.v[16], &X.v[0]);
+    }
+    for (i = 0; i < 1024; i++) {
+        // Each lane picks its own row of V; Ops gathers them into place.
+        Ops::XorRows(X.v, V, X.v[16]);
+        xor_salsa8<Ops>(&X.v[0], &X.v[16]);
+        xor_salsa8<Ops>(&X.v[16], &X.v[0]);
+    }
+
+    for (l = 0; l < LANES; l++) {
+        for (k = 0; k < 32; k++)
+            le32enc(&B[4 * k], X.u32[k][l]);
+        PBKDF2_SHA256((const uint8_t *)input[l], 80, B, 128, 1, (uint8_t *)output[l], 32);
+    }
+}
+
+} // namespace scrypt_multi
+} // namespace
+
+#endif // BITCOIN_CRYPTO_SCRYPT_MULTI_H
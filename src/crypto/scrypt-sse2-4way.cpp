@@ -0,0 +1,47 @@
+// Copyright (c) 2017 The Einsteinium Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/scrypt-multi.h"
+
+#include <emmintrin.h>
+
+namespace {
+
+struct SSE2Ops
+{
+    typedef __m128i Vec;
+    static const int LANES = 4;
+
+    static inline Vec Add(Vec a, Vec b) { return _mm_add_epi32(a, b); }
+    static inline Vec Xor(Vec a, Vec b) { return _mm_xor_si128(a, b); }
+    template <int n>
+    static inline Vec Rotl(Vec a) { return _mm_or_si128(_mm_slli_epi32(a, n), _mm_srli_epi32(a, 32 - n)); }
+
+    /** SSE2 has no gather, so pick up the four rows word by word. */
+    static inline void XorRows(Vec X[32], const Vec *V, Vec idx)
+    {
+        union {
+            __m128i v;
+            uint32_t u32[4];
+        } j, row;
+        const uint32_t *Vu = (const uint32_t *)V;
+        int k, l;
+
+        j.v = idx;
+        for (l = 0; l < LANES; l++)
+            j.u32[l] = (j.u32[l] & 1023) * 32 * LANES + l;
+        for (k = 0; k < 32; k++) {
+            for (l = 0; l < LANES; l++)
+                row.u32[l] = Vu[j.u32[l] + k * LANES];
+            X[k] = _mm_xor_si128(X[k], row.v);
+        }
+    }
+};
+
+} // namespace
+
+void scrypt_1024_1_1_256_sp_sse2_4way(const char *const input[4], char *const output[4], char *scratchpad)
+{
+    scrypt_multi::scrypt_1024_1_1_256_lanes<SSE2Ops>(input, output, scratchpad);
+}
@@ -27,11 +27,24 @@
  * online backup system.
  */
 
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#if defined(BUILD_BITCOIN_INTERNAL)
+// libbitcoinconsensus is built from the base crypto sources only and does not
+// link the per-instruction-set scrypt kernels.
+#undef ENABLE_SSE2
+#undef ENABLE_AVX2
+#undef ENABLE_AVX512
+#endif
+
 #include "crypto/scrypt.h"
 //#include "util.h"
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <vector>
 #include <openssl/sha.h>
 
 #if defined(USE_SSE2) && !defined(USE_SSE2_ALWAYS)
@@ -327,3 +340,91 @@ void scrypt_1024_1_1_256(const char *input, char *output)
 	char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
     scrypt_1024_1_1_256_sp(input, output, scratchpad);
 }
+
+typedef void (*scrypt_lanes_fn)(const char *const input[], char *const output[], char *scratchpad);
+
+// Widest multi-lane kernel available, or NULL to hash one input at a time.
+static scrypt_lanes_fn scrypt_multi_kernel = NULL;
+static size_t scrypt_multi_lanes = 1;
+
+#if defined(ENABLE_AVX2) || defined(ENABLE_AVX512)
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+
+static inline uint64_t scrypt_xgetbv()
+{
+	uint32_t a, d;
+	__asm__ ("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+	return ((uint64_t)d << 32) | a;
+}
+#endif
+#endif
+
+const char *scrypt_detect_multi()
+{
+	const char *desc = "generic";
+	scrypt_multi_kernel = NULL;
+	scrypt_multi_lanes = 1;
+
+#if defined(ENABLE_SSE2)
+	scrypt_multi_kernel = &scrypt_1024_1_1_256_sp_sse2_4way;
+	scrypt_multi_lanes = 4;
+	desc = "sse2(4-way)";
+#endif
+
+#if defined(ENABLE_AVX2) || defined(ENABLE_AVX512)
+#if defined(__x86_64__) || defined(__i386__)
+	uint32_t eax, ebx, ecx, edx;
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & (1 << 27)) && __get_cpuid_max(0, NULL) >= 7) {
+		// OSXSAVE is set, so XCR0 tells us which register files the OS preserves.
+		uint64_t xcr0 = scrypt_xgetbv();
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+#if defined(ENABLE_AVX2)
+		if ((ebx & (1 << 5)) && (xcr0 & 0x6) == 0x6) {
+			scrypt_multi_kernel = &scrypt_1024_1_1_256_sp_avx2_8way;
+			scrypt_multi_lanes = 8;
+			desc = "avx2(8-way)";
+		}
+#endif
+#if defined(ENABLE_AVX512)
+		if ((ebx & (1 << 16)) && (xcr0 & 0xe6) == 0xe6) {
+			scrypt_multi_kernel = &scrypt_1024_1_1_256_sp_avx512_16way;
+			scrypt_multi_lanes = 16;
+			desc = "avx512(16-way)";
+		}
+#endif
+	}
+#endif
+#endif
+
+	return desc;
+}
+
+void scrypt_1024_1_1_256_multi(const char *const input[], char *const output[], size_t n)
+{
+	const size_t lanes = scrypt_multi_lanes;
+	std::vector<char> scratchpad(131072 * lanes + 63);
+	size_t i = 0;
+
+	if (scrypt_multi_kernel != NULL) {
+		for (; i + lanes <= n; i += lanes)
+			scrypt_multi_kernel(&input[i], &output[i], &scratchpad[0]);
+
+		// A partially filled pass still costs about as much as a full one,
+		// but beats hashing two or more leftovers one at a time.
+		if (n - i >= 2) {
+			std::vector<const char *> tailin(lanes, input[n - 1]);
+			std::vector<char *> tailout(lanes);
+			std::vector<char> discard(32 * lanes);
+			for (size_t l = 0; l < lanes; l++)
+				tailout[l] = i + l < n ? output[i + l] : &discard[32 * l];
+			for (size_t l = 0; i + l < n; l++)
+				tailin[l] = input[i + l];
+			scrypt_multi_kernel(&tailin[0], &tailout[0], &scratchpad[0]);
+			i = n;
+		}
+	}
+
+	for (; i < n; i++)
+		scrypt_1024_1_1_256_sp(input[i], output[i], &scratchpad[0]);
+}
@@ -23,6 +23,24 @@ extern void (*scrypt_1024_1_1_256_sp_detected)(const char *input, char *output,
 #define scrypt_1024_1_1_256_sp(input, output, scratchpad) scrypt_1024_1_1_256_sp_generic((input), (output), (scratchpad))
 #endif
 
+/**
+ * Hash n independent 80-byte inputs, e.g. a batch of block headers. Where the
+ * CPU supports it several inputs are hashed at once in interleaved SIMD lanes;
+ * call scrypt_detect_multi() once at startup to select the widest kernel.
+ */
+void scrypt_1024_1_1_256_multi(const char *const input[], char *const output[], size_t n);
+const char *scrypt_detect_multi();
+
+#if defined(ENABLE_SSE2)
+void scrypt_1024_1_1_256_sp_sse2_4way(const char *const input[4], char *const output[4], char *scratchpad);
+#endif
+#if defined(ENABLE_AVX2)
+void scrypt_1024_1_1_256_sp_avx2_8way(const char *const input[8], char *const output[8], char *scratchpad);
+#endif
+#if defined(ENABLE_AVX512)
+void scrypt_1024_1_1_256_sp_avx512_16way(const char *const input[16], char *const output[16], char *scratchpad);
+#endif
+
 void
 PBKDF2_SHA256(const uint8_t *passwd, size_t passwdlen, const uint8_t *salt,
     size_t saltlen, uint64_t c, uint8_t *buf, size_t dkLen);
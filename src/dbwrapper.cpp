@@ -7,7 +7,10 @@
 #include "util.h"
 #include "random.h"
 
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
 
 #include <leveldb/cache.h>
 #include <leveldb/env.h>
@@ -15,14 +18,19 @@
 #include <memenv.h>
 #include <stdint.h>
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+static leveldb::Options GetOptions(size_t nCacheSize, const CDBOptions& dbopts)
 {
     leveldb::Options options;
     options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    if (dbopts.nWriteBufferSize)
+        options.write_buffer_size = dbopts.nWriteBufferSize;
+    else
+        options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
+    if (dbopts.nBloomBits > 0)
+        options.filter_policy = leveldb::NewBloomFilterPolicy(dbopts.nBloomBits);
+    options.compression = dbopts.fCompression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+    options.block_size = dbopts.nBlockSize;
+    options.max_open_files = dbopts.nMaxOpenFiles;
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
         // on corruption in later versions.
@@ -31,14 +39,66 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate)
+static bool ParseDBOptionValue(const std::string& strName, const std::string& strValue, int64_t nMin, int64_t nMax, int64_t& nOut, std::string& strError)
+{
+    if (!ParseInt64(strValue, &nOut) || nOut < nMin || nOut > nMax) {
+        strError = strprintf("%s must be a number from %d to %d", strName, nMin, nMax);
+        return false;
+    }
+    return true;
+}
+
+bool ParseDBOptions(const std::string& strOpts, CDBOptions& opts, std::string& strError)
+{
+    std::vector<std::string> vOpts;
+    boost::split(vOpts, strOpts, boost::is_any_of(","));
+    BOOST_FOREACH(const std::string& strOpt, vOpts) {
+        if (strOpt.empty())
+            continue;
+        size_t nPos = strOpt.find('=');
+        if (nPos == std::string::npos) {
+            strError = strprintf("missing value for %s", strOpt);
+            return false;
+        }
+        const std::string strName = strOpt.substr(0, nPos);
+        const std::string strValue = strOpt.substr(nPos + 1);
+        int64_t n;
+        if (strName == "compression") {
+            if (!ParseDBOptionValue(strName, strValue, 0, 1, n, strError))
+                return false;
+            opts.fCompression = n != 0;
+        } else if (strName == "blocksize") {
+            if (!ParseDBOptionValue(strName, strValue, 1024, 4 << 20, n, strError))
+                return false;
+            opts.nBlockSize = n;
+        } else if (strName == "maxopenfiles") {
+            if (!ParseDBOptionValue(strName, strValue, 16, 65536, n, strError))
+                return false;
+            opts.nMaxOpenFiles = n;
+        } else if (strName == "writebuffer") {
+            if (!ParseDBOptionValue(strName, strValue, 0, 1024, n, strError))
+                return false;
+            opts.nWriteBufferSize = n << 20;
+        } else if (strName == "bloombits") {
+            if (!ParseDBOptionValue(strName, strValue, 0, 32, n, strError))
+                return false;
+            opts.nBloomBits = n;
+        } else {
+            strError = strprintf("unknown option %s", strName);
+            return false;
+        }
+    }
+    return true;
+}
+
+CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate, const CDBOptions& dbopts)
 {
     penv = NULL;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(nCacheSize, dbopts);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -51,6 +111,8 @@ CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, b
         }
         TryCreateDirectory(path);
         LogPrintf("Opening LevelDB in %s\n", path.string());
+        LogPrintf("Using LevelDB compression=%d blocksize=%u maxopenfiles=%d writebuffer=%u bloombits=%d\n",
+            dbopts.fCompression, options.block_size, options.max_open_files, options.write_buffer_size, dbopts.nBloomBits);
     }
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     dbwrapper_private::HandleError(status);
@@ -90,11 +152,43 @@ CDBWrapper::~CDBWrapper()
 
 bool CDBWrapper::WriteBatch(CDBBatch& batch, bool fSync)
 {
+    int64_t nTimeStart = GetTimeMicros();
     leveldb::Status status = pdb->Write(fSync ? syncoptions : writeoptions, &batch.batch);
+    int64_t nTime = GetTimeMicros() - nTimeStart;
+    {
+        LOCK(cs_stats);
+        stats.nWrites++;
+        stats.nWriteBytes += batch.SizeEstimate();
+        stats.nWriteMicros += nTime;
+        stats.nMaxWriteMicros = std::max(stats.nMaxWriteMicros, nTime);
+        if (nTime > DB_WRITE_STALL_MICROS) {
+            stats.nStalls++;
+            stats.nStallMicros += nTime;
+        }
+    }
+    if (nTime > DB_WRITE_STALL_MICROS)
+        LogPrint("leveldb", "Slow LevelDB write of %u bytes took %.2fms\n", batch.SizeEstimate(), nTime * 0.001);
     dbwrapper_private::HandleError(status);
     return true;
 }
 
+void CDBWrapper::DoCompactRange(const leveldb::Slice* begin, const leveldb::Slice* end) const
+{
+    int64_t nTimeStart = GetTimeMicros();
+    pdb->CompactRange(begin, end);
+    int64_t nTime = GetTimeMicros() - nTimeStart;
+    LogPrint("leveldb", "LevelDB range compaction took %.2fms\n", nTime * 0.001);
+    LOCK(cs_stats);
+    stats.nCompactions++;
+    stats.nCompactionMicros += nTime;
+}
+
+CDBWriteStats CDBWrapper::GetWriteStats() const
+{
+    LOCK(cs_stats);
+    return stats;
+}
+
 // Prefixed with null character to avoid collisions with other keys
 //
 // We must use a string constructor which specifies length so that we copy
@@ -115,6 +209,70 @@ std::vector<unsigned char> CDBWrapper::CreateObfuscateKey() const
 
 }
 
+bool CDBWrapper::GetProperty(const std::string& strName, std::string& strValue) const
+{
+    return pdb->GetProperty(strName, &strValue);
+}
+
+bool CDBWrapper::GetLevelStats(std::vector<CDBLevelStats>& vLevels) const
+{
+    // Exact file sizes come from the table listing, whose level headers read
+    // "--- level N ---" and whose files read " number:size[smallest .. largest]".
+    std::string strTables, strStats;
+    if (!GetProperty("leveldb.sstables", strTables) || !GetProperty("leveldb.stats", strStats))
+        return false;
+    vLevels.clear();
+    std::vector<std::string> vLines;
+    boost::split(vLines, strTables, boost::is_any_of("\n"));
+    BOOST_FOREACH(const std::string& strLine, vLines) {
+        if (strLine.compare(0, 10, "--- level ") == 0) {
+            vLevels.push_back(CDBLevelStats());
+        } else if (!vLevels.empty() && strLine.size() > 1 && strLine[0] == ' ') {
+            size_t nColon = strLine.find(':'), nBracket = strLine.find('[');
+            if (nColon == std::string::npos || nBracket == std::string::npos || nBracket < nColon)
+                continue;
+            vLevels.back().nFiles++;
+            vLevels.back().nBytes += atoi64(strLine.substr(nColon + 1, nBracket - nColon - 1));
+        }
+    }
+    // The compaction statistics are only listed for levels that have seen any.
+    boost::split(vLines, strStats, boost::is_any_of("\n"));
+    BOOST_FOREACH(const std::string& strLine, vLines) {
+        int nLevel, nFiles;
+        double dSize, dSeconds, dRead, dWritten;
+        if (sscanf(strLine.c_str(), "%d %d %lf %lf %lf %lf", &nLevel, &nFiles, &dSize, &dSeconds, &dRead, &dWritten) != 6)
+            continue;
+        if (nLevel < 0 || nLevel >= (int)vLevels.size())
+            continue;
+        vLevels[nLevel].dCompactionSeconds = dSeconds;
+        vLevels[nLevel].dCompactionReadMiB = dRead;
+        vLevels[nLevel].dCompactionWrittenMiB = dWritten;
+    }
+    // Mirrors MaxBytesForLevel() in LevelDB: 10MiB for level 1, ten times more for every further one.
+    uint64_t nTarget = 10 << 20;
+    for (size_t nLevel = 1; nLevel + 1 < vLevels.size(); nLevel++) {
+        vLevels[nLevel].nTargetBytes = nTarget;
+        nTarget *= 10;
+    }
+    return true;
+}
+
+uint64_t EstimatePendingCompactionBytes(const std::vector<CDBLevelStats>& vLevels)
+{
+    // LevelDB compacts level 0 by number of files (kL0_CompactionTrigger) rather than by size.
+    static const int L0_COMPACTION_TRIGGER = 4;
+    uint64_t nPending = 0;
+    for (size_t nLevel = 0; nLevel < vLevels.size(); nLevel++) {
+        if (nLevel == 0) {
+            if (vLevels[0].nFiles >= L0_COMPACTION_TRIGGER)
+                nPending += vLevels[0].nBytes;
+        } else if (vLevels[nLevel].nTargetBytes && vLevels[nLevel].nBytes > vLevels[nLevel].nTargetBytes) {
+            nPending += vLevels[nLevel].nBytes - vLevels[nLevel].nTargetBytes;
+        }
+    }
+    return nPending;
+}
+
 bool CDBWrapper::IsEmpty()
 {
     boost::scoped_ptr<CDBIterator> it(NewIterator());
@@ -8,6 +8,7 @@
 #include "clientversion.h"
 #include "serialize.h"
 #include "streams.h"
+#include "sync.h"
 #include "util.h"
 #include "utilstrencodings.h"
 #include "version.h"
@@ -23,6 +24,9 @@ public:
     dbwrapper_error(const std::string& msg) : std::runtime_error(msg) {}
 };
 
+//! Writes to LevelDB that take longer than this count as stalls (microseconds)
+static const int64_t DB_WRITE_STALL_MICROS = 100000;
+
 class CDBWrapper;
 
 /** These should be considered an implementation detail of the specific database.
@@ -49,12 +53,13 @@ class CDBBatch
 private:
     const CDBWrapper &parent;
     leveldb::WriteBatch batch;
+    size_t size_estimate;
 
 public:
     /**
      * @param[in] parent    CDBWrapper that this batch is to be submitted to
      */
-    CDBBatch(const CDBWrapper &parent) : parent(parent) { };
+    CDBBatch(const CDBWrapper &parent) : parent(parent), size_estimate(0) { };
 
     template <typename K, typename V>
     void Write(const K& key, const V& value)
@@ -71,6 +76,7 @@ public:
         leveldb::Slice slValue(&ssValue[0], ssValue.size());
 
         batch.Put(slKey, slValue);
+        size_estimate += slKey.size() + slValue.size();
     }
 
     template <typename K>
@@ -82,7 +88,17 @@ public:
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
         batch.Delete(slKey);
+        size_estimate += slKey.size();
+    }
+
+    void Clear()
+    {
+        batch.Clear();
+        size_estimate = 0;
     }
+
+    //! Bytes of keys and values queued so far
+    size_t SizeEstimate() const { return size_estimate; }
 };
 
 class CDBIterator
@@ -148,6 +164,60 @@ public:
 
 };
 
+/** LevelDB settings that can be tuned per database, see ParseDBOptions(). */
+struct CDBOptions
+{
+    bool fCompression;          //!< compress tables with Snappy, if LevelDB was built with it
+    size_t nBlockSize;          //!< uncompressed bytes packed per table block
+    int nMaxOpenFiles;          //!< table files LevelDB may keep open
+    size_t nWriteBufferSize;    //!< memtable size in bytes, or 0 to take a quarter of the cache
+    int nBloomBits;             //!< bloom filter bits per key, or 0 for no filter
+
+    CDBOptions() : fCompression(false), nBlockSize(4096), nMaxOpenFiles(64), nWriteBufferSize(0), nBloomBits(10) {}
+};
+
+/**
+ * Parse a comma separated list of name=value pairs (compression=0|1,
+ * blocksize=<bytes>, maxopenfiles=<n>, writebuffer=<MiB>, bloombits=<n>)
+ * into opts. Settings that are not mentioned keep their value.
+ */
+bool ParseDBOptions(const std::string& strOpts, CDBOptions& opts, std::string& strError);
+
+/** Write and manual compaction counters of a CDBWrapper since it was opened. */
+struct CDBWriteStats
+{
+    uint64_t nWrites;           //!< batches written
+    uint64_t nWriteBytes;       //!< bytes of keys and values in those batches
+    int64_t nWriteMicros;       //!< time spent in LevelDB writes
+    int64_t nMaxWriteMicros;    //!< the slowest single write
+    uint64_t nStalls;           //!< writes that took longer than DB_WRITE_STALL_MICROS
+    int64_t nStallMicros;       //!< time spent in those writes
+    uint64_t nCompactions;      //!< range compactions run through CompactRange()
+    int64_t nCompactionMicros;  //!< time spent in those
+
+    CDBWriteStats() : nWrites(0), nWriteBytes(0), nWriteMicros(0), nMaxWriteMicros(0), nStalls(0), nStallMicros(0), nCompactions(0), nCompactionMicros(0) {}
+};
+
+/** The table files at one LevelDB level and the compactions that wrote into it. */
+struct CDBLevelStats
+{
+    int nFiles;
+    uint64_t nBytes;
+    uint64_t nTargetBytes;      //!< size above which LevelDB compacts the level, 0 if it never does
+    double dCompactionSeconds;
+    double dCompactionReadMiB;
+    double dCompactionWrittenMiB;
+
+    CDBLevelStats() : nFiles(0), nBytes(0), nTargetBytes(0), dCompactionSeconds(0), dCompactionReadMiB(0), dCompactionWrittenMiB(0) {}
+};
+
+/**
+ * Estimate how many bytes LevelDB still has to compact: all of level 0 once
+ * it holds enough files to be compacted, and what every further level holds
+ * beyond its target size. The last level is never compacted on its own.
+ */
+uint64_t EstimatePendingCompactionBytes(const std::vector<CDBLevelStats>& vLevels);
+
 class CDBWrapper
 {
     friend const std::vector<unsigned char>& dbwrapper_private::GetObfuscateKey(const CDBWrapper &w);
@@ -184,6 +254,11 @@ private:
 
     std::vector<unsigned char> CreateObfuscateKey() const;
 
+    mutable CCriticalSection cs_stats;
+    mutable CDBWriteStats stats;
+
+    void DoCompactRange(const leveldb::Slice* begin, const leveldb::Slice* end) const;
+
 public:
     /**
      * @param[in] path        Location in the filesystem where leveldb data will be stored.
@@ -192,8 +267,9 @@ public:
      * @param[in] fWipe       If true, remove all existing data.
      * @param[in] obfuscate   If true, store data obfuscated via simple XOR. If false, XOR
      *                        with a zero'd byte array.
+     * @param[in] dbopts      LevelDB tuning settings.
      */
-    CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false);
+    CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false, const CDBOptions& dbopts = CDBOptions());
     ~CDBWrapper();
 
     template <typename K, typename V>
@@ -276,10 +352,83 @@ public:
         return new CDBIterator(*this, pdb->NewIterator(iteroptions));
     }
 
+    /** Iterator for looking up a short run of adjacent keys, which unlike NewIterator() fills the block cache. */
+    CDBIterator *NewLookupIterator() const
+    {
+        return new CDBIterator(*this, pdb->NewIterator(readoptions));
+    }
+
+    /**
+     * Pin the current state of the database, so that several iterators can
+     * read the same state while it is being written to. Release it with
+     * ReleaseSnapshot().
+     */
+    const leveldb::Snapshot *GetSnapshot() const
+    {
+        return pdb->GetSnapshot();
+    }
+
+    void ReleaseSnapshot(const leveldb::Snapshot *snapshot) const
+    {
+        pdb->ReleaseSnapshot(snapshot);
+    }
+
+    /** Iterator over the state pinned by snapshot. */
+    CDBIterator *NewIterator(const leveldb::Snapshot *snapshot) const
+    {
+        leveldb::ReadOptions options = iteroptions;
+        options.snapshot = snapshot;
+        return new CDBIterator(*this, pdb->NewIterator(options));
+    }
+
     /**
      * Return true if the database managed by this class contains no entries.
      */
     bool IsEmpty();
+
+    /** Read a LevelDB property such as "leveldb.stats". Returns false if it is unknown. */
+    bool GetProperty(const std::string& strName, std::string& strValue) const;
+
+    /** Approximate disk space taken by the keys from key_begin up to key_end. */
+    template <typename K>
+    uint64_t EstimateSize(const K& key_begin, const K& key_end) const
+    {
+        CDataStream ssKey1(SER_DISK, CLIENT_VERSION), ssKey2(SER_DISK, CLIENT_VERSION);
+        ssKey1 << key_begin;
+        ssKey2 << key_end;
+        leveldb::Range range(leveldb::Slice(&ssKey1[0], ssKey1.size()), leveldb::Slice(&ssKey2[0], ssKey2.size()));
+        uint64_t nSize = 0;
+        pdb->GetApproximateSizes(&range, 1, &nSize);
+        return nSize;
+    }
+
+    /**
+     * Compact the keys from key_begin up to key_end down to the last level
+     * they belong in, on the calling thread. Reads and writes go on in the
+     * meantime, but this competes with LevelDB's own compactions for the
+     * disk, so it is best run while the database is quiet.
+     */
+    template <typename K>
+    void CompactRange(const K& key_begin, const K& key_end) const
+    {
+        CDataStream ssKey1(SER_DISK, CLIENT_VERSION), ssKey2(SER_DISK, CLIENT_VERSION);
+        ssKey1 << key_begin;
+        ssKey2 << key_end;
+        leveldb::Slice slKey1(&ssKey1[0], ssKey1.size()), slKey2(&ssKey2[0], ssKey2.size());
+        DoCompactRange(&slKey1, &slKey2);
+    }
+
+    /** Compact the whole database. */
+    void CompactFull() const
+    {
+        DoCompactRange(NULL, NULL);
+    }
+
+    /** Counters of the writes and manual compactions so far. */
+    CDBWriteStats GetWriteStats() const;
+
+    /** The files and compaction statistics of every level. Returns false if LevelDB does not report them. */
+    bool GetLevelStats(std::vector<CDBLevelStats>& vLevels) const;
 };
 
 #endif // BITCOIN_DBWRAPPER_H
@@ -0,0 +1,441 @@
+// Copyright (c) 2017 The Einsteinium Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_FLATMAP_H
+#define BITCOIN_FLATMAP_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace flatmap_detail {
+
+/** Control byte of a slot: EMPTY, DELETED, or the low 7 bits of the hash of a full slot. */
+static const int8_t CTRL_EMPTY = -128;
+static const int8_t CTRL_DELETED = -2;
+static const size_t GROUP_SIZE = 16;
+
+static inline bool IsFull(int8_t ctrl) { return ctrl >= 0; }
+
+static inline unsigned int CountTrailingZeros(uint32_t x)
+{
+#if defined(__GNUC__)
+    return __builtin_ctz(x);
+#else
+    unsigned int n = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+/** The control bytes of one group of slots, matched against a byte all at once. */
+class Group
+{
+private:
+#if defined(__SSE2__)
+    __m128i ctrl;
+#else
+    int8_t ctrl[GROUP_SIZE];
+#endif
+
+public:
+    explicit Group(const int8_t* pos)
+    {
+#if defined(__SSE2__)
+        ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+#else
+        memcpy(ctrl, pos, GROUP_SIZE);
+#endif
+    }
+
+    /** Bitmask of the slots whose control byte equals h. */
+    uint32_t Match(int8_t h) const
+    {
+#if defined(__SSE2__)
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h), ctrl));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < GROUP_SIZE; i++)
+            if (ctrl[i] == h)
+                mask |= 1U << i;
+        return mask;
+#endif
+    }
+
+    uint32_t MatchEmpty() const { return Match(CTRL_EMPTY); }
+
+    /** Bitmask of the slots that are free to take a new entry. */
+    uint32_t MatchEmptyOrDeleted() const
+    {
+#if defined(__SSE2__)
+        return _mm_movemask_epi8(ctrl);
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < GROUP_SIZE; i++)
+            if (ctrl[i] < 0)
+                mask |= 1U << i;
+        return mask;
+#endif
+    }
+};
+
+} // namespace flatmap_detail
+
+/**
+ * Open addressing hash map, laid out like a "Swiss table": a flat array of
+ * one-byte control entries (7 bits of the hash, or empty/deleted) is probed a
+ * group of 16 slots at a time, so most lookups touch a single cache line
+ * before reaching the entry they are after.
+ *
+ * Slots point to individually allocated entries instead of holding them, so
+ * that references to mapped values stay valid while the table grows, just
+ * like with node based maps. Pair it with PoolAllocator to avoid a malloc per
+ * entry. Iterators are invalidated by insertions; erasing only invalidates
+ * iterators to the erased entry.
+ *
+ * Only the parts of the std::unordered_map interface needed by its users are
+ * provided. The bucket interface treats every slot as a bucket of at most one
+ * entry.
+ */
+template <typename K, typename T, typename Hash = std::hash<K>, typename Pred = std::equal_to<K>,
+          typename Alloc = std::allocator<std::pair<const K, T> > >
+class flatmap
+{
+public:
+    typedef K key_type;
+    typedef T mapped_type;
+    typedef std::pair<const K, T> value_type;
+    typedef Hash hasher;
+    typedef Pred key_equal;
+    typedef Alloc allocator_type;
+    typedef size_t size_type;
+
+private:
+    typedef flatmap_detail::Group Group;
+
+    hasher hash;
+    key_equal equal;
+    allocator_type alloc;
+
+    int8_t* ctrl;           //!< control bytes, one per slot
+    value_type** slots;     //!< entries of the full slots
+    size_t nCapacity;       //!< number of slots, a power of two and a multiple of GROUP_SIZE
+    size_t nSize;
+    size_t nGrowthLeft;     //!< number of empty slots that may still be filled before growing
+
+    static size_t MaxLoad(size_t nCapacity) { return nCapacity - nCapacity / 8; }
+
+    static int8_t H2(size_t h) { return (int8_t)(h & 0x7f); }
+    static size_t H1(size_t h) { return h >> 7; }
+
+    template <bool Const>
+    class iterator_base
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef typename flatmap::value_type value_type;
+        typedef ptrdiff_t difference_type;
+        typedef typename std::conditional<Const, const value_type*, value_type*>::type pointer;
+        typedef typename std::conditional<Const, const value_type&, value_type&>::type reference;
+
+    private:
+        friend class flatmap;
+        const int8_t* ctrl;
+        const int8_t* ctrlEnd;
+        value_type* const* slot;
+
+        iterator_base(const int8_t* ctrlIn, const int8_t* ctrlEndIn, value_type* const* slotIn) : ctrl(ctrlIn), ctrlEnd(ctrlEndIn), slot(slotIn) { SkipFree(); }
+
+        void SkipFree()
+        {
+            while (ctrl != ctrlEnd && !flatmap_detail::IsFull(*ctrl)) {
+                ++ctrl;
+                ++slot;
+            }
+        }
+
+    public:
+        iterator_base() : ctrl(NULL), ctrlEnd(NULL), slot(NULL) {}
+        // Converts iterator to const_iterator
+        iterator_base(const iterator_base<false>& it) : ctrl(it.ctrl), ctrlEnd(it.ctrlEnd), slot(it.slot) {}
+
+        reference operator*() const { return **slot; }
+        pointer operator->() const { return *slot; }
+        iterator_base& operator++() { ++ctrl; ++slot; SkipFree(); return *this; }
+        iterator_base operator++(int) { iterator_base copy(*this); ++(*this); return copy; }
+        bool operator==(const iterator_base& other) const { return ctrl == other.ctrl; }
+        bool operator!=(const iterator_base& other) const { return ctrl != other.ctrl; }
+
+        template <bool C> friend class iterator_base;
+    };
+
+    template <bool Const>
+    class local_iterator_base
+    {
+    private:
+        friend class flatmap;
+        value_type* entry;
+        explicit local_iterator_base(value_type* entryIn) : entry(entryIn) {}
+
+    public:
+        typedef typename std::conditional<Const, const value_type&, value_type&>::type reference;
+        typedef typename std::conditional<Const, const value_type*, value_type*>::type pointer;
+
+        reference operator*() const { return *entry; }
+        pointer operator->() const { return entry; }
+        local_iterator_base& operator++() { entry = NULL; return *this; }
+        bool operator==(const local_iterator_base& other) const { return entry == other.entry; }
+        bool operator!=(const local_iterator_base& other) const { return entry != other.entry; }
+    };
+
+public:
+    typedef iterator_base<false> iterator;
+    typedef iterator_base<true> const_iterator;
+    typedef local_iterator_base<false> local_iterator;
+    typedef local_iterator_base<true> const_local_iterator;
+
+    explicit flatmap(size_t n = 0, const hasher& hashIn = hasher(), const key_equal& equalIn = key_equal(), const allocator_type& allocIn = allocator_type()) :
+        hash(hashIn), equal(equalIn), alloc(allocIn), ctrl(NULL), slots(NULL), nCapacity(0), nSize(0), nGrowthLeft(0)
+    {
+        if (n)
+            rehash(n);
+    }
+
+    ~flatmap()
+    {
+        clear();
+    }
+
+    iterator begin() { return iterator(ctrl, ctrl + nCapacity, slots); }
+    iterator end() { return iterator(ctrl + nCapacity, ctrl + nCapacity, slots + nCapacity); }
+    const_iterator begin() const { return const_iterator(ctrl, ctrl + nCapacity, slots); }
+    const_iterator end() const { return const_iterator(ctrl + nCapacity, ctrl + nCapacity, slots + nCapacity); }
+
+    size_t size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+
+    size_t bucket_count() const { return nCapacity; }
+    local_iterator begin(size_t n) { return local_iterator(flatmap_detail::IsFull(ctrl[n]) ? slots[n] : NULL); }
+    local_iterator end(size_t n) { return local_iterator(NULL); }
+    const_local_iterator begin(size_t n) const { return const_local_iterator(flatmap_detail::IsFull(ctrl[n]) ? slots[n] : NULL); }
+    const_local_iterator end(size_t n) const { return const_local_iterator(NULL); }
+
+    allocator_type get_allocator() const { return alloc; }
+
+    iterator find(const K& key)
+    {
+        size_t pos = Find(key, hash(key));
+        return pos == nCapacity ? end() : IteratorAt(pos);
+    }
+
+    const_iterator find(const K& key) const
+    {
+        size_t pos = Find(key, hash(key));
+        return pos == nCapacity ? end() : const_iterator(ctrl + pos, ctrl + nCapacity, slots + pos);
+    }
+
+    size_t count(const K& key) const { return Find(key, hash(key)) == nCapacity ? 0 : 1; }
+
+    template <typename P>
+    std::pair<iterator, bool> insert(const P& value)
+    {
+        const size_t h = hash(value.first);
+        size_t pos = Find(value.first, h);
+        if (pos != nCapacity)
+            return std::make_pair(IteratorAt(pos), false);
+        value_type* entry = alloc.allocate(1);
+        try {
+            new (entry) value_type(value);
+        } catch (...) {
+            alloc.deallocate(entry, 1);
+            throw;
+        }
+        pos = Insert(entry, h);
+        return std::make_pair(IteratorAt(pos), true);
+    }
+
+    T& operator[](const K& key)
+    {
+        return insert(std::make_pair(key, T())).first->second;
+    }
+
+    void erase(const_iterator it)
+    {
+        EraseAt(it.ctrl - ctrl);
+    }
+
+    size_t erase(const K& key)
+    {
+        size_t pos = Find(key, hash(key));
+        if (pos == nCapacity)
+            return 0;
+        EraseAt(pos);
+        return 1;
+    }
+
+    /** Remove all entries and free the table. */
+    void clear()
+    {
+        for (size_t i = 0; i < nCapacity; i++) {
+            if (flatmap_detail::IsFull(ctrl[i]))
+                Destroy(slots[i]);
+        }
+        delete[] ctrl;
+        delete[] slots;
+        ctrl = NULL;
+        slots = NULL;
+        nCapacity = nSize = nGrowthLeft = 0;
+    }
+
+    /** Make room for at least n entries without growing. */
+    void rehash(size_t n)
+    {
+        size_t nNewCapacity = flatmap_detail::GROUP_SIZE;
+        while (MaxLoad(nNewCapacity) < std::max(n, nSize))
+            nNewCapacity *= 2;
+        Resize(nNewCapacity);
+    }
+
+    void swap(flatmap& other)
+    {
+        std::swap(hash, other.hash);
+        std::swap(equal, other.equal);
+        std::swap(alloc, other.alloc);
+        std::swap(ctrl, other.ctrl);
+        std::swap(slots, other.slots);
+        std::swap(nCapacity, other.nCapacity);
+        std::swap(nSize, other.nSize);
+        std::swap(nGrowthLeft, other.nGrowthLeft);
+    }
+
+private:
+    flatmap(const flatmap&);
+    flatmap& operator=(const flatmap&);
+
+    iterator IteratorAt(size_t pos) { return iterator(ctrl + pos, ctrl + nCapacity, slots + pos); }
+
+    void Destroy(value_type* entry)
+    {
+        entry->~value_type();
+        alloc.deallocate(entry, 1);
+    }
+
+    /** Position of key, or nCapacity if it is not present. */
+    size_t Find(const K& key, size_t h) const
+    {
+        if (nCapacity == 0)
+            return nCapacity;
+        const size_t mask = nCapacity / flatmap_detail::GROUP_SIZE - 1;
+        size_t group = H1(h) & mask;
+        for (size_t nProbe = 1; ; nProbe++) {
+            const int8_t* pos = ctrl + group * flatmap_detail::GROUP_SIZE;
+            Group g(pos);
+            for (uint32_t match = g.Match(H2(h)); match; match &= match - 1) {
+                size_t i = pos - ctrl + flatmap_detail::CountTrailingZeros(match);
+                if (equal(slots[i]->first, key))
+                    return i;
+            }
+            if (g.MatchEmpty())
+                return nCapacity;
+            // Triangular steps visit every group of a power of two table.
+            group = (group + nProbe) & mask;
+        }
+    }
+
+    /** First free slot on the probe sequence of h. There must be one. */
+    size_t FindFree(size_t h) const
+    {
+        const size_t mask = nCapacity / flatmap_detail::GROUP_SIZE - 1;
+        size_t group = H1(h) & mask;
+        for (size_t nProbe = 1; ; nProbe++) {
+            const int8_t* pos = ctrl + group * flatmap_detail::GROUP_SIZE;
+            uint32_t match = Group(pos).MatchEmptyOrDeleted();
+            if (match)
+                return pos - ctrl + flatmap_detail::CountTrailingZeros(match);
+            group = (group + nProbe) & mask;
+        }
+    }
+
+    size_t Insert(value_type* entry, size_t h)
+    {
+        if (nGrowthLeft == 0) {
+            // Reclaim deleted slots if they make up much of the table, grow otherwise.
+            if (nCapacity && nSize * 2 < MaxLoad(nCapacity))
+                Resize(nCapacity);
+            else
+                Resize(nCapacity ? nCapacity * 2 : flatmap_detail::GROUP_SIZE);
+        }
+        size_t pos = FindFree(h);
+        if (ctrl[pos] == flatmap_detail::CTRL_EMPTY)
+            nGrowthLeft--;
+        ctrl[pos] = H2(h);
+        slots[pos] = entry;
+        nSize++;
+        return pos;
+    }
+
+    void EraseAt(size_t pos)
+    {
+        assert(flatmap_detail::IsFull(ctrl[pos]));
+        Destroy(slots[pos]);
+        nSize--;
+        // A group that still has an empty slot never made a probe move on to
+        // the next group, so the slot can be marked empty. Otherwise lookups
+        // for entries further along must continue past it.
+        const size_t group = pos - pos % flatmap_detail::GROUP_SIZE;
+        if (Group(ctrl + group).MatchEmpty()) {
+            ctrl[pos] = flatmap_detail::CTRL_EMPTY;
+            nGrowthLeft++;
+        } else {
+            ctrl[pos] = flatmap_detail::CTRL_DELETED;
+        }
+    }
+
+    void Resize(size_t nNewCapacity)
+    {
+        int8_t* oldCtrl = ctrl;
+        value_type** oldSlots = slots;
+        const size_t nOldCapacity = nCapacity;
+
+        ctrl = new int8_t[nNewCapacity];
+        try {
+            slots = new value_type*[nNewCapacity];
+        } catch (...) {
+            delete[] ctrl;
+            ctrl = oldCtrl;
+            throw;
+        }
+        memset(ctrl, flatmap_detail::CTRL_EMPTY, nNewCapacity);
+        nCapacity = nNewCapacity;
+        nGrowthLeft = MaxLoad(nCapacity) - nSize;
+
+        for (size_t i = 0; i < nOldCapacity; i++) {
+            if (flatmap_detail::IsFull(oldCtrl[i])) {
+                const size_t h = hash(oldSlots[i]->first);
+                size_t pos = FindFree(h);
+                ctrl[pos] = H2(h);
+                slots[pos] = oldSlots[i];
+            }
+        }
+        delete[] oldCtrl;
+        delete[] oldSlots;
+    }
+};
+
+#endif // BITCOIN_FLATMAP_H
@@ -16,6 +16,7 @@
 #include "checkpoints.h"
 #include "compat/sanity.h"
 #include "consensus/validation.h"
+#include "crypto/scrypt.h"
 #include "httpserver.h"
 #include "httprpc.h"
 #include "key.h"
@@ -64,6 +65,8 @@
 using namespace std;
 
 bool fFeeEstimatesInitialized = false;
+//! Set once mempool.dat has been read, so that an unfinished load does not overwrite it
+static std::atomic<bool> fDumpMempoolLater(false);
 static const bool DEFAULT_PROXYRANDOMIZE = true;
 static const bool DEFAULT_REST_ENABLE = false;
 static const bool DEFAULT_DISABLE_SAFEMODE = false;
@@ -159,7 +162,6 @@ public:
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
-static CCoinsViewDB *pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher *pcoinscatcher = NULL;
 static boost::scoped_ptr<ECCVerifyHandle> globalVerifyHandle;
 
@@ -199,6 +201,8 @@ void Shutdown()
     StopNode();
     StopTorControl();
     UnregisterNodeSignals(GetNodeSignals());
+    if (fDumpMempoolLater && GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL))
+        DumpMempool();
 
     if (fFeeEstimatesInitialized)
     {
@@ -218,6 +222,8 @@ void Shutdown()
         }
         delete pcoinsTip;
         pcoinsTip = NULL;
+        delete pcoinsPrefetch;
+        pcoinsPrefetch = NULL;
         delete pcoinscatcher;
         pcoinscatcher = NULL;
         delete pcoinsdbview;
@@ -305,11 +311,16 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-?", _("Print this help message and exit"));
     strUsage += HelpMessageOpt("-version", _("Print version and exit"));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt("-blockindexdbopts=<opts>", _("Tune the LevelDB block index database, as a comma separated list of compression=<0|1>, blocksize=<bytes>, maxopenfiles=<n>, writebuffer=<MiB> and bloombits=<n>"));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", strprintf(_("Whether to operate in a blocks only mode (default: %u)"), DEFAULT_BLOCKSONLY));
+    strUsage += HelpMessageOpt("-chainstatedbopts=<opts>", _("Tune the LevelDB chain state database, taking the same settings as -blockindexdbopts"));
     strUsage += HelpMessageOpt("-checkblocks=<n>", strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), DEFAULT_CHECKBLOCKS));
     strUsage += HelpMessageOpt("-checklevel=<n>", strprintf(_("How thorough the block verification of -checkblocks is (0-4, default: %u)"), DEFAULT_CHECKLEVEL));
+    strUsage += HelpMessageOpt("-checkpowhashes=<n>", strprintf(_("How many stored block proof of work hashes to re-verify at startup (default: %u)"), DEFAULT_CHECKPOWHASHES));
+    strUsage += HelpMessageOpt("-coinsperoutput", strprintf(_("Store one chain state record per unspent output instead of per transaction, converting the database at startup (default: %u)"), DEFAULT_COINS_PER_OUTPUT));
+    strUsage += HelpMessageOpt("-compactinterval=<n>", strprintf(_("Compact 1/%d of the chain state database every <n> minutes while the node is not syncing and LevelDB is idle (0 to disable, default: %u)"), COMPACT_SLICES, DEFAULT_COMPACT_INTERVAL));
     strUsage += HelpMessageOpt("-conf=<file>", strprintf(_("Specify configuration file (default: %s)"), BITCOIN_CONF_FILENAME));
     if (mode == HMM_BITCOIND)
     {
@@ -322,14 +333,19 @@ std::string HelpMessage(HelpMessageMode mode)
     if (showDebug)
         strUsage += HelpMessageOpt("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
+    strUsage += HelpMessageOpt("-loadtxoutset=<file>", _("Start a new pruned node from a UTXO snapshot written by dumptxoutset, once the header of its block is known, and check it against the blocks below it in the background"));
+    strUsage += HelpMessageOpt("-loadtxoutsethash=<hash>", _("Refuse a -loadtxoutset snapshot unless it has this UTXO set commitment (muhash)"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
 #ifndef WIN32
+    strUsage += HelpMessageOpt("-persistmempool", strprintf(_("Whether to save the mempool on shutdown and load on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL));
+    strUsage += HelpMessageOpt("-persistmempoolinterval=<n>", strprintf(_("Also save the mempool every <n> minutes (default: %u)"), DEFAULT_PERSIST_MEMPOOL_INTERVAL));
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), BITCOIN_PID_FILENAME));
 #endif
+    strUsage += HelpMessageOpt("-prefetchthreads=<n>", strprintf(_("Set the number of threads reading block inputs from the coin database ahead of validation (0 to %d, default: %d)"), MAX_PREFETCH_THREADS, DEFAULT_PREFETCH_THREADS));
     strUsage += HelpMessageOpt("-prune=<n>", strprintf(_("Reduce storage requirements by pruning (deleting) old blocks. This mode is incompatible with -txindex and -rescan. "
             "Warning: Reverting this setting requires re-downloading the entire blockchain. "
             "(default: 0 = disable pruning blocks, >%u = target size in MiB to use for block files)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
@@ -409,11 +425,12 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-stopafterblockimport", strprintf("Stop running after importing blocks from disk (default: %u)", DEFAULT_STOPAFTERBLOCKIMPORT));
         strUsage += HelpMessageOpt("-limitancestorcount=<n>", strprintf("Do not accept transactions if number of in-mempool ancestors is <n> or more (default: %u)", DEFAULT_ANCESTOR_LIMIT));
         strUsage += HelpMessageOpt("-limitancestorsize=<n>", strprintf("Do not accept transactions whose size with all in-mempool ancestors exceeds <n> kilobytes (default: %u)", DEFAULT_ANCESTOR_SIZE_LIMIT));
+        strUsage += HelpMessageOpt("-limitclustercount=<n>", strprintf("Do not accept transactions that would grow a cluster of connected in-mempool transactions beyond <n> (default: %u)", DEFAULT_CLUSTER_LIMIT));
         strUsage += HelpMessageOpt("-limitdescendantcount=<n>", strprintf("Do not accept transactions if any ancestor would have <n> or more in-mempool descendants (default: %u)", DEFAULT_DESCENDANT_LIMIT));
         strUsage += HelpMessageOpt("-limitdescendantsize=<n>", strprintf("Do not accept transactions if any ancestor would have more than <n> kilobytes of in-mempool descendants (default: %u).", DEFAULT_DESCENDANT_SIZE_LIMIT));
         strUsage += HelpMessageOpt("-bip9params=deployment:start:end", "Use given start/end times for specified bip9 deployment (regtest-only)");
     }
-    string debugCategories = "addrman, alert, bench, cmpctblock, coindb, db, http, libevent, lock, mempool, mempoolrej, net, proxy, prune, rand, reindex, rpc, selectcoins, tor, zmq"; // Don't translate these and qt below
+    string debugCategories = "addrman, alert, bench, cmpctblock, coindb, db, http, leveldb, libevent, lock, mempool, mempoolrej, net, pow, proxy, prune, rand, reindex, rpc, selectcoins, tor, zmq"; // Don't translate these and qt below
     if (mode == HMM_BITCOIN_QT)
         debugCategories += ", qt";
     strUsage += HelpMessageOpt("-debug=<category>", strprintf(_("Output debugging information (default: %u, supplying <category> is optional)"), 0) + ". " +
@@ -587,67 +604,70 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
 {
     const CChainParams& chainparams = Params();
     RenameThread("einsteinium-loadblk");
-    CImportingNow imp;
-
-    // -reindex
-    if (fReindex) {
-        int nFile = 0;
-        while (true) {
-            CDiskBlockPos pos(nFile, 0);
-            if (!boost::filesystem::exists(GetBlockPosFilename(pos, "blk")))
-                break; // No block files left to reindex
-            FILE *file = OpenBlockFile(pos, true);
-            if (!file)
-                break; // This error is logged in OpenBlockFile
-            LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
-            LoadExternalBlockFile(chainparams, file, &pos);
-            nFile++;
+
+    {
+        CImportingNow imp;
+
+        // -reindex
+        if (fReindex) {
+            ReindexBlockFiles(chainparams);
+            pblocktree->WriteReindexing(false);
+            fReindex = false;
+            LogPrintf("Reindexing finished\n");
+            // To avoid ending up in a situation without genesis block, re-try initializing (no-op if reindexing worked):
+            InitBlockIndex(chainparams);
         }
-        pblocktree->WriteReindexing(false);
-        fReindex = false;
-        LogPrintf("Reindexing finished\n");
-        // To avoid ending up in a situation without genesis block, re-try initializing (no-op if reindexing worked):
-        InitBlockIndex(chainparams);
-    }
 
-    // hardcoded $DATADIR/bootstrap.dat
-    boost::filesystem::path pathBootstrap = GetDataDir() / "bootstrap.dat";
-    if (boost::filesystem::exists(pathBootstrap)) {
-        FILE *file = fopen(pathBootstrap.string().c_str(), "rb");
-        if (file) {
-            boost::filesystem::path pathBootstrapOld = GetDataDir() / "bootstrap.dat.old";
-            LogPrintf("Importing bootstrap.dat...\n");
-            LoadExternalBlockFile(chainparams, file);
-            RenameOver(pathBootstrap, pathBootstrapOld);
-        } else {
-            LogPrintf("Warning: Could not open bootstrap file %s\n", pathBootstrap.string());
+        // hardcoded $DATADIR/bootstrap.dat
+        boost::filesystem::path pathBootstrap = GetDataDir() / "bootstrap.dat";
+        if (boost::filesystem::exists(pathBootstrap)) {
+            FILE *file = fopen(pathBootstrap.string().c_str(), "rb");
+            if (file) {
+                boost::filesystem::path pathBootstrapOld = GetDataDir() / "bootstrap.dat.old";
+                LogPrintf("Importing bootstrap.dat...\n");
+                LoadExternalBlockFile(chainparams, file);
+                RenameOver(pathBootstrap, pathBootstrapOld);
+            } else {
+                LogPrintf("Warning: Could not open bootstrap file %s\n", pathBootstrap.string());
+            }
         }
-    }
 
-    // -loadblock=
-    BOOST_FOREACH(const boost::filesystem::path& path, vImportFiles) {
-        FILE *file = fopen(path.string().c_str(), "rb");
-        if (file) {
-            LogPrintf("Importing blocks file %s...\n", path.string());
-            LoadExternalBlockFile(chainparams, file);
-        } else {
-            LogPrintf("Warning: Could not open blocks file %s\n", path.string());
+        // -loadblock=
+        BOOST_FOREACH(const boost::filesystem::path& path, vImportFiles) {
+            FILE *file = fopen(path.string().c_str(), "rb");
+            if (file) {
+                LogPrintf("Importing blocks file %s...\n", path.string());
+                LoadExternalBlockFile(chainparams, file);
+            } else {
+                LogPrintf("Warning: Could not open blocks file %s\n", path.string());
+            }
         }
-    }
 
-    // scan for better chains in the block chain database, that are not yet connected in the active best chain
-    CValidationState state;
-    if (!ActivateBestChain(state, chainparams)) {
-        LogPrintf("Failed to connect best block");
-        StartShutdown();
-    }
+        // scan for better chains in the block chain database, that are not yet connected in the active best chain
+        CValidationState state;
+        if (!ActivateBestChain(state, chainparams)) {
+            LogPrintf("Failed to connect best block");
+            StartShutdown();
+        }
+
+        if (GetBoolArg("-stopafterblockimport", DEFAULT_STOPAFTERBLOCKIMPORT)) {
+            LogPrintf("Stopping after block import\n");
+            StartShutdown();
+        }
+    } // End scope of CImportingNow
 
-    if (GetBoolArg("-stopafterblockimport", DEFAULT_STOPAFTERBLOCKIMPORT)) {
-        LogPrintf("Stopping after block import\n");
-        StartShutdown();
+    if (GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
+        LoadMempool();
+        fDumpMempoolLater = !fRequestShutdown;
     }
 }
 
+static void DumpMempoolPeriodically()
+{
+    if (fDumpMempoolLater)
+        DumpMempool();
+}
+
 /** Sanity checks
  *  Ensure that Bitcoin is running in a usable environment with all
  *  necessary library support.
@@ -854,6 +874,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 #endif
     }
 
+    // a node started from a UTXO snapshot never gets the blocks below it for good
+    if (mapArgs.count("-loadtxoutset")) {
+        if (!GetArg("-prune", 0))
+            return InitError(_("-loadtxoutset requires pruning (-prune)."));
+        if (GetBoolArg("-reindex", false) || GetBoolArg("-reindex-chainstate", false))
+            return InitError(_("-loadtxoutset cannot be combined with -reindex or -reindex-chainstate."));
+    }
+
     // Make sure enough file descriptors are available
     int nBind = std::max(
                 (mapMultiArgs.count("-bind") ? mapMultiArgs.at("-bind").size() : 0) +
@@ -861,12 +889,26 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     int nUserMaxConnections = GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     nMaxConnections = std::max(nUserMaxConnections, 0);
 
+    // LevelDB may be allowed to keep more files open than the core allowance covers
+    CDBOptions chainstateDBOpts, blockIndexDBOpts;
+    std::string strDBOptsError;
+    if (!ParseDBOptions(GetArg("-chainstatedbopts", ""), chainstateDBOpts, strDBOptsError))
+        return InitError(strprintf(_("Invalid -chainstatedbopts: %s"), strDBOptsError));
+    if (!ParseDBOptions(GetArg("-blockindexdbopts", ""), blockIndexDBOpts, strDBOptsError))
+        return InitError(strprintf(_("Invalid -blockindexdbopts: %s"), strDBOptsError));
+    const CDBOptions defaultDBOpts;
+    int nCoreFD = MIN_CORE_FILEDESCRIPTORS;
+    if (nCoreFD > 0) {
+        nCoreFD += std::max(chainstateDBOpts.nMaxOpenFiles - defaultDBOpts.nMaxOpenFiles, 0);
+        nCoreFD += std::max(blockIndexDBOpts.nMaxOpenFiles - defaultDBOpts.nMaxOpenFiles, 0);
+    }
+
     // Trim requested connection counts, to fit into system limitations
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
-    int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
-    if (nFD < MIN_CORE_FILEDESCRIPTORS)
+    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - nCoreFD)), 0);
+    int nFD = RaiseFileDescriptorLimit(nMaxConnections + nCoreFD);
+    if (nFD < nCoreFD)
         return InitError(_("Not enough file descriptors available."));
-    nMaxConnections = std::min(nFD - MIN_CORE_FILEDESCRIPTORS, nMaxConnections);
+    nMaxConnections = std::min(nFD - nCoreFD, nMaxConnections);
 
     if (nMaxConnections < nUserMaxConnections)
         InitWarning(strprintf(_("Reducing -maxconnections from %d to %d, because of system limitations."), nUserMaxConnections, nMaxConnections));
@@ -1081,6 +1123,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (nScriptCheckThreads) {
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadHeaderPoWCheck);
     }
 
     // Start the lightweight task scheduler thread
@@ -1104,6 +1148,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 #if defined(USE_SSE2)
     scrypt_detect_sse2();
 #endif
+    LogPrintf("Using %s scrypt implementation for header batches\n", scrypt_detect_multi());
 
     // ********************************************************* Step 5: verify wallet database integrity
 #ifdef ENABLE_WALLET
@@ -1294,7 +1339,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("* Using %.1fMiB for in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
 
     bool fLoaded = false;
-    while (!fLoaded) {
+    while (!fLoaded && !fRequestShutdown) {
         bool fReset = fReindex;
         std::string strLoadError;
 
@@ -1305,14 +1350,27 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             try {
                 UnloadBlockIndex();
                 delete pcoinsTip;
+                delete pcoinsPrefetch;
                 delete pcoinsdbview;
                 delete pcoinscatcher;
                 delete pblocktree;
 
-                pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
-                pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex || fReindexChainState);
+                pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex, blockIndexDBOpts);
+                pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex || fReindexChainState, chainstateDBOpts);
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
-                pcoinsTip = new CCoinsViewCache(pcoinscatcher);
+                pcoinsPrefetch = new CCoinsViewPrefetch(pcoinscatcher);
+                pcoinsTip = new CCoinsViewCache(pcoinsPrefetch);
+
+                bool fCoinsPerOutput = GetBoolArg("-coinsperoutput", DEFAULT_COINS_PER_OUTPUT);
+                if (!pcoinsdbview->Upgrade(fCoinsPerOutput)) {
+                    strLoadError = _("Error upgrading chain state database");
+                    break;
+                }
+                // The upgrade stops early on shutdown, leaving the rest for the next start.
+                if (fRequestShutdown)
+                    break;
+                if (pcoinsdbview->IsPerOutput() && !fCoinsPerOutput)
+                    LogPrintf("Keeping the per-output chain state layout; rebuild with -reindex-chainstate to go back\n");
 
                 if (fReindex) {
                     pblocktree->WriteReindexing(true);
@@ -1380,6 +1438,16 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     strLoadError = _("Corrupted block database detected");
                     break;
                 }
+
+                if (!LoadUTXOCommitment()) {
+                    strLoadError = _("Error computing the UTXO set commitment");
+                    break;
+                }
+
+                // Rebuilding cannot recover a node without the blocks below
+                // its snapshot, so do not offer it.
+                if (!LoadTxOutSetSnapshot(mapArgs.count("-loadtxoutset")))
+                    return InitError(_("Loading the UTXO snapshot did not finish. Start again with -loadtxoutset to load it again."));
             } catch (const std::exception& e) {
                 if (fDebug) LogPrintf("%s\n", e.what());
                 strLoadError = _("Error opening block database");
@@ -1389,7 +1457,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             fLoaded = true;
         } while(false);
 
-        if (!fLoaded) {
+        if (!fLoaded && !fRequestShutdown) {
             // first suggest a reindex
             if (!fReset) {
                 bool fRet = uiInterface.ThreadSafeQuestion(
@@ -1409,6 +1477,22 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         }
     }
 
+    if (mapArgs.count("-loadtxoutset") && !fRequestShutdown) {
+        boost::filesystem::path pathSnapshot = GetArg("-loadtxoutset", "");
+        if (!pathSnapshot.is_complete())
+            pathSnapshot = GetDataDir() / pathSnapshot;
+        uint256 hashExpected;
+        if (mapArgs.count("-loadtxoutsethash")) {
+            std::string strHash = GetArg("-loadtxoutsethash", "");
+            if (strHash.size() != 64 || !IsHex(strHash))
+                return InitError(strprintf(_("Invalid -loadtxoutsethash: '%s'"), strHash));
+            hashExpected = uint256S(strHash);
+        }
+        std::string strError;
+        if (!InitLoadTxOutSet(pathSnapshot, hashExpected, strError))
+            return InitError(strError);
+    }
+
     // As LoadBlockIndex can take several minutes, it's possible the user
     // requested to kill the GUI during the last operation. If so, exit.
     // As the program has not fully started yet, Shutdown() is possibly overkill.
@@ -1488,6 +1572,13 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             vImportFiles.push_back(strFile);
     }
 
+    int nPrefetchThreads = std::min(std::max(0, (int)GetArg("-prefetchthreads", DEFAULT_PREFETCH_THREADS)), MAX_PREFETCH_THREADS);
+    LogPrintf("Using %u threads for coin prefetching\n", nPrefetchThreads);
+    for (int i = 0; i < nPrefetchThreads; i++) {
+        boost::function<void()> prefetchLoop = boost::bind(&CCoinsViewPrefetch::ThreadPrefetch, pcoinsPrefetch);
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "coinsprefetch", prefetchLoop));
+    }
+
     threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles));
 
     // Wait for genesis block to be processed
@@ -1499,6 +1590,17 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         uiInterface.NotifyBlockTip.disconnect(BlockNotifyGenesisWait);
     }
 
+    threadGroup.create_thread(boost::bind(&ThreadCheckPoWHashes, (unsigned int)std::max(0, (int)GetArg("-checkpowhashes", DEFAULT_CHECKPOWHASHES))));
+    threadGroup.create_thread(&ThreadTxOutSetSnapshot);
+
+    int64_t nCompactInterval = GetArg("-compactinterval", DEFAULT_COMPACT_INTERVAL);
+    if (nCompactInterval > 0)
+        scheduler.scheduleEvery(&CompactChainStateSlice, nCompactInterval * 60);
+
+    int64_t nPersistMempoolInterval = GetArg("-persistmempoolinterval", DEFAULT_PERSIST_MEMPOOL_INTERVAL);
+    if (GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL) && nPersistMempoolInterval > 0)
+        scheduler.scheduleEvery(&DumpMempoolPeriodically, nPersistMempoolInterval * 60);
+
     // ********************************************************* Step 11: start node
 
     if (!strErrors.str().empty())
@@ -14,8 +14,10 @@
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "crypto/scrypt.h"
 #include "hash.h"
 #include "init.h"
+#include "limitedmap.h"
 #include "merkleblock.h"
 #include "net.h"
 #include "policy/fees.h"
@@ -47,8 +49,6 @@
 #include <boost/filesystem/fstream.hpp>
 #include <boost/math/distributions/poisson.hpp>
 #include <boost/thread.hpp>
-#include <boost/random/mersenne_twister.hpp>
-#include <boost/random/uniform_int.hpp>
 
 using namespace std;
 
@@ -90,6 +90,16 @@ CAmount maxTxFee = DEFAULT_TRANSACTION_MAXFEE;
 CTxMemPool mempool(::minRelayTxFee);
 FeeFilterRounder filterRounder(::minRelayTxFee);
 
+/**
+ * Transactions whose scripts passed AcceptToMemoryPool, by witness hash, with
+ * the time they did and the script flags they were checked with. Script
+ * validity only depends on the transaction and the outputs it spends, so
+ * TestBlockTemplateValidity can skip the script checks of these when the
+ * block's flags are no stricter. The oldest entries make room for new ones.
+ */
+static CCriticalSection cs_scriptExecutionCache;
+static limitedmap<uint256, std::pair<int64_t, unsigned int> > scriptExecutionCache(SCRIPT_EXECUTION_CACHE_SIZE);
+
 struct IteratorComparator
 {
     template<typename I>
@@ -226,6 +236,12 @@ namespace {
     /** Dirty block index entries. */
     set<CBlockIndex*> setDirtyBlockIndex;
 
+    /** PoW hashes of newly accepted headers, keyed by block hash, not yet written to the block index database. */
+    std::vector<std::pair<uint256, uint256> > vDirtyPoWHashes;
+
+    /** Block index entries loaded without a stored PoW hash, to be back-filled by ThreadCheckPoWHashes. */
+    std::vector<uint256> vPoWHashBackfill;
+
     /** Dirty block file entries. */
     set<int> setDirtyFileInfo;
 
@@ -237,6 +253,21 @@ namespace {
     MapRelay mapRelay;
     /** Expiration-time ordered list of (expire time, relay map entry) pairs, protected by cs_main). */
     std::deque<std::pair<int64_t, MapRelay::iterator>> vRelayExpiration;
+
+    /**
+     * UTXO snapshot state, protected by cs_main. While the snapshot given with
+     * -loadtxoutset waits for the header of its block, hashSnapshotPending is
+     * set and no blocks are downloaded or connected. Once it is loaded, pindexSnapshot
+     * points at its block until the background check has connected all blocks
+     * up to it and found the same commitment; nSnapshotCheckHeight is how far
+     * that check got.
+     */
+    uint256 hashSnapshotPending;
+    boost::filesystem::path pathSnapshotPending;
+    uint256 hashSnapshotExpected;
+    CTxOutSetSnapshot snapshotInfo;
+    CBlockIndex *pindexSnapshot = NULL;
+    int nSnapshotCheckHeight = -1;
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -644,6 +675,34 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
     }
 }
 
+/** Add blocks below the UTXO snapshot which the background check is going to
+ *  need and the given peer has to vBlocks, until it holds count blocks. Only a
+ *  window above the check is fetched, so that a pruned node does not pile up
+ *  history it cannot delete yet. */
+void FindSnapshotBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, const Consensus::Params& consensusParams) {
+    if (pindexSnapshot == NULL || vBlocks.size() >= count)
+        return;
+
+    CNodeState *state = State(nodeid);
+    assert(state != NULL);
+    if (state->pindexBestKnownBlock == NULL || state->pindexBestKnownBlock->GetAncestor(pindexSnapshot->nHeight) != pindexSnapshot)
+        return;
+
+    int nWindowEnd = std::min<int>(nSnapshotCheckHeight + BLOCK_DOWNLOAD_WINDOW, pindexSnapshot->nHeight);
+    std::vector<CBlockIndex*> vToFetch;
+    for (CBlockIndex *pindex = pindexSnapshot->GetAncestor(nWindowEnd); pindex != NULL && pindex->nHeight > nSnapshotCheckHeight; pindex = pindex->pprev)
+        vToFetch.push_back(pindex);
+    BOOST_REVERSE_FOREACH(CBlockIndex* pindex, vToFetch) {
+        if (pindex->nStatus & BLOCK_HAVE_DATA || mapBlocksInFlight.count(pindex->GetBlockHash()))
+            continue;
+        if (!state->fHaveWitness && IsWitnessEnabled(pindex->pprev, consensusParams))
+            return;
+        vBlocks.push_back(pindex);
+        if (vBlocks.size() == count)
+            return;
+    }
+}
+
 } // anon namespace
 
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
@@ -698,8 +757,18 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewPrefetch *pcoinsPrefetch = NULL;
+CCoinsViewDB *pcoinsdbview = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
+/**
+ * Rolling commitment to the UTXO set, kept up to date block by block. It is
+ * only valid while hashUTXOCommitmentBlock is the best block of pcoinsTip.
+ * Protected by cs_main.
+ */
+static CUTXOCommitment utxoCommitment;
+static uint256 hashUTXOCommitmentBlock;
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // mapOrphanTransactions
@@ -1144,7 +1213,7 @@ std::string FormatStateMessage(const CValidationState &state)
 }
 
 bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree,
-                              bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount& nAbsurdFee,
+                              bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit, const CAmount& nAbsurdFee,
                               std::vector<uint256>& vHashTxnToUncache)
 {
     const uint256 hash = tx.GetHash();
@@ -1317,7 +1386,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
             }
         }
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), pool.HasNoInputsOf(tx), inChainInputValue, fSpendsCoinbase, nSigOpsCost, lp);
+        CTxMemPoolEntry entry(tx, nFees, nAcceptTime, dPriority, chainActive.Height(), pool.HasNoInputsOf(tx), inChainInputValue, fSpendsCoinbase, nSigOpsCost, lp);
         unsigned int nSize = entry.GetTxSize();
 
         // Check that the transaction doesn't have an excessive number of
@@ -1375,6 +1444,11 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
             return state.DoS(0, false, REJECT_NONSTANDARD, "too-long-mempool-chain", false, errString);
         }
+        size_t nLimitCluster = GetArg("-limitclustercount", DEFAULT_CLUSTER_LIMIT);
+        if (pool.CalculateClusterCount(setAncestors) > nLimitCluster) {
+            return state.DoS(0, false, REJECT_NONSTANDARD, "too-long-mempool-chain", false,
+                             strprintf("too many transactions in cluster [limit: %u]", nLimitCluster));
+        }
 
         // A transaction that spends outputs that would be replaced by it is invalid. Now
         // that we have the set of all ancestors we can detect this
@@ -1554,6 +1628,11 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
                 __func__, hash.ToString(), FormatStateMessage(state));
         }
 
+        {
+            LOCK(cs_scriptExecutionCache);
+            scriptExecutionCache.insert(std::make_pair(tx.GetWitnessHash(), std::make_pair(GetTimeMicros(), scriptVerifyFlags)));
+        }
+
         // Remove conflicting transactions from the mempool
         BOOST_FOREACH(const CTxMemPool::txiter it, allConflicting)
         {
@@ -1581,11 +1660,11 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
     return true;
 }
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                        bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
 {
     std::vector<uint256> vHashTxToUncache;
-    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, fOverrideMempoolLimit, nAbsurdFee, vHashTxToUncache);
+    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, fOverrideMempoolLimit, nAbsurdFee, vHashTxToUncache);
     if (!res) {
         BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache)
             pcoinsTip->Uncache(hashTx);
@@ -1593,6 +1672,12 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     return res;
 }
 
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                        bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
+{
+    return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), fOverrideMempoolLimit, nAbsurdFee);
+}
+
 /** Return transaction in txOut, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::Params& consensusParams, uint256 &hashBlock, bool fAllowSlow)
 {
@@ -1687,7 +1772,7 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHea
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+static bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams, bool fCheckPoW)
 {
     block.SetNull();
 
@@ -1705,15 +1790,24 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
     }
 
     // Check the header
-    if (!CheckProofOfWork(block.GetPoWHash(), block.nBits, consensusParams))
+    if (fCheckPoW && !CheckProofOfWork(block.GetPoWHash(), block.nBits, consensusParams))
         return error("ReadBlockFromDisk: Errors in block header at %s", pos.ToString());
 
     return true;
 }
 
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+{
+    return ReadBlockFromDisk(block, pos, consensusParams, true);
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams))
+    // The scrypt PoW of a header was already checked before its index entry
+    // could reach BLOCK_VALID_TREE. For such entries matching the header hash
+    // against the index is sufficient and avoids rehashing on every read.
+    const bool fCheckPoW = !pindex->IsValid(BLOCK_VALID_TREE);
+    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams, fCheckPoW))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
@@ -1721,49 +1815,58 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
-int static generateMTRandom(unsigned int s, int range)
-{
-    boost::mt19937 gen(s);
-    boost::uniform_int<> dist(1, range);
-    return dist(gen);
-}
+/**
+ * Offset of the first wormhole block into each epoch from 2 to 147, as drawn
+ * by boost::uniform_int<>(1, 35820) from a boost::mt19937 seeded with
+ * 5299860 * epoch. Precomputed because seeding the generator on every call
+ * dominated GetBlockSubsidy; main_tests checks the table against it.
+ */
+static const int WORMHOLE_START_OFFSETS[WORMHOLE_LAST_EPOCH - WORMHOLE_FIRST_EPOCH + 1] = {
+     6206, 32828, 33278,  7500, 18359,  7280, 33119, 19569, 21963, 17684,
+    26560, 15521,  3262, 21052, 17577, 26812, 16596, 24438, 13540, 35485,
+     1034, 18301, 19386, 16396, 11051, 22404,  2359, 12970,  4871, 29083,
+    14352, 16826, 13419,   198, 17526, 29084, 14069,  1705,  8673,  3415,
+     4030, 18896,  7229, 32516, 20530,  6162,  7157, 31982,  3082, 35818,
+     9367, 14288,  5392, 12335, 32592,  5421,  5763, 29892, 10407, 16884,
+    14881, 26400, 34740, 24177, 30403, 16457, 25494,  6109,  4358, 26975,
+     7057, 13602, 28451, 28796, 13748, 29519, 33472, 13956,  9681,  7536,
+    31510,   775, 25144, 17013, 27326, 16559,  7282, 34211, 11820,  3971,
+    25678, 31361, 30466,  7852, 35106, 20563, 13424, 22984, 20881,  7143,
+    13749, 15742, 32612,  1454, 34131, 10167, 27931, 18068, 16463,  6400,
+    24722,  3404, 11310, 27346, 22381, 34655,  5971,  4038, 25614,   493,
+    29339, 10402, 26743, 29789,  5637, 19290, 14809, 27725, 31086, 20974,
+     3663, 31257,  3253, 30424, 28092,  7695,  4170, 34312,  4319, 25334,
+    20982, 14619, 10095, 35290,  8752, 11118
+};
 
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams) // EMC2 is not using consensusParams right now, but they remain for future compatibility
 {
     CAmount nSubsidy = 0;
 
-    int StartOffset;
-    int WormholeStartBlock;
-    int mod = nHeight % 36000;
+    int mod = nHeight % WORMHOLE_EPOCH_BLOCKS;
     if (mod != 0) mod = 1;
-    int epoch = (nHeight / 36000) + mod;
-
-    long wseed = 5299860 * epoch; // Discovered: 1952, Atomic number: 99 Melting Point: 860
+    int epoch = (nHeight / WORMHOLE_EPOCH_BLOCKS) + mod;
 
-    StartOffset = generateMTRandom(wseed, 35820);
-    WormholeStartBlock = StartOffset + ((epoch - 1)  * 36000); // Wormholes start from Epoch 2
-
-
-    if(epoch > 1 && epoch < 148 && nHeight >= WormholeStartBlock && nHeight < WormholeStartBlock + 180)
+    if (epoch >= WORMHOLE_FIRST_EPOCH && epoch <= WORMHOLE_LAST_EPOCH)
     {
-        nSubsidy = 2973 * COIN;
-    }
-    else
-	{
-		if (nHeight == 1) nSubsidy = 10747 * COIN;
-		else if (nHeight <= 72000) nSubsidy = 1024 * COIN;
-		else if(nHeight <= 144000) nSubsidy = 512 * COIN;
-		else if(nHeight <= 288000) nSubsidy = 256 * COIN;
-		else if(nHeight <= 432000) nSubsidy = 128 * COIN;
-		else if(nHeight <= 576000) nSubsidy = 64 * COIN;
-		else if(nHeight <= 864000) nSubsidy = 32 * COIN;
-		else if(nHeight <= 1080000) nSubsidy = 16 * COIN;
-		else if (nHeight <= 1584000) nSubsidy = 8 * COIN;
-		else if (nHeight <= 2304000) nSubsidy = 4 * COIN;
-		else if (nHeight <= 5256000) nSubsidy = 2 * COIN;
-		else if (nHeight <= 26280000) nSubsidy = 1 * COIN;
-
-	}
+        // Wormholes start from Epoch 2
+        int WormholeStartBlock = WORMHOLE_START_OFFSETS[epoch - WORMHOLE_FIRST_EPOCH] + ((epoch - 1) * WORMHOLE_EPOCH_BLOCKS);
+        if (nHeight >= WormholeStartBlock && nHeight < WormholeStartBlock + WORMHOLE_BLOCKS)
+            return 2973 * COIN;
+    }
+
+    if (nHeight == 1) nSubsidy = 10747 * COIN;
+    else if (nHeight <= 72000) nSubsidy = 1024 * COIN;
+    else if (nHeight <= 144000) nSubsidy = 512 * COIN;
+    else if (nHeight <= 288000) nSubsidy = 256 * COIN;
+    else if (nHeight <= 432000) nSubsidy = 128 * COIN;
+    else if (nHeight <= 576000) nSubsidy = 64 * COIN;
+    else if (nHeight <= 864000) nSubsidy = 32 * COIN;
+    else if (nHeight <= 1080000) nSubsidy = 16 * COIN;
+    else if (nHeight <= 1584000) nSubsidy = 8 * COIN;
+    else if (nHeight <= 2304000) nSubsidy = 4 * COIN;
+    else if (nHeight <= 5256000) nSubsidy = 2 * COIN;
+    else if (nHeight <= 26280000) nSubsidy = 1 * COIN;
 
     return nSubsidy;
 }
@@ -1945,7 +2048,7 @@ void static InvalidBlockFound(CBlockIndex *pindex, const CValidationState &state
     }
 }
 
-void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txundo, int nHeight)
+static void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txundo, int nHeight, CUTXOCommitment* pcommitment)
 {
     // mark inputs spent
     if (!tx.IsCoinBase()) {
@@ -1956,6 +2059,8 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txund
 
             if (nPos >= coins->vout.size() || coins->vout[nPos].IsNull())
                 assert(false);
+            if (pcommitment)
+                pcommitment->RemoveCoin(txin.prevout.hash, *coins, nPos);
             // mark an outpoint spent, and construct undo information
             txundo.vprevout.push_back(CTxInUndo(coins->vout[nPos]));
             coins->Spend(nPos);
@@ -1968,13 +2073,22 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txund
         }
     }
     // add outputs
-    inputs.ModifyNewCoins(tx.GetHash(), tx.IsCoinBase())->FromTx(tx, nHeight);
+    if (pcommitment && tx.IsCoinBase()) {
+        // A duplicate coinbase overwrites what is left of its predecessor.
+        const CCoins* coinsOld = inputs.AccessCoins(tx.GetHash());
+        if (coinsOld)
+            pcommitment->RemoveCoins(tx.GetHash(), *coinsOld);
+    }
+    CCoinsModifier coins = inputs.ModifyNewCoins(tx.GetHash(), tx.IsCoinBase());
+    coins->FromTx(tx, nHeight);
+    if (pcommitment)
+        pcommitment->AddCoins(tx.GetHash(), *coins);
 }
 
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
 {
     CTxUndo txundo;
-    UpdateCoins(tx, inputs, txundo, nHeight);
+    UpdateCoins(tx, inputs, txundo, nHeight, NULL);
 }
 
 bool CScriptCheck::operator()() {
@@ -2039,11 +2153,11 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
 }
 }// namespace Consensus
 
-bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks)
+static bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, int nSpendHeight, bool fScriptChecks, unsigned int flags, bool cacheStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks)
 {
     if (!tx.IsCoinBase())
     {
-        if (!Consensus::CheckTxInputs(tx, state, inputs, GetSpendHeight(inputs)))
+        if (!Consensus::CheckTxInputs(tx, state, inputs, nSpendHeight))
             return false;
 
         if (pvChecks)
@@ -2099,6 +2213,11 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
     return true;
 }
 
+bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks)
+{
+    return CheckInputs(tx, state, inputs, tx.IsCoinBase() ? 0 : GetSpendHeight(inputs), fScriptChecks, flags, cacheStore, txdata, pvChecks);
+}
+
 namespace {
 
 bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
@@ -2180,9 +2299,10 @@ bool AbortNode(CValidationState& state, const std::string& strMessage, const std
  * @param undo The undo object.
  * @param view The coins view to which to apply the changes.
  * @param out The out point that corresponds to the tx input.
+ * @param pcommitment If given, collects the changes to the UTXO set.
  * @return True on success.
  */
-static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint& out)
+static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint& out, CUTXOCommitment* pcommitment)
 {
     bool fClean = true;
 
@@ -2191,6 +2311,8 @@ static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const CO
         // undo data contains height: this is the last output of the prevout tx being spent
         if (!coins->IsPruned())
             fClean = fClean && error("%s: undo data overwriting existing transaction", __func__);
+        if (pcommitment)
+            pcommitment->RemoveCoins(out.hash, *coins);
         coins->Clear();
         coins->fCoinBase = undo.fCoinBase;
         coins->nHeight = undo.nHeight;
@@ -2203,12 +2325,16 @@ static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const CO
         fClean = fClean && error("%s: undo data overwriting existing output", __func__);
     if (coins->vout.size() < out.n+1)
         coins->vout.resize(out.n+1);
+    if (pcommitment && coins->IsAvailable(out.n))
+        pcommitment->RemoveCoin(out.hash, *coins, out.n);
     coins->vout[out.n] = undo.txout;
+    if (pcommitment && coins->IsAvailable(out.n))
+        pcommitment->AddCoin(out.hash, *coins, out.n);
 
     return fClean;
 }
 
-bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
+bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean, CUTXOCommitment* pcommitmentDelta)
 {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
 
@@ -2248,6 +2374,8 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
             fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
 
         // remove outputs
+        if (pcommitmentDelta)
+            pcommitmentDelta->RemoveCoins(hash, *outs);
         outs->Clear();
         }
 
@@ -2259,7 +2387,7 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint &out = tx.vin[j].prevout;
                 const CTxInUndo &undo = txundo.vprevout[j];
-                if (!ApplyTxInUndo(undo, view, out))
+                if (!ApplyTxInUndo(undo, view, out, pcommitmentDelta))
                     fClean = false;
             }
         }
@@ -2308,6 +2436,84 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+/** Number of headers hashed by one CHeaderPoWCheck, a multiple of every scrypt lane count. */
+static const unsigned int HEADER_POW_CHECK_BATCH = 16;
+
+/**
+ * Closure representing the proof of work check of a run of consecutive
+ * headers. The headers are referenced, not copied, and their PoW hashes are
+ * written to phashes.
+ */
+class CHeaderPoWCheck
+{
+private:
+    const CBlockHeader *pheaders;
+    uint256 *phashes;
+    unsigned int nCount;
+    const Consensus::Params *pconsensusParams;
+
+public:
+    CHeaderPoWCheck(): pheaders(NULL), phashes(NULL), nCount(0), pconsensusParams(NULL) {}
+    CHeaderPoWCheck(const CBlockHeader* pheadersIn, uint256* phashesIn, unsigned int nCountIn, const Consensus::Params& consensusParams) :
+        pheaders(pheadersIn), phashes(phashesIn), nCount(nCountIn), pconsensusParams(&consensusParams) { }
+
+    bool operator()() {
+        const char* input[HEADER_POW_CHECK_BATCH];
+        char* output[HEADER_POW_CHECK_BATCH];
+        assert(nCount <= HEADER_POW_CHECK_BATCH);
+        for (unsigned int i = 0; i < nCount; i++) {
+            input[i] = BEGIN(pheaders[i].nVersion);
+            output[i] = BEGIN(phashes[i]);
+        }
+        scrypt_1024_1_1_256_multi(input, output, nCount);
+        for (unsigned int i = 0; i < nCount; i++) {
+            if (!CheckProofOfWork(phashes[i], pheaders[i].nBits, *pconsensusParams))
+                return false;
+        }
+        return true;
+    }
+
+    void swap(CHeaderPoWCheck &check) {
+        std::swap(pheaders, check.pheaders);
+        std::swap(phashes, check.phashes);
+        std::swap(nCount, check.nCount);
+        std::swap(pconsensusParams, check.pconsensusParams);
+    }
+};
+
+static CCheckQueue<CHeaderPoWCheck> headerpowcheckqueue(4);
+
+void ThreadHeaderPoWCheck() {
+    RenameThread("einsteinium-headerch");
+    headerpowcheckqueue.Thread();
+}
+
+/**
+ * Check the proof of work of headers[nStart..] without holding cs_main,
+ * spread over the header check threads, storing the PoW hashes in the
+ * matching elements of vHashPoW. Returns false if any header fails; the
+ * caller is expected to find and punish the offender through the regular
+ * serial checks. The caller must first check that headers[nStart..] link to
+ * each other and to a known block, which costs no scrypt.
+ */
+static bool CheckHeadersProofOfWork(const std::vector<CBlockHeader>& headers, size_t nStart, std::vector<uint256>& vHashPoW, const Consensus::Params& consensusParams)
+{
+    CCheckQueueControl<CHeaderPoWCheck> control(nScriptCheckThreads ? &headerpowcheckqueue : NULL);
+    std::vector<CHeaderPoWCheck> vChecks;
+    vHashPoW.resize(headers.size());
+    for (size_t i = nStart; i < headers.size(); i += HEADER_POW_CHECK_BATCH) {
+        CHeaderPoWCheck check(&headers[i], &vHashPoW[i], std::min<size_t>(HEADER_POW_CHECK_BATCH, headers.size() - i), consensusParams);
+        if (nScriptCheckThreads) {
+            vChecks.push_back(CHeaderPoWCheck());
+            check.swap(vChecks.back());
+        } else if (!check()) {
+            return false;
+        }
+    }
+    control.Add(vChecks);
+    return control.Wait();
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -2361,8 +2567,46 @@ static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
+/** The script verification flags, and lock time flags, a block connected at pindex is checked with */
+static unsigned int GetBlockScriptFlags(const CBlock& block, const CBlockIndex* pindex, const CChainParams& chainparams, int& nLockTimeFlags)
+{
+    AssertLockHeld(cs_main);
+
+    // BIP16 didn't become active until Oct 1 2012
+    int64_t nBIP16SwitchTime = 1349049600;
+    bool fStrictPayToScriptHash = (pindex->GetBlockTime() >= nBIP16SwitchTime);
+
+    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
+
+    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=3 blocks,
+    // when 75% of the network has upgraded:
+    if (block.nVersion >= 3 && IsSuperMajority(3, pindex->pprev, chainparams.GetConsensus().nMajorityEnforceBlockUpgrade, chainparams.GetConsensus())) {
+        flags |= SCRIPT_VERIFY_DERSIG;
+    }
+
+    // Start enforcing CHECKLOCKTIMEVERIFY, (BIP65) for block.nVersion=4
+    // blocks, when 75% of the network has upgraded:
+    if (block.nVersion >= 4 && IsSuperMajority(4, pindex->pprev, chainparams.GetConsensus().nMajorityEnforceBlockUpgrade, chainparams.GetConsensus())) {
+        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
+    }
+
+    // Start enforcing BIP68 (sequence locks) and BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
+    if (VersionBitsState(pindex->pprev, chainparams.GetConsensus(), Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE) {
+        flags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
+        nLockTimeFlags |= LOCKTIME_VERIFY_SEQUENCE;
+    }
+
+    // Start enforcing WITNESS rules using versionbits logic.
+    if (IsWitnessEnabled(pindex->pprev, chainparams.GetConsensus())) {
+        flags |= SCRIPT_VERIFY_WITNESS;
+        flags |= SCRIPT_VERIFY_NULLDUMMY;
+    }
+
+    return flags;
+}
+
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck)
+                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck, CUTXOCommitment* pcommitmentDelta)
 {
     AssertLockHeld(cs_main);
 
@@ -2432,36 +2676,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
     }
 
-    // BIP16 didn't become active until Oct 1 2012
-    int64_t nBIP16SwitchTime = 1349049600;
-    bool fStrictPayToScriptHash = (pindex->GetBlockTime() >= nBIP16SwitchTime);
-
-    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
-
-    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=3 blocks,
-    // when 75% of the network has upgraded:
-    if (block.nVersion >= 3 && IsSuperMajority(3, pindex->pprev, chainparams.GetConsensus().nMajorityEnforceBlockUpgrade, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_DERSIG;
-    }
-
-    // Start enforcing CHECKLOCKTIMEVERIFY, (BIP65) for block.nVersion=4
-    // blocks, when 75% of the network has upgraded:
-    if (block.nVersion >= 4 && IsSuperMajority(4, pindex->pprev, chainparams.GetConsensus().nMajorityEnforceBlockUpgrade, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
-    }
-
-    // Start enforcing BIP68 (sequence locks) and BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
     int nLockTimeFlags = 0;
-    if (VersionBitsState(pindex->pprev, chainparams.GetConsensus(), Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE) {
-        flags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
-        nLockTimeFlags |= LOCKTIME_VERIFY_SEQUENCE;
-    }
-
-    // Start enforcing WITNESS rules using versionbits logic.
-    if (IsWitnessEnabled(pindex->pprev, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_WITNESS;
-        flags |= SCRIPT_VERIFY_NULLDUMMY;
-    }
+    unsigned int flags = GetBlockScriptFlags(block, pindex, chainparams, nLockTimeFlags);
 
     int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
     LogPrint("bench", "    - Fork checks: %.2fms [%.2fs]\n", 0.001 * (nTime2 - nTime1), nTimeForks * 0.000001);
@@ -2544,7 +2760,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (i > 0) {
             blockundo.vtxundo.push_back(CTxUndo());
         }
-        UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
+        UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight, pcommitmentDelta);
 
         vPos.push_back(std::make_pair(tx.GetHash(), pos));
         pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
@@ -2661,6 +2877,11 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         nLastSetChain = nNow;
     }
     size_t cacheSize = pcoinsTip->DynamicMemoryUsage();
+    if (mode == FLUSH_STATE_PERIODIC && cacheSize * (10.0/9) > nCoinCacheUsage) {
+        // Try to stay clear of a flush by dropping a slice of cold, unmodified coins.
+        pcoinsTip->Evict(nCoinCacheUsage / 100 * COIN_CACHE_EVICT_TARGET, COIN_CACHE_EVICT_STEP);
+        cacheSize = pcoinsTip->DynamicMemoryUsage();
+    }
     // The cache is large and close to the limit, but we have time now (not in the middle of a block processing).
     bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize * (10.0/9) > nCoinCacheUsage;
     // The cache is over the limit, we have to write now.
@@ -2692,7 +2913,9 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
                 vBlocks.push_back(*it);
                 setDirtyBlockIndex.erase(it++);
             }
-            if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
+            std::vector<std::pair<uint256, uint256> > vPoWHashes;
+            vPoWHashes.swap(vDirtyPoWHashes);
+            if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks, vPoWHashes)) {
                 return AbortNode(state, "Files to write to block index database");
             }
         }
@@ -2711,8 +2934,15 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
         // Flush the chainstate (which may refer to block index entries).
-        if (!pcoinsTip->Flush())
+        // Only modified coins are written, and the cache is kept warm
+        // except for the coldest entries when it is over its limit.
+        // The UTXO commitment goes into the same batch as the best block.
+        if (pcoinsdbview)
+            pcoinsdbview->SetCommitment(utxoCommitment, hashUTXOCommitmentBlock);
+        if (!pcoinsTip->Sync())
             return AbortNode(state, "Failed to write to coin database");
+        if (fCacheLarge || fCacheCritical)
+            pcoinsTip->Evict(nCoinCacheUsage / 100 * COIN_CACHE_EVICT_TARGET);
         nLastFlush = nNow;
     }
     if (fDoFullFlush || ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000)) {
@@ -2731,6 +2961,53 @@ void FlushStateToDisk() {
     FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
 }
 
+bool GetUTXOCommitment(CUTXOCommitment& commitment, uint256& hashBlock)
+{
+    LOCK(cs_main);
+    if (hashUTXOCommitmentBlock != pcoinsTip->GetBestBlock())
+        return false;
+    commitment = utxoCommitment;
+    hashBlock = hashUTXOCommitmentBlock;
+    return true;
+}
+
+bool ComputeUTXOCommitment(CCoinsViewCursor* pcursor, CUTXOCommitment& commitment)
+{
+    commitment = CUTXOCommitment();
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        uint256 key;
+        CCoins coins;
+        if (!pcursor->GetKey(key) || !pcursor->GetValue(coins))
+            return error("%s: unable to read value", __func__);
+        commitment.AddCoins(key, coins);
+        pcursor->Next();
+    }
+    return true;
+}
+
+bool LoadUTXOCommitment()
+{
+    LOCK(cs_main);
+    uint256 hashBestBlock = pcoinsTip->GetBestBlock();
+    if (pcoinsdbview->GetCommitment(utxoCommitment, hashUTXOCommitmentBlock) && hashUTXOCommitmentBlock == hashBestBlock)
+        return true;
+
+    // Missing, or left at another block by a version that did not keep it up to date.
+    if (pcoinsdbview->GetBestBlock() != hashBestBlock)
+        FlushStateToDisk();
+    LogPrintf("Computing UTXO set commitment at %s...\n", hashBestBlock.ToString());
+    int64_t nStart = GetTimeMillis();
+    boost::scoped_ptr<CCoinsViewCursor> pcursor(pcoinsdbview->Cursor());
+    CUTXOCommitment commitment;
+    if (!ComputeUTXOCommitment(pcursor.get(), commitment))
+        return false;
+    utxoCommitment = commitment;
+    hashUTXOCommitmentBlock = pcursor->GetBestBlock();
+    LogPrintf("UTXO set commitment computed over %d outputs in %dms\n", commitment.nTxOuts, GetTimeMillis() - nStart);
+    return true;
+}
+
 void PruneAndFlush() {
     CValidationState state;
     fCheckForPruning = true;
@@ -2812,9 +3089,15 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
     int64_t nStart = GetTimeMicros();
     {
         CCoinsViewCache view(pcoinsTip);
-        if (!DisconnectBlock(block, state, pindexDelete, view))
+        bool fCommitment = hashUTXOCommitmentBlock == pcoinsTip->GetBestBlock();
+        CUTXOCommitment commitmentDelta;
+        if (!DisconnectBlock(block, state, pindexDelete, view, NULL, fCommitment ? &commitmentDelta : NULL))
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         assert(view.Flush());
+        if (fCommitment) {
+            utxoCommitment += commitmentDelta;
+            hashUTXOCommitmentBlock = pindexDelete->pprev->GetBlockHash();
+        }
     }
     LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
     // Write the chain state to disk, if necessary.
@@ -2879,7 +3162,10 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
     {
         CCoinsViewCache view(pcoinsTip);
-        bool rv = ConnectBlock(*pblock, state, pindexNew, view, chainparams);
+        // Only keep the UTXO commitment rolling while it matches the tip.
+        bool fCommitment = hashUTXOCommitmentBlock == pcoinsTip->GetBestBlock();
+        CUTXOCommitment commitmentDelta;
+        bool rv = ConnectBlock(*pblock, state, pindexNew, view, chainparams, false, fCommitment ? &commitmentDelta : NULL);
         GetMainSignals().BlockChecked(*pblock, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -2890,6 +3176,10 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
         nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
         LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
         assert(view.Flush());
+        if (fCommitment) {
+            utxoCommitment += commitmentDelta;
+            hashUTXOCommitmentBlock = pindexNew->GetBlockHash();
+        }
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
     LogPrint("bench", "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
@@ -3105,6 +3395,10 @@ bool ActivateBestChain(CValidationState &state, const CChainParams& chainparams,
         int nNewHeight;
         {
             LOCK(cs_main);
+            // The chain state is about to be replaced by a UTXO snapshot.
+            if (!hashSnapshotPending.IsNull())
+                return true;
+
             CBlockIndex *pindexOldTip = chainActive.Tip();
             if (pindexMostWork == NULL) {
                 pindexMostWork = FindMostWorkChain();
@@ -3713,13 +4007,18 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL)
+/**
+ * Accept a header into the block index. phashPoW may point to its already
+ * computed PoW hash, which saves hashing it again here.
+ */
+static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL, const uint256* phashPoW=NULL)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
     uint256 hash = block.GetHash();
     BlockMap::iterator miSelf = mapBlockIndex.find(hash);
     CBlockIndex *pindex = NULL;
+    uint256 hashPoW;
     if (hash != chainparams.GetConsensus().hashGenesisBlock) {
 
         if (miSelf != mapBlockIndex.end()) {
@@ -3732,8 +4031,16 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus()))
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), false))
+            return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
+
+        // Check proof of work here rather than in CheckBlockHeader, so the
+        // hash can be kept for the block index database.
+        hashPoW = phashPoW ? *phashPoW : block.GetPoWHash();
+        if (!CheckProofOfWork(hashPoW, block.nBits, chainparams.GetConsensus())) {
+            state.DoS(50, false, REJECT_INVALID, "high-hash", false, "proof of work failed");
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
+        }
 
         // Get prev block index
         CBlockIndex* pindexPrev = NULL;
@@ -3751,8 +4058,11 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
         if (!ContextualCheckBlockHeader(block, state, chainparams.GetConsensus(), pindexPrev, GetAdjustedTime()))
             return error("%s: Consensus::ContextualCheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
     }
-    if (pindex == NULL)
+    if (pindex == NULL) {
         pindex = AddToBlockIndex(block);
+        if (!hashPoW.IsNull())
+            vDirtyPoWHashes.push_back(std::make_pair(hash, hashPoW));
+    }
 
     if (ppindex)
         *ppindex = pindex;
@@ -3760,8 +4070,11 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
     return true;
 }
 
-/** Store block on disk. If dbp is non-NULL, the file is known to already reside on disk */
-static bool AcceptBlock(const CBlock& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock)
+/**
+ * Store block on disk. If dbp is non-NULL, the file is known to already reside on disk.
+ * If phashPoW is non-NULL it is the block's scrypt hash, computed by the caller.
+ */
+static bool AcceptBlock(const CBlock& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock, const uint256* phashPoW=NULL)
 {
     if (fNewBlock) *fNewBlock = false;
     AssertLockHeld(cs_main);
@@ -3769,7 +4082,7 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
     CBlockIndex *pindexDummy = NULL;
     CBlockIndex *&pindex = ppindex ? *ppindex : pindexDummy;
 
-    if (!AcceptBlockHeader(block, state, chainparams, &pindex))
+    if (!AcceptBlockHeader(block, state, chainparams, &pindex, phashPoW))
         return false;
 
     // Try to process all requested blocks that we don't have, but only
@@ -3840,8 +4153,47 @@ static bool IsSuperMajority(int minVersion, const CBlockIndex* pstart, unsigned
 }
 
 
+/**
+ * Start reading the coins spent by a block from disk, so that they are at
+ * hand by the time ConnectBlock asks for them.
+ */
+static void PrefetchBlockInputs(const CBlock& block)
+{
+    if (pcoinsPrefetch == NULL)
+        return;
+
+    std::set<uint256> setSeen;
+    std::vector<uint256> vTxid;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        if (!tx.IsCoinBase()) {
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                if (setSeen.insert(txin.prevout.hash).second)
+                    vTxid.push_back(txin.prevout.hash);
+            }
+        }
+        // Outputs created within the block are not on disk yet.
+        setSeen.insert(tx.GetHash());
+    }
+
+    {
+        // Leave out what is cached already, if that can be found out without waiting.
+        TRY_LOCK(cs_main, lockMain);
+        if (lockMain && pcoinsTip != NULL) {
+            std::vector<uint256>::iterator itEnd = vTxid.begin();
+            BOOST_FOREACH(const uint256& txid, vTxid) {
+                if (!pcoinsTip->HaveCoinsInCache(txid))
+                    *itEnd++ = txid;
+            }
+            vTxid.erase(itEnd, vTxid.end());
+        }
+    }
+    pcoinsPrefetch->Prefetch(vTxid);
+}
+
 bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, CNode* pfrom, const CBlock* pblock, bool fForceProcessing, const CDiskBlockPos* dbp, bool fMayBanPeerIfInvalid)
 {
+    PrefetchBlockInputs(*pblock);
+
     {
         LOCK(cs_main);
         bool fRequested = MarkBlockAsReceived(pblock->GetHash());
@@ -3894,51 +4246,177 @@ bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams,
     return true;
 }
 
-/**
- * BLOCK PRUNING CODE
- */
-
-/* Calculate the amount of disk space the block & undo files currently use */
-uint64_t CalculateCurrentUsage()
-{
-    uint64_t retval = 0;
-    BOOST_FOREACH(const CBlockFileInfo &file, vinfoBlockFile) {
-        retval += file.nSize + file.nUndoSize;
-    }
-    return retval;
-}
-
-/* Prune a block file (modify associated database entries)*/
-void PruneOneBlockFile(const int fileNumber)
+bool TestBlockTemplateValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev)
 {
-    for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); ++it) {
-        CBlockIndex* pindex = it->second;
-        if (pindex->nFile == fileNumber) {
-            pindex->nStatus &= ~BLOCK_HAVE_DATA;
-            pindex->nStatus &= ~BLOCK_HAVE_UNDO;
-            pindex->nFile = 0;
-            pindex->nDataPos = 0;
-            pindex->nUndoPos = 0;
-            setDirtyBlockIndex.insert(pindex);
+    CCoinsView viewDummy;
+    CCoinsViewCache view(&viewDummy);
+    CBlockIndex indexDummy(block);
+    indexDummy.pprev = pindexPrev;
+    indexDummy.nHeight = pindexPrev->nHeight + 1;
+    unsigned int flags;
+    int nLockTimeFlags = 0;
 
-            // Prune from mapBlocksUnlinked -- any block we prune would have
-            // to be downloaded again in order to consider its chain, at which
-            // point it would be considered as a candidate for
-            // mapBlocksUnlinked or setBlockIndexCandidates.
-            std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex->pprev);
-            while (range.first != range.second) {
-                std::multimap<CBlockIndex *, CBlockIndex *>::iterator it = range.first;
-                range.first++;
-                if (it->second == pindex) {
-                    mapBlocksUnlinked.erase(it);
-                }
+    {
+        LOCK(cs_main);
+        if (pindexPrev != chainActive.Tip())
+            return state.Invalid(false, 0, "inconclusive-not-best-prevblk");
+        if (fCheckpointsEnabled && !CheckIndexAgainstCheckpoint(pindexPrev, state, chainparams, block.GetHash()))
+            return error("%s: CheckIndexAgainstCheckpoint(): %s", __func__, state.GetRejectReason().c_str());
+        if (!ContextualCheckBlockHeader(block, state, chainparams.GetConsensus(), pindexPrev, GetAdjustedTime()))
+            return error("%s: Consensus::ContextualCheckBlockHeader: %s", __func__, FormatStateMessage(state));
+        if (!ContextualCheckBlock(block, state, pindexPrev))
+            return error("%s: Consensus::ContextualCheckBlock: %s", __func__, FormatStateMessage(state));
+        flags = GetBlockScriptFlags(block, &indexDummy, chainparams, nLockTimeFlags);
+
+        // Copy the coins the block spends from the tip, so the rest can be
+        // checked without cs_main
+        view.SetBestBlock(pindexPrev->GetBlockHash());
+        BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+            if (tx.IsCoinBase())
+                continue;
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                if (view.HaveCoinsInCache(txin.prevout.hash))
+                    continue;
+                const CCoins* coins = pcoinsTip->AccessCoins(txin.prevout.hash);
+                if (coins)
+                    *view.ModifyCoins(txin.prevout.hash) = *coins;
             }
         }
     }
 
-    vinfoBlockFile[fileNumber].SetNull();
-    setDirtyFileInfo.insert(fileNumber);
-}
+    if (!CheckBlock(block, state, chainparams.GetConsensus(), false, false))
+        return error("%s: Consensus::CheckBlock: %s", __func__, FormatStateMessage(state));
+
+    // The part of ConnectBlock that does not write anything. BIP30 is left
+    // out: AcceptToMemoryPool refuses txids that still have unspent outputs.
+    // Scripts AcceptToMemoryPool already ran are not run again, the rest are
+    // collected and checked in parallel at the end. The queue is only taken
+    // then, so that ConnectBlock does not wait behind the serial part.
+    int64_t nTimeStart = GetTimeMicros();
+    std::vector<CScriptCheck> vChecks;
+    unsigned int nCached = 0;
+    CAmount nFees = 0;
+    int64_t nSigOpsCost = 0;
+    std::vector<int> prevheights;
+    std::vector<PrecomputedTransactionData> txdata;
+    txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+    {
+        const CTransaction &tx = block.vtx[i];
+
+        if (!tx.IsCoinBase())
+        {
+            if (!view.HaveInputs(tx))
+                return state.DoS(100, error("%s: inputs missing/spent", __func__),
+                                 REJECT_INVALID, "bad-txns-inputs-missingorspent");
+
+            prevheights.resize(tx.vin.size());
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                prevheights[j] = view.AccessCoins(tx.vin[j].prevout.hash)->nHeight;
+            }
+            if (!SequenceLocks(tx, nLockTimeFlags, &prevheights, indexDummy)) {
+                return state.DoS(100, error("%s: contains a non-BIP68-final transaction", __func__),
+                                 REJECT_INVALID, "bad-txns-nonfinal");
+            }
+        }
+
+        nSigOpsCost += GetTransactionSigOpCost(tx, view, flags);
+        if (nSigOpsCost > MAX_BLOCK_SIGOPS_COST)
+            return state.DoS(100, error("%s: too many sigops", __func__),
+                             REJECT_INVALID, "bad-blk-sigops");
+
+        txdata.emplace_back(tx);
+        if (!tx.IsCoinBase())
+        {
+            nFees += view.GetValueIn(tx)-tx.GetValueOut();
+
+            bool fScriptChecks = true;
+            {
+                LOCK(cs_scriptExecutionCache);
+                limitedmap<uint256, std::pair<int64_t, unsigned int> >::const_iterator it = scriptExecutionCache.find(tx.GetWitnessHash());
+                if (it != scriptExecutionCache.end() && (flags & ~it->second.second) == 0) {
+                    fScriptChecks = false;
+                    nCached++;
+                }
+            }
+
+            std::vector<CScriptCheck> vTxChecks;
+            if (!CheckInputs(tx, state, view, indexDummy.nHeight, fScriptChecks, flags, true, txdata[i], nScriptCheckThreads ? &vTxChecks : NULL))
+                return error("%s: CheckInputs on %s failed with %s", __func__,
+                    tx.GetHash().ToString(), FormatStateMessage(state));
+            vChecks.reserve(vChecks.size() + vTxChecks.size());
+            BOOST_FOREACH(CScriptCheck& check, vTxChecks) {
+                vChecks.push_back(CScriptCheck());
+                check.swap(vChecks.back());
+            }
+        }
+
+        UpdateCoins(tx, view, indexDummy.nHeight);
+    }
+
+    CAmount blockReward = nFees + GetBlockSubsidy(indexDummy.nHeight, chainparams.GetConsensus());
+    if (block.vtx[0].GetValueOut() > blockReward)
+        return state.DoS(100,
+                         error("%s: coinbase pays too much (actual=%d vs limit=%d)", __func__,
+                               block.vtx[0].GetValueOut(), blockReward),
+                               REJECT_INVALID, "bad-cb-amount");
+
+    if (!vChecks.empty()) {
+        CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+        control.Add(vChecks);
+        if (!control.Wait())
+            return state.DoS(100, false);
+    }
+    LogPrint("bench", "    - Verify template with %u txs (%u scripts cached): %.2fms\n", (unsigned)block.vtx.size(), nCached, 0.001 * (GetTimeMicros() - nTimeStart));
+
+    return true;
+}
+
+/**
+ * BLOCK PRUNING CODE
+ */
+
+/* Calculate the amount of disk space the block & undo files currently use */
+uint64_t CalculateCurrentUsage()
+{
+    uint64_t retval = 0;
+    BOOST_FOREACH(const CBlockFileInfo &file, vinfoBlockFile) {
+        retval += file.nSize + file.nUndoSize;
+    }
+    return retval;
+}
+
+/* Prune a block file (modify associated database entries)*/
+void PruneOneBlockFile(const int fileNumber)
+{
+    for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); ++it) {
+        CBlockIndex* pindex = it->second;
+        if (pindex->nFile == fileNumber) {
+            pindex->nStatus &= ~BLOCK_HAVE_DATA;
+            pindex->nStatus &= ~BLOCK_HAVE_UNDO;
+            pindex->nFile = 0;
+            pindex->nDataPos = 0;
+            pindex->nUndoPos = 0;
+            setDirtyBlockIndex.insert(pindex);
+
+            // Prune from mapBlocksUnlinked -- any block we prune would have
+            // to be downloaded again in order to consider its chain, at which
+            // point it would be considered as a candidate for
+            // mapBlocksUnlinked or setBlockIndexCandidates.
+            std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex->pprev);
+            while (range.first != range.second) {
+                std::multimap<CBlockIndex *, CBlockIndex *>::iterator it = range.first;
+                range.first++;
+                if (it->second == pindex) {
+                    mapBlocksUnlinked.erase(it);
+                }
+            }
+        }
+    }
+
+    vinfoBlockFile[fileNumber].SetNull();
+    setDirtyFileInfo.insert(fileNumber);
+}
 
 
 void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
@@ -3963,6 +4441,9 @@ void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight
     }
 
     unsigned int nLastBlockWeCanPrune = chainActive.Tip()->nHeight - MIN_BLOCKS_TO_KEEP;
+    // Keep the blocks below a UTXO snapshot until its background check has connected them
+    if (pindexSnapshot != NULL)
+        nLastBlockWeCanPrune = std::min(nLastBlockWeCanPrune, (unsigned int)std::max(nSnapshotCheckHeight, 0));
     uint64_t nCurrentUsage = CalculateCurrentUsage();
     // We don't check to prune until after we've allocated new space for files
     // So we should leave a buffer under our target to account for another allocation
@@ -4069,8 +4550,10 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
 bool static LoadBlockIndexDB()
 {
     const CChainParams& chainparams = Params();
-    if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex))
+    if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex, vPoWHashBackfill))
         return false;
+    if (!vPoWHashBackfill.empty())
+        LogPrintf("%s: %u block index entries have no stored PoW hash yet\n", __func__, vPoWHashBackfill.size());
 
     boost::this_thread::interruption_point();
 
@@ -4274,294 +4757,1375 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         }
     }
 
-    LogPrintf("[DONE].\n");
-    LogPrintf("No coin database inconsistencies in last %i blocks (%i transactions)\n", chainActive.Height() - pindexState->nHeight, nGoodTransactions);
+    LogPrintf("[DONE].\n");
+    LogPrintf("No coin database inconsistencies in last %i blocks (%i transactions)\n", chainActive.Height() - pindexState->nHeight, nGoodTransactions);
+
+    return true;
+}
+
+bool RewindBlockIndex(const CChainParams& params)
+{
+    LOCK(cs_main);
+
+    int nHeight = 1;
+    while (nHeight <= chainActive.Height()) {
+        if (IsWitnessEnabled(chainActive[nHeight - 1], params.GetConsensus()) && !(chainActive[nHeight]->nStatus & BLOCK_OPT_WITNESS)) {
+            break;
+        }
+        nHeight++;
+    }
+
+    // nHeight is now the height of the first insufficiently-validated block, or tipheight + 1
+    CValidationState state;
+    CBlockIndex* pindex = chainActive.Tip();
+    while (chainActive.Height() >= nHeight) {
+        if (fPruneMode && !(chainActive.Tip()->nStatus & BLOCK_HAVE_DATA)) {
+            // If pruning, don't try rewinding past the HAVE_DATA point;
+            // since older blocks can't be served anyway, there's
+            // no need to walk further, and trying to DisconnectTip()
+            // will fail (and require a needless reindex/redownload
+            // of the blockchain).
+            break;
+        }
+        if (!DisconnectTip(state, params, true)) {
+            return error("RewindBlockIndex: unable to disconnect block at height %i", pindex->nHeight);
+        }
+        // Occasionally flush state to disk.
+        if (!FlushStateToDisk(state, FLUSH_STATE_PERIODIC))
+            return false;
+    }
+
+    // Reduce validity flag and have-data flags.
+    // We do this after actual disconnecting, otherwise we'll end up writing the lack of data
+    // to disk before writing the chainstate, resulting in a failure to continue if interrupted.
+    for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); it++) {
+        CBlockIndex* pindexIter = it->second;
+
+        // Note: If we encounter an insufficiently validated block that
+        // is on chainActive, it must be because we are a pruning node, and
+        // this block or some successor doesn't HAVE_DATA, so we were unable to
+        // rewind all the way.  Blocks remaining on chainActive at this point
+        // must not have their validity reduced.
+        if (IsWitnessEnabled(pindexIter->pprev, params.GetConsensus()) && !(pindexIter->nStatus & BLOCK_OPT_WITNESS) && !chainActive.Contains(pindexIter)) {
+            // Reduce validity
+            pindexIter->nStatus = std::min<unsigned int>(pindexIter->nStatus & BLOCK_VALID_MASK, BLOCK_VALID_TREE) | (pindexIter->nStatus & ~BLOCK_VALID_MASK);
+            // Remove have-data flags.
+            pindexIter->nStatus &= ~(BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO);
+            // Remove storage location.
+            pindexIter->nFile = 0;
+            pindexIter->nDataPos = 0;
+            pindexIter->nUndoPos = 0;
+            // Remove various other things
+            pindexIter->nTx = 0;
+            pindexIter->nChainTx = 0;
+            pindexIter->nSequenceId = 0;
+            // Make sure it gets written.
+            setDirtyBlockIndex.insert(pindexIter);
+            // Update indexes
+            setBlockIndexCandidates.erase(pindexIter);
+            std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> ret = mapBlocksUnlinked.equal_range(pindexIter->pprev);
+            while (ret.first != ret.second) {
+                if (ret.first->second == pindexIter) {
+                    mapBlocksUnlinked.erase(ret.first++);
+                } else {
+                    ++ret.first;
+                }
+            }
+        } else if (pindexIter->IsValid(BLOCK_VALID_TRANSACTIONS) && pindexIter->nChainTx) {
+            setBlockIndexCandidates.insert(pindexIter);
+        }
+    }
+
+    PruneBlockIndexCandidates();
+
+    CheckBlockIndex(params.GetConsensus());
+
+    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS)) {
+        return false;
+    }
+
+    return true;
+}
+
+void UnloadBlockIndex()
+{
+    LOCK(cs_main);
+    utxoCommitment = CUTXOCommitment();
+    hashUTXOCommitmentBlock.SetNull();
+    hashSnapshotPending.SetNull();
+    pathSnapshotPending.clear();
+    hashSnapshotExpected.SetNull();
+    snapshotInfo = CTxOutSetSnapshot();
+    pindexSnapshot = NULL;
+    nSnapshotCheckHeight = -1;
+    setBlockIndexCandidates.clear();
+    chainActive.SetTip(NULL);
+    pindexBestInvalid = NULL;
+    pindexBestHeader = NULL;
+    mempool.clear();
+    mapOrphanTransactions.clear();
+    mapOrphanTransactionsByPrev.clear();
+    nSyncStarted = 0;
+    mapBlocksUnlinked.clear();
+    vinfoBlockFile.clear();
+    nLastBlockFile = 0;
+    nBlockSequenceId = 1;
+    mapBlockSource.clear();
+    mapBlocksInFlight.clear();
+    nPreferredDownload = 0;
+    setDirtyBlockIndex.clear();
+    vDirtyPoWHashes.clear();
+    vPoWHashBackfill.clear();
+    setDirtyFileInfo.clear();
+    mapNodeState.clear();
+    recentRejects.reset(NULL);
+    versionbitscache.Clear();
+    for (int b = 0; b < VERSIONBITS_NUM_BITS; b++) {
+        warningcache[b].clear();
+    }
+
+    BOOST_FOREACH(BlockMap::value_type& entry, mapBlockIndex) {
+        delete entry.second;
+    }
+    mapBlockIndex.clear();
+    fHavePruned = false;
+}
+
+bool LoadBlockIndex()
+{
+    // Load block index from databases
+    if (!fReindex && !LoadBlockIndexDB())
+        return false;
+    return true;
+}
+
+bool InitBlockIndex(const CChainParams& chainparams) 
+{
+    LOCK(cs_main);
+
+    // Initialize global variables that cannot be constructed at startup.
+    recentRejects.reset(new CRollingBloomFilter(120000, 0.000001));
+
+    // Check whether we're already initialized
+    if (chainActive.Genesis() != NULL)
+        return true;
+
+    // Use the provided setting for -txindex in the new database
+    fTxIndex = GetBoolArg("-txindex", DEFAULT_TXINDEX);
+    pblocktree->WriteFlag("txindex", fTxIndex);
+    LogPrintf("Initializing databases...\n");
+
+    // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
+    if (!fReindex) {
+        try {
+            CBlock &block = const_cast<CBlock&>(chainparams.GenesisBlock());
+            // Start new block file
+            unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+            CDiskBlockPos blockPos;
+            CValidationState state;
+            if (!FindBlockPos(state, blockPos, nBlockSize+8, 0, block.GetBlockTime()))
+                return error("LoadBlockIndex(): FindBlockPos failed");
+            if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
+                return error("LoadBlockIndex(): writing genesis block to disk failed");
+            CBlockIndex *pindex = AddToBlockIndex(block);
+            if (!ReceivedBlockTransactions(block, state, pindex, blockPos))
+                return error("LoadBlockIndex(): genesis block not accepted");
+            // Force a chainstate write so that when we VerifyDB in a moment, it doesn't check stale data
+            return FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
+        } catch (const std::runtime_error& e) {
+            return error("LoadBlockIndex(): failed to initialize block database: %s", e.what());
+        }
+    }
+
+    return true;
+}
+
+/** Scrypt the headers of the given block index entries, skipping the ones no longer in mapBlockIndex. */
+static void HashBlockIndexHeaders(const std::vector<uint256>& vHash, std::vector<uint256>& vHashFound, std::vector<CBlockHeader>& vHeader, std::vector<uint256>& vHashPoW)
+{
+    vHashFound.clear();
+    vHeader.clear();
+    {
+        LOCK(cs_main);
+        BOOST_FOREACH(const uint256& hash, vHash) {
+            BlockMap::iterator mi = mapBlockIndex.find(hash);
+            if (mi == mapBlockIndex.end())
+                continue;
+            vHashFound.push_back(hash);
+            vHeader.push_back(mi->second->GetBlockHeader());
+        }
+    }
+    std::vector<const char*> input(vHeader.size());
+    std::vector<char*> output(vHeader.size());
+    vHashPoW.resize(vHeader.size());
+    for (size_t i = 0; i < vHeader.size(); i++) {
+        input[i] = BEGIN(vHeader[i].nVersion);
+        output[i] = BEGIN(vHashPoW[i]);
+    }
+    if (!vHeader.empty())
+        scrypt_1024_1_1_256_multi(&input[0], &output[0], vHeader.size());
+}
+
+static void PoWHashWarning(const std::string& strMessage)
+{
+    LogPrintf("ERROR: %s\n", strMessage);
+    strMiscWarning = _("Warning: The block index database failed a proof of work check. You may need to rebuild it using -reindex.");
+    uiInterface.NotifyAlertChanged();
+}
+
+void ThreadCheckPoWHashes(unsigned int nSampleSize)
+{
+    RenameThread("einsteinium-powhash");
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+
+    // Let a reindex finish first; it rewrites every entry anyway.
+    while (fReindex || fImporting)
+        MilliSleep(1000);
+
+    std::vector<uint256> vBackfill;
+    {
+        LOCK(cs_main);
+        vBackfill.swap(vPoWHashBackfill);
+    }
+
+    // Back-fill the entries written before PoW hashes were stored. The
+    // version record is only written once every entry has been visited.
+    std::vector<uint256> vHash, vHashFound, vHashPoW;
+    std::vector<CBlockHeader> vHeader;
+    std::vector<std::pair<uint256, uint256> > vWrite;
+    size_t nBad = 0, nWritten = 0;
+    int64_t nStart = GetTimeMillis();
+    for (size_t i = 0; i < vBackfill.size(); i += POW_HASH_BACKFILL_BATCH) {
+        boost::this_thread::interruption_point();
+        vHash.assign(vBackfill.begin() + i, vBackfill.begin() + std::min(vBackfill.size(), i + POW_HASH_BACKFILL_BATCH));
+        HashBlockIndexHeaders(vHash, vHashFound, vHeader, vHashPoW);
+        vWrite.clear();
+        for (size_t j = 0; j < vHeader.size(); j++) {
+            if (!CheckProofOfWork(vHashPoW[j], vHeader[j].nBits, consensusParams)) {
+                PoWHashWarning(strprintf("%s: block %s fails its proof of work", __func__, vHashFound[j].ToString()));
+                nBad++;
+                continue;
+            }
+            vWrite.push_back(std::make_pair(vHashFound[j], vHashPoW[j]));
+        }
+        if (!pblocktree->WritePoWHashes(vWrite)) {
+            LogPrintf("%s: failed to write PoW hashes\n", __func__);
+            return;
+        }
+        nWritten += vWrite.size();
+    }
+    if (!vBackfill.empty())
+        LogPrintf("%s: back-filled %u PoW hashes (%u bad), %dms\n", __func__, nWritten, nBad, GetTimeMillis() - nStart);
+    if (nBad == 0)
+        pblocktree->WritePoWHashVersion(POW_HASH_INDEX_VERSION);
+
+    // The startup check only compares the stored hashes against the targets,
+    // so make sure a random sample of them really is the scrypt hash of the
+    // header it is stored for.
+    vHash.clear();
+    {
+        LOCK(cs_main);
+        int nHeight = chainActive.Height();
+        for (unsigned int i = 0; nHeight > 0 && i < nSampleSize; i++)
+            vHash.push_back(chainActive[1 + GetRand(nHeight)]->GetBlockHash());
+    }
+    size_t nChecked = 0;
+    nBad = 0;
+    for (size_t i = 0; i < vHash.size(); i += POW_HASH_BACKFILL_BATCH) {
+        boost::this_thread::interruption_point();
+        std::vector<uint256> vBatch(vHash.begin() + i, vHash.begin() + std::min(vHash.size(), i + POW_HASH_BACKFILL_BATCH));
+        HashBlockIndexHeaders(vBatch, vHashFound, vHeader, vHashPoW);
+        for (size_t j = 0; j < vHeader.size(); j++) {
+            uint256 hashStored;
+            if (!pblocktree->ReadPoWHash(vHashFound[j], hashStored))
+                continue;
+            nChecked++;
+            if (hashStored != vHashPoW[j]) {
+                PoWHashWarning(strprintf("%s: stored PoW hash of block %s is %s, expected %s", __func__,
+                    vHashFound[j].ToString(), hashStored.ToString(), vHashPoW[j].ToString()));
+                nBad++;
+            }
+        }
+    }
+    LogPrintf("%s: spot-checked %u stored PoW hashes, %u mismatched\n", __func__, nChecked, nBad);
+}
+
+bool InitLoadTxOutSet(const boost::filesystem::path& path, const uint256& hashExpected, std::string& strError)
+{
+    LOCK(cs_main);
+    CTxOutSetSnapshot snapshot;
+    if ((pcoinsdbview->ReadSnapshot(snapshot) && snapshot.fLoaded) || chainActive.Height() > 0) {
+        LogPrintf("Not loading UTXO snapshot %s, the chain state is past the genesis block already\n", path.string());
+        return true;
+    }
+
+    CAutoFile file(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        strError = strprintf(_("Unable to open UTXO snapshot %s"), path.string());
+        return false;
+    }
+    CTxOutSetHeader header;
+    try {
+        file >> header;
+    } catch (const std::exception&) {
+        header.nVersion = 0;
+    }
+    if (!header.IsValid()) {
+        strError = strprintf(_("%s is not a UTXO snapshot"), path.string());
+        return false;
+    }
+
+    pathSnapshotPending = path;
+    hashSnapshotPending = header.hashBlock;
+    hashSnapshotExpected = hashExpected;
+    LogPrintf("Waiting for the header of block %s to load UTXO snapshot %s; not downloading blocks meanwhile\n", header.hashBlock.ToString(), path.string());
+    return true;
+}
+
+bool LoadTxOutSetSnapshot(bool fReload)
+{
+    LOCK(cs_main);
+    if (!pcoinsdbview->ReadSnapshot(snapshotInfo))
+        return true;
+    if (!snapshotInfo.fLoaded) {
+        if (!fReload || chainActive.Height() > 0)
+            return error("%s: loading the UTXO snapshot of block %s did not finish", __func__, snapshotInfo.hashBlock.ToString());
+        // InitLoadTxOutSet() sets the load up again, which drops the coins
+        // written so far.
+        snapshotInfo = CTxOutSetSnapshot();
+        return true;
+    }
+    if (snapshotInfo.fValidated)
+        return true;
+
+    BlockMap::iterator mi = mapBlockIndex.find(snapshotInfo.hashBlock);
+    if (mi != mapBlockIndex.end() && chainActive.Contains(mi->second)) {
+        pindexSnapshot = mi->second;
+        LogPrintf("%s: chain state loaded from the UTXO snapshot of block %s, not checked yet\n", __func__, snapshotInfo.hashBlock.ToString());
+        return true;
+    }
+    if (chainActive.Height() > 0)
+        return error("%s: block %s of the UTXO snapshot is not in the active chain", __func__, snapshotInfo.hashBlock.ToString());
+
+    // All coins were written, but the node stopped before switching to them.
+    hashSnapshotPending = snapshotInfo.hashBlock;
+    pathSnapshotPending.clear();
+    return true;
+}
+
+bool GetTxOutSetSnapshot(CTxOutSetSnapshot& snapshot, int& nCheckHeight, bool& fPending)
+{
+    LOCK(cs_main);
+    fPending = !hashSnapshotPending.IsNull();
+    if (fPending) {
+        snapshot = CTxOutSetSnapshot();
+        snapshot.hashBlock = hashSnapshotPending;
+        nCheckHeight = -1;
+        return true;
+    }
+    if (snapshotInfo.hashBlock.IsNull())
+        return false;
+    snapshot = snapshotInfo;
+    nCheckHeight = nSnapshotCheckHeight;
+    return true;
+}
+
+/**
+ * Write the coins of the UTXO snapshot file path, which is for block pindex,
+ * to the coin database. cs_main is only taken around the writes, as the chain
+ * cannot move while a snapshot is pending.
+ */
+static bool LoadTxOutSet(CBlockIndex* pindex, const boost::filesystem::path& path, const uint256& hashExpected, CTxOutSetSnapshot& snapshot)
+{
+    snapshot = CTxOutSetSnapshot();
+    snapshot.hashBlock = pindex->GetBlockHash();
+
+    CAutoFile file(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        return error("%s: unable to open %s", __func__, path.string());
+
+    LogPrintf("Loading UTXO snapshot %s...\n", path.string());
+    uiInterface.ShowProgress(_("Loading UTXO snapshot..."), 0);
+    int64_t nStart = GetTimeMillis();
+    uint64_t nTransactions = 0;
+    try {
+        CTxOutSetHeader header;
+        file >> header;
+        if (!header.IsValid() || header.hashBlock != snapshot.hashBlock)
+            return error("%s: %s is not a UTXO snapshot of block %s", __func__, path.string(), snapshot.hashBlock.ToString());
+
+        // Nothing cached or staged for the empty chain state may survive the
+        // load, nor coins written by an earlier load that did not finish.
+        {
+            LOCK(cs_main);
+            if (!pcoinsTip->Flush() || !pcoinsdbview->EraseCoins() || !pcoinsdbview->WriteSnapshot(snapshot))
+                return error("%s: failed to write to coin database", __func__);
+        }
+
+        // The records come in txid order, so every batch is a sorted run of
+        // keys past the ones written before.
+        CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+        std::vector<std::pair<uint256, CCoins> > vCoins;
+        size_t nBatchSize = 0;
+        uint256 txidPrev;
+        int nReportDone = 0;
+        for (nTransactions = 0; nTransactions < header.nTransactions; nTransactions++) {
+            boost::this_thread::interruption_point();
+            vCoins.push_back(std::make_pair(uint256(), CCoins()));
+            uint256& txid = vCoins.back().first;
+            CCoins& coins = vCoins.back().second;
+            file >> txid >> coins;
+            ss << txid << coins;
+            if ((nTransactions > 0 && !(txidPrev < txid)) || coins.IsPruned())
+                return error("%s: unexpected record for %s", __func__, txid.ToString());
+            txidPrev = txid;
+            snapshot.commitment.AddCoins(txid, coins);
+            nBatchSize += ::GetSerializeSize(coins, SER_DISK, CLIENT_VERSION);
+            if (nBatchSize >= TXOUTSET_LOAD_BATCH_SIZE) {
+                {
+                    LOCK(cs_main);
+                    if (!pcoinsdbview->WriteFreshCoins(vCoins))
+                        return error("%s: failed to write to coin database", __func__);
+                }
+                vCoins.clear();
+                nBatchSize = 0;
+                int nDone = (int)*txidPrev.begin() * 100 / 256;
+                if (nDone >= nReportDone + 10) {
+                    LogPrintf("[%d%%]...", nDone);
+                    uiInterface.ShowProgress(_("Loading UTXO snapshot..."), nDone);
+                    nReportDone = nDone;
+                }
+            }
+        }
+        {
+            LOCK(cs_main);
+            if (!pcoinsdbview->WriteFreshCoins(vCoins))
+                return error("%s: failed to write to coin database", __func__);
+        }
+
+        uint256 hashRecords;
+        file >> hashRecords;
+        if (hashRecords != ss.GetHash())
+            return error("%s: %s is corrupt", __func__, path.string());
+    } catch (const std::exception& e) {
+        return error("%s: unable to read %s: %s", __func__, path.string(), e.what());
+    }
+    uiInterface.ShowProgress("", 100);
+
+    if (!hashExpected.IsNull() && snapshot.commitment.GetHash() != hashExpected)
+        return error("%s: the UTXO snapshot has commitment %s, expected %s", __func__, snapshot.commitment.GetHash().ToString(), hashExpected.ToString());
+    snapshot.fLoaded = true;
+    {
+        LOCK(cs_main);
+        if (!pcoinsdbview->WriteSnapshot(snapshot))
+            return error("%s: failed to write to coin database", __func__);
+    }
+    LogPrintf("[DONE]. Loaded %u transactions with %d outputs in %dms\n", nTransactions, snapshot.commitment.nTxOuts, GetTimeMillis() - nStart);
+    return true;
+}
+
+/**
+ * Make the block of a loaded UTXO snapshot the tip. Its ancestors are taken
+ * as valid and pruned, the way a pruned node sees blocks it has deleted, until
+ * the background check has connected them.
+ */
+static bool ActivateTxOutSet(CBlockIndex* pindex, const CTxOutSetSnapshot& snapshot, const CChainParams& chainparams)
+{
+    AssertLockHeld(cs_main);
+    const Consensus::Params& consensusParams = chainparams.GetConsensus();
+
+    // The transaction counts of blocks never seen are unknown; one each keeps
+    // them linked until the real count arrives with the block.
+    std::vector<CBlockIndex*> vChain;
+    for (CBlockIndex* pindexWalk = pindex; pindexWalk->pprev != NULL; pindexWalk = pindexWalk->pprev)
+        vChain.push_back(pindexWalk);
+    BOOST_REVERSE_FOREACH(CBlockIndex* pindexWalk, vChain) {
+        if (pindexWalk->nTx == 0)
+            pindexWalk->nTx = 1;
+        pindexWalk->nChainTx = pindexWalk->pprev->nChainTx + pindexWalk->nTx;
+        pindexWalk->RaiseValidity(BLOCK_VALID_SCRIPTS);
+        if (IsWitnessEnabled(pindexWalk->pprev, consensusParams))
+            pindexWalk->nStatus |= BLOCK_OPT_WITNESS;
+        setDirtyBlockIndex.insert(pindexWalk);
+    }
+    setBlockIndexCandidates.insert(pindex);
+    if (!fHavePruned) {
+        pblocktree->WriteFlag("prunedblockfiles", true);
+        fHavePruned = true;
+    }
+
+    mempool.clear();
+    pcoinsTip->SetBestBlock(pindex->GetBlockHash());
+    utxoCommitment = snapshot.commitment;
+    hashUTXOCommitmentBlock = pindex->GetBlockHash();
+    UpdateTip(pindex, chainparams);
+    PruneBlockIndexCandidates();
+
+    snapshotInfo = snapshot;
+    pindexSnapshot = pindex;
+    nSnapshotCheckHeight = -1;
+    hashSnapshotPending.SetNull();
+    pathSnapshotPending.clear();
+
+    CValidationState state;
+    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
+        return false;
+    CheckBlockIndex(consensusParams);
+    return true;
+}
+
+/**
+ * Connect the blocks up to the UTXO snapshot to a chain state of their own,
+ * kept in chainstate_snapshotcheck/ so that a restart continues where it
+ * left, and compare the resulting commitment with the snapshot's.
+ */
+static void CheckTxOutSetSnapshot(const CChainParams& chainparams)
+{
+    const boost::filesystem::path pathCheck = GetDataDir() / "chainstate_snapshotcheck";
+    CTxOutSetSnapshot snapshot;
+    {
+        LOCK(cs_main);
+        if (pindexSnapshot != NULL)
+            snapshot = snapshotInfo;
+    }
+    if (snapshot.hashBlock.IsNull()) {
+        // Left behind by a -reindex-chainstate, say.
+        boost::system::error_code ec;
+        boost::filesystem::remove_all(pathCheck, ec);
+        return;
+    }
+
+    CUTXOCommitment commitment;
+    int64_t nStart = GetTimeMillis();
+    {
+        CCoinsViewDB viewDB(nMaxCoinsDBCache << 20, false, false, CDBOptions(), pathCheck.filename().string());
+        CCoinsViewCache view(&viewDB);
+        uint256 hashCommitment;
+        if (!viewDB.GetCommitment(commitment, hashCommitment) || hashCommitment != view.GetBestBlock()) {
+            boost::scoped_ptr<CCoinsViewCursor> pcursor(viewDB.Cursor());
+            if (!ComputeUTXOCommitment(pcursor.get(), commitment)) {
+                AbortNode("Failed to read the UTXO snapshot check database");
+                return;
+            }
+        }
+        {
+            LOCK(cs_main);
+            if (!view.GetBestBlock().IsNull()) {
+                BlockMap::iterator mi = mapBlockIndex.find(view.GetBestBlock());
+                if (mi == mapBlockIndex.end() || pindexSnapshot->GetAncestor(mi->second->nHeight) != mi->second) {
+                    AbortNode("The UTXO snapshot check database is not on the chain of the snapshot");
+                    return;
+                }
+                nSnapshotCheckHeight = mi->second->nHeight;
+            }
+            LogPrintf("Checking the UTXO snapshot of block %s in the background, from height %d\n", snapshot.hashBlock.ToString(), nSnapshotCheckHeight + 1);
+        }
+
+        int64_t nLastWrite = GetTimeMicros();
+        while (true) {
+            boost::this_thread::interruption_point();
+            bool fConnected = false, fDone = false;
+            {
+                LOCK(cs_main);
+                CBlockIndex* pindex = pindexSnapshot->GetAncestor(nSnapshotCheckHeight + 1);
+                if (pindex->nStatus & BLOCK_HAVE_DATA) {
+                    CBlock block;
+                    if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus())) {
+                        AbortNode(strprintf("Failed to read block %s", pindex->GetBlockHash().ToString()));
+                        return;
+                    }
+                    CCoinsViewCache viewBlock(&view);
+                    CUTXOCommitment delta;
+                    CValidationState state;
+                    if (!ConnectBlock(block, state, pindex, viewBlock, chainparams, false, &delta)) {
+                        AbortNode(strprintf("Block %s below the UTXO snapshot is invalid: %s", pindex->GetBlockHash().ToString(), FormatStateMessage(state)),
+                            _("The UTXO snapshot is on an invalid chain. You will need to rebuild the database using -reindex."));
+                        return;
+                    }
+                    viewBlock.Flush();
+                    commitment += delta;
+                    nSnapshotCheckHeight = pindex->nHeight;
+                    fConnected = true;
+                    fDone = pindex == pindexSnapshot;
+                }
+            }
+            if (fDone)
+                break;
+            if (!fConnected) {
+                // Wait for the download to catch up.
+                MilliSleep(200);
+                continue;
+            }
+            if (view.DynamicMemoryUsage() > SNAPSHOT_CHECK_CACHE || GetTimeMicros() > nLastWrite + (int64_t)DATABASE_WRITE_INTERVAL * 1000000) {
+                viewDB.SetCommitment(commitment, view.GetBestBlock());
+                if (!view.Flush()) {
+                    AbortNode("Failed to write to the UTXO snapshot check database");
+                    return;
+                }
+                nLastWrite = GetTimeMicros();
+            }
+        }
+    }
+
+    if (commitment.GetHash() != snapshot.commitment.GetHash() || commitment.nTxOuts != snapshot.commitment.nTxOuts || commitment.nTotalAmount != snapshot.commitment.nTotalAmount) {
+        AbortNode(strprintf("The blocks up to %s lead to UTXO set commitment %s, but the snapshot has %s", snapshot.hashBlock.ToString(),
+            commitment.GetHash().ToString(), snapshot.commitment.GetHash().ToString()),
+            _("The UTXO snapshot does not match the block chain. You will need to rebuild the database using -reindex."));
+        return;
+    }
+    {
+        LOCK(cs_main);
+        snapshotInfo.fValidated = true;
+        if (!pcoinsdbview->WriteSnapshot(snapshotInfo)) {
+            AbortNode("Failed to write to coin database");
+            return;
+        }
+        pindexSnapshot = NULL;
+        fCheckForPruning = true;
+    }
+    LogPrintf("UTXO snapshot of block %s confirmed by connecting the blocks up to it, %dms\n", snapshot.hashBlock.ToString(), GetTimeMillis() - nStart);
+    boost::system::error_code ec;
+    boost::filesystem::remove_all(pathCheck, ec);
+}
+
+void ThreadTxOutSetSnapshot()
+{
+    RenameThread("einsteinium-snapshot");
+    const CChainParams& chainparams = Params();
+
+    // A snapshot waiting to be loaded needs the header of its block first.
+    CBlockIndex* pindexLoaded = NULL;
+    while (pindexLoaded == NULL) {
+        CBlockIndex* pindex = NULL;
+        boost::filesystem::path path;
+        uint256 hashExpected;
+        {
+            LOCK(cs_main);
+            if (hashSnapshotPending.IsNull())
+                break;
+            BlockMap::iterator mi = mapBlockIndex.find(hashSnapshotPending);
+            if (mi != mapBlockIndex.end()) {
+                pindex = mi->second;
+                if (chainActive.Height() > 0 || (pindex->nStatus & BLOCK_FAILED_MASK)) {
+                    AbortNode(strprintf("Cannot switch to the UTXO snapshot of block %s", pindex->GetBlockHash().ToString()));
+                    return;
+                }
+                path = pathSnapshotPending;
+                hashExpected = hashSnapshotExpected;
+            }
+        }
+        if (pindex == NULL) {
+            MilliSleep(1000);
+            continue;
+        }
+
+        CTxOutSetSnapshot snapshot;
+        bool fLoaded;
+        if (path.empty()) {
+            LOCK(cs_main);
+            fLoaded = pcoinsdbview->ReadSnapshot(snapshot) && snapshot.fLoaded;
+        } else {
+            fLoaded = LoadTxOutSet(pindex, path, hashExpected, snapshot);
+        }
+        if (!fLoaded) {
+            // The snapshot record stays marked as not loaded, so the next
+            // start with -loadtxoutset erases these coins and loads again.
+            AbortNode(strprintf("Failed to load the UTXO snapshot of block %s", pindex->GetBlockHash().ToString()),
+                _("Error loading the UTXO snapshot, see debug.log for details. Start again with -loadtxoutset to load it again."));
+            return;
+        }
+        LOCK(cs_main);
+        if (!ActivateTxOutSet(pindex, snapshot, chainparams))
+            return;
+        pindexLoaded = pindex;
+    }
+    if (pindexLoaded != NULL) {
+        bool fInitialDownload = IsInitialBlockDownload();
+        uiInterface.NotifyBlockTip(fInitialDownload, pindexLoaded);
+        if (!fInitialDownload)
+            GetMainSignals().UpdatedBlockTip(pindexLoaded);
+        CValidationState state;
+        ActivateBestChain(state, chainparams);
+    }
+
+    CheckTxOutSetSnapshot(chainparams);
+}
+
+void CompactChainStateSlice()
+{
+    static int nSlice = 0;
+    if (fImporting || fReindex || IsInitialBlockDownload())
+        return;
+
+    CCoinsViewDB* pcoinsview;
+    {
+        LOCK(cs_main);
+        if (!hashSnapshotPending.IsNull())
+            return;
+        pcoinsview = pcoinsdbview;
+    }
+    // Leave LevelDB to its own compactions while it has any to do.
+    std::vector<CDBLevelStats> vLevels;
+    if (!pcoinsview->GetDB().GetLevelStats(vLevels) || EstimatePendingCompactionBytes(vLevels) > 0)
+        return;
+
+    int64_t nTimeStart = GetTimeMicros();
+    pcoinsview->CompactSlice(nSlice, COMPACT_SLICES);
+    LogPrint("leveldb", "Compacted chain state slice %d/%d in %.2fms\n", nSlice + 1, COMPACT_SLICES, (GetTimeMicros() - nTimeStart) * 0.001);
+    nSlice = (nSlice + 1) % COMPACT_SLICES;
+}
+
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+
+/**
+ * Verify the scripts of a run of transactions about to be offered to the
+ * mempool on the script check threads, so that AcceptToMemoryPool finds their
+ * signatures in the cache rather than checking them one by one. Failures are
+ * left for AcceptToMemoryPool to report. cs_main is only held to copy the
+ * coins they spend.
+ */
+static void CacheMempoolSignatures(const std::vector<CTransaction>& vtx)
+{
+    if (nScriptCheckThreads == 0)
+        return;
+
+    // Copy the coins the batch spends, so the scripts can be checked without
+    // holding up block processing.
+    CCoinsView viewDummy;
+    CCoinsViewCache view(&viewDummy);
+    {
+        LOCK2(cs_main, mempool.cs);
+        CCoinsViewMemPool viewMemPool(pcoinsTip, mempool);
+        view.SetBestBlock(pcoinsTip->GetBestBlock());
+        BOOST_FOREACH(const CTransaction& tx, vtx) {
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                CCoins coins;
+                if (!view.HaveCoinsInCache(txin.prevout.hash) && viewMemPool.GetCoins(txin.prevout.hash, coins))
+                    view.ModifyCoins(txin.prevout.hash)->swap(coins);
+            }
+        }
+    }
+
+    std::vector<PrecomputedTransactionData> txdata;
+    txdata.reserve(vtx.size());
+    std::vector<CScriptCheck> vChecks;
+    BOOST_FOREACH(const CTransaction& tx, vtx) {
+        txdata.push_back(PrecomputedTransactionData(tx));
+        if (!tx.IsCoinBase() && view.HaveInputs(tx)) {
+            CValidationState state;
+            std::vector<CScriptCheck> vTxChecks;
+            if (CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true, txdata.back(), &vTxChecks)) {
+                vChecks.reserve(vChecks.size() + vTxChecks.size());
+                BOOST_FOREACH(CScriptCheck& check, vTxChecks) {
+                    vChecks.push_back(CScriptCheck());
+                    check.swap(vChecks.back());
+                }
+            }
+        }
+        // Later transactions of the run may spend this one.
+        view.ModifyCoins(tx.GetHash())->FromTx(tx, MEMPOOL_HEIGHT);
+    }
+
+    CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+    control.Add(vChecks);
+    control.Wait();
+}
+
+bool LoadMempool()
+{
+    int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    FILE* filestr = fopen((GetDataDir() / "mempool.dat").string().c_str(), "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    int64_t nStart = GetTimeMicros();
+    int64_t nAccepted = 0, nFailed = 0, nExpired = 0;
+    int64_t nNow = GetTime();
+    try {
+        uint64_t nVersion;
+        file >> nVersion;
+        if (nVersion != MEMPOOL_DUMP_VERSION)
+            return error("%s: unknown mempool file version %d", __func__, nVersion);
+        uint64_t nEntries;
+        file >> nEntries;
+
+        std::vector<CTransaction> vtx;
+        std::vector<int64_t> vTime;
+        while (nEntries > 0 || !vtx.empty()) {
+            if (nEntries > 0) {
+                CTransaction tx;
+                int64_t nTime, nFeeDelta;
+                file >> tx;
+                file >> nTime;
+                file >> nFeeDelta;
+                nEntries--;
+
+                if (nFeeDelta != 0)
+                    mempool.PrioritiseTransaction(tx.GetHash(), tx.GetHash().ToString(), 0, nFeeDelta);
+                if (nTime + nExpiryTimeout > nNow) {
+                    vtx.push_back(tx);
+                    vTime.push_back(nTime);
+                } else {
+                    nExpired++;
+                }
+                if (nEntries > 0 && vtx.size() < MEMPOOL_LOAD_BATCH_SIZE)
+                    continue;
+            }
+
+            // Only hold cs_main while the transactions go in.
+            CacheMempoolSignatures(vtx);
+            LOCK(cs_main);
+            for (size_t i = 0; i < vtx.size(); i++) {
+                CValidationState state;
+                if (AcceptToMemoryPoolWithTime(mempool, state, vtx[i], true, NULL, vTime[i]))
+                    nAccepted++;
+                else
+                    nFailed++;
+            }
+            vtx.clear();
+            vTime.clear();
+            if (ShutdownRequested())
+                return false;
+        }
+
+        // Prioritisations of transactions that were not in the mempool.
+        std::map<uint256, CAmount> mapDeltas;
+        file >> mapDeltas;
+        for (std::map<uint256, CAmount>::const_iterator it = mapDeltas.begin(); it != mapDeltas.end(); ++it)
+            mempool.PrioritiseTransaction(it->first, it->first.ToString(), 0, it->second);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+
+    LogPrintf("Imported mempool transactions from disk: %i succeeded, %i failed, %i expired (%.2fs)\n",
+        nAccepted, nFailed, nExpired, (GetTimeMicros() - nStart) * 0.000001);
+    return true;
+}
+
+bool DumpMempool()
+{
+    int64_t nStart = GetTimeMicros();
+
+    std::map<uint256, CAmount> mapDeltas;
+    std::vector<TxMempoolInfo> vInfo;
+    {
+        LOCK(mempool.cs);
+        for (std::map<uint256, std::pair<double, CAmount> >::const_iterator it = mempool.mapDeltas.begin(); it != mempool.mapDeltas.end(); ++it) {
+            if (it->second.second != 0)
+                mapDeltas[it->first] = it->second.second;
+        }
+        vInfo = mempool.infoAll();
+    }
+
+    int64_t nMid = GetTimeMicros();
+    try {
+        boost::filesystem::path pathTmp = GetDataDir() / "mempool.dat.new";
+        FILE* filestr = fopen(pathTmp.string().c_str(), "wb");
+        if (!filestr)
+            return error("%s: failed to open %s", __func__, pathTmp.string());
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+        file << MEMPOOL_DUMP_VERSION;
+        file << (uint64_t)vInfo.size();
+        BOOST_FOREACH(const TxMempoolInfo& info, vInfo) {
+            // infoAll() lists parents before their children, which is the order they have to be loaded in.
+            int64_t nFeeDelta = 0;
+            std::map<uint256, CAmount>::iterator it = mapDeltas.find(info.tx->GetHash());
+            if (it != mapDeltas.end()) {
+                nFeeDelta = it->second;
+                mapDeltas.erase(it);
+            }
+            file << *info.tx;
+            file << (int64_t)info.nTime;
+            file << nFeeDelta;
+        }
+        file << mapDeltas;
+        FileCommit(file.Get());
+        file.fclose();
+        if (!RenameOver(pathTmp, GetDataDir() / "mempool.dat"))
+            return error("%s: failed to rename %s", __func__, pathTmp.string());
+    } catch (const std::exception& e) {
+        return error("%s: failed to write the mempool: %s", __func__, e.what());
+    }
+    LogPrintf("Dumped %u mempool transactions: %.3fs to copy, %.3fs to write\n",
+        vInfo.size(), (nMid - nStart) * 0.000001, (GetTimeMicros() - nMid) * 0.000001);
+    return true;
+}
+
+namespace {
+
+/**
+ * Bytes of scanned block data that files after the one currently being
+ * imported may hold in memory before their scanners wait.
+ */
+const uint64_t MAX_IMPORT_BUFFER_SIZE = 128 * 1024 * 1024;
+/** Number of blocks that may be deserialized and checked ahead of the import. */
+const unsigned int MAX_IMPORT_CHECK_AHEAD = 1024;
+/** Number of block files scanned for block boundaries at the same time. */
+const int IMPORT_SCAN_THREADS = 2;
+
+/** A block found in a block file, on its way through the import pipeline. */
+struct CImportBlock
+{
+    CDiskBlockPos pos;          //!< position of the block data; null for external files
+    unsigned int nSize;         //!< serialized size, counted against MAX_IMPORT_BUFFER_SIZE
+    std::vector<char> vchData;  //!< serialized block, released once deserialized
+    CBlock block;
+    uint256 hash;
+    uint256 hashPoW;
+    std::string strError;       //!< deserialization error, if any
+    bool fDecoded;              //!< block deserialized
+    bool fChecked;              //!< block passed the context-free checks
+    bool fDone;                 //!< checking finished
+
+    CImportBlock() : nSize(0), fDecoded(false), fChecked(false), fDone(false) {}
+};
+
+/** A block file being imported and the blocks scanned from it so far. */
+struct CImportFile
+{
+    FILE* file;                     //!< external file, or NULL to open blk?????.dat number nFile
+    int nFile;                      //!< block file number when reindexing, -1 otherwise
+    bool fScanned;                  //!< no more blocks will be added
+    std::deque<CImportBlock> blocks;
+    size_t nClaimed;                //!< blocks at the front of blocks that are (being) checked
+
+    CImportFile(FILE* fileIn, int nFileIn) : file(fileIn), nFile(nFileIn), fScanned(false), nClaimed(0) {}
+};
+
+/** A block found before its parent during a reindex. */
+struct COutOfOrderBlock
+{
+    CDiskBlockPos pos;
+    uint256 hash;
+    uint256 hashPoW;                //!< null if the block did not pass the context-free checks
+};
+
+// Disk positions of blocks with unknown parent (only used for reindex)
+std::multimap<uint256, COutOfOrderBlock> mapBlocksUnknownParent;
+
+/**
+ * Run the context-free block checks using an already computed scrypt hash,
+ * and mark the block as checked so that AcceptBlock does not hash it again.
+ */
+bool CheckBlockWithPoWHash(const CBlock& block, const uint256& hashPoW, CValidationState& state, const Consensus::Params& consensusParams)
+{
+    if (!CheckProofOfWork(hashPoW, block.nBits, consensusParams))
+        return state.DoS(50, false, REJECT_INVALID, "high-hash", false, "proof of work failed");
+    if (!CheckBlock(block, state, consensusParams, false, true))
+        return false;
+    block.fChecked = true;
+    return true;
+}
+
+/**
+ * Imports block files in three stages:
+ *  - scanner threads locate the blocks in several files at once,
+ *  - worker threads deserialize them and run the context-free checks,
+ *    including the scrypt proof of work,
+ *  - the calling thread accepts the blocks strictly in file order.
+ * Memory use is bounded by MAX_IMPORT_BUFFER_SIZE and MAX_IMPORT_CHECK_AHEAD.
+ */
+class CBlockFileImporter
+{
+private:
+    const CChainParams& chainparams;
+
+    boost::mutex mutex;
+    boost::condition_variable condScan;     //!< scanners wait for buffer space
+    boost::condition_variable condCheck;    //!< workers wait for blocks to check
+    boost::condition_variable condImport;   //!< the importer waits for checked blocks
 
-    return true;
-}
+    std::deque<CImportFile> files;          //!< the front is being imported
+    size_t nNextScan;                       //!< index into files of the next one to scan
+    uint64_t nBuffered;                     //!< bytes scanned but not imported
+    unsigned int nAhead;                    //!< blocks claimed but not imported
+    bool fStop;
 
-bool RewindBlockIndex(const CChainParams& params)
+    boost::thread_group threads;
+
+    void ThreadScan();
+    void ThreadCheck();
+    void ScanFile(CImportFile& file);
+    CImportBlock* Claim();
+    void Check(CImportBlock& entry);
+    bool Import(CImportBlock& entry, int& nLoaded);
+
+public:
+    CBlockFileImporter(const CChainParams& chainparamsIn) : chainparams(chainparamsIn), nNextScan(0), nBuffered(0), nAhead(0), fStop(false) {}
+    ~CBlockFileImporter();
+
+    /** Queue a file for import. Takes over file and closes it. */
+    void AddFile(FILE* file, int nFile) { files.push_back(CImportFile(file, nFile)); }
+    /** Import all queued files, checking blocks on nWorkers extra threads. Returns the number of blocks loaded. */
+    int Run(int nWorkers);
+};
+
+CBlockFileImporter::~CBlockFileImporter()
 {
-    LOCK(cs_main);
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fStop = true;
+    }
+    condScan.notify_all();
+    condCheck.notify_all();
+    threads.join_all();
 
-    int nHeight = 1;
-    while (nHeight <= chainActive.Height()) {
-        if (IsWitnessEnabled(chainActive[nHeight - 1], params.GetConsensus()) && !(chainActive[nHeight]->nStatus & BLOCK_OPT_WITNESS)) {
-            break;
-        }
-        nHeight++;
+    // Close external files that never reached a scanner.
+    for (size_t i = nNextScan; i < files.size(); i++) {
+        if (files[i].file)
+            fclose(files[i].file);
     }
+}
 
-    // nHeight is now the height of the first insufficiently-validated block, or tipheight + 1
-    CValidationState state;
-    CBlockIndex* pindex = chainActive.Tip();
-    while (chainActive.Height() >= nHeight) {
-        if (fPruneMode && !(chainActive.Tip()->nStatus & BLOCK_HAVE_DATA)) {
-            // If pruning, don't try rewinding past the HAVE_DATA point;
-            // since older blocks can't be served anyway, there's
-            // no need to walk further, and trying to DisconnectTip()
-            // will fail (and require a needless reindex/redownload
-            // of the blockchain).
-            break;
+void CBlockFileImporter::ThreadScan()
+{
+    RenameThread("einsteinium-scanblk");
+    while (true) {
+        CImportFile* pfile;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (fStop || nNextScan == files.size())
+                return;
+            pfile = &files[nNextScan++];
         }
-        if (!DisconnectTip(state, params, true)) {
-            return error("RewindBlockIndex: unable to disconnect block at height %i", pindex->nHeight);
+        try {
+            ScanFile(*pfile);
+        } catch (const std::runtime_error& e) {
+            AbortNode(std::string("System error: ") + e.what());
         }
-        // Occasionally flush state to disk.
-        if (!FlushStateToDisk(state, FLUSH_STATE_PERIODIC))
-            return false;
-    }
-
-    // Reduce validity flag and have-data flags.
-    // We do this after actual disconnecting, otherwise we'll end up writing the lack of data
-    // to disk before writing the chainstate, resulting in a failure to continue if interrupted.
-    for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); it++) {
-        CBlockIndex* pindexIter = it->second;
-
-        // Note: If we encounter an insufficiently validated block that
-        // is on chainActive, it must be because we are a pruning node, and
-        // this block or some successor doesn't HAVE_DATA, so we were unable to
-        // rewind all the way.  Blocks remaining on chainActive at this point
-        // must not have their validity reduced.
-        if (IsWitnessEnabled(pindexIter->pprev, params.GetConsensus()) && !(pindexIter->nStatus & BLOCK_OPT_WITNESS) && !chainActive.Contains(pindexIter)) {
-            // Reduce validity
-            pindexIter->nStatus = std::min<unsigned int>(pindexIter->nStatus & BLOCK_VALID_MASK, BLOCK_VALID_TREE) | (pindexIter->nStatus & ~BLOCK_VALID_MASK);
-            // Remove have-data flags.
-            pindexIter->nStatus &= ~(BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO);
-            // Remove storage location.
-            pindexIter->nFile = 0;
-            pindexIter->nDataPos = 0;
-            pindexIter->nUndoPos = 0;
-            // Remove various other things
-            pindexIter->nTx = 0;
-            pindexIter->nChainTx = 0;
-            pindexIter->nSequenceId = 0;
-            // Make sure it gets written.
-            setDirtyBlockIndex.insert(pindexIter);
-            // Update indexes
-            setBlockIndexCandidates.erase(pindexIter);
-            std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> ret = mapBlocksUnlinked.equal_range(pindexIter->pprev);
-            while (ret.first != ret.second) {
-                if (ret.first->second == pindexIter) {
-                    mapBlocksUnlinked.erase(ret.first++);
-                } else {
-                    ++ret.first;
-                }
-            }
-        } else if (pindexIter->IsValid(BLOCK_VALID_TRANSACTIONS) && pindexIter->nChainTx) {
-            setBlockIndexCandidates.insert(pindexIter);
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            pfile->fScanned = true;
         }
+        condImport.notify_one();
     }
+}
 
-    PruneBlockIndexCandidates();
+void CBlockFileImporter::ScanFile(CImportFile& importfile)
+{
+    FILE* fileIn = importfile.file;
+    importfile.file = NULL;
+    if (!fileIn) {
+        fileIn = OpenBlockFile(CDiskBlockPos(importfile.nFile, 0), true);
+        if (!fileIn)
+            return; // This error is logged in OpenBlockFile
+    }
+
+    // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
+    CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
+    uint64_t nRewind = blkdat.GetPos();
+    while (!blkdat.eof()) {
+        blkdat.SetPos(nRewind);
+        nRewind++; // start one byte further next time, in case of failure
+        blkdat.SetLimit(); // remove former limit
+        unsigned int nSize = 0;
+        try {
+            // locate a header
+            unsigned char buf[MESSAGE_START_SIZE];
+            blkdat.FindByte(chainparams.MessageStart()[0]);
+            nRewind = blkdat.GetPos()+1;
+            blkdat >> FLATDATA(buf);
+            if (memcmp(buf, chainparams.MessageStart(), MESSAGE_START_SIZE))
+                continue;
+            // read size
+            blkdat >> nSize;
+            if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
+                continue;
+        } catch (const std::exception&) {
+            // no valid block header found; don't complain
+            break;
+        }
 
-    CheckBlockIndex(params.GetConsensus());
+        // read block; deserializing it is left to the workers
+        uint64_t nBlockPos = blkdat.GetPos();
+        std::vector<char> vchData(nSize);
+        try {
+            blkdat.SetLimit(nBlockPos + nSize);
+            blkdat.read(&vchData[0], nSize);
+            nRewind = blkdat.GetPos();
+        } catch (const std::exception& e) {
+            LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+            continue;
+        }
 
-    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS)) {
-        return false;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            // The file being imported must never wait, or the import could stall.
+            while (!fStop && nBuffered >= MAX_IMPORT_BUFFER_SIZE && &importfile != &files.front())
+                condScan.wait(lock);
+            if (fStop)
+                return;
+            importfile.blocks.push_back(CImportBlock());
+            CImportBlock& entry = importfile.blocks.back();
+            if (importfile.nFile >= 0)
+                entry.pos = CDiskBlockPos(importfile.nFile, nBlockPos);
+            entry.nSize = nSize;
+            entry.vchData.swap(vchData);
+            nBuffered += nSize;
+        }
+        condCheck.notify_one();
+        condImport.notify_one();
     }
-
-    return true;
 }
 
-void UnloadBlockIndex()
+CImportBlock* CBlockFileImporter::Claim()
 {
-    LOCK(cs_main);
-    setBlockIndexCandidates.clear();
-    chainActive.SetTip(NULL);
-    pindexBestInvalid = NULL;
-    pindexBestHeader = NULL;
-    mempool.clear();
-    mapOrphanTransactions.clear();
-    mapOrphanTransactionsByPrev.clear();
-    nSyncStarted = 0;
-    mapBlocksUnlinked.clear();
-    vinfoBlockFile.clear();
-    nLastBlockFile = 0;
-    nBlockSequenceId = 1;
-    mapBlockSource.clear();
-    mapBlocksInFlight.clear();
-    nPreferredDownload = 0;
-    setDirtyBlockIndex.clear();
-    setDirtyFileInfo.clear();
-    mapNodeState.clear();
-    recentRejects.reset(NULL);
-    versionbitscache.Clear();
-    for (int b = 0; b < VERSIONBITS_NUM_BITS; b++) {
-        warningcache[b].clear();
+    if (nAhead >= MAX_IMPORT_CHECK_AHEAD)
+        return NULL;
+    for (size_t i = 0; i < nNextScan && i < files.size(); i++) {
+        CImportFile& importfile = files[i];
+        if (importfile.nClaimed < importfile.blocks.size()) {
+            nAhead++;
+            return &importfile.blocks[importfile.nClaimed++];
+        }
     }
+    return NULL;
+}
 
-    BOOST_FOREACH(BlockMap::value_type& entry, mapBlockIndex) {
-        delete entry.second;
+void CBlockFileImporter::ThreadCheck()
+{
+    RenameThread("einsteinium-chkblk");
+    while (true) {
+        CImportBlock* pentry;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!fStop && (pentry = Claim()) == NULL)
+                condCheck.wait(lock);
+            if (fStop)
+                return;
+        }
+        Check(*pentry);
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            pentry->fDone = true;
+        }
+        condImport.notify_one();
     }
-    mapBlockIndex.clear();
-    fHavePruned = false;
 }
 
-bool LoadBlockIndex()
+void CBlockFileImporter::Check(CImportBlock& entry)
 {
-    // Load block index from databases
-    if (!fReindex && !LoadBlockIndexDB())
-        return false;
-    return true;
+    try {
+        CDataStream ssBlock(entry.vchData, SER_DISK, CLIENT_VERSION);
+        ssBlock >> entry.block;
+        entry.fDecoded = true;
+    } catch (const std::exception& e) {
+        entry.strError = e.what();
+    }
+    std::vector<char>().swap(entry.vchData);
+    if (!entry.fDecoded)
+        return;
+
+    entry.hash = entry.block.GetHash();
+    {
+        // Import skips blocks we already have, so don't hash them either.
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(entry.hash);
+        if (mi != mapBlockIndex.end() && (mi->second->nStatus & BLOCK_HAVE_DATA))
+            return;
+    }
+    entry.hashPoW = entry.block.GetPoWHash();
+    // Invalid blocks go through AcceptBlock unchecked, so that they are
+    // rejected and marked exactly like before.
+    CValidationState state;
+    entry.fChecked = CheckBlockWithPoWHash(entry.block, entry.hashPoW, state, chainparams.GetConsensus());
 }
 
-bool InitBlockIndex(const CChainParams& chainparams) 
+bool CBlockFileImporter::Import(CImportBlock& entry, int& nLoaded)
 {
-    LOCK(cs_main);
+    if (!entry.fDecoded) {
+        LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, entry.strError);
+        return true;
+    }
 
-    // Initialize global variables that cannot be constructed at startup.
-    recentRejects.reset(new CRollingBloomFilter(120000, 0.000001));
+    CBlock& block = entry.block;
+    const uint256& hash = entry.hash;
+    const CDiskBlockPos* dbp = entry.pos.IsNull() ? NULL : &entry.pos;
+    const uint256* phashPoW = entry.fChecked ? &entry.hashPoW : NULL;
 
-    // Check whether we're already initialized
-    if (chainActive.Genesis() != NULL)
+    // detect out of order blocks, and store them for later
+    if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+        LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                block.hashPrevBlock.ToString());
+        if (dbp) {
+            COutOfOrderBlock child;
+            child.pos = *dbp;
+            child.hash = hash;
+            if (phashPoW)
+                child.hashPoW = *phashPoW;
+            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, child));
+        }
         return true;
+    }
 
-    // Use the provided setting for -txindex in the new database
-    fTxIndex = GetBoolArg("-txindex", DEFAULT_TXINDEX);
-    pblocktree->WriteFlag("txindex", fTxIndex);
-    LogPrintf("Initializing databases...\n");
+    // process in case the block isn't known yet
+    if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+        LOCK(cs_main);
+        CValidationState state;
+        if (AcceptBlock(block, state, chainparams, NULL, true, dbp, NULL, phashPoW))
+            nLoaded++;
+        if (state.IsError())
+            return false;
+    } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+        LogPrint("reindex", "Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+    }
 
-    // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
-    if (!fReindex) {
-        try {
-            CBlock &block = const_cast<CBlock&>(chainparams.GenesisBlock());
-            // Start new block file
-            unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
-            CDiskBlockPos blockPos;
-            CValidationState state;
-            if (!FindBlockPos(state, blockPos, nBlockSize+8, 0, block.GetBlockTime()))
-                return error("LoadBlockIndex(): FindBlockPos failed");
-            if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
-                return error("LoadBlockIndex(): writing genesis block to disk failed");
-            CBlockIndex *pindex = AddToBlockIndex(block);
-            if (!ReceivedBlockTransactions(block, state, pindex, blockPos))
-                return error("LoadBlockIndex(): genesis block not accepted");
-            // Force a chainstate write so that when we VerifyDB in a moment, it doesn't check stale data
-            return FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
-        } catch (const std::runtime_error& e) {
-            return error("LoadBlockIndex(): failed to initialize block database: %s", e.what());
+    // Activate the genesis block so normal node progress can continue
+    if (hash == chainparams.GetConsensus().hashGenesisBlock) {
+        CValidationState state;
+        if (!ActivateBestChain(state, chainparams)) {
+            return false;
         }
     }
 
+    NotifyHeaderTip();
+
+    // Recursively process earlier encountered successors of this block
+    deque<uint256> queue;
+    queue.push_back(hash);
+    while (!queue.empty()) {
+        uint256 head = queue.front();
+        queue.pop_front();
+        std::pair<std::multimap<uint256, COutOfOrderBlock>::iterator, std::multimap<uint256, COutOfOrderBlock>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+        while (range.first != range.second) {
+            std::multimap<uint256, COutOfOrderBlock>::iterator it = range.first;
+            const COutOfOrderBlock& child = it->second;
+            CBlock blockChild;
+            // The scrypt hash of checked children is known already; matching
+            // the block hash is enough to know the same header was read.
+            bool fRead = child.hashPoW.IsNull() ?
+                ReadBlockFromDisk(blockChild, child.pos, chainparams.GetConsensus()) :
+                ReadBlockFromDisk(blockChild, child.pos, chainparams.GetConsensus(), false) && blockChild.GetHash() == child.hash;
+            if (fRead)
+            {
+                LogPrint("reindex", "%s: Processing out of order child %s of %s\n", __func__, blockChild.GetHash().ToString(),
+                        head.ToString());
+                CValidationState dummy;
+                const uint256* phashPoWChild = NULL;
+                if (!child.hashPoW.IsNull() && CheckBlockWithPoWHash(blockChild, child.hashPoW, dummy, chainparams.GetConsensus()))
+                    phashPoWChild = &child.hashPoW;
+                LOCK(cs_main);
+                if (AcceptBlock(blockChild, dummy, chainparams, NULL, true, &child.pos, NULL, phashPoWChild))
+                {
+                    nLoaded++;
+                    queue.push_back(blockChild.GetHash());
+                }
+            }
+            range.first++;
+            mapBlocksUnknownParent.erase(it);
+            NotifyHeaderTip();
+        }
+    }
     return true;
 }
 
-bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
+int CBlockFileImporter::Run(int nWorkers)
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
-    int64_t nStart = GetTimeMillis();
+    for (int i = 0; i < IMPORT_SCAN_THREADS; i++)
+        threads.create_thread(boost::bind(&CBlockFileImporter::ThreadScan, this));
+    for (int i = 0; i < nWorkers; i++)
+        threads.create_thread(boost::bind(&CBlockFileImporter::ThreadCheck, this));
 
     int nLoaded = 0;
-    try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
-            boost::this_thread::interruption_point();
-
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[MESSAGE_START_SIZE];
-                blkdat.FindByte(chainparams.MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, chainparams.MessageStart(), MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
-            }
-            try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
-
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                            block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                    continue;
-                }
+    const CImportFile* pfileCurrent = NULL;
+    bool fSkipFile = false;
+    while (true) {
+        boost::this_thread::interruption_point();
 
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    LOCK(cs_main);
-                    CValidationState state;
-                    if (AcceptBlock(block, state, chainparams, NULL, true, dbp, NULL))
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrint("reindex", "Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+        CImportBlock* pentry = NULL;
+        bool fCheck = false;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!files.empty()) {
+                CImportFile& importfile = files.front();
+                if (&importfile != pfileCurrent) {
+                    pfileCurrent = &importfile;
+                    fSkipFile = false;
+                    if (importfile.nFile >= 0)
+                        LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)importfile.nFile);
                 }
-
-                // Activate the genesis block so normal node progress can continue
-                if (hash == chainparams.GetConsensus().hashGenesisBlock) {
-                    CValidationState state;
-                    if (!ActivateBestChain(state, chainparams)) {
+                if (!importfile.blocks.empty()) {
+                    pentry = &importfile.blocks.front();
+                    if (importfile.nClaimed == 0) {
+                        // No worker got to it yet; check it here.
+                        importfile.nClaimed++;
+                        nAhead++;
+                        fCheck = true;
                         break;
                     }
+                    if (pentry->fDone)
+                        break;
+                    pentry = NULL;
+                } else if (importfile.fScanned) {
+                    files.pop_front();
+                    nNextScan--;
+                    pfileCurrent = NULL;
+                    condScan.notify_all();
+                    continue;
                 }
+                condImport.wait(lock);
+            }
+        }
+        if (!pentry)
+            break;
 
-                NotifyHeaderTip();
-
-                // Recursively process earlier encountered successors of this block
-                deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        if (ReadBlockFromDisk(block, it->second, chainparams.GetConsensus()))
-                        {
-                            LogPrint("reindex", "%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
-                                    head.ToString());
-                            LOCK(cs_main);
-                            CValidationState dummy;
-                            if (AcceptBlock(block, dummy, chainparams, NULL, true, &it->second, NULL))
-                            {
-                                nLoaded++;
-                                queue.push_back(block.GetHash());
-                            }
-                        }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                        NotifyHeaderTip();
-                    }
-                }
-            } catch (const std::exception& e) {
-                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+        if (fCheck)
+            Check(*pentry);
+        if (!fSkipFile) {
+            try {
+                if (!Import(*pentry, nLoaded))
+                    fSkipFile = true;
+            } catch (const std::runtime_error& e) {
+                AbortNode(std::string("System error: ") + e.what());
+                return nLoaded;
             }
         }
-    } catch (const std::runtime_error& e) {
-        AbortNode(std::string("System error: ") + e.what());
+
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            CImportFile& importfile = files.front();
+            nBuffered -= pentry->nSize;
+            nAhead--;
+            importfile.nClaimed--;
+            importfile.blocks.pop_front();
+        }
+        condScan.notify_all();
+        condCheck.notify_all();
     }
+    return nLoaded;
+}
+
+} // anon namespace
+
+bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
+{
+    int64_t nStart = GetTimeMillis();
+
+    CBlockFileImporter importer(chainparams);
+    importer.AddFile(fileIn, dbp ? dbp->nFile : -1);
+    int nLoaded = importer.Run(nScriptCheckThreads);
     if (nLoaded > 0)
         LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
     return nLoaded > 0;
 }
 
+bool ReindexBlockFiles(const CChainParams& chainparams)
+{
+    int64_t nStart = GetTimeMillis();
+
+    CBlockFileImporter importer(chainparams);
+    for (int nFile = 0; boost::filesystem::exists(GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk")); nFile++)
+        importer.AddFile(NULL, nFile);
+    int nLoaded = importer.Run(nScriptCheckThreads);
+    LogPrintf("Loaded %i blocks from block files in %dms\n", nLoaded, GetTimeMillis() - nStart);
+    return nLoaded > 0;
+}
+
 void static CheckBlockIndex(const Consensus::Params& consensusParams)
 {
     if (!fCheckBlockIndex) {
@@ -5989,6 +7553,31 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // Scrypt dominates header processing, so verify the proof of work
+        // of every header we don't know yet in parallel before taking
+        // cs_main for the serial contextual checks. Headers form a chain, so
+        // the known ones are a prefix. Only headers that connect to a block
+        // we know and link to each other are hashed, so that a peer cannot
+        // make us hash headers the serial checks would reject unhashed.
+        bool fPoWChecked = false;
+        std::vector<uint256> vHashPoW;
+        if (nCount > 0) {
+            size_t nFirstUnknown = 0;
+            bool fConnects = false;
+            {
+                LOCK(cs_main);
+                while (nFirstUnknown < headers.size() && mapBlockIndex.count(headers[nFirstUnknown].GetHash()))
+                    nFirstUnknown++;
+                if (nFirstUnknown < headers.size() && mapBlockIndex.count(headers[nFirstUnknown].hashPrevBlock)) {
+                    fConnects = true;
+                    for (size_t i = nFirstUnknown + 1; fConnects && i < headers.size(); i++)
+                        fConnects = headers[i].hashPrevBlock == headers[i - 1].GetHash();
+                }
+            }
+            if (fConnects && headers.size() - nFirstUnknown > 1)
+                fPoWChecked = CheckHeadersProofOfWork(headers, nFirstUnknown, vHashPoW, chainparams.GetConsensus());
+        }
+
         {
         LOCK(cs_main);
 
@@ -6027,13 +7616,15 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
 
         CBlockIndex *pindexLast = NULL;
-        BOOST_FOREACH(const CBlockHeader& header, headers) {
+        for (size_t i = 0; i < headers.size(); i++) {
+            const CBlockHeader& header = headers[i];
             CValidationState state;
             if (pindexLast != NULL && header.hashPrevBlock != pindexLast->GetBlockHash()) {
                 Misbehaving(pfrom->GetId(), 20);
                 return error("non-continuous headers sequence");
             }
-            if (!AcceptBlockHeader(header, state, chainparams, &pindexLast)) {
+            const uint256* phashPoW = (fPoWChecked && !vHashPoW[i].IsNull()) ? &vHashPoW[i] : NULL;
+            if (!AcceptBlockHeader(header, state, chainparams, &pindexLast, phashPoW)) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
@@ -6938,10 +8529,13 @@ bool SendMessages(CNode* pto)
         // Message: getdata (blocks)
         //
         vector<CInv> vGetData;
-        if (!pto->fDisconnect && !pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        // Nothing is downloaded while a UTXO snapshot waits to be loaded, it would only be
+        // connected on top of the genesis block.
+        if (!pto->fDisconnect && !pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER && hashSnapshotPending.IsNull()) {
             vector<CBlockIndex*> vToDownload;
             NodeId staller = -1;
             FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller, consensusParams);
+            FindSnapshotBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, consensusParams);
             BOOST_FOREACH(CBlockIndex *pindex, vToDownload) {
                 uint32_t nFetchFlags = GetFetchFlags(pto, pindex->pprev, consensusParams);
                 vGetData.push_back(CInv(MSG_BLOCK | nFetchFlags, pindex->GetBlockHash()));
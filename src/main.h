@@ -33,9 +33,12 @@ class CBlockIndex;
 class CBlockTreeDB;
 class CBloomFilter;
 class CChainParams;
+class CCoinsViewDB;
+class CCoinsViewPrefetch;
 class CInv;
 class CScriptCheck;
 class CTxMemPool;
+class CTxOutSetSnapshot;
 class CValidationInterface;
 class CValidationState;
 
@@ -69,8 +72,18 @@ static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 101;
 static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
 /** Default for -limitdescendantsize, maximum kilobytes of in-mempool descendants */
 static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
+/** Default for -limitclustercount, max number of transactions in a connected group of in-mempool transactions */
+static const unsigned int DEFAULT_CLUSTER_LIMIT = 250;
 /** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
 static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Default for -persistmempool */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Default for -persistmempoolinterval, minutes between mempool dumps besides the one at shutdown (0 = none) */
+static const int64_t DEFAULT_PERSIST_MEMPOOL_INTERVAL = 0;
+/** Transactions of mempool.dat whose signatures are checked together before they are accepted */
+static const size_t MEMPOOL_LOAD_BATCH_SIZE = 500;
+/** Transactions whose script checks at mempool acceptance are remembered for block template validation */
+static const size_t SCRIPT_EXECUTION_CACHE_SIZE = 100000;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
@@ -103,6 +116,10 @@ static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 /** Time to wait (in seconds) between flushing chainstate to disk. */
 static const unsigned int DATABASE_FLUSH_INTERVAL = 24 * 60 * 60;
+/** Percentage of the coin cache limit that eviction of unmodified coins aims for. */
+static const unsigned int COIN_CACHE_EVICT_TARGET = 75;
+/** Maximum number of coin cache entries inspected by a periodic eviction step. */
+static const unsigned int COIN_CACHE_EVICT_STEP = 50000;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 /** Average delay between local address broadcasts in seconds. */
@@ -197,8 +214,23 @@ extern uint64_t nPruneTarget;
 /** Block files containing a block-height within MIN_BLOCKS_TO_KEEP of chainActive.Tip() will not be pruned. */
 static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
 
+/** Block rewards run in epochs of this many blocks; epochs 2 to 147 each contain one wormhole */
+static const int WORMHOLE_EPOCH_BLOCKS = 36000;
+static const int WORMHOLE_FIRST_EPOCH = 2;
+static const int WORMHOLE_LAST_EPOCH = 147;
+/** Length in blocks of a wormhole, during which the subsidy is raised */
+static const int WORMHOLE_BLOCKS = 180;
+
 static const signed int DEFAULT_CHECKBLOCKS = 6 * 4;
 static const unsigned int DEFAULT_CHECKLEVEL = 3;
+/** Number of stored block PoW hashes to re-verify with scrypt at startup */
+static const unsigned int DEFAULT_CHECKPOWHASHES = 1000;
+/** Number of block index entries hashed at a time when back-filling or checking PoW hashes */
+static const size_t POW_HASH_BACKFILL_BATCH = 256;
+/** Bytes of coins from a UTXO snapshot written to the coin database per batch */
+static const size_t TXOUTSET_LOAD_BATCH_SIZE = 16 << 20;
+/** Memory the background check of a UTXO snapshot may use for caching coins (bytes) */
+static const size_t SNAPSHOT_CHECK_CACHE = 64 << 20;
 
 // Require that user allocate at least 550MB for block & undo files (blk???.dat and rev???.dat)
 // At 1MB per block, 288 blocks = 288MB.
@@ -238,6 +270,8 @@ FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp = NULL);
+/** Rebuild the block index from all blk?????.dat files, scanning several at once */
+bool ReindexBlockFiles(const CChainParams& chainparams);
 /** Initialize a new block tree database + block data on disk */
 bool InitBlockIndex(const CChainParams& chainparams);
 /** Load the block tree and coins database from disk */
@@ -254,6 +288,25 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the header proof of work checking thread */
+void ThreadHeaderPoWCheck();
+/** Back-fill missing PoW hashes in the block index database and re-verify nSampleSize stored ones */
+void ThreadCheckPoWHashes(unsigned int nSampleSize);
+/** Load a pending UTXO snapshot once the header of its block is known, then connect the blocks below it to confirm it */
+void ThreadTxOutSetSnapshot();
+/**
+ * Compact the next of COMPACT_SLICES parts of the chain state database,
+ * unless the node is syncing or LevelDB has compaction work of its own.
+ * Scheduled every -compactinterval minutes.
+ */
+void CompactChainStateSlice();
+/**
+ * Add the transactions saved in mempool.dat to the mempool, keeping their
+ * time and fee deltas, and checking their signatures in batches.
+ */
+bool LoadMempool();
+/** Save the mempool to mempool.dat */
+bool DumpMempool();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Format a string that describes several potential problems detected by the core.
@@ -300,6 +353,27 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
 void Misbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
+/** Get the rolling UTXO set commitment and the block it is for, if it is up to date */
+bool GetUTXOCommitment(CUTXOCommitment& commitment, uint256& hashBlock);
+/** Compute the UTXO set commitment from scratch by walking a coins cursor */
+bool ComputeUTXOCommitment(CCoinsViewCursor* pcursor, CUTXOCommitment& commitment);
+/** Read the UTXO set commitment from the coin database, or compute it if it is missing or stale */
+bool LoadUTXOCommitment();
+/**
+ * Have the UTXO snapshot in path (see dumptxoutset) loaded by
+ * ThreadTxOutSetSnapshot() if the chain state is still empty, or its last
+ * load did not finish; no blocks are downloaded or connected until then. hashExpected, unless null, is the commitment the
+ * snapshot must have.
+ */
+bool InitLoadTxOutSet(const boost::filesystem::path& path, const uint256& hashExpected, std::string& strError);
+/**
+ * Pick up the UTXO snapshot the coin database was loaded from. If loading it
+ * did not finish, this fails unless fReload, for the snapshot to be loaded
+ * again with InitLoadTxOutSet().
+ */
+bool LoadTxOutSetSnapshot(bool fReload);
+/** Get the UTXO snapshot the chain state comes from, or is waiting for, and the height its background check got to */
+bool GetTxOutSetSnapshot(CTxOutSetSnapshot& snapshot, int& nCheckHeight, bool& fPending);
 /** Prune block files and flush state to disk. */
 void PruneAndFlush();
 
@@ -307,6 +381,10 @@ void PruneAndFlush();
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fOverrideMempoolLimit=false, const CAmount nAbsurdFee=0);
 
+/** (try to) add transaction to memory pool with a specified acceptance time **/
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                        bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit=false, const CAmount nAbsurdFee=0);
+
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState &state);
 
@@ -458,19 +536,29 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
 
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins.
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
- *  can fail if those validity checks fail (among other reasons). */
+ *  can fail if those validity checks fail (among other reasons). The changes to
+ *  the UTXO set are added to pcommitmentDelta, if given. */
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins,
-                  const CChainParams& chainparams, bool fJustCheck = false);
+                  const CChainParams& chainparams, bool fJustCheck = false, CUTXOCommitment* pcommitmentDelta = NULL);
 
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  In case pfClean is provided, operation will try to be tolerant about errors, and *pfClean
  *  will be true if no problems were found. Otherwise, the return value will be false in case
- *  of problems. Note that in any case, coins may be modified. */
-bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
+ *  of problems. Note that in any case, coins may be modified. The changes to the UTXO set
+ *  are added to pcommitmentDelta, if given. */
+bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL, CUTXOCommitment* pcommitmentDelta = NULL);
 
 /** Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held) */
 bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
 
+/**
+ * Check a new block template on top of pindexPrev like TestBlockValidity, but
+ * without cs_main held: it is only taken to confirm pindexPrev is still the
+ * tip and to copy the coins the block spends. Fails with reject reason
+ * "inconclusive-not-best-prevblk" if the tip has moved on.
+ */
+bool TestBlockTemplateValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev);
+
 /** Check whether witness commitments are required for block. */
 bool IsWitnessEnabled(const CBlockIndex* pindexPrev, const Consensus::Params& params);
 
@@ -506,6 +594,12 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** Global variable that points to the coins database (protected by cs_main) */
+extern CCoinsViewDB *pcoinsdbview;
+
+/** Reads coins ahead for pcoinsTip, or NULL (owned by init; the object itself is thread safe) */
+extern CCoinsViewPrefetch *pcoinsPrefetch;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
@@ -5,7 +5,9 @@
 #ifndef BITCOIN_MEMUSAGE_H
 #define BITCOIN_MEMUSAGE_H
 
+#include "flatmap.h"
 #include "indirectmap.h"
+#include "support/allocators/pool.h"
 
 #include <stdlib.h>
 
@@ -167,6 +169,24 @@ static inline size_t DynamicUsage(const boost::unordered_map<X, Y, Z>& m)
     return MallocUsage(sizeof(boost_unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
 }
 
+// Other data structures
+
+template<typename X, typename Y, typename Z, typename E, typename A>
+static inline size_t DynamicUsage(const flatmap<X, Y, Z, E, A>& m)
+{
+    return MallocUsage(sizeof(std::pair<const X, Y>)) * m.size() + MallocUsage(m.bucket_count()) + MallocUsage(sizeof(void*) * m.bucket_count());
+}
+
+/**
+ * A pooled map is charged for every chunk of its pool, as freed nodes stay
+ * with the pool rather than going back to malloc.
+ */
+template<typename X, typename Y, typename Z, typename E>
+static inline size_t DynamicUsage(const flatmap<X, Y, Z, E, PoolAllocator<std::pair<const X, Y> > >& m)
+{
+    return m.get_allocator().GetResource()->BytesAllocated() + MallocUsage(m.bucket_count()) + MallocUsage(sizeof(void*) * m.bucket_count());
+}
+
 }
 
 #endif // BITCOIN_MEMUSAGE_H
@@ -28,6 +28,7 @@
 #include "validationinterface.h"
 
 #include <algorithm>
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
 #include <queue>
@@ -76,7 +77,7 @@ int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParam
 }
 
 BlockAssembler::BlockAssembler(const CChainParams& _chainparams)
-    : chainparams(_chainparams)
+    : pool(NULL), chainparams(_chainparams)
 {
     // Block resource limits
     // If neither -blockmaxsize or -blockmaxweight is given, limit to DEFAULT_BLOCK_MAX_*
@@ -125,13 +126,32 @@ void BlockAssembler::resetBlock()
 }
 
 CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
+{
+    if (!BuildBlock(scriptPubKeyIn))
+        return NULL;
+    return pblocktemplate.release();
+}
+
+bool BlockAssembler::BuildBlock(const CScript& scriptPubKeyIn)
+{
+    // Each attempt drops its mempool snapshot before the next one starts.
+    for (int nAttempt = 0; nAttempt < MAX_UNLOCKED_TEMPLATE_ATTEMPTS; nAttempt++) {
+        if (TryBuildBlock(scriptPubKeyIn))
+            return true;
+    }
+    // Blocks keep coming in; hold the tip still for the last attempt.
+    LOCK(cs_main);
+    return TryBuildBlock(scriptPubKeyIn);
+}
+
+bool BlockAssembler::TryBuildBlock(const CScript& scriptPubKeyIn)
 {
     resetBlock();
 
     pblocktemplate.reset(new CBlockTemplate());
 
     if(!pblocktemplate.get())
-        return NULL;
+        return false;
     pblock = &pblocktemplate->block; // pointer for convenience
 
     // Add dummy coinbase tx as first transaction
@@ -139,38 +159,83 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
     pblocktemplate->vTxFees.push_back(-1); // updated at end
     pblocktemplate->vTxSigOpsCost.push_back(-1); // updated at end
 
-    LOCK2(cs_main, mempool.cs);
-    CBlockIndex* pindexPrev = chainActive.Tip();
-    nHeight = pindexPrev->nHeight + 1;
+    // Transactions are selected from a copy of the mempool, so that neither
+    // cs_main nor mempool.cs is held while the block is put together and
+    // checked. The copy is taken without cs_main; if a block is connected
+    // in between, TestBlockTemplateValidity finds that the tip moved on.
+    CTxMemPool snapshot(::minRelayTxFee);
+    CBlockIndex* pindexPrev;
+    {
+        LOCK(cs_main);
+        pindexPrev = chainActive.Tip();
+        nHeight = pindexPrev->nHeight + 1;
+
+        pblock->nVersion = ComputeBlockVersion(pindexPrev, chainparams.GetConsensus());
+        // -regtest only: allow overriding block.nVersion with
+        // -blockversion=N to test forking scenarios
+        if (chainparams.MineBlocksOnDemand())
+            pblock->nVersion = GetArg("-blockversion", pblock->nVersion);
+
+        pblock->nTime = GetAdjustedTime();
+        const int64_t nMedianTimePast = pindexPrev->GetMedianTimePast();
+
+        nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                           ? nMedianTimePast
+                           : pblock->GetBlockTime();
+
+        // Decide whether to include witness transactions
+        // This is only needed in case the witness softfork activation is reverted
+        // (which would require a very deep reorganization) or when
+        // -promiscuousmempoolflags is used.
+        // TODO: replace this with a call to main to assess validity of a mempool
+        // transaction (which in most cases can be a no-op).
+        fIncludeWitness = IsWitnessEnabled(pindexPrev, chainparams.GetConsensus());
+    }
+    {
+        LOCK(mempool.cs);
+        mempool.Snapshot(snapshot);
+        if (fnSnapshotTaken)
+            fnSnapshotTaken();
+    }
 
-    pblock->nVersion = ComputeBlockVersion(pindexPrev, chainparams.GetConsensus());
-    // -regtest only: allow overriding block.nVersion with
-    // -blockversion=N to test forking scenarios
-    if (chainparams.MineBlocksOnDemand())
-        pblock->nVersion = GetArg("-blockversion", pblock->nVersion);
+    {
+        LOCK(snapshot.cs);
+        pool = &snapshot;
+        addPriorityTxs();
+        addPackageTxs();
+        // The snapshot goes away with this call
+        inBlock.clear();
+        pool = NULL;
+    }
 
-    pblock->nTime = GetAdjustedTime();
-    const int64_t nMedianTimePast = pindexPrev->GetMedianTimePast();
+    nLastBlockTx = nBlockTx;
+    nLastBlockSize = nBlockSize;
+    nLastBlockWeight = nBlockWeight;
 
-    nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
-                       ? nMedianTimePast
-                       : pblock->GetBlockTime();
+    CreateCoinbase(pindexPrev, scriptPubKeyIn);
 
-    // Decide whether to include witness transactions
-    // This is only needed in case the witness softfork activation is reverted
-    // (which would require a very deep reorganization) or when
-    // -promiscuousmempoolflags is used.
-    // TODO: replace this with a call to main to assess validity of a mempool
-    // transaction (which in most cases can be a no-op).
-    fIncludeWitness = IsWitnessEnabled(pindexPrev, chainparams.GetConsensus());
+    uint64_t nSerializeSize = GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION);
+    LogPrintf("CreateNewBlock(): total size: %u block weight: %u txs: %u fees: %ld sigops %d\n", nSerializeSize, GetBlockWeight(*pblock), nBlockTx, nFees, nBlockSigOpsCost);
 
-    addPriorityTxs();
-    addPackageTxs();
+    // Fill in header
+    pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
+    UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
+    pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
+    pblock->nNonce         = 0;
 
-    nLastBlockTx = nBlockTx;
-    nLastBlockSize = nBlockSize;
-    nLastBlockWeight = nBlockWeight;
+    CValidationState state;
+    if (!TestBlockTemplateValidity(state, chainparams, *pblock, pindexPrev)) {
+        // A block was connected while this one was assembled
+        if (state.GetRejectReason() == "inconclusive-not-best-prevblk")
+            return false;
+        throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+    }
 
+    return true;
+}
+
+void BlockAssembler::CreateCoinbase(const CBlockIndex* pindexPrev, const CScript& scriptPubKeyIn)
+{
     // Create coinbase transaction.
     CMutableTransaction coinbaseTx;
     coinbaseTx.vin.resize(1);
@@ -187,28 +252,12 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
     pblock->vtx[0] = coinbaseTx;
     pblocktemplate->vchCoinbaseCommitment = GenerateCoinbaseCommitment(*pblock, pindexPrev, chainparams.GetConsensus());
     pblocktemplate->vTxFees[0] = -nFees;
-	
-    uint64_t nSerializeSize = GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION);
-    LogPrintf("CreateNewBlock(): total size: %u block weight: %u txs: %u fees: %ld sigops %d\n", nSerializeSize, GetBlockWeight(*pblock), nBlockTx, nFees, nBlockSigOpsCost);
-
-    // Fill in header
-    pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
-    UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
-    pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
-    pblock->nNonce         = 0;
     pblocktemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(pblock->vtx[0]);
-
-    CValidationState state;
-    if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
-        throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
-    }
-
-    return pblocktemplate.release();
 }
 
 bool BlockAssembler::isStillDependent(CTxMemPool::txiter iter)
 {
-    BOOST_FOREACH(CTxMemPool::txiter parent, mempool.GetMemPoolParents(iter))
+    BOOST_FOREACH(CTxMemPool::txiter parent, pool->GetMemPoolParents(iter))
     {
         if (!inBlock.count(parent)) {
             return true;
@@ -334,7 +383,7 @@ void BlockAssembler::AddToBlock(CTxMemPool::txiter iter)
     if (fPrintPriority) {
         double dPriority = iter->GetPriority(nHeight);
         CAmount dummy;
-        mempool.ApplyDeltas(iter->GetTx().GetHash(), dPriority, dummy);
+        pool->ApplyDeltas(iter->GetTx().GetHash(), dPriority, dummy);
         LogPrintf("priority %.1f fee %s txid %s\n",
                   dPriority,
                   CFeeRate(iter->GetModifiedFee(), iter->GetTxSize()).ToString(),
@@ -347,7 +396,7 @@ void BlockAssembler::UpdatePackagesForAdded(const CTxMemPool::setEntries& alread
 {
     BOOST_FOREACH(const CTxMemPool::txiter it, alreadyAdded) {
         CTxMemPool::setEntries descendants;
-        mempool.CalculateDescendants(it, descendants);
+        pool->CalculateDescendants(it, descendants);
         // Insert all descendants (not yet in block) into the modified set
         BOOST_FOREACH(CTxMemPool::txiter desc, descendants) {
             if (alreadyAdded.count(desc))
@@ -377,7 +426,7 @@ void BlockAssembler::UpdatePackagesForAdded(const CTxMemPool::setEntries& alread
 // cached size/sigops/fee values that are not actually correct.
 bool BlockAssembler::SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set &mapModifiedTx, CTxMemPool::setEntries &failedTx)
 {
-    assert (it != mempool.mapTx.end());
+    assert (it != pool->mapTx.end());
     if (mapModifiedTx.count(it) || inBlock.count(it) || failedTx.count(it))
         return true;
     return false;
@@ -416,13 +465,13 @@ void BlockAssembler::addPackageTxs()
     // and modifying them for their already included ancestors
     UpdatePackagesForAdded(inBlock, mapModifiedTx);
 
-    CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator mi = mempool.mapTx.get<ancestor_score>().begin();
+    CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator mi = pool->mapTx.get<ancestor_score>().begin();
     CTxMemPool::txiter iter;
-    while (mi != mempool.mapTx.get<ancestor_score>().end() || !mapModifiedTx.empty())
+    while (mi != pool->mapTx.get<ancestor_score>().end() || !mapModifiedTx.empty())
     {
         // First try to find a new transaction in mapTx to evaluate.
-        if (mi != mempool.mapTx.get<ancestor_score>().end() &&
-                SkipMapTxEntry(mempool.mapTx.project<0>(mi), mapModifiedTx, failedTx)) {
+        if (mi != pool->mapTx.get<ancestor_score>().end() &&
+                SkipMapTxEntry(pool->mapTx.project<0>(mi), mapModifiedTx, failedTx)) {
             ++mi;
             continue;
         }
@@ -432,13 +481,13 @@ void BlockAssembler::addPackageTxs()
         bool fUsingModified = false;
 
         modtxscoreiter modit = mapModifiedTx.get<ancestor_score>().begin();
-        if (mi == mempool.mapTx.get<ancestor_score>().end()) {
+        if (mi == pool->mapTx.get<ancestor_score>().end()) {
             // We're out of entries in mapTx; use the entry from mapModifiedTx
             iter = modit->iter;
             fUsingModified = true;
         } else {
             // Try to compare the mapTx entry to the mapModifiedTx entry
-            iter = mempool.mapTx.project<0>(mi);
+            iter = pool->mapTx.project<0>(mi);
             if (modit != mapModifiedTx.get<ancestor_score>().end() &&
                     CompareModifiedEntry()(*modit, CTxMemPoolModifiedEntry(iter))) {
                 // The best entry in mapModifiedTx has higher score
@@ -485,7 +534,7 @@ void BlockAssembler::addPackageTxs()
         CTxMemPool::setEntries ancestors;
         uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
         std::string dummy;
-        mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+        pool->CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
 
         onlyUnconfirmed(ancestors);
         ancestors.insert(iter);
@@ -535,13 +584,13 @@ void BlockAssembler::addPriorityTxs()
     typedef std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash>::iterator waitPriIter;
     double actualPriority = -1;
 
-    vecPriority.reserve(mempool.mapTx.size());
-    for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
-         mi != mempool.mapTx.end(); ++mi)
+    vecPriority.reserve(pool->mapTx.size());
+    for (CTxMemPool::indexed_transaction_set::iterator mi = pool->mapTx.begin();
+         mi != pool->mapTx.end(); ++mi)
     {
         double dPriority = mi->GetPriority(nHeight);
         CAmount dummy;
-        mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
+        pool->ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
         vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
     }
     std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
@@ -582,7 +631,7 @@ void BlockAssembler::addPriorityTxs()
 
             // This tx was successfully added, so
             // add transactions that depend on this one to the priority queue to try again
-            BOOST_FOREACH(CTxMemPool::txiter child, mempool.GetMemPoolChildren(iter))
+            BOOST_FOREACH(CTxMemPool::txiter child, pool->GetMemPoolChildren(iter))
             {
                 waitPriIter wpiter = waitPriMap.find(child);
                 if (wpiter != waitPriMap.end()) {
@@ -596,6 +645,218 @@ void BlockAssembler::addPriorityTxs()
     fNeedSizeAccounting = fSizeAccounting;
 }
 
+CBlockTemplateUpdater::CBlockTemplateUpdater(const CChainParams& chainparams, const CScript& scriptPubKeyIn)
+    : assembler(chainparams), scriptPubKey(scriptPubKeyIn), pindexPrev(NULL), nTimeBuilt(0), fRebuild(true), nTransactionsUpdatedLast(0)
+{
+    mempool.NotifyEntryAdded.connect(boost::bind(&CBlockTemplateUpdater::TransactionAdded, this, _1));
+    mempool.NotifyEntryRemoved.connect(boost::bind(&CBlockTemplateUpdater::TransactionRemoved, this, _1));
+    assembler.fnSnapshotTaken = boost::bind(&CBlockTemplateUpdater::SnapshotTaken, this);
+}
+
+CBlockTemplateUpdater::~CBlockTemplateUpdater()
+{
+    mempool.NotifyEntryAdded.disconnect(boost::bind(&CBlockTemplateUpdater::TransactionAdded, this, _1));
+    mempool.NotifyEntryRemoved.disconnect(boost::bind(&CBlockTemplateUpdater::TransactionRemoved, this, _1));
+}
+
+void CBlockTemplateUpdater::TransactionAdded(const uint256& hash)
+{
+    LOCK(cs_changes);
+    // Changes beyond the limit are dropped; the mempool counter then no
+    // longer matches and Update() rebuilds instead.
+    if (vChanges.size() < MAX_TEMPLATE_CHANGES)
+        vChanges.push_back(std::make_pair(hash, true));
+}
+
+void CBlockTemplateUpdater::TransactionRemoved(const uint256& hash)
+{
+    LOCK(cs_changes);
+    if (vChanges.size() < MAX_TEMPLATE_CHANGES)
+        vChanges.push_back(std::make_pair(hash, false));
+}
+
+void CBlockTemplateUpdater::SnapshotTaken()
+{
+    // The new template is built from the mempool as it is now, so only
+    // changes from here on are left to apply to it.
+    AssertLockHeld(mempool.cs);
+    LOCK(cs_changes);
+    vChanges.clear();
+    nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+}
+
+bool CBlockTemplateUpdater::Rebuild()
+{
+    pindexPrev = NULL;
+    setBlockTx.clear();
+
+    if (!assembler.BuildBlock(scriptPubKey))
+        return false;
+
+    const CBlock& block = assembler.pblocktemplate->block;
+    for (unsigned int i = 1; i < block.vtx.size(); i++)
+        setBlockTx.insert(block.vtx[i].GetHash());
+    {
+        LOCK(cs_main);
+        pindexPrev = mapBlockIndex.find(block.hashPrevBlock)->second;
+    }
+    nTimeBuilt = GetTime();
+    fRebuild = false;
+    return true;
+}
+
+bool CBlockTemplateUpdater::AddTransaction(CTxMemPool::txiter it)
+{
+    // Parents must precede the transaction in the block
+    BOOST_FOREACH(const CTxMemPool::txiter parent, mempool.GetMemPoolParents(it)) {
+        if (!setBlockTx.count(parent->GetTx().GetHash()))
+            return false;
+    }
+
+    // Transactions the assembler would leave out are skipped, not a reason
+    // to rebuild
+    const CTransaction& tx = it->GetTx();
+    if (it->GetModifiedFee() < ::minRelayTxFee.GetFee(it->GetTxSize()))
+        return true;
+    if (!IsFinalTx(tx, assembler.nHeight, assembler.nLockTimeCutoff))
+        return true;
+    if (!assembler.fIncludeWitness && !tx.wit.IsNull())
+        return true;
+
+    if (assembler.nBlockWeight + it->GetTxWeight() >= assembler.nBlockMaxWeight)
+        return false;
+    uint64_t nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+    if (assembler.fNeedSizeAccounting && assembler.nBlockSize + nTxSize >= assembler.nBlockMaxSize)
+        return false;
+    if (assembler.nBlockSigOpsCost + it->GetSigOpCost() >= MAX_BLOCK_SIGOPS_COST)
+        return false;
+
+    CBlockTemplate& blocktemplate = *assembler.pblocktemplate;
+    blocktemplate.block.vtx.push_back(tx);
+    blocktemplate.vTxFees.push_back(it->GetFee());
+    blocktemplate.vTxSigOpsCost.push_back(it->GetSigOpCost());
+    if (assembler.fNeedSizeAccounting)
+        assembler.nBlockSize += nTxSize;
+    assembler.nBlockWeight += it->GetTxWeight();
+    ++assembler.nBlockTx;
+    assembler.nBlockSigOpsCost += it->GetSigOpCost();
+    assembler.nFees += it->GetFee();
+    setBlockTx.insert(tx.GetHash());
+    return true;
+}
+
+void CBlockTemplateUpdater::RemoveTransactions(const std::set<uint256>& setRemove)
+{
+    CBlockTemplate& blocktemplate = *assembler.pblocktemplate;
+    std::vector<CTransaction>& vtx = blocktemplate.block.vtx;
+    std::set<uint256> setRemoved;
+    unsigned int nKept = 1;
+    for (unsigned int i = 1; i < vtx.size(); i++) {
+        const CTransaction& tx = vtx[i];
+        bool fRemove = setRemove.count(tx.GetHash()) > 0;
+        // Whatever spends a removed transaction goes with it; the block is
+        // ordered, so the spent one was seen first.
+        for (unsigned int j = 0; !fRemove && j < tx.vin.size(); j++)
+            fRemove = setRemoved.count(tx.vin[j].prevout.hash) > 0;
+        if (fRemove) {
+            if (assembler.fNeedSizeAccounting)
+                assembler.nBlockSize -= ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+            assembler.nBlockWeight -= GetTransactionWeight(tx);
+            --assembler.nBlockTx;
+            assembler.nBlockSigOpsCost -= blocktemplate.vTxSigOpsCost[i];
+            assembler.nFees -= blocktemplate.vTxFees[i];
+            setRemoved.insert(tx.GetHash());
+            setBlockTx.erase(tx.GetHash());
+            continue;
+        }
+        if (nKept != i) {
+            vtx[nKept] = tx;
+            blocktemplate.vTxFees[nKept] = blocktemplate.vTxFees[i];
+            blocktemplate.vTxSigOpsCost[nKept] = blocktemplate.vTxSigOpsCost[i];
+        }
+        nKept++;
+    }
+    vtx.resize(nKept);
+    blocktemplate.vTxFees.resize(nKept);
+    blocktemplate.vTxSigOpsCost.resize(nKept);
+}
+
+CBlockTemplate* CBlockTemplateUpdater::Update(int64_t nRebuildInterval)
+{
+    bool fChanged = false;
+    {
+        LOCK2(cs_main, mempool.cs);
+
+        std::vector<std::pair<uint256, bool> > vChangesNow;
+        {
+            LOCK(cs_changes);
+            vChangesNow.swap(vChanges);
+        }
+
+        // Every add and remove bumps the mempool counter once; anything else
+        // that bumped it (a fee delta, a new tip, a dropped change) means the
+        // queued changes alone do not describe the mempool.
+        if (mempool.GetTransactionsUpdated() - nTransactionsUpdatedLast != vChangesNow.size())
+            fRebuild = true;
+
+        bool fNewTip = !assembler.pblocktemplate || pindexPrev != chainActive.Tip();
+        if (!fNewTip && !vChangesNow.empty()) {
+            // Priority space is filled by a different ordering than ancestor
+            // feerate, so appending cannot keep it right.
+            if (GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE) > 0)
+                fRebuild = true;
+
+            std::set<uint256> setRemove;
+            for (unsigned int i = 0; i < vChangesNow.size(); i++) {
+                const uint256& hash = vChangesNow[i].first;
+                if (!vChangesNow[i].second) {
+                    if (setBlockTx.count(hash))
+                        setRemove.insert(hash);
+                    continue;
+                }
+                if (!setRemove.empty()) {
+                    RemoveTransactions(setRemove);
+                    setRemove.clear();
+                }
+                CTxMemPool::txiter it = mempool.mapTx.find(hash);
+                if (it == mempool.mapTx.end() || setBlockTx.count(hash))
+                    continue;
+                if (!AddTransaction(it))
+                    fRebuild = true;
+            }
+            if (!setRemove.empty())
+                RemoveTransactions(setRemove);
+
+            assembler.CreateCoinbase(pindexPrev, scriptPubKey);
+            fChanged = true;
+            nLastBlockTx = assembler.nBlockTx;
+            nLastBlockSize = assembler.nBlockSize;
+            nLastBlockWeight = assembler.nBlockWeight;
+        }
+        nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+
+        if (fNewTip || (fRebuild && GetTime() - nTimeBuilt >= nRebuildInterval))
+            fChanged = false;
+        else if (!fChanged)
+            return assembler.pblocktemplate.get();
+    }
+
+    // Check the changed template without the locks; if the tip moved on or
+    // something appended does not fit the block after all, rebuild.
+    if (fChanged) {
+        CValidationState state;
+        if (TestBlockTemplateValidity(state, assembler.chainparams, assembler.pblocktemplate->block, pindexPrev))
+            return assembler.pblocktemplate.get();
+        if (state.GetRejectReason() != "inconclusive-not-best-prevblk")
+            LogPrintf("%s: updated block template is invalid, rebuilding: %s\n", __func__, FormatStateMessage(state));
+    }
+
+    // Rebuild without the locks, BuildBlock takes them as needed
+    if (!Rebuild())
+        return NULL;
+    return assembler.pblocktemplate.get();
+}
+
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
     // Update nExtraNonce
@@ -7,10 +7,13 @@
 #define BITCOIN_MINER_H
 
 #include "primitives/block.h"
+#include "script/script.h"
+#include "sync.h"
 #include "txmempool.h"
 
 #include <stdint.h>
 #include <memory>
+#include <boost/function.hpp>
 #include "boost/multi_index_container.hpp"
 #include "boost/multi_index/ordered_index.hpp"
 
@@ -23,6 +26,10 @@ class CWallet;
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Mempool changes a CBlockTemplateUpdater queues before it gives up and rebuilds */
+static const unsigned int MAX_TEMPLATE_CHANGES = 10000;
+/** Attempts at a block template without cs_main before it is held throughout, so the tip cannot move */
+static const int MAX_UNLOCKED_TEMPLATE_ATTEMPTS = 3;
 
 struct CBlockTemplate
 {
@@ -73,7 +80,7 @@ struct modifiedentry_iter {
 // except operating on CTxMemPoolModifiedEntry.
 // TODO: refactor to avoid duplication of this logic.
 struct CompareModifiedEntry {
-    bool operator()(const CTxMemPoolModifiedEntry &a, const CTxMemPoolModifiedEntry &b)
+    bool operator()(const CTxMemPoolModifiedEntry &a, const CTxMemPoolModifiedEntry &b) const
     {
         double f1 = (double)a.nModFeesWithAncestors * b.nSizeWithAncestors;
         double f2 = (double)b.nModFeesWithAncestors * a.nSizeWithAncestors;
@@ -88,7 +95,7 @@ struct CompareModifiedEntry {
 // This is sufficient to sort an ancestor package in an order that is valid
 // to appear in a block.
 struct CompareTxIterByAncestorCount {
-    bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b)
+    bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b) const
     {
         if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
             return a->GetCountWithAncestors() < b->GetCountWithAncestors();
@@ -133,6 +140,8 @@ struct update_for_parent_inclusion
 /** Generate a new block, without valid proof-of-work */
 class BlockAssembler
 {
+    friend class CBlockTemplateUpdater;
+
 private:
     // The constructed block template
     std::unique_ptr<CBlockTemplate> pblocktemplate;
@@ -151,6 +160,8 @@ private:
     uint64_t nBlockSigOpsCost;
     CAmount nFees;
     CTxMemPool::setEntries inBlock;
+    // The copy of the mempool transactions are selected from
+    CTxMemPool* pool;
 
     // Chain context for the block
     int nHeight;
@@ -161,6 +172,9 @@ private:
     int lastFewTxs;
     bool blockFinished;
 
+    // Called with mempool.cs held right after the mempool is copied
+    boost::function<void()> fnSnapshotTaken;
+
 public:
     BlockAssembler(const CChainParams& chainparams);
     /** Construct a new block template with coinbase to scriptPubKeyIn */
@@ -168,6 +182,15 @@ public:
 
 private:
     // utility functions
+    /** Assemble a new block template into pblocktemplate, which is kept */
+    bool BuildBlock(const CScript& scriptPubKeyIn);
+    /**
+     * One attempt at BuildBlock(). Returns false if the tip moved meanwhile,
+     * which cannot happen while the caller holds cs_main.
+     */
+    bool TryBuildBlock(const CScript& scriptPubKeyIn);
+    /** (Re)create the coinbase of the block, paying out nFees */
+    void CreateCoinbase(const CBlockIndex* pindexPrev, const CScript& scriptPubKeyIn);
     /** Clear the block's state and prepare for assembling a new block */
     void resetBlock();
     /** Add a tx to the block */
@@ -205,6 +228,62 @@ private:
     void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
 };
 
+/**
+ * Keeps a block template up to date with the mempool between full rebuilds.
+ *
+ * The mempool reports every transaction it adds or removes. Update() appends
+ * added ones while the block has room for them and their unconfirmed parents
+ * are in it already, and takes removed ones out along with whatever in the
+ * block spends them. Appending tests the block limits, finality and witness
+ * rules, and a changed template is run through TestBlockTemplateValidity
+ * before it is returned; that skips the scripts AcceptToMemoryPool ran.
+ *
+ * A new tip makes the next Update() run the full BlockAssembler. So does a
+ * change that appending cannot follow (a transaction whose parents were left
+ * out, a block too full for a new transaction, a fee delta, priority space),
+ * but then at most every nRebuildInterval seconds.
+ */
+class CBlockTemplateUpdater
+{
+private:
+    BlockAssembler assembler;
+    const CScript scriptPubKey;
+    CBlockIndex* pindexPrev;
+    int64_t nTimeBuilt;
+    bool fRebuild;
+    //! The transactions in the template
+    std::set<uint256> setBlockTx;
+    //! mempool.GetTransactionsUpdated() as of the changes applied so far
+    unsigned int nTransactionsUpdatedLast;
+
+    //! Mempool changes not applied yet, in order: txid and whether it was added
+    CCriticalSection cs_changes;
+    std::vector<std::pair<uint256, bool> > vChanges;
+
+    void TransactionAdded(const uint256& hash);
+    void TransactionRemoved(const uint256& hash);
+    void SnapshotTaken();
+    bool Rebuild();
+    bool AddTransaction(CTxMemPool::txiter it);
+    void RemoveTransactions(const std::set<uint256>& setRemove);
+
+public:
+    CBlockTemplateUpdater(const CChainParams& chainparams, const CScript& scriptPubKeyIn);
+    ~CBlockTemplateUpdater();
+
+    /**
+     * Bring the template up to date with the tip and the mempool and return
+     * it, or NULL if it could not be built. It stays owned by the updater and
+     * is valid until the next call. Calls must not overlap. A rebuild does
+     * not need cs_main, so when it is not held the tip may have moved on by
+     * the time this returns.
+     */
+    CBlockTemplate* Update(int64_t nRebuildInterval);
+
+    //! mempool.GetTransactionsUpdated() as of the returned template
+    unsigned int GetTransactionsUpdated() const { return nTransactionsUpdatedLast; }
+};
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
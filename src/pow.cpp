@@ -8,9 +8,13 @@
 #include "arith_uint256.h"
 #include "chain.h"
 #include "primitives/block.h"
+#include "sync.h"
 #include "uint256.h"
 #include "util.h"
 #include <inttypes.h>
+#include <math.h>
+
+#include <deque>
 
 
 static const int64_t nDiffChangeTarget = 56000; // Patch effective @ block 56000
@@ -20,6 +24,33 @@ static const int64_t nTargetTimespanNEW = 60;
 static const int64_t nTargetSpacing = 60; // Einsteinium: one minute
 static const int64_t nInterval = nTargetTimespan / nTargetSpacing;
 
+static CCriticalSection cs_retargetTrace;
+static std::deque<CRetargetTrace> retargetTrace; // protected by cs_retargetTrace
+
+/** Remember a retarget decision and log it under the "pow" debug category. */
+static void TraceRetarget(const CRetargetTrace& trace)
+{
+    LogPrint("pow", "%s retarget for height %d: blocks=%d actual=%ds adjusted=%ds target=%ds before=%08x after=%08x\n",
+        trace.strAlgorithm, trace.nHeight, trace.nBlocks, trace.nActualTimespan, trace.nAdjustedTimespan,
+        trace.nTargetTimespan, trace.nBitsBefore, trace.nBitsAfter);
+
+    LOCK(cs_retargetTrace);
+    // getblocktemplate polling recomputes the same target over and over.
+    if (!retargetTrace.empty() && retargetTrace.back().nHeight == trace.nHeight &&
+        retargetTrace.back().nBitsBefore == trace.nBitsBefore && retargetTrace.back().nBitsAfter == trace.nBitsAfter)
+        return;
+    retargetTrace.push_back(trace);
+    if (retargetTrace.size() > RETARGET_TRACE_SIZE)
+        retargetTrace.pop_front();
+}
+
+std::vector<CRetargetTrace> GetRetargetTrace(size_t nCount)
+{
+    LOCK(cs_retargetTrace);
+    nCount = std::min(nCount, retargetTrace.size());
+    return std::vector<CRetargetTrace>(retargetTrace.end() - nCount, retargetTrace.end());
+}
+
 
 unsigned int DigiShield(const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params& params)
 {
@@ -48,7 +79,11 @@ unsigned int DigiShield(const CBlockIndex* pindexLast, const CBlockHeader *pbloc
 
     // Limit adjustment step
     int64_t nActualTimespan = pindexLast->GetBlockTime() - pindexFirst->GetBlockTime();
-    printf(" nActualTimespan = %" PRId64 " before bounds\n", nActualTimespan);
+    CRetargetTrace trace;
+    trace.nHeight = pindexLast->nHeight + 1;
+    trace.strAlgorithm = "digishield";
+    trace.nBlocks = blockstogoback;
+    trace.nActualTimespan = nActualTimespan;
     
     arith_uint256 bnNew;
     bnNew.SetCompact(pindexLast->nBits);
@@ -56,7 +91,6 @@ unsigned int DigiShield(const CBlockIndex* pindexLast, const CBlockHeader *pbloc
  //DigiShield implementation - thanks to RealSolid & WDC for this code
 // amplitude filter - thanks to daft27 for this code
         nActualTimespan = retargetTimespan + (nActualTimespan - retargetTimespan)/8;
-        printf("DIGISHIELD RETARGET\n");
         if (nActualTimespan < (retargetTimespan - (retargetTimespan/4)) ) nActualTimespan = (retargetTimespan - (retargetTimespan/4));
         if (nActualTimespan > (retargetTimespan + (retargetTimespan/2)) ) nActualTimespan = (retargetTimespan + (retargetTimespan/2));
     // Retarget
@@ -67,16 +101,49 @@ unsigned int DigiShield(const CBlockIndex* pindexLast, const CBlockHeader *pbloc
     if (bnNew > bnProofOfWorkLimit)
         bnNew = bnProofOfWorkLimit;
 
-    /// debug print
-    printf("GetNextWorkRequired: DIGISHIELD RETARGET\n");
-    printf("nTargetTimespan = %" PRId64 " nActualTimespan = %" PRId64 "\n", retargetTimespan, nActualTimespan);
-    printf("Before: %08x %s\n", pindexLast->nBits, ArithToUint256(arith_uint256().SetCompact(pindexLast->nBits)).ToString().c_str());
-    printf("After: %08x %s\n", bnNew.GetCompact(), ArithToUint256(bnNew).ToString().c_str());
+    trace.nAdjustedTimespan = nActualTimespan;
+    trace.nTargetTimespan = retargetTimespan;
+    trace.nBitsBefore = pindexLast->nBits;
+    trace.nBitsAfter = bnNew.GetCompact();
+    TraceRetarget(trace);
 
-    return bnNew.GetCompact();
+    return trace.nBitsAfter;
 }
 
 
+/**
+ * The Kimoto Gravity Well event horizon only depends on the number of blocks
+ * walked so far, so tabulate it once instead of calling pow() for every step
+ * of every retarget. Entries are computed with the exact same expression, so
+ * results are bit-identical.
+ */
+class CKGWEventHorizonTable
+{
+public:
+    static const uint64_t nSize = 10080 + 1; // PastBlocksMax of the mainnet KGW era
+
+    CKGWEventHorizonTable()
+    {
+        for (uint64_t i = 0; i < nSize; i++)
+            deviation[i] = Compute(i);
+    }
+
+    static double Compute(uint64_t PastBlocksMass)
+    {
+        return 1 + (0.7084 * pow((double(PastBlocksMass)/double(144)), -1.228));
+    }
+
+    double operator[](uint64_t PastBlocksMass) const
+    {
+        return PastBlocksMass < nSize ? deviation[PastBlocksMass] : Compute(PastBlocksMass);
+    }
+
+private:
+    double deviation[nSize];
+};
+
+static const CKGWEventHorizonTable kgwEventHorizon;
+
 unsigned int KimotoGravityWell(const CBlockIndex* pindexLast, const CBlockHeader *pblock, uint64_t TargetBlocksSpacingSeconds, uint64_t PastBlocksMin, uint64_t PastBlocksMax, const Consensus::Params& params) {
         /* current difficulty formula - kimoto gravity well */
         const CBlockIndex *BlockLastSolved                                = pindexLast;
@@ -119,7 +186,7 @@ unsigned int KimotoGravityWell(const CBlockIndex* pindexLast, const CBlockHeader
                 if (PastRateActualSeconds != 0 && PastRateTargetSeconds != 0) {
                 PastRateAdjustmentRatio                        = double(PastRateTargetSeconds) / double(PastRateActualSeconds);
                 }
-                EventHorizonDeviation                        = 1 + (0.7084 * pow((double(PastBlocksMass)/double(144)), -1.228));
+                EventHorizonDeviation                        = kgwEventHorizon[PastBlocksMass];
                 EventHorizonDeviationFast                = EventHorizonDeviation;
                 EventHorizonDeviationSlow                = 1 / EventHorizonDeviation;
                 
@@ -136,15 +203,19 @@ unsigned int KimotoGravityWell(const CBlockIndex* pindexLast, const CBlockHeader
                 bnNew /= PastRateTargetSeconds;
         }
     if (bnNew > bnProofOfWorkLimit) { bnNew = bnProofOfWorkLimit; }
-        
-/* debug print (commented out due to spamming logs when the loop above breaks)
-   printf("Difficulty Retarget - Kimoto Gravity Well\n");
-   printf("PastRateAdjustmentRatio = %g\n", PastRateAdjustmentRatio);
-   printf("Before: %08x %s\n", BlockLastSolved->nBits, arith_uint256().SetCompact(BlockLastSolved->nBits).getuint256().ToString().c_str());
-   printf("After: %08x %s\n", bnNew.GetCompact(), bnNew.getuint256().ToString().c_str());
-*/ 
-      
-        return bnNew.GetCompact();
+
+        CRetargetTrace trace;
+        trace.nHeight = BlockLastSolved->nHeight + 1;
+        trace.strAlgorithm = "kgw";
+        trace.nBlocks = PastBlocksMass;
+        trace.nActualTimespan = PastRateActualSeconds;
+        trace.nAdjustedTimespan = PastRateActualSeconds;
+        trace.nTargetTimespan = PastRateTargetSeconds;
+        trace.nBitsBefore = BlockLastSolved->nBits;
+        trace.nBitsAfter = bnNew.GetCompact();
+        TraceRetarget(trace);
+
+        return trace.nBitsAfter;
 }
 
 
@@ -9,6 +9,8 @@
 #include "consensus/params.h"
 
 #include <stdint.h>
+#include <string>
+#include <vector>
 
 class CBlockHeader;
 class CBlockIndex;
@@ -20,4 +22,23 @@ unsigned int CalculateNextWorkRequired(const CBlockIndex* pindexLast, int64_t nF
 /** Check whether a block hash satisfies the proof-of-work requirement specified by nBits */
 bool CheckProofOfWork(uint256 hash, unsigned int nBits, const Consensus::Params&);
 
+/** Number of recent retarget decisions kept for getretargetinfo */
+static const size_t RETARGET_TRACE_SIZE = 100;
+
+/** A difficulty retarget decision made by GetNextWorkRequired */
+struct CRetargetTrace
+{
+    int nHeight;                //!< height of the block the new target applies to
+    std::string strAlgorithm;   //!< "kgw" or "digishield"
+    uint64_t nBlocks;           //!< number of past blocks the decision looked at
+    int64_t nActualTimespan;    //!< time those blocks took
+    int64_t nAdjustedTimespan;  //!< timespan after damping and bounds
+    int64_t nTargetTimespan;    //!< time those blocks should have taken
+    unsigned int nBitsBefore;
+    unsigned int nBitsAfter;
+};
+
+/** Return up to nCount of the most recent retarget decisions, oldest first */
+std::vector<CRetargetTrace> GetRetargetTrace(size_t nCount);
+
 #endif // BITCOIN_POW_H
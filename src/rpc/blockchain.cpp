@@ -15,6 +15,7 @@
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
+#include "txdb.h"
 #include "txmempool.h"
 #include "util.h"
 #include "utilstrencodings.h"
@@ -24,6 +25,7 @@
 
 #include <univalue.h>
 
+#include <boost/filesystem.hpp>
 #include <boost/thread/thread.hpp> // boost::thread::interrupt
 
 using namespace std;
@@ -200,6 +202,9 @@ std::string EntryDescriptionString()
            "    \"ancestorcount\" : n,    (numeric) number of in-mempool ancestor transactions (including this one)\n"
            "    \"ancestorsize\" : n,     (numeric) size of in-mempool ancestors (including this one)\n"
            "    \"ancestorfees\" : n,     (numeric) modified fees (see above) of in-mempool ancestors (including this one)\n"
+           "    \"clustercount\" : n,     (numeric) number of in-mempool transactions connected to this one (including this one)\n"
+           "    \"clustersize\" : n,      (numeric) size of the connected in-mempool transactions (including this one)\n"
+           "    \"clusterfees\" : n,      (numeric) modified fees (see above) of the connected in-mempool transactions (including this one)\n"
            "    \"depends\" : [           (array) unconfirmed transactions used as inputs for this transaction\n"
            "        \"transactionid\",    (string) parent transaction id\n"
            "       ... ]\n";
@@ -222,6 +227,12 @@ void entryToJSON(UniValue &info, const CTxMemPoolEntry &e)
     info.push_back(Pair("ancestorcount", e.GetCountWithAncestors()));
     info.push_back(Pair("ancestorsize", e.GetSizeWithAncestors()));
     info.push_back(Pair("ancestorfees", e.GetModFeesWithAncestors()));
+    uint64_t nClusterCount, nClusterSize;
+    CAmount nClusterFees;
+    mempool.GetClusterStats(mempool.mapTx.iterator_to(e), nClusterCount, nClusterSize, nClusterFees);
+    info.push_back(Pair("clustercount", nClusterCount));
+    info.push_back(Pair("clustersize", nClusterSize));
+    info.push_back(Pair("clusterfees", nClusterFees));
     const CTransaction& tx = e.GetTx();
     set<string> setDepends;
     BOOST_FOREACH(const CTxIn& txin, tx.vin)
@@ -629,80 +640,139 @@ struct CCoinsStats
     CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
 };
 
-//! Calculate statistics about the unspent transaction output set
-static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
+//! Number of threads to scan the UTXO set with
+static int GetScanThreads()
+{
+    return std::max(1, std::min(GetNumCores(), MAX_SCAN_THREADS));
+}
+
+//! Serialize the coins of a transaction the way hash_serialized covers them
+static void EncodeUTXOStats(const uint256& txid, const CCoins& coins, unsigned int nValueSize, CCoinsScanChunk& chunk)
+{
+    chunk.nTransactions++;
+    chunk.data << txid;
+    for (unsigned int i=0; i<coins.vout.size(); i++) {
+        const CTxOut &out = coins.vout[i];
+        if (!out.IsNull()) {
+            chunk.nTransactionOutputs++;
+            chunk.data << VARINT(i+1);
+            chunk.data << out;
+            chunk.nTotalAmount += out.nValue;
+        }
+    }
+    chunk.nSerializedSize += 32 + nValueSize;
+    chunk.data << VARINT(0);
+}
+
+/** Adds up the chunks of a UTXO set scan, in order, into CCoinsStats. */
+class CCoinsStatsMerger
 {
-    boost::scoped_ptr<CCoinsViewCursor> pcursor(view->Cursor());
+private:
+    CHashWriter ss;
+    CCoinsStats& stats;
+    bool fStarted;
 
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = pcursor->GetBestBlock();
+public:
+    CCoinsStatsMerger(CCoinsStats& statsIn) : ss(SER_GETHASH, PROTOCOL_VERSION), stats(statsIn), fStarted(false) {}
+
+    bool operator()(const CCoinsScanChunk& chunk)
+    {
+        // The scan has settled on its best block before handing out anything.
+        if (!fStarted) {
+            ss << stats.hashBlock;
+            fStarted = true;
+        }
+        if (!chunk.data.empty())
+            ss.write(&chunk.data[0], chunk.data.size());
+        stats.nTransactions += chunk.nTransactions;
+        stats.nTransactionOutputs += chunk.nTransactionOutputs;
+        stats.nSerializedSize += chunk.nSerializedSize;
+        stats.nTotalAmount += chunk.nTotalAmount;
+        return true;
+    }
+
+    uint256 GetHash() { return ss.GetHash(); }
+};
+
+//! Calculate statistics about the unspent transaction output set
+static bool GetUTXOStats(CCoinsViewDB *view, CCoinsStats &stats)
+{
+    CCoinsStatsMerger merger(stats);
+    if (!view->ScanCoins(GetScanThreads(), SER_GETHASH, PROTOCOL_VERSION, EncodeUTXOStats, boost::ref(merger), stats.hashBlock))
+        return error("%s: unable to read value", __func__);
+    stats.hashSerialized = merger.GetHash();
     {
         LOCK(cs_main);
         stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
     }
-    ss << stats.hashBlock;
-    CAmount nTotalAmount = 0;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        uint256 key;
-        CCoins coins;
-        if (pcursor->GetKey(key) && pcursor->GetValue(coins)) {
-            stats.nTransactions++;
-            ss << key;
-            for (unsigned int i=0; i<coins.vout.size(); i++) {
-                const CTxOut &out = coins.vout[i];
-                if (!out.IsNull()) {
-                    stats.nTransactionOutputs++;
-                    ss << VARINT(i+1);
-                    ss << out;
-                    nTotalAmount += out.nValue;
-                }
-            }
-            stats.nSerializedSize += 32 + pcursor->GetValueSize();
-            ss << VARINT(0);
-        } else {
-            return error("%s: unable to read value", __func__);
-        }
-        pcursor->Next();
-    }
-    stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
     return true;
 }
 
 UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( \"hash_type\" )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time, unless hash_type is \"muhash\".\n"
+            "\nArguments:\n"
+            "1. \"hash_type\"    (string, optional, default=\"hash_serialized\") \"hash_serialized\" to walk the whole set,\n"
+            "                   or \"muhash\" to only return the rolling commitment kept up to date with every block\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
-            "  \"transactions\": n,      (numeric) The number of transactions\n"
+            "  \"transactions\": n,      (numeric) The number of transactions (hash_serialized only)\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
-            "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"bytes_serialized\": n,  (numeric) The serialized size (hash_serialized only)\n"
+            "  \"hash_serialized\": \"hash\",   (string) The serialized hash (hash_serialized only)\n"
+            "  \"muhash\": \"hash\",     (string) The rolling MuHash of the set, if it is up to date\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
-            + HelpExampleRpc("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "\"muhash\"")
+            + HelpExampleRpc("gettxoutsetinfo", "\"muhash\"")
         );
 
+    std::string strHashType = params.size() > 0 ? params[0].get_str() : "hash_serialized";
+    if (strHashType != "hash_serialized" && strHashType != "muhash")
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown hash_type: " + strHashType);
+
     UniValue ret(UniValue::VOBJ);
 
+    CUTXOCommitment commitment;
+    uint256 hashCommitmentBlock;
+    if (strHashType == "muhash") {
+        if (!GetUTXOCommitment(commitment, hashCommitmentBlock))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "UTXO set commitment is not up to date");
+        int nHeight;
+        {
+            LOCK(cs_main);
+            BlockMap::iterator mi = mapBlockIndex.find(hashCommitmentBlock);
+            if (mi == mapBlockIndex.end())
+                throw JSONRPCError(RPC_INTERNAL_ERROR, "UTXO set commitment is not up to date");
+            nHeight = mi->second->nHeight;
+        }
+        ret.push_back(Pair("height", (int64_t)nHeight));
+        ret.push_back(Pair("bestblock", hashCommitmentBlock.GetHex()));
+        ret.push_back(Pair("txouts", commitment.nTxOuts));
+        ret.push_back(Pair("muhash", commitment.GetHash().GetHex()));
+        ret.push_back(Pair("total_amount", ValueFromAmount(commitment.nTotalAmount)));
+        return ret;
+    }
+
     CCoinsStats stats;
     FlushStateToDisk();
-    if (GetUTXOStats(pcoinsTip, stats)) {
+    if (GetUTXOStats(pcoinsdbview, stats)) {
         ret.push_back(Pair("height", (int64_t)stats.nHeight));
         ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
         ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
         ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
         ret.push_back(Pair("bytes_serialized", (int64_t)stats.nSerializedSize));
         ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
+        if (GetUTXOCommitment(commitment, hashCommitmentBlock) && hashCommitmentBlock == stats.hashBlock)
+            ret.push_back(Pair("muhash", commitment.GetHash().GetHex()));
         ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
     } else {
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
@@ -710,6 +780,354 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
     return ret;
 }
 
+UniValue verifyutxocommitment(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "verifyutxocommitment\n"
+            "\nChecks the rolling UTXO set commitment against one computed from scratch.\n"
+            "The set is walked without holding the chain lock, so blocks keep being processed meanwhile.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"height\":n,              (numeric) The block height the check was done at\n"
+            "  \"bestblock\": \"hex\",      (string) The block hash the check was done at\n"
+            "  \"muhash\": \"hash\",        (string) The rolling commitment\n"
+            "  \"muhash_computed\": \"hash\", (string) The commitment computed from the database\n"
+            "  \"txouts\": n,              (numeric) The number of outputs according to the rolling commitment\n"
+            "  \"txouts_computed\": n,     (numeric) The number of outputs found in the database\n"
+            "  \"consistent\": true|false  (boolean) Whether the two agree\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("verifyutxocommitment", "")
+            + HelpExampleRpc("verifyutxocommitment", "")
+        );
+
+    CUTXOCommitment commitment;
+    uint256 hashBlock;
+    int nHeight;
+    boost::scoped_ptr<CCoinsViewCursor> pcursor;
+    {
+        LOCK(cs_main);
+        FlushStateToDisk();
+        if (!GetUTXOCommitment(commitment, hashBlock))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "UTXO set commitment is not up to date");
+        // The cursor reads from a snapshot of the database as it is now.
+        pcursor.reset(pcoinsdbview->Cursor());
+        if (pcursor->GetBestBlock() != hashBlock)
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to flush the UTXO set");
+        nHeight = mapBlockIndex.find(hashBlock)->second->nHeight;
+    }
+
+    CUTXOCommitment computed;
+    if (!ComputeUTXOCommitment(pcursor.get(), computed))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+
+    uint256 hash = commitment.GetHash();
+    uint256 hashComputed = computed.GetHash();
+    bool fConsistent = hash == hashComputed && commitment.nTxOuts == computed.nTxOuts &&
+                       commitment.nTotalAmount == computed.nTotalAmount;
+    LogPrintf("%s: UTXO set commitment at %s is %s\n", __func__, hashBlock.ToString(), fConsistent ? "consistent" : "INCONSISTENT");
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("height", (int64_t)nHeight));
+    ret.push_back(Pair("bestblock", hashBlock.GetHex()));
+    ret.push_back(Pair("muhash", hash.GetHex()));
+    ret.push_back(Pair("muhash_computed", hashComputed.GetHex()));
+    ret.push_back(Pair("txouts", commitment.nTxOuts));
+    ret.push_back(Pair("txouts_computed", computed.nTxOuts));
+    ret.push_back(Pair("consistent", fConsistent));
+    return ret;
+}
+
+//! Serialize the coins of a transaction into a dumptxoutset file
+static void EncodeTxOutSet(const uint256& txid, const CCoins& coins, unsigned int nValueSize, CCoinsScanChunk& chunk)
+{
+    chunk.nTransactions++;
+    chunk.data << txid << coins;
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        if (!coins.vout[i].IsNull()) {
+            chunk.nTransactionOutputs++;
+            chunk.nTotalAmount += coins.vout[i].nValue;
+        }
+    }
+}
+
+/** Writes the chunks of a UTXO set scan, in order, to a dumptxoutset file. */
+class CTxOutSetWriter
+{
+private:
+    CAutoFile& file;
+    CHashWriter ss;
+
+public:
+    CCoinsStats stats;
+
+    CTxOutSetWriter(CAutoFile& fileIn) : file(fileIn), ss(SER_GETHASH, PROTOCOL_VERSION) {}
+
+    bool operator()(const CCoinsScanChunk& chunk)
+    {
+        if (!chunk.data.empty()) {
+            file.write(&chunk.data[0], chunk.data.size());
+            ss.write(&chunk.data[0], chunk.data.size());
+        }
+        stats.nTransactions += chunk.nTransactions;
+        stats.nTransactionOutputs += chunk.nTransactionOutputs;
+        stats.nTotalAmount += chunk.nTotalAmount;
+        return true;
+    }
+
+    uint256 GetHash() { return ss.GetHash(); }
+};
+
+UniValue dumptxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrites the unspent transaction output set to a file, reading it on several threads.\n"
+            "\nArguments:\n"
+            "1. \"path\"          (string, required) The file to write to, relative to the data directory unless absolute\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"path\": \"path\",          (string) The file written\n"
+            "  \"height\":n,              (numeric) The block height of the set\n"
+            "  \"bestblock\": \"hex\",      (string) The block hash of the set\n"
+            "  \"transactions\": n,       (numeric) The number of transactions written\n"
+            "  \"txouts\": n,             (numeric) The number of outputs written\n"
+            "  \"total_amount\": x.xxx,   (numeric) The total amount\n"
+            "  \"hash\": \"hash\",          (string) The hash of the records in the file\n"
+            "  \"muhash\": \"hash\"         (string) The rolling MuHash of the set, if it was up to date for this block\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    boost::filesystem::path path(params[0].get_str());
+    if (!path.is_complete())
+        path = GetDataDir() / path;
+    if (boost::filesystem::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+    // Only give the file its name once it is complete.
+    boost::filesystem::path pathTmp = path.string() + ".incomplete";
+
+    FlushStateToDisk();
+    CAutoFile file(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to open " + pathTmp.string() + " for writing");
+
+    CTxOutSetHeader header;
+    CTxOutSetWriter writer(file);
+    try {
+        file << header;
+        if (!pcoinsdbview->ScanCoins(GetScanThreads(), SER_DISK, CLIENT_VERSION, EncodeTxOutSet, boost::ref(writer), header.hashBlock))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+        file << writer.GetHash();
+        header.nTransactions = writer.stats.nTransactions;
+        if (fseek(file.Get(), 0, SEEK_SET) != 0)
+            throw std::ios_base::failure("seek failed");
+        file << header;
+        if (fflush(file.Get()) != 0)
+            throw std::ios_base::failure("flush failed");
+        FileCommit(file.Get());
+        file.fclose();
+        if (!RenameOver(pathTmp, path))
+            throw std::ios_base::failure("rename failed");
+    } catch (const std::ios_base::failure& e) {
+        file.fclose();
+        boost::filesystem::remove(pathTmp);
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to write " + pathTmp.string() + ": " + e.what());
+    } catch (...) {
+        file.fclose();
+        boost::filesystem::remove(pathTmp);
+        throw;
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("path", path.string()));
+    {
+        LOCK(cs_main);
+        ret.push_back(Pair("height", (int64_t)mapBlockIndex.find(header.hashBlock)->second->nHeight));
+    }
+    ret.push_back(Pair("bestblock", header.hashBlock.GetHex()));
+    ret.push_back(Pair("transactions", (int64_t)writer.stats.nTransactions));
+    ret.push_back(Pair("txouts", (int64_t)writer.stats.nTransactionOutputs));
+    ret.push_back(Pair("total_amount", ValueFromAmount(writer.stats.nTotalAmount)));
+    ret.push_back(Pair("hash", writer.GetHash().GetHex()));
+    CUTXOCommitment commitment;
+    uint256 hashCommitmentBlock;
+    if (GetUTXOCommitment(commitment, hashCommitmentBlock) && hashCommitmentBlock == header.hashBlock)
+        ret.push_back(Pair("muhash", commitment.GetHash().GetHex()));
+    return ret;
+}
+
+static UniValue DBStatsToJSON(const CDBWrapper& db)
+{
+    UniValue ret(UniValue::VOBJ);
+    // Every key starts with a one byte prefix below 0xff.
+    ret.push_back(Pair("approximate_size", (uint64_t)db.EstimateSize((char)0x00, (char)0xff)));
+    std::vector<CDBLevelStats> vLevels;
+    if (db.GetLevelStats(vLevels)) {
+        UniValue files(UniValue::VARR);
+        UniValue levels(UniValue::VARR);
+        BOOST_FOREACH(const CDBLevelStats& level, vLevels) {
+            files.push_back(level.nFiles);
+            UniValue obj(UniValue::VOBJ);
+            obj.push_back(Pair("files", level.nFiles));
+            obj.push_back(Pair("bytes", level.nBytes));
+            obj.push_back(Pair("target_bytes", level.nTargetBytes));
+            obj.push_back(Pair("compaction_time", level.dCompactionSeconds));
+            obj.push_back(Pair("compaction_read_mib", level.dCompactionReadMiB));
+            obj.push_back(Pair("compaction_written_mib", level.dCompactionWrittenMiB));
+            levels.push_back(obj);
+        }
+        ret.push_back(Pair("files_per_level", files));
+        ret.push_back(Pair("levels", levels));
+        ret.push_back(Pair("pending_compaction_bytes", EstimatePendingCompactionBytes(vLevels)));
+    }
+    CDBWriteStats stats = db.GetWriteStats();
+    UniValue writes(UniValue::VOBJ);
+    writes.push_back(Pair("count", stats.nWrites));
+    writes.push_back(Pair("bytes", stats.nWriteBytes));
+    writes.push_back(Pair("time", stats.nWriteMicros * 0.000001));
+    writes.push_back(Pair("max_time", stats.nMaxWriteMicros * 0.000001));
+    writes.push_back(Pair("stalls", stats.nStalls));
+    writes.push_back(Pair("stall_time", stats.nStallMicros * 0.000001));
+    ret.push_back(Pair("writes", writes));
+    UniValue compactions(UniValue::VOBJ);
+    compactions.push_back(Pair("count", stats.nCompactions));
+    compactions.push_back(Pair("time", stats.nCompactionMicros * 0.000001));
+    ret.push_back(Pair("manual_compactions", compactions));
+    std::string strValue;
+    if (db.GetProperty("leveldb.stats", strValue))
+        ret.push_back(Pair("stats", strValue));
+    if (db.GetProperty("leveldb.sstables", strValue))
+        ret.push_back(Pair("sstables", strValue));
+    return ret;
+}
+
+UniValue getdbstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getdbstats ( \"dbname\" )\n"
+            "\nReturns LevelDB statistics of the chain state and block index databases.\n"
+            "\nArguments:\n"
+            "1. \"dbname\"    (string, optional) Only report \"chainstate\" or \"blockindex\"\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"chainstate\": {                (json object) The chain state database\n"
+            "    \"approximate_size\": n,       (numeric) The approximate size on disk in bytes\n"
+            "    \"files_per_level\": [n,...],  (array) The number of table files at each level\n"
+            "    \"levels\": [                  (array) Every level, from 0 up\n"
+            "      {\n"
+            "        \"files\": n,                (numeric) The number of table files\n"
+            "        \"bytes\": n,                (numeric) Their size in bytes\n"
+            "        \"target_bytes\": n,         (numeric) The size above which LevelDB compacts the level, 0 if it goes by file count or never\n"
+            "        \"compaction_time\": x.xxx,  (numeric) Seconds spent in compactions writing into the level\n"
+            "        \"compaction_read_mib\": n,  (numeric) MiB those compactions read\n"
+            "        \"compaction_written_mib\": n (numeric) MiB those compactions wrote\n"
+            "      }, ...\n"
+            "    ],\n"
+            "    \"pending_compaction_bytes\": n, (numeric) Estimated bytes LevelDB still has to compact\n"
+            "    \"writes\": {                  (json object) Batches written since startup\n"
+            "      \"count\": n,                (numeric) The number of batches\n"
+            "      \"bytes\": n,                (numeric) The bytes of keys and values in them\n"
+            "      \"time\": x.xxx,             (numeric) Seconds spent writing them\n"
+            "      \"max_time\": x.xxx,         (numeric) Seconds the slowest write took\n"
+            "      \"stalls\": n,               (numeric) Writes that took longer than " + strprintf("%d", DB_WRITE_STALL_MICROS / 1000) + "ms, mostly waiting for compactions\n"
+            "      \"stall_time\": x.xxx        (numeric) Seconds spent in those writes\n"
+            "    },\n"
+            "    \"manual_compactions\": {      (json object) Compactions run by compactdb or -compactinterval since startup\n"
+            "      \"count\": n,                (numeric) The number of compactions\n"
+            "      \"time\": x.xxx              (numeric) Seconds spent in them\n"
+            "    },\n"
+            "    \"stats\": \"str\",              (string) Compaction statistics (leveldb.stats)\n"
+            "    \"sstables\": \"str\"            (string) The table files per level (leveldb.sstables)\n"
+            "  },\n"
+            "  \"blockindex\": { ... }          (json object) The block index database, in the same format\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdbstats", "")
+            + HelpExampleCli("getdbstats", "\"chainstate\"")
+            + HelpExampleRpc("getdbstats", "\"chainstate\"")
+        );
+
+    std::string strName;
+    if (params.size() > 0) {
+        strName = params[0].get_str();
+        if (strName != "chainstate" && strName != "blockindex")
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown database " + strName);
+    }
+
+    LOCK(cs_main);
+    UniValue ret(UniValue::VOBJ);
+    if ((strName.empty() || strName == "chainstate") && pcoinsdbview)
+        ret.push_back(Pair("chainstate", DBStatsToJSON(pcoinsdbview->GetDB())));
+    if ((strName.empty() || strName == "blockindex") && pblocktree)
+        ret.push_back(Pair("blockindex", DBStatsToJSON(*pblocktree)));
+    return ret;
+}
+
+static UniValue CompactDB(const CDBWrapper& db)
+{
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("size_before", (uint64_t)db.EstimateSize((char)0x00, (char)0xff)));
+    int64_t nTimeStart = GetTimeMicros();
+    db.CompactFull();
+    ret.push_back(Pair("time", (GetTimeMicros() - nTimeStart) * 0.000001));
+    ret.push_back(Pair("size_after", (uint64_t)db.EstimateSize((char)0x00, (char)0xff)));
+    return ret;
+}
+
+UniValue compactdb(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "compactdb ( \"dbname\" )\n"
+            "\nCompact the chain state and block index databases, which drops deleted and overwritten entries\n"
+            "from disk and leaves every key in one table file. This can take minutes on a large chain state;\n"
+            "the node keeps validating blocks meanwhile, but the disk is busy, so prefer a quiet moment.\n"
+            "\nArguments:\n"
+            "1. \"dbname\"    (string, optional) Only compact \"chainstate\" or \"blockindex\"\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"chainstate\": {             (json object) The chain state database\n"
+            "    \"size_before\": n,         (numeric) The approximate size on disk in bytes before compacting\n"
+            "    \"time\": x.xxx,            (numeric) Seconds the compaction took\n"
+            "    \"size_after\": n           (numeric) The approximate size on disk in bytes afterwards\n"
+            "  },\n"
+            "  \"blockindex\": { ... }       (json object) The block index database, in the same format\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("compactdb", "")
+            + HelpExampleCli("compactdb", "\"chainstate\"")
+            + HelpExampleRpc("compactdb", "\"chainstate\"")
+        );
+
+    std::string strName;
+    if (params.size() > 0) {
+        strName = params[0].get_str();
+        if (strName != "chainstate" && strName != "blockindex")
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown database " + strName);
+    }
+
+    // The databases only go away at shutdown; compacting does not need cs_main.
+    CCoinsViewDB* pcoinsview;
+    CBlockTreeDB* pblocktreeview;
+    {
+        LOCK(cs_main);
+        pcoinsview = pcoinsdbview;
+        pblocktreeview = pblocktree;
+    }
+    UniValue ret(UniValue::VOBJ);
+    if ((strName.empty() || strName == "chainstate") && pcoinsview)
+        ret.push_back(Pair("chainstate", CompactDB(pcoinsview->GetDB())));
+    if ((strName.empty() || strName == "blockindex") && pblocktreeview)
+        ret.push_back(Pair("blockindex", CompactDB(*pblocktreeview)));
+    return ret;
+}
+
 UniValue gettxout(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -895,6 +1313,12 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
             "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
             "  \"pruned\": xx,             (boolean) if the blocks are subject to pruning\n"
             "  \"pruneheight\": xxxxxx,    (numeric) lowest-height complete block stored\n"
+            "  \"snapshot\": {              (object, optional) the UTXO snapshot the chain state was loaded from (see -loadtxoutset)\n"
+            "     \"bestblock\": \"hex\",     (string) the block the snapshot is of\n"
+            "     \"status\": \"xxxx\",       (string) one of \"pending\" (waiting to be loaded), \"checking\" (blocks below it being connected) or \"validated\"\n"
+            "     \"checkheight\": xxxxxx,  (numeric) the height the blocks below the snapshot have been connected up to (only for \"checking\" status)\n"
+            "     \"muhash\": \"hex\"         (string) the UTXO set commitment of the snapshot (unless \"pending\")\n"
+            "  },\n"
             "  \"softforks\": [            (array) status of softforks in progress\n"
             "     {\n"
             "        \"id\": \"xxxx\",        (string) name of softfork\n"
@@ -955,6 +1379,20 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
 
         obj.push_back(Pair("pruneheight",        block->nHeight));
     }
+
+    CTxOutSetSnapshot snapshot;
+    int nCheckHeight;
+    bool fPending;
+    if (GetTxOutSetSnapshot(snapshot, nCheckHeight, fPending)) {
+        UniValue snapshotobj(UniValue::VOBJ);
+        snapshotobj.push_back(Pair("bestblock", snapshot.hashBlock.GetHex()));
+        snapshotobj.push_back(Pair("status", fPending ? "pending" : snapshot.fValidated ? "validated" : "checking"));
+        if (!fPending && !snapshot.fValidated)
+            snapshotobj.push_back(Pair("checkheight", nCheckHeight));
+        if (!fPending)
+            snapshotobj.push_back(Pair("muhash", snapshot.commitment.GetHash().GetHex()));
+        obj.push_back(Pair("snapshot", snapshotobj));
+    }
     return obj;
 }
 
@@ -1189,6 +1627,8 @@ UniValue reconsiderblock(const UniValue& params, bool fHelp)
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafeMode
   //  --------------------- ------------------------  -----------------------  ----------
+    { "blockchain",         "compactdb",              &compactdb,              true  },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           true  },
     { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true  },
     { "blockchain",         "getbestblockhash",       &getbestblockhash,       true  },
     { "blockchain",         "getblockcount",          &getblockcount,          true  },
@@ -1196,6 +1636,7 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getblockhash",           &getblockhash,           true  },
     { "blockchain",         "getblockheader",         &getblockheader,         true  },
     { "blockchain",         "getchaintips",           &getchaintips,           true  },
+    { "blockchain",         "getdbstats",             &getdbstats,             true  },
     { "blockchain",         "getdifficulty",          &getdifficulty,          true  },
     { "blockchain",         "getmempoolancestors",    &getmempoolancestors,    true  },
     { "blockchain",         "getmempooldescendants",  &getmempooldescendants,  true  },
@@ -1205,6 +1646,7 @@ static const CRPCCommand commands[] =
     { "blockchain",         "gettxout",               &gettxout,               true  },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true  },
     { "blockchain",         "verifychain",            &verifychain,            true  },
+    { "blockchain",         "verifyutxocommitment",   &verifyutxocommitment,   true  },
 
     /* Not shown in help */
     { "hidden",             "invalidateblock",        &invalidateblock,        true  },
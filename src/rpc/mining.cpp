@@ -255,6 +255,53 @@ UniValue getmininginfo(const UniValue& params, bool fHelp)
     return obj;
 }
 
+UniValue getretargetinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getretargetinfo ( count )\n"
+            "\nReturns the most recent difficulty retarget decisions, oldest first.\n"
+            "Every header, block and block template the node validates or builds leads to one.\n"
+            "\nArguments:\n"
+            "1. count        (numeric, optional, default=" + strprintf("%u", RETARGET_TRACE_SIZE) + ") The number of decisions to return\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"height\": nnn,          (numeric) The height the new target applies to\n"
+            "    \"algorithm\": \"xxxx\",   (string) \"kgw\" (Kimoto Gravity Well) or \"digishield\"\n"
+            "    \"blocks\": nnn,          (numeric) The number of past blocks taken into account\n"
+            "    \"actualtimespan\": nnn,  (numeric) The time in seconds those blocks took\n"
+            "    \"adjustedtimespan\": nnn,(numeric) The timespan after damping and bounds\n"
+            "    \"targettimespan\": nnn,  (numeric) The time in seconds those blocks should have taken\n"
+            "    \"bitsbefore\": \"xxxx\",  (string) The compact target of the previous block\n"
+            "    \"bitsafter\": \"xxxx\"    (string) The new compact target\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getretargetinfo", "10")
+            + HelpExampleRpc("getretargetinfo", "10")
+        );
+
+    int nCount = params.size() > 0 ? params[0].get_int() : RETARGET_TRACE_SIZE;
+    if (nCount < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+
+    UniValue ret(UniValue::VARR);
+    BOOST_FOREACH(const CRetargetTrace& trace, GetRetargetTrace(nCount)) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("height",           trace.nHeight));
+        obj.push_back(Pair("algorithm",        trace.strAlgorithm));
+        obj.push_back(Pair("blocks",           trace.nBlocks));
+        obj.push_back(Pair("actualtimespan",   trace.nActualTimespan));
+        obj.push_back(Pair("adjustedtimespan", trace.nAdjustedTimespan));
+        obj.push_back(Pair("targettimespan",   trace.nTargetTimespan));
+        obj.push_back(Pair("bitsbefore",       strprintf("%08x", trace.nBitsBefore)));
+        obj.push_back(Pair("bitsafter",        strprintf("%08x", trace.nBitsAfter)));
+        ret.push_back(obj);
+    }
+    return ret;
+}
 
 // NOTE: Unlike wallet RPC (which use BTC values), mining RPCs follow GBT (BIP 22) in using satoshi amounts
 UniValue prioritisetransaction(const UniValue& params, bool fHelp)
@@ -518,35 +565,34 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
         // TODO: Maybe recheck connections/IBD and (if something wrong) send an expires-immediately template to stop miners?
     }
 
-    // Update block
-    static CBlockIndex* pindexPrev;
-    static int64_t nStart;
-    static CBlockTemplate* pblocktemplate;
-    if (pindexPrev != chainActive.Tip() ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
-    {
-        // Clear pindexPrev so future calls make a new block, despite any failures from here on
-        pindexPrev = NULL;
-
-        // Store the pindexBest used before CreateNewBlock, to avoid races
-        nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-        CBlockIndex* pindexPrevNew = chainActive.Tip();
-        nStart = GetTime();
-
-        // Create new block
-        if(pblocktemplate)
-        {
-            delete pblocktemplate;
-            pblocktemplate = NULL;
+    // Update block: the template follows the mempool incrementally and is
+    // rebuilt on a new tip, or at most every 5 seconds when it cannot be.
+    // Rebuilding does not need cs_main, so it is released meanwhile and
+    // cs_template keeps concurrent calls off the updater instead; it is
+    // always taken before cs_main.
+    static CCriticalSection cs_template;
+    static CBlockTemplateUpdater templateUpdater(Params(), CScript() << OP_TRUE);
+    LEAVE_CRITICAL_SECTION(cs_main);
+    CCriticalBlock lockTemplate(cs_template, "cs_template", __FILE__, __LINE__);
+    CBlockTemplate* pblocktemplate;
+    while (true) {
+        try {
+            pblocktemplate = templateUpdater.Update(5);
+        } catch (...) {
+            ENTER_CRITICAL_SECTION(cs_main);
+            throw;
         }
-        CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy);
-        if (!pblocktemplate)
-            throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
-
-        // Need to update only after we know CreateNewBlock succeeded
-        pindexPrev = pindexPrevNew;
+        ENTER_CRITICAL_SECTION(cs_main);
+        if (!pblocktemplate || pblocktemplate->block.hashPrevBlock == chainActive.Tip()->GetBlockHash())
+            break;
+        // A block was connected in the meantime
+        LEAVE_CRITICAL_SECTION(cs_main);
     }
+    if (!pblocktemplate)
+        throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
+    nTransactionsUpdatedLast = templateUpdater.GetTransactionsUpdated();
+    CBlockIndex* pindexPrev = chainActive.Tip();
+
     CBlock* pblock = &pblocktemplate->block; // pointer for convenience
     const Consensus::Params& consensusParams = Params().GetConsensus();
 
@@ -918,6 +964,7 @@ static const CRPCCommand commands[] =
   //  --------------------- ------------------------  -----------------------  ----------
     { "mining",             "getnetworkhashps",       &getnetworkhashps,       true  },
     { "mining",             "getmininginfo",          &getmininginfo,          true  },
+    { "mining",             "getretargetinfo",        &getretargetinfo,        true  },
     { "mining",             "prioritisetransaction",  &prioritisetransaction,  true  },
     { "mining",             "getblocktemplate",       &getblocktemplate,       true  },
     { "mining",             "submitblock",            &submitblock,            true  },
@@ -0,0 +1,201 @@
+// Copyright (c) 2017 The Einsteinium Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <new>
+#include <vector>
+
+/**
+ * Hands out small blocks of memory carved from large chunks, and keeps freed
+ * blocks on a free list per size class for reuse. This avoids a malloc per
+ * node for node based containers, with its per-allocation overhead and heap
+ * fragmentation. Requests larger than MAX_BLOCK_SIZE, or needing stronger
+ * alignment than ALIGN, are passed on to operator new.
+ *
+ * Chunks are only returned to the system by Release(), so users wanting to
+ * shrink a pool with live blocks have to move them to a fresh one. Not thread
+ * safe.
+ */
+class PoolResource
+{
+public:
+    static const size_t ALIGN = sizeof(void*);
+    static const size_t MAX_BLOCK_SIZE = 256;
+    static const size_t DEFAULT_CHUNK_SIZE = 256 * 1024;
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    const size_t nChunkSize;
+    std::vector<char*> vChunks;
+    FreeBlock* freeLists[MAX_BLOCK_SIZE / ALIGN + 1];
+    char* pChunkFree;       //!< start of the unused tail of the newest chunk
+    char* pChunkEnd;
+    size_t nBlocksInUse;
+    size_t nBytesInUse;
+
+    static size_t SizeClass(size_t nBytes) { return (nBytes + ALIGN - 1) / ALIGN; }
+
+    PoolResource(const PoolResource&);
+    PoolResource& operator=(const PoolResource&);
+
+public:
+    explicit PoolResource(size_t nChunkSizeIn = DEFAULT_CHUNK_SIZE) : nChunkSize(nChunkSizeIn), pChunkFree(NULL), pChunkEnd(NULL), nBlocksInUse(0), nBytesInUse(0)
+    {
+        assert(nChunkSize >= MAX_BLOCK_SIZE);
+        for (size_t i = 0; i < sizeof(freeLists) / sizeof(freeLists[0]); i++)
+            freeLists[i] = NULL;
+    }
+
+    ~PoolResource()
+    {
+        for (size_t i = 0; i < vChunks.size(); i++)
+            ::operator delete(vChunks[i]);
+    }
+
+    /** Whether a request is served from the pool rather than operator new. */
+    static bool IsPooled(size_t nBytes, size_t nAlign) { return nBytes <= MAX_BLOCK_SIZE && nAlign <= ALIGN; }
+
+    /** The number of bytes a pooled request of nBytes takes up. */
+    static size_t BlockSize(size_t nBytes) { return SizeClass(nBytes) * ALIGN; }
+
+    void* Allocate(size_t nBytes, size_t nAlign)
+    {
+        if (!IsPooled(nBytes, nAlign))
+            return ::operator new(nBytes);
+        const size_t nClass = SizeClass(nBytes);
+        nBlocksInUse++;
+        nBytesInUse += nClass * ALIGN;
+        if (freeLists[nClass]) {
+            FreeBlock* block = freeLists[nClass];
+            freeLists[nClass] = block->next;
+            return block;
+        }
+        const size_t nBlockSize = nClass * ALIGN;
+        if (pChunkFree == NULL || (size_t)(pChunkEnd - pChunkFree) < nBlockSize) {
+            // Leftovers of the old chunk are recycled as blocks of their size.
+            if (pChunkFree != NULL && pChunkEnd - pChunkFree >= (ptrdiff_t)ALIGN)
+                PushFree(pChunkFree, (pChunkEnd - pChunkFree) / ALIGN);
+            pChunkFree = static_cast<char*>(::operator new(nChunkSize));
+            pChunkEnd = pChunkFree + nChunkSize;
+            vChunks.push_back(pChunkFree);
+        }
+        void* p = pChunkFree;
+        pChunkFree += nBlockSize;
+        return p;
+    }
+
+    void Deallocate(void* p, size_t nBytes, size_t nAlign)
+    {
+        if (!IsPooled(nBytes, nAlign)) {
+            ::operator delete(p);
+            return;
+        }
+        assert(nBlocksInUse > 0);
+        nBlocksInUse--;
+        nBytesInUse -= SizeClass(nBytes) * ALIGN;
+        PushFree(p, SizeClass(nBytes));
+    }
+
+    /**
+     * Return all chunks to the system if no block is in use anymore.
+     * Returns whether anything was released.
+     */
+    bool Release()
+    {
+        if (nBlocksInUse != 0 || vChunks.empty())
+            return false;
+        for (size_t i = 0; i < vChunks.size(); i++)
+            ::operator delete(vChunks[i]);
+        vChunks.clear();
+        for (size_t i = 0; i < sizeof(freeLists) / sizeof(freeLists[0]); i++)
+            freeLists[i] = NULL;
+        pChunkFree = pChunkEnd = NULL;
+        return true;
+    }
+
+    size_t BlocksInUse() const { return nBlocksInUse; }
+    size_t BytesInUse() const { return nBytesInUse; }
+    /** The memory the pool holds, including free blocks and unused chunk tails. */
+    size_t BytesAllocated() const { return vChunks.size() * nChunkSize; }
+    size_t ChunkCount() const { return vChunks.size(); }
+    size_t ChunkSize() const { return nChunkSize; }
+
+private:
+    void PushFree(void* p, size_t nClass)
+    {
+        FreeBlock* block = static_cast<FreeBlock*>(p);
+        block->next = freeLists[nClass];
+        freeLists[nClass] = block;
+    }
+};
+
+/**
+ * Allocator drawing single objects from a PoolResource, for use by node
+ * based containers. Arrays (such as hash table buckets) bypass the pool.
+ */
+template <typename T>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U> other;
+    };
+
+    explicit PoolAllocator(PoolResource* resourceIn) throw() : resource(resourceIn) {}
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& other) throw() : resource(other.GetResource()) {}
+
+    T* allocate(size_t n)
+    {
+        if (n != 1)
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        return static_cast<T*>(resource->Allocate(sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        if (n != 1) {
+            ::operator delete(p);
+            return;
+        }
+        resource->Deallocate(p, sizeof(T), alignof(T));
+    }
+
+    PoolResource* GetResource() const { return resource; }
+
+private:
+    PoolResource* resource;
+};
+
+template <typename T, typename U>
+bool operator==(const PoolAllocator<T>& a, const PoolAllocator<U>& b)
+{
+    return a.GetResource() == b.GetResource();
+}
+
+template <typename T, typename U>
+bool operator!=(const PoolAllocator<T>& a, const PoolAllocator<U>& b)
+{
+    return !(a == b);
+}
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
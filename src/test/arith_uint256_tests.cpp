@@ -366,6 +366,18 @@ BOOST_AUTO_TEST_CASE( divide )
     BOOST_CHECK(R2L / MaxL == ZeroL);
     BOOST_CHECK(MaxL / R2L == 1);
     BOOST_CHECK_THROW(R2L / ZeroL, uint_error);
+
+    // Single word divisors take a separate path; check q * d <= n < (q + 1) * d.
+    const uint32_t smalldivs[] = { 2, 3, 144, 10080, 0x7fffffff, 0xffffffff };
+    for (unsigned int i = 0; i < sizeof(smalldivs) / sizeof(smalldivs[0]); i++) {
+        const arith_uint256 d(smalldivs[i]);
+        const arith_uint256 nums[] = { R1L, R2L, MaxL >> 1, arith_uint256(0x123456789abcdefULL) };
+        for (unsigned int j = 0; j < sizeof(nums) / sizeof(nums[0]); j++) {
+            arith_uint256 q = nums[j] / d;
+            BOOST_CHECK(q * d <= nums[j]);
+            BOOST_CHECK(nums[j] - q * d < d);
+        }
+    }
 }
 
 
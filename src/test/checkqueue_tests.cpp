@@ -0,0 +1,66 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+#include "utiltime.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(checkqueue_tests, BasicTestingSetup)
+
+struct FakeCheck
+{
+    bool fResult;
+
+    FakeCheck() : fResult(true) {}
+    FakeCheck(bool fResultIn) : fResult(fResultIn) {}
+
+    bool operator()() { return fResult; }
+    void swap(FakeCheck& check) { std::swap(fResult, check.fResult); }
+};
+
+static void RunControl(CCheckQueue<FakeCheck>* pqueue, boost::mutex* pmutex, bool* pfEntered, bool* pfResult)
+{
+    CCheckQueueControl<FakeCheck> control(pqueue);
+    {
+        boost::unique_lock<boost::mutex> lock(*pmutex);
+        *pfEntered = true;
+    }
+    std::vector<FakeCheck> vChecks(1, FakeCheck(false));
+    control.Add(vChecks);
+    *pfResult = control.Wait();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_control_serialized)
+{
+    // Without worker threads the checks run in Wait()
+    CCheckQueue<FakeCheck> queue(128);
+    boost::mutex mutex;
+    bool fEntered = false;
+    bool fResult = true;
+    boost::thread thread;
+    {
+        CCheckQueueControl<FakeCheck> control(&queue);
+        thread = boost::thread(boost::bind(&RunControl, &queue, &mutex, &fEntered, &fResult));
+        std::vector<FakeCheck> vChecks(2);
+        control.Add(vChecks);
+        // The second control waits for this one to go
+        MilliSleep(100);
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            BOOST_CHECK(!fEntered);
+        }
+        BOOST_CHECK(control.Wait());
+    }
+    thread.join();
+    BOOST_CHECK(fEntered);
+    BOOST_CHECK(!fResult);
+    BOOST_CHECK(queue.IsIdle());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
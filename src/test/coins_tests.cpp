@@ -9,11 +9,15 @@
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
 #include "main.h"
+#include "txdb.h"
+#include "utiltime.h"
 #include "consensus/validation.h"
 
 #include <vector>
 #include <map>
 
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
 #include <boost/test/unit_test.hpp>
 
 namespace
@@ -46,7 +50,7 @@ public:
 
     uint256 GetBestBlock() const { return hashBestBlock_; }
 
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase = true)
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             if (it->second.flags & CCoinsCacheEntry::DIRTY) {
@@ -57,7 +61,10 @@ public:
                     map_.erase(it->first);
                 }
             }
-            mapCoins.erase(it++);
+            if (fErase)
+                mapCoins.erase(it++);
+            else
+                ++it;
         }
         if (!hashBlock.IsNull())
             hashBestBlock_ = hashBlock;
@@ -65,6 +72,69 @@ public:
     }
 };
 
+class CCoinsViewFailingTest : public CCoinsViewTest
+{
+public:
+    bool fFail;
+
+    CCoinsViewFailingTest() : fFail(true) {}
+
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase = true)
+    {
+        if (fFail)
+            return false;
+        return CCoinsViewTest::BatchWrite(mapCoins, hashBlock, fErase);
+    }
+};
+
+// Holds up reads of one txid, so a test can tell how far the prefetch
+// workers got.
+class CCoinsViewGateTest : public CCoinsViewTest
+{
+    mutable boost::mutex mutex;
+    mutable boost::condition_variable cond;
+    uint256 txidGate;
+    mutable bool fWaiting;
+
+public:
+    CCoinsViewGateTest() : fWaiting(false) {}
+
+    bool GetCoins(const uint256& txid, CCoins& coins) const
+    {
+        bool ret = CCoinsViewTest::GetCoins(txid, coins);
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (txid == txidGate) {
+            fWaiting = true;
+            cond.notify_all();
+            while (txid == txidGate)
+                cond.wait(lock);
+        }
+        return ret;
+    }
+
+    //! Hold up reads of txid from now on, letting any held up read go on
+    void SetGate(const uint256& txid)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        txidGate = txid;
+        fWaiting = false;
+        cond.notify_all();
+    }
+
+    bool IsWaiting() const
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return fWaiting;
+    }
+
+    void WaitAtGate() const
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!fWaiting)
+            cond.wait(lock);
+    }
+};
+
 class CCoinsViewCacheTest : public CCoinsViewCache
 {
 public:
@@ -107,6 +177,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     bool updated_an_entry = false;
     bool found_an_entry = false;
     bool missed_an_entry = false;
+    bool synced_a_cache = false;
 
     // A simple map to track what we expect the cache stack to represent.
     std::map<uint256, CCoins> result;
@@ -168,7 +239,14 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
             // Every 100 iterations, flush an intermediate cache
             if (stack.size() > 1 && insecure_rand() % 2 == 0) {
                 unsigned int flushIndex = insecure_rand() % (stack.size() - 1);
-                stack[flushIndex]->Flush();
+                if (insecure_rand() % 2) {
+                    stack[flushIndex]->Flush();
+                } else {
+                    // Write without emptying, then drop some of what is left.
+                    stack[flushIndex]->Sync();
+                    stack[flushIndex]->Evict(stack[flushIndex]->DynamicMemoryUsage() / 2);
+                    synced_a_cache = true;
+                }
             }
         }
         if (insecure_rand() % 100 == 0) {
@@ -209,6 +287,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(updated_an_entry);
     BOOST_CHECK(found_an_entry);
     BOOST_CHECK(missed_an_entry);
+    BOOST_CHECK(synced_a_cache);
 }
 
 // This test is similar to the previous test
@@ -316,7 +395,13 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
             // Every 100 iterations, flush an intermediate cache
             if (stack.size() > 1 && insecure_rand() % 2 == 0) {
                 unsigned int flushIndex = insecure_rand() % (stack.size() - 1);
-                stack[flushIndex]->Flush();
+                if (insecure_rand() % 2) {
+                    stack[flushIndex]->Flush();
+                } else {
+                    // Write without emptying, then drop some of what is left.
+                    stack[flushIndex]->Sync();
+                    stack[flushIndex]->Evict(stack[flushIndex]->DynamicMemoryUsage() / 2);
+                }
             }
         }
         if (insecure_rand() % 100 == 0) {
@@ -346,6 +431,179 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
     BOOST_CHECK(spent_a_duplicate_coinbase);
 }
 
+// A Sync() whose write fails must leave the modified and spent entries in
+// place, so that a later flush still writes them.
+BOOST_AUTO_TEST_CASE(coins_sync_failure)
+{
+    CCoinsViewFailingTest base;
+    CCoinsViewCacheTest cache(&base);
+    uint256 txidSpent = GetRandHash();
+    uint256 txidNew = GetRandHash();
+    CCoins coins;
+
+    {
+        CCoinsModifier modifier = cache.ModifyNewCoins(txidSpent, false);
+        modifier->vout.resize(1);
+        modifier->vout[0].nValue = 1;
+    }
+    base.fFail = false;
+    BOOST_CHECK(cache.Sync());
+    BOOST_CHECK(base.GetCoins(txidSpent, coins) && !coins.IsPruned());
+
+    {
+        CCoinsModifier modifier = cache.ModifyCoins(txidSpent);
+        modifier->Clear();
+    }
+    {
+        CCoinsModifier modifier = cache.ModifyNewCoins(txidNew, false);
+        modifier->vout.resize(1);
+        modifier->vout[0].nValue = 2;
+    }
+    base.fFail = true;
+    BOOST_CHECK(!cache.Sync());
+    BOOST_CHECK(!base.GetCoins(txidNew, coins));
+    BOOST_CHECK(base.GetCoins(txidSpent, coins) && !coins.IsPruned());
+    BOOST_CHECK(cache.HaveCoinsInCache(txidNew));
+    cache.SelfTest();
+
+    base.fFail = false;
+    BOOST_CHECK(cache.Sync());
+    BOOST_CHECK(base.GetCoins(txidNew, coins) && coins.vout[0].nValue == 2);
+    BOOST_CHECK(!base.GetCoins(txidSpent, coins) || coins.IsPruned());
+    cache.SelfTest();
+}
+
+BOOST_AUTO_TEST_CASE(coins_evict_compacts)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+    std::vector<uint256> txids;
+    for (int i = 0; i < 20000; i++) {
+        txids.push_back(GetRandHash());
+        CCoinsModifier modifier = cache.ModifyNewCoins(txids.back(), false);
+        modifier->vout.resize(1);
+        modifier->vout[0].nValue = i + 1;
+    }
+    BOOST_CHECK(cache.Sync());
+    cache.SelfTest();
+
+    // The pool chunks the evicted entries leave behind must be given back,
+    // or the cache would still be charged for them.
+    const size_t nTarget = cache.DynamicMemoryUsage() / 2;
+    BOOST_CHECK(cache.Evict(nTarget) > 0);
+    BOOST_CHECK(cache.DynamicMemoryUsage() <= nTarget + PoolResource::DEFAULT_CHUNK_SIZE);
+    cache.SelfTest();
+
+    size_t nCached = 0;
+    for (size_t i = 0; i < txids.size(); i++) {
+        if (!cache.HaveCoinsInCache(txids[i]))
+            continue;
+        nCached++;
+        BOOST_CHECK_EQUAL(cache.AccessCoins(txids[i])->vout[0].nValue, (CAmount)(i + 1));
+    }
+    BOOST_CHECK(nCached > 0 && nCached < txids.size());
+}
+
+static void WriteCoins(CCoinsView* view, const uint256& txid, CAmount nValue)
+{
+    CCoinsViewCacheTest cache(view);
+    {
+        CCoinsModifier modifier = cache.ModifyNewCoins(txid, false);
+        modifier->vout.resize(1);
+        modifier->vout[0].nValue = nValue;
+    }
+    BOOST_CHECK(cache.Flush());
+}
+
+static CAmount ReadValue(const CCoinsView& view, const uint256& txid)
+{
+    CCoins coins;
+    if (!view.GetCoins(txid, coins) || coins.vout.empty())
+        return -1;
+    return coins.vout[0].nValue;
+}
+
+BOOST_AUTO_TEST_CASE(coins_prefetch)
+{
+    CCoinsViewGateTest base;
+    std::vector<uint256> txids;
+    for (int i = 0; i < 16; i++) {
+        txids.push_back(GetRandHash());
+        WriteCoins(&base, txids.back(), 1);
+    }
+    CCoins coins;
+    BOOST_CHECK(base.GetCoins(txids[0], coins));
+    size_t nEntryUsage = coins.DynamicMemoryUsage() + sizeof(std::pair<const uint256, CCoins>);
+    CCoinsViewPrefetch prefetch(&base, 4 * nEntryUsage);
+
+    // Reads of the marker are only made to see how far the single worker
+    // got, as it works through the queue in order.
+    uint256 marker = GetRandHash();
+    std::vector<uint256> vTxid(1, marker);
+    base.SetGate(marker);
+    boost::thread thread(boost::bind(&CCoinsViewPrefetch::ThreadPrefetch, &prefetch));
+    // Prefetch() ignores requests until the worker has started.
+    while (!base.IsWaiting()) {
+        prefetch.Prefetch(vTxid);
+        MilliSleep(1);
+    }
+
+    // Staged coins are served instead of what the base has now, once.
+    marker = GetRandHash();
+    vTxid.assign(1, txids[0]);
+    vTxid.push_back(marker);
+    base.SetGate(marker);
+    prefetch.Prefetch(vTxid);
+    base.WaitAtGate();
+    BOOST_CHECK_EQUAL(prefetch.StagedUsage(), nEntryUsage);
+    WriteCoins(&base, txids[0], 2);
+    BOOST_CHECK_EQUAL(ReadValue(prefetch, txids[0]), 1);
+    BOOST_CHECK_EQUAL(prefetch.StagedUsage(), 0U);
+    BOOST_CHECK_EQUAL(ReadValue(prefetch, txids[0]), 2);
+
+    // A write through the view drops what is staged.
+    marker = GetRandHash();
+    vTxid.assign(1, txids[1]);
+    vTxid.push_back(marker);
+    base.SetGate(marker);
+    prefetch.Prefetch(vTxid);
+    base.WaitAtGate();
+    BOOST_CHECK_EQUAL(prefetch.StagedUsage(), nEntryUsage);
+    WriteCoins(&prefetch, txids[2], 2);
+    BOOST_CHECK_EQUAL(prefetch.StagedUsage(), 0U);
+    BOOST_CHECK_EQUAL(ReadValue(prefetch, txids[1]), 1);
+
+    // So is a read that was in flight during the write, as it may have seen
+    // the coins from before it.
+    base.SetGate(txids[3]);
+    vTxid.assign(1, txids[3]);
+    prefetch.Prefetch(vTxid);
+    base.WaitAtGate();
+    WriteCoins(&prefetch, txids[3], 2);
+    marker = GetRandHash();
+    vTxid.assign(1, marker);
+    base.SetGate(marker);
+    prefetch.Prefetch(vTxid);
+    base.WaitAtGate();
+    BOOST_CHECK_EQUAL(prefetch.StagedUsage(), 0U);
+    BOOST_CHECK_EQUAL(ReadValue(prefetch, txids[3]), 2);
+
+    // Staged coins never take up more than the limit.
+    marker = GetRandHash();
+    vTxid.assign(txids.begin() + 4, txids.end());
+    vTxid.push_back(marker);
+    base.SetGate(marker);
+    prefetch.Prefetch(vTxid);
+    base.WaitAtGate();
+    BOOST_CHECK(prefetch.StagedUsage() > 0);
+    BOOST_CHECK(prefetch.StagedUsage() <= 4 * nEntryUsage);
+
+    base.SetGate(uint256());
+    thread.interrupt();
+    thread.join();
+    BOOST_CHECK_EQUAL(prefetch.StagedUsage(), 0U);
+}
+
 BOOST_AUTO_TEST_CASE(ccoins_serialization)
 {
     // Good example
@@ -415,4 +673,285 @@ BOOST_AUTO_TEST_CASE(ccoins_serialization)
     }
 }
 
+BOOST_FIXTURE_TEST_CASE(coins_db_per_output_layout, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    BOOST_CHECK(!db.IsPerOutput());
+
+    // Fill the per-transaction layout with transactions with gaps in their outputs.
+    std::map<uint256, CCoins> result;
+    {
+        CCoinsViewCache cache(&db);
+        for (int i = 0; i < 100; i++) {
+            uint256 txid = GetRandHash();
+            CCoinsModifier coins = cache.ModifyNewCoins(txid, i % 10 == 0);
+            coins->fCoinBase = i % 10 == 0;
+            coins->nVersion = 1 + i % 2;
+            coins->nHeight = 100 + i;
+            coins->vout.resize(1 + insecure_rand() % 40);
+            for (unsigned int n = 0; n < coins->vout.size(); n++) {
+                if (n + 1 < coins->vout.size() && insecure_rand() % 4 == 0)
+                    continue;
+                coins->vout[n].nValue = insecure_rand();
+                coins->vout[n].scriptPubKey.assign(insecure_rand() & 0x3F, 0);
+            }
+            result[txid] = *coins;
+        }
+        cache.SetBestBlock(GetRandHash());
+        BOOST_CHECK(cache.Flush());
+    }
+
+    BOOST_CHECK(db.Upgrade(true));
+    BOOST_CHECK(db.IsPerOutput());
+
+    // Spend some outputs, some transactions entirely, and add a new one.
+    {
+        CCoinsViewCache cache(&db);
+        int i = 0;
+        for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); ++it, ++i) {
+            if (i % 3 != 0)
+                continue;
+            CCoinsModifier coins = cache.ModifyCoins(it->first);
+            for (unsigned int n = 0; n < coins->vout.size(); n++) {
+                if (i % 2 == 0 || insecure_rand() % 2 == 0)
+                    coins->Spend(n);
+            }
+            it->second = *coins;
+        }
+        {
+            uint256 txid = GetRandHash();
+            CCoinsModifier coins = cache.ModifyNewCoins(txid, false);
+            coins->nHeight = 300;
+            coins->vout.resize(3);
+            coins->vout[2].nValue = 5;
+            result[txid] = *coins;
+        }
+        BOOST_CHECK(cache.Flush());
+    }
+
+    // Spend trailing outputs in a child cache whose parent dropped the
+    // entry, so the parent only learns of the trimmed outputs from the child.
+    {
+        CCoinsViewCache parent(&db);
+        int i = 0;
+        for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); ++it, ++i) {
+            if (i % 3 != 1 || it->second.IsPruned())
+                continue;
+            CCoinsViewCache child(&parent);
+            {
+                CCoinsModifier coins = child.ModifyCoins(it->first);
+                parent.Uncache(it->first);
+                for (unsigned int n = coins->vout.size() / 2; n < coins->vout.size(); n++)
+                    coins->Spend(n);
+                it->second = *coins;
+            }
+            BOOST_CHECK(!parent.HaveCoinsInCache(it->first));
+            BOOST_CHECK(child.Flush());
+        }
+        BOOST_CHECK(parent.Flush());
+    }
+
+    // The database gives back exactly what went in, per transaction and through its cursor.
+    size_t nFound = 0;
+    for (std::map<uint256, CCoins>::const_iterator it = result.begin(); it != result.end(); ++it) {
+        CCoins coins;
+        BOOST_CHECK_EQUAL(db.HaveCoins(it->first), !it->second.IsPruned());
+        if (db.GetCoins(it->first, coins)) {
+            BOOST_CHECK(coins == it->second);
+            nFound++;
+        }
+    }
+    boost::scoped_ptr<CCoinsViewCursor> pcursor(db.Cursor());
+    size_t nCursor = 0;
+    for (; pcursor->Valid(); pcursor->Next()) {
+        uint256 txid;
+        CCoins coins;
+        BOOST_CHECK(pcursor->GetKey(txid));
+        BOOST_CHECK(pcursor->GetValue(coins));
+        BOOST_CHECK(coins == result[txid]);
+        BOOST_CHECK_EQUAL(pcursor->GetValueSize(), ::GetSerializeSize(coins, SER_DISK, CLIENT_VERSION));
+        nCursor++;
+    }
+    BOOST_CHECK_EQUAL(nCursor, nFound);
+    BOOST_CHECK(nFound < result.size());
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_utxo_commitment, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    CUTXOCommitment commitment;
+    uint256 hashBlock = GetRandHash();
+
+    // Track additions and spends the way block connection does.
+    {
+        CCoinsViewCache cache(&db);
+        std::vector<uint256> txids;
+        for (int i = 0; i < 50; i++) {
+            uint256 txid = GetRandHash();
+            CCoinsModifier coins = cache.ModifyNewCoins(txid, i % 10 == 0);
+            coins->fCoinBase = i % 10 == 0;
+            coins->nHeight = 100 + i;
+            coins->vout.resize(1 + insecure_rand() % 10);
+            for (unsigned int n = 0; n < coins->vout.size(); n++) {
+                coins->vout[n].nValue = 1 + insecure_rand() % 1000;
+                coins->vout[n].scriptPubKey.assign(insecure_rand() & 0x3F, 0);
+            }
+            commitment.AddCoins(txid, *coins);
+            txids.push_back(txid);
+        }
+        for (unsigned int i = 0; i < txids.size(); i += 3) {
+            CCoinsModifier coins = cache.ModifyCoins(txids[i]);
+            for (unsigned int n = 0; n < coins->vout.size(); n += 2) {
+                commitment.RemoveCoin(txids[i], *coins, n);
+                coins->Spend(n);
+            }
+        }
+        cache.SetBestBlock(hashBlock);
+        db.SetCommitment(commitment, hashBlock);
+        BOOST_CHECK(cache.Flush());
+    }
+
+    boost::scoped_ptr<CCoinsViewCursor> pcursor(db.Cursor());
+    CUTXOCommitment computed;
+    BOOST_CHECK(ComputeUTXOCommitment(pcursor.get(), computed));
+    BOOST_CHECK(computed.GetHash() == commitment.GetHash());
+    BOOST_CHECK_EQUAL(computed.nTxOuts, commitment.nTxOuts);
+    BOOST_CHECK_EQUAL(computed.nTotalAmount, commitment.nTotalAmount);
+
+    // It was stored along with the best block.
+    CUTXOCommitment stored;
+    uint256 hashStored;
+    BOOST_CHECK(db.GetCommitment(stored, hashStored));
+    BOOST_CHECK(hashStored == hashBlock);
+    BOOST_CHECK(stored.GetHash() == commitment.GetHash());
+    BOOST_CHECK_EQUAL(stored.nTxOuts, commitment.nTxOuts);
+
+    // A write for another block leaves it as it was.
+    {
+        CCoinsViewCache cache(&db);
+        cache.SetBestBlock(GetRandHash());
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(db.GetCommitment(stored, hashStored));
+    BOOST_CHECK(hashStored == hashBlock);
+}
+
+static void EncodeScanTest(const uint256& txid, const CCoins& coins, unsigned int nValueSize, CCoinsScanChunk& chunk)
+{
+    chunk.data << txid << coins << nValueSize;
+    chunk.nTransactions++;
+}
+
+static bool ConsumeScanTest(CDataStream* pss, uint64_t* pnTransactions, const CCoinsScanChunk& chunk)
+{
+    if (!chunk.data.empty())
+        pss->write(&chunk.data[0], chunk.data.size());
+    *pnTransactions += chunk.nTransactions;
+    return true;
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_db_parallel_scan, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    uint256 hashBlock = GetRandHash();
+    {
+        CCoinsViewCache cache(&db);
+        for (int i = 0; i < 1000; i++) {
+            CCoinsModifier coins = cache.ModifyNewCoins(GetRandHash(), false);
+            coins->nHeight = 1 + i;
+            coins->vout.resize(1 + insecure_rand() % 4);
+            for (unsigned int n = 0; n < coins->vout.size(); n++) {
+                coins->vout[n].nValue = insecure_rand();
+                coins->vout[n].scriptPubKey.assign(insecure_rand() & 0x3F, 0);
+            }
+        }
+        cache.SetBestBlock(hashBlock);
+        BOOST_CHECK(cache.Flush());
+    }
+
+    for (int nLayout = 0; nLayout < 2; nLayout++) {
+        if (nLayout == 1)
+            BOOST_CHECK(db.Upgrade(true));
+
+        // A single cursor gives the reference order.
+        CDataStream ssExpected(SER_DISK, CLIENT_VERSION);
+        boost::scoped_ptr<CCoinsViewCursor> pcursor(db.Cursor());
+        for (; pcursor->Valid(); pcursor->Next()) {
+            uint256 txid;
+            CCoins coins;
+            BOOST_CHECK(pcursor->GetKey(txid) && pcursor->GetValue(coins));
+            ssExpected << txid << coins << pcursor->GetValueSize();
+        }
+
+        for (int nThreads = 1; nThreads <= 4; nThreads += 3) {
+            CDataStream ss(SER_DISK, CLIENT_VERSION);
+            uint64_t nTransactions = 0;
+            uint256 hashScanned;
+            BOOST_CHECK(db.ScanCoins(nThreads, SER_DISK, CLIENT_VERSION, EncodeScanTest, boost::bind(ConsumeScanTest, &ss, &nTransactions, _1), hashScanned));
+            BOOST_CHECK(hashScanned == hashBlock);
+            BOOST_CHECK_EQUAL(nTransactions, 1000U);
+            BOOST_CHECK(ss.str() == ssExpected.str());
+        }
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_db_fresh_coins, TestingSetup)
+{
+    std::map<uint256, CCoins> mapCoins;
+    for (int i = 0; i < 500; i++) {
+        CCoins& coins = mapCoins[GetRandHash()];
+        coins.nHeight = 1 + i;
+        coins.fCoinBase = (i % 10) == 0;
+        coins.vout.resize(1 + insecure_rand() % 4);
+        for (unsigned int n = 0; n < coins.vout.size(); n++) {
+            coins.vout[n].nValue = insecure_rand();
+            coins.vout[n].scriptPubKey.assign(insecure_rand() & 0x3F, 0);
+        }
+        // Leave a gap before the last output now and then.
+        if (coins.vout.size() > 2 && i % 3 == 0)
+            coins.vout[1].SetNull();
+    }
+    std::vector<std::pair<uint256, CCoins> > vCoins(mapCoins.begin(), mapCoins.end());
+
+    for (int nLayout = 0; nLayout < 2; nLayout++) {
+        CCoinsViewDB db(1 << 20, true);
+        BOOST_CHECK(db.Upgrade(nLayout == 1));
+
+        CTxOutSetSnapshot snapshot;
+        BOOST_CHECK(!db.ReadSnapshot(snapshot));
+        snapshot.hashBlock = GetRandHash();
+        BOOST_CHECK(db.WriteSnapshot(snapshot));
+
+        // Two batches, in key order, the way a snapshot is loaded.
+        std::vector<std::pair<uint256, CCoins> > vFirst(vCoins.begin(), vCoins.begin() + 200);
+        std::vector<std::pair<uint256, CCoins> > vSecond(vCoins.begin() + 200, vCoins.end());
+        BOOST_CHECK(db.WriteFreshCoins(vFirst));
+        BOOST_CHECK(db.WriteFreshCoins(vSecond));
+        for (size_t i = 0; i < vCoins.size(); i++)
+            snapshot.commitment.AddCoins(vCoins[i].first, vCoins[i].second);
+        snapshot.fLoaded = true;
+        BOOST_CHECK(db.WriteSnapshot(snapshot));
+
+        size_t nFound = 0;
+        boost::scoped_ptr<CCoinsViewCursor> pcursor(db.Cursor());
+        for (; pcursor->Valid(); pcursor->Next()) {
+            uint256 txid;
+            CCoins coins;
+            BOOST_CHECK(pcursor->GetKey(txid) && pcursor->GetValue(coins));
+            BOOST_CHECK(nFound < vCoins.size() && txid == vCoins[nFound].first && coins == vCoins[nFound].second);
+            nFound++;
+        }
+        BOOST_CHECK_EQUAL(nFound, vCoins.size());
+        CCoins coins;
+        BOOST_CHECK(db.GetCoins(vCoins[123].first, coins) && coins == vCoins[123].second);
+
+        CTxOutSetSnapshot snapshotRead;
+        BOOST_CHECK(db.ReadSnapshot(snapshotRead));
+        BOOST_CHECK(snapshotRead.hashBlock == snapshot.hashBlock);
+        BOOST_CHECK(snapshotRead.fLoaded && !snapshotRead.fValidated);
+        BOOST_CHECK(snapshotRead.commitment.GetHash() == snapshot.commitment.GetHash());
+        BOOST_CHECK_EQUAL(snapshotRead.commitment.nTxOuts, snapshot.commitment.nTxOuts);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,7 @@
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "crypto/muhash.h"
 #include "random.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
@@ -439,4 +440,83 @@ BOOST_AUTO_TEST_CASE(aes_cbc_testvectors) {
                   "b2eb05e2c39be9fcda6c19078c6a9d1b3f461796d6b0d6b2e0c2a72b4d80e644");
 }
 
+static uint256 MuHashFinal(MuHash3072 muhash)
+{
+    uint256 hash;
+    muhash.Finalize(hash.begin());
+    return hash;
+}
+
+static std::vector<unsigned char> Num3072Bytes(const Num3072& num)
+{
+    std::vector<unsigned char> ret(Num3072::BYTE_SIZE);
+    num.ToBytes(&ret[0]);
+    return ret;
+}
+
+BOOST_AUTO_TEST_CASE(num3072_arithmetic) {
+    // 2^3072 - 1 reduces to 2^3072 - 1 - p.
+    std::vector<unsigned char> data(Num3072::BYTE_SIZE, 0xff);
+    std::vector<unsigned char> expected(Num3072::BYTE_SIZE, 0);
+    expected[0] = 1103716 & 0xff; expected[1] = (1103716 >> 8) & 0xff; expected[2] = 1103716 >> 16;
+    BOOST_CHECK(Num3072Bytes(Num3072(&data[0])) == expected);
+
+    // (p - 1)^2 = 1
+    data[0] = 0x9a; data[1] = 0x28; data[2] = 0xef;
+    Num3072 minusone(&data[0]);
+    BOOST_CHECK(Num3072Bytes(minusone) == data);
+    minusone.Multiply(minusone);
+    BOOST_CHECK(Num3072Bytes(minusone) == Num3072Bytes(Num3072()));
+
+    // x * x^-1 = 1
+    for (int i = 0; i < 4; i++) {
+        for (unsigned int j = 0; j < data.size(); j++)
+            data[j] = insecure_rand();
+        Num3072 x(&data[0]);
+        x.Multiply(x.GetInverse());
+        BOOST_CHECK(Num3072Bytes(x) == Num3072Bytes(Num3072()));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests) {
+    const unsigned char a[] = "a", b[] = "b", c[] = "c";
+    MuHash3072 empty;
+
+    MuHash3072 abc, cba;
+    abc.Insert(a, 1).Insert(b, 1).Insert(c, 1);
+    cba.Insert(c, 1).Insert(b, 1).Insert(a, 1);
+    BOOST_CHECK(MuHashFinal(abc) == MuHashFinal(cba));
+    BOOST_CHECK(MuHashFinal(abc) != MuHashFinal(empty));
+
+    // Removing cancels inserting, in any order.
+    MuHash3072 ac;
+    ac.Remove(b, 1).Insert(a, 1).Insert(b, 1).Insert(c, 1);
+    MuHash3072 ac2;
+    ac2.Insert(a, 1).Insert(c, 1);
+    BOOST_CHECK(MuHashFinal(ac) == MuHashFinal(ac2));
+    BOOST_CHECK(MuHashFinal(ac) != MuHashFinal(abc));
+    ac.Remove(a, 1).Remove(c, 1);
+    BOOST_CHECK(MuHashFinal(ac) == MuHashFinal(empty));
+
+    // Sets combine and split.
+    MuHash3072 onlyb;
+    onlyb.Insert(b, 1);
+    ac2 *= onlyb;
+    BOOST_CHECK(MuHashFinal(ac2) == MuHashFinal(abc));
+    ac2 /= onlyb;
+    ac2 /= abc;
+    MuHash3072 minusb;
+    minusb.Remove(b, 1);
+    BOOST_CHECK(MuHashFinal(ac2) == MuHashFinal(minusb));
+
+    // The state survives a round trip, pending removals included.
+    unsigned char state[MuHash3072::STATE_SIZE];
+    ac2.GetState(state);
+    MuHash3072 restored;
+    restored.SetState(state);
+    BOOST_CHECK(MuHashFinal(restored) == MuHashFinal(ac2));
+    restored.Insert(b, 1);
+    BOOST_CHECK(MuHashFinal(restored) == MuHashFinal(empty));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
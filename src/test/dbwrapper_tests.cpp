@@ -324,4 +324,96 @@ BOOST_AUTO_TEST_CASE(iterator_string_ordering)
 
 
 
+BOOST_AUTO_TEST_CASE(dbwrapper_options)
+{
+    CDBOptions opts;
+    std::string strError;
+    BOOST_CHECK(ParseDBOptions("", opts, strError));
+    BOOST_CHECK(!opts.fCompression);
+    BOOST_CHECK_EQUAL(opts.nMaxOpenFiles, 64);
+
+    BOOST_CHECK(ParseDBOptions("compression=1,blocksize=16384,maxopenfiles=1000,writebuffer=64,bloombits=0", opts, strError));
+    BOOST_CHECK(opts.fCompression);
+    BOOST_CHECK_EQUAL(opts.nBlockSize, 16384U);
+    BOOST_CHECK_EQUAL(opts.nMaxOpenFiles, 1000);
+    BOOST_CHECK_EQUAL(opts.nWriteBufferSize, 64U << 20);
+    BOOST_CHECK_EQUAL(opts.nBloomBits, 0);
+
+    // Settings that are not mentioned are left alone.
+    BOOST_CHECK(ParseDBOptions("bloombits=12", opts, strError));
+    BOOST_CHECK_EQUAL(opts.nBloomBits, 12);
+    BOOST_CHECK_EQUAL(opts.nMaxOpenFiles, 1000);
+
+    BOOST_CHECK(!ParseDBOptions("maxopenfiles=1", opts, strError));
+    BOOST_CHECK(!ParseDBOptions("blocksize", opts, strError));
+    BOOST_CHECK(!ParseDBOptions("cache=10", opts, strError));
+    BOOST_CHECK(!ParseDBOptions("compression=yes", opts, strError));
+
+    path ph = temp_directory_path() / unique_path();
+    CDBWrapper dbw(ph, (1 << 20), true, false, false, opts);
+    for (char key = 'a'; key <= 'z'; key++)
+        BOOST_CHECK(dbw.Write(key, GetRandHash()));
+    std::string strStats;
+    BOOST_CHECK(dbw.GetProperty("leveldb.stats", strStats));
+    BOOST_CHECK(!dbw.GetProperty("leveldb.nonexistent", strStats));
+}
+
+BOOST_AUTO_TEST_CASE(dbwrapper_compaction_stats)
+{
+    path ph = temp_directory_path() / unique_path();
+    CDBWrapper dbw(ph, (1 << 20), true, false, false);
+
+    // Every batch is counted with the bytes of its keys and values.
+    CDBWriteStats stats = dbw.GetWriteStats();
+    CDBBatch batch(dbw);
+    for (char key = 'a'; key <= 'z'; key++)
+        batch.Write(key, GetRandHash());
+    BOOST_CHECK_EQUAL(batch.SizeEstimate(), 26U * (1 + 32));
+    BOOST_CHECK(dbw.WriteBatch(batch));
+    CDBWriteStats statsAfter = dbw.GetWriteStats();
+    BOOST_CHECK_EQUAL(statsAfter.nWrites, stats.nWrites + 1);
+    BOOST_CHECK_EQUAL(statsAfter.nWriteBytes, stats.nWriteBytes + 26 * (1 + 32));
+    BOOST_CHECK(statsAfter.nMaxWriteMicros <= statsAfter.nWriteMicros);
+
+    // Before compacting everything is still in the memtable, afterwards in the tables.
+    std::vector<CDBLevelStats> vLevels;
+    BOOST_CHECK(dbw.GetLevelStats(vLevels));
+    BOOST_CHECK_EQUAL(vLevels.size(), 7U);
+    int nFiles = 0;
+    BOOST_FOREACH(const CDBLevelStats& level, vLevels)
+        nFiles += level.nFiles;
+    BOOST_CHECK_EQUAL(nFiles, 0);
+
+    dbw.CompactRange('a', 'm');
+    dbw.CompactFull();
+    BOOST_CHECK_EQUAL(dbw.GetWriteStats().nCompactions, 2U);
+    BOOST_CHECK(dbw.GetLevelStats(vLevels));
+    nFiles = 0;
+    uint64_t nBytes = 0;
+    BOOST_FOREACH(const CDBLevelStats& level, vLevels) {
+        nFiles += level.nFiles;
+        nBytes += level.nBytes;
+    }
+    BOOST_CHECK_EQUAL(nFiles, 1);
+    BOOST_CHECK(nBytes > 26 * 32);
+    BOOST_CHECK_EQUAL(vLevels[0].nTargetBytes, 0U);
+    BOOST_CHECK_EQUAL(vLevels[1].nTargetBytes, 10U << 20);
+    BOOST_CHECK_EQUAL(vLevels[6].nTargetBytes, 0U);
+    BOOST_CHECK_EQUAL(EstimatePendingCompactionBytes(vLevels), 0U);
+    for (char key = 'a'; key <= 'z'; key++) {
+        uint256 hash;
+        BOOST_CHECK(dbw.Read(key, hash));
+    }
+
+    // Level 0 counts once it has enough files, the others by how far they are over target.
+    vLevels[0].nFiles = 3;
+    vLevels[0].nBytes = 1000;
+    BOOST_CHECK_EQUAL(EstimatePendingCompactionBytes(vLevels), 0U);
+    vLevels[0].nFiles = 4;
+    BOOST_CHECK_EQUAL(EstimatePendingCompactionBytes(vLevels), 1000U);
+    vLevels[2].nBytes = vLevels[2].nTargetBytes + 500;
+    vLevels[6].nBytes = 1ULL << 40;
+    BOOST_CHECK_EQUAL(EstimatePendingCompactionBytes(vLevels), 1500U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,94 @@
+// Copyright (c) 2017 The Einsteinium Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "flatmap.h"
+#include "random.h"
+#include "support/allocators/pool.h"
+
+#include "test/test_bitcoin.h"
+
+#include <map>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(flatmap_tests, BasicTestingSetup)
+
+typedef flatmap<uint32_t, uint32_t, std::hash<uint32_t>, std::equal_to<uint32_t>, PoolAllocator<std::pair<const uint32_t, uint32_t> > > PooledFlatMap;
+
+// Random inserts, updates, erasures and lookups, checked against std::map.
+// The key range is small enough that tables fill up with deleted slots.
+BOOST_AUTO_TEST_CASE(flatmap_simulation)
+{
+    PoolResource resource;
+    std::map<uint32_t, uint32_t> expected;
+    {
+        PooledFlatMap map(0, std::hash<uint32_t>(), std::equal_to<uint32_t>(), PooledFlatMap::allocator_type(&resource));
+        for (uint32_t i = 0; i < 200000; i++) {
+            uint32_t key = insecure_rand() % 5000;
+            switch (insecure_rand() % 4) {
+            case 0:
+                map[key] = i;
+                expected[key] = i;
+                break;
+            case 1:
+                BOOST_CHECK_EQUAL(map.insert(std::make_pair(key, i)).second, expected.insert(std::make_pair(key, i)).second);
+                break;
+            case 2:
+                BOOST_CHECK_EQUAL(map.erase(key), expected.erase(key));
+                break;
+            case 3:
+                PooledFlatMap::const_iterator it = map.find(key);
+                BOOST_CHECK_EQUAL(it == map.end(), expected.count(key) == 0);
+                if (it != map.end())
+                    BOOST_CHECK_EQUAL(it->second, expected[key]);
+                break;
+            }
+        }
+        BOOST_CHECK_EQUAL(map.size(), expected.size());
+        BOOST_CHECK_EQUAL(resource.BlocksInUse(), expected.size());
+
+        // Every entry is visited once, and erasing while iterating is safe.
+        size_t nVisited = 0;
+        for (PooledFlatMap::iterator it = map.begin(); it != map.end();) {
+            BOOST_CHECK_EQUAL(it->second, expected[it->first]);
+            nVisited++;
+            if (it->first % 2)
+                map.erase(it++);
+            else
+                ++it;
+        }
+        BOOST_CHECK_EQUAL(nVisited, expected.size());
+        for (std::map<uint32_t, uint32_t>::iterator it = expected.begin(); it != expected.end(); ++it)
+            BOOST_CHECK_EQUAL(map.count(it->first), (size_t)(it->first % 2 == 0));
+
+        // Every slot can be reached as a bucket.
+        size_t nInBuckets = 0;
+        for (size_t i = 0; i < map.bucket_count(); i++) {
+            for (PooledFlatMap::local_iterator it = map.begin(i); it != map.end(i); ++it)
+                nInBuckets++;
+        }
+        BOOST_CHECK_EQUAL(nInBuckets, map.size());
+    }
+    BOOST_CHECK_EQUAL(resource.BlocksInUse(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(flatmap_reference_stability)
+{
+    flatmap<uint32_t, uint32_t> map;
+    map[0] = 42;
+    uint32_t* p = &map[0];
+    // Growing the table moves slots around, but not the entries.
+    for (uint32_t i = 1; i < 10000; i++)
+        map[i] = i;
+    BOOST_CHECK(p == &map[0]);
+    BOOST_CHECK_EQUAL(*p, 42U);
+
+    map.clear();
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK_EQUAL(map.bucket_count(), 0U);
+    BOOST_CHECK(map.begin() == map.end());
+    BOOST_CHECK(map.find(0) == map.end());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -3,12 +3,24 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "chainparams.h"
+#include "clientversion.h"
+#include "consensus/validation.h"
 #include "main.h"
+#include "miner.h"
+#include "random.h"
+#include "script/interpreter.h"
+#include "streams.h"
+#include "txdb.h"
+#include "util.h"
 
 #include "test/test_bitcoin.h"
 
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/random/uniform_int.hpp>
 #include <boost/signals2/signal.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(main_tests, TestingSetup)
 
@@ -56,6 +68,64 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
     BOOST_CHECK_EQUAL(nSum, 8399999990760000ULL);
 }
 
+/** GetBlockSubsidy as it was before the wormhole offsets were tabulated, drawing them from the generator on every call. */
+static CAmount ReferenceBlockSubsidy(int nHeight)
+{
+    int mod = nHeight % 36000;
+    if (mod != 0) mod = 1;
+    int epoch = (nHeight / 36000) + mod;
+    boost::mt19937 gen(5299860 * epoch);
+    boost::uniform_int<> dist(1, 35820);
+    int WormholeStartBlock = dist(gen) + ((epoch - 1) * 36000);
+    if (epoch > 1 && epoch < 148 && nHeight >= WormholeStartBlock && nHeight < WormholeStartBlock + 180)
+        return 2973 * COIN;
+    if (nHeight == 1) return 10747 * COIN;
+    else if (nHeight <= 72000) return 1024 * COIN;
+    else if (nHeight <= 144000) return 512 * COIN;
+    else if (nHeight <= 288000) return 256 * COIN;
+    else if (nHeight <= 432000) return 128 * COIN;
+    else if (nHeight <= 576000) return 64 * COIN;
+    else if (nHeight <= 864000) return 32 * COIN;
+    else if (nHeight <= 1080000) return 16 * COIN;
+    else if (nHeight <= 1584000) return 8 * COIN;
+    else if (nHeight <= 2304000) return 4 * COIN;
+    else if (nHeight <= 5256000) return 2 * COIN;
+    else if (nHeight <= 26280000) return 1 * COIN;
+    return 0;
+}
+
+BOOST_AUTO_TEST_CASE(wormhole_subsidy_matches_generator)
+{
+    const Consensus::Params& consensusParams = Params(CBaseChainParams::MAIN).GetConsensus();
+    for (int epoch = 0; epoch <= WORMHOLE_LAST_EPOCH + 2; epoch++) {
+        boost::mt19937 gen(5299860 * epoch);
+        boost::uniform_int<> dist(1, 35820);
+        const int nStart = dist(gen) + (epoch - 1) * WORMHOLE_EPOCH_BLOCKS;
+        const bool fWormhole = epoch >= WORMHOLE_FIRST_EPOCH && epoch <= WORMHOLE_LAST_EPOCH;
+
+        if (fWormhole) {
+            BOOST_CHECK_EQUAL(GetBlockSubsidy(nStart, consensusParams), 2973 * COIN);
+            BOOST_CHECK_EQUAL(GetBlockSubsidy(nStart + WORMHOLE_BLOCKS - 1, consensusParams), 2973 * COIN);
+            BOOST_CHECK(GetBlockSubsidy(nStart - 1, consensusParams) != 2973 * COIN);
+            BOOST_CHECK(GetBlockSubsidy(nStart + WORMHOLE_BLOCKS, consensusParams) != 2973 * COIN);
+        }
+
+        // Around the wormhole, the epoch boundaries, and anywhere else in the epoch.
+        std::vector<int> vHeights;
+        for (int i = -2; i <= 2; i++) {
+            vHeights.push_back(nStart + i);
+            vHeights.push_back(nStart + WORMHOLE_BLOCKS + i);
+            vHeights.push_back(epoch * WORMHOLE_EPOCH_BLOCKS + i);
+        }
+        for (int i = 0; i < 100; i++)
+            vHeights.push_back((epoch - 1) * WORMHOLE_EPOCH_BLOCKS + 1 + insecure_rand() % WORMHOLE_EPOCH_BLOCKS);
+        BOOST_FOREACH(int nHeight, vHeights) {
+            if (nHeight >= 0)
+                BOOST_CHECK_EQUAL(GetBlockSubsidy(nHeight, consensusParams), ReferenceBlockSubsidy(nHeight));
+        }
+    }
+}
+
 bool ReturnFalse() { return false; }
 bool ReturnTrue() { return true; }
 
@@ -72,4 +142,205 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     Test.disconnect(&ReturnTrue);
     BOOST_CHECK(Test());
 }
+BOOST_FIXTURE_TEST_CASE(load_external_block_file, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    boost::filesystem::path path = GetDataDir() / "import.dat";
+
+    // A block on top of the tip that the node has not seen yet
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CBlockTemplate *pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
+    CBlock block = pblocktemplate->block;
+    delete pblocktemplate;
+    unsigned int extraNonce = 0;
+    IncrementExtraNonce(&block, chainActive.Tip(), extraNonce);
+    while (!CheckProofOfWork(block.GetPoWHash(), block.nBits, chainparams.GetConsensus())) ++block.nNonce;
+
+    // Known blocks come first, as in a bootstrap.dat overlapping our chain.
+    {
+        CAutoFile fileout(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_REQUIRE(!fileout.IsNull());
+        for (int nHeight = 1; nHeight <= chainActive.Height(); nHeight++) {
+            CBlock blockKnown;
+            BOOST_REQUIRE(ReadBlockFromDisk(blockKnown, chainActive[nHeight], chainparams.GetConsensus()));
+            fileout << FLATDATA(chainparams.MessageStart()) << (unsigned int)GetSerializeSize(blockKnown, SER_DISK, CLIENT_VERSION) << blockKnown;
+        }
+        fileout << FLATDATA(chainparams.MessageStart()) << (unsigned int)GetSerializeSize(block, SER_DISK, CLIENT_VERSION) << block;
+    }
+
+    // Only the new block is loaded.
+    BOOST_CHECK(LoadExternalBlockFile(chainparams, fopen(path.string().c_str(), "rb")));
+    {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(block.GetHash());
+        BOOST_REQUIRE(mi != mapBlockIndex.end());
+        BOOST_CHECK(mi->second->nStatus & BLOCK_HAVE_DATA);
+    }
+    CValidationState state;
+    BOOST_CHECK(ActivateBestChain(state, chainparams));
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+
+    // Loading the file again finds nothing new.
+    BOOST_CHECK(!LoadExternalBlockFile(chainparams, fopen(path.string().c_str(), "rb")));
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+}
+
+static uint256 GetCommitmentHash()
+{
+    CUTXOCommitment commitment;
+    uint256 hashBlock;
+    BOOST_REQUIRE(GetUTXOCommitment(commitment, hashBlock));
+    BOOST_CHECK(hashBlock == chainActive.Tip()->GetBlockHash());
+    return commitment.GetHash();
+}
+
+BOOST_FIXTURE_TEST_CASE(utxo_commitment_connect_disconnect, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    BOOST_REQUIRE(LoadUTXOCommitment());
+    const uint256 hashStart = GetCommitmentHash();
+
+    // A block spending a mature coinbase, so connecting it both adds and
+    // removes outputs.
+    const CTransaction& coinbase = coinbaseTxns[0];
+    unsigned int nOut = 0;
+    while (nOut < coinbase.vout.size() && coinbase.vout[nOut].scriptPubKey != scriptPubKey)
+        nOut++;
+    BOOST_REQUIRE(nOut < coinbase.vout.size());
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(coinbase.GetHash(), nOut);
+    spend.vout.resize(2);
+    spend.vout[0].nValue = coinbase.vout[nOut].nValue / 2;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+    spend.vout[1].nValue = coinbase.vout[nOut].nValue / 2 - CENT;
+    spend.vout[1].scriptPubKey = scriptPubKey;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_REQUIRE(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+
+    std::vector<CMutableTransaction> txns(1, spend);
+    CBlock block = CreateAndProcessBlock(txns, scriptPubKey);
+    BOOST_REQUIRE(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    const uint256 hashConnected = GetCommitmentHash();
+    BOOST_CHECK(hashConnected != hashStart);
+
+    // The rolling commitment matches one computed from scratch.
+    FlushStateToDisk();
+    {
+        boost::scoped_ptr<CCoinsViewCursor> pcursor(pcoinsdbview->Cursor());
+        CUTXOCommitment commitment;
+        BOOST_REQUIRE(ComputeUTXOCommitment(pcursor.get(), commitment));
+        BOOST_CHECK(commitment.GetHash() == hashConnected);
+    }
+
+    // Disconnecting restores the spent coinbase from undo data.
+    CValidationState state;
+    CBlockIndex* pindex = chainActive.Tip();
+    {
+        LOCK(cs_main);
+        BOOST_REQUIRE(InvalidateBlock(state, chainparams, pindex));
+    }
+    BOOST_CHECK(chainActive.Tip() == pindex->pprev);
+    BOOST_CHECK(GetCommitmentHash() == hashStart);
+
+    // And reconnecting brings the commitment forward again.
+    {
+        LOCK(cs_main);
+        BOOST_REQUIRE(ResetBlockFailureFlags(pindex));
+    }
+    BOOST_REQUIRE(ActivateBestChain(state, chainparams));
+    BOOST_CHECK(chainActive.Tip() == pindex);
+    BOOST_CHECK(GetCommitmentHash() == hashConnected);
+}
+
+BOOST_FIXTURE_TEST_CASE(txoutset_snapshot_load_and_check, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    boost::filesystem::path path = GetDataDir() / "utxo.dat";
+    CBlockIndex* pindexSnapshot = chainActive.Tip();
+
+    // Write the set at the tip the way dumptxoutset does.
+    FlushStateToDisk();
+    uint256 hashExpected;
+    {
+        std::vector<std::pair<uint256, CCoins> > vCoins;
+        boost::scoped_ptr<CCoinsViewCursor> pcursor(pcoinsdbview->Cursor());
+        for (; pcursor->Valid(); pcursor->Next()) {
+            vCoins.push_back(std::make_pair(uint256(), CCoins()));
+            BOOST_REQUIRE(pcursor->GetKey(vCoins.back().first) && pcursor->GetValue(vCoins.back().second));
+        }
+        BOOST_REQUIRE(!vCoins.empty());
+        CTxOutSetHeader header;
+        header.hashBlock = pindexSnapshot->GetBlockHash();
+        header.nTransactions = vCoins.size();
+        CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+        CUTXOCommitment commitment;
+        CAutoFile fileout(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_REQUIRE(!fileout.IsNull());
+        fileout << header;
+        for (size_t i = 0; i < vCoins.size(); i++) {
+            fileout << vCoins[i].first << vCoins[i].second;
+            ss << vCoins[i].first << vCoins[i].second;
+            commitment.AddCoins(vCoins[i].first, vCoins[i].second);
+        }
+        fileout << ss.GetHash();
+        hashExpected = commitment.GetHash();
+    }
+
+    // Go back to an empty chain state, with the blocks still around.
+    CValidationState state;
+    {
+        LOCK(cs_main);
+        BOOST_REQUIRE(InvalidateBlock(state, chainparams, chainActive[1]));
+        BOOST_REQUIRE(ResetBlockFailureFlags(pindexSnapshot));
+    }
+    BOOST_CHECK_EQUAL(chainActive.Height(), 0);
+    FlushStateToDisk();
+
+    // Leave a load behind that did not finish, with a coin the snapshot
+    // does not have.
+    uint256 txidStale = GetRandHash();
+    {
+        CTxOutSetSnapshot snapshotStale;
+        snapshotStale.hashBlock = pindexSnapshot->GetBlockHash();
+        BOOST_REQUIRE(pcoinsdbview->WriteSnapshot(snapshotStale));
+        std::vector<std::pair<uint256, CCoins> > vCoins(1);
+        vCoins[0].first = txidStale;
+        vCoins[0].second.vout.resize(1);
+        vCoins[0].second.vout[0].nValue = COIN;
+        BOOST_REQUIRE(pcoinsdbview->WriteFreshCoins(vCoins));
+    }
+    BOOST_CHECK(!LoadTxOutSetSnapshot(false));
+    BOOST_CHECK(LoadTxOutSetSnapshot(true));
+
+    std::string strError;
+    BOOST_REQUIRE(InitLoadTxOutSet(path, hashExpected, strError));
+
+    // Blocks are not connected while the snapshot is pending.
+    BOOST_CHECK(ActivateBestChain(state, chainparams));
+    BOOST_CHECK_EQUAL(chainActive.Height(), 0);
+
+    // Loads the snapshot, switches to it, and connects the blocks below it
+    // in a chain state of their own to compare commitments.
+    boost::thread thread(&ThreadTxOutSetSnapshot);
+    thread.join();
+
+    BOOST_CHECK(chainActive.Tip() == pindexSnapshot);
+    BOOST_CHECK(GetCommitmentHash() == hashExpected);
+    BOOST_CHECK(!pcoinsTip->HaveCoins(txidStale));
+    CTxOutSetSnapshot snapshot;
+    int nCheckHeight;
+    bool fPending;
+    BOOST_REQUIRE(GetTxOutSetSnapshot(snapshot, nCheckHeight, fPending));
+    BOOST_CHECK(!fPending);
+    BOOST_CHECK(snapshot.fLoaded);
+    BOOST_CHECK(snapshot.fValidated);
+    BOOST_CHECK_EQUAL(nCheckHeight, pindexSnapshot->nHeight);
+    BOOST_CHECK(!boost::filesystem::exists(GetDataDir() / "chainstate_snapshotcheck"));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
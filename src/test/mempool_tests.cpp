@@ -2,7 +2,11 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "consensus/validation.h"
+#include "main.h"
 #include "policy/policy.h"
+#include "script/interpreter.h"
+#include "script/standard.h"
 #include "txmempool.h"
 #include "util.h"
 
@@ -578,4 +582,350 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolPersistTest)
+{
+    TestMemPoolEntryHelper entry;
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vin.resize(1);
+    tx1.vin[0].prevout.hash = GetRandHash();
+    tx1.vin[0].prevout.n = 0;
+    tx1.vin[0].scriptSig = CScript() << OP_11;
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    mempool.addUnchecked(tx1.GetHash(), entry.Fee(10000LL).Time(GetTime()).FromTx(tx1));
+    mempool.PrioritiseTransaction(tx1.GetHash(), tx1.GetHash().ToString(), 0, 500);
+    // A prioritisation of a transaction the mempool does not have is kept too.
+    uint256 hashAbsent = GetRandHash();
+    mempool.PrioritiseTransaction(hashAbsent, hashAbsent.ToString(), 0, -300);
+    BOOST_CHECK(DumpMempool());
+    BOOST_CHECK(boost::filesystem::exists(GetDataDir() / "mempool.dat"));
+
+    mempool.clear();
+    mempool.ClearPrioritisation(tx1.GetHash());
+    mempool.ClearPrioritisation(hashAbsent);
+
+    // The inputs of tx1 do not exist, so only the fee deltas come back.
+    BOOST_CHECK(LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), 0U);
+    double dPriorityDelta = 0;
+    CAmount nFeeDelta = 0;
+    mempool.ApplyDeltas(tx1.GetHash(), dPriorityDelta, nFeeDelta);
+    BOOST_CHECK_EQUAL(nFeeDelta, 500);
+    nFeeDelta = 0;
+    mempool.ApplyDeltas(hashAbsent, dPriorityDelta, nFeeDelta);
+    BOOST_CHECK_EQUAL(nFeeDelta, -300);
+    mempool.ClearPrioritisation(tx1.GetHash());
+    mempool.ClearPrioritisation(hashAbsent);
+
+    // Files of another version are left alone.
+    {
+        CAutoFile file(fopen((GetDataDir() / "mempool.dat").string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        file << (uint64_t)2 << (uint64_t)0;
+    }
+    BOOST_CHECK(!LoadMempool());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSnapshotTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vin.resize(1);
+    tx1.vin[0].scriptSig = CScript() << OP_1;
+    tx1.vout.resize(2);
+    tx1.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    tx1.vout[1].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx1.vout[1].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), entry.Fee(1000LL).FromTx(tx1));
+
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vin.resize(1);
+    tx2.vin[0].prevout = COutPoint(tx1.GetHash(), 0);
+    tx2.vin[0].scriptSig = CScript() << OP_1;
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx2.vout[0].nValue = 9 * COIN;
+    pool.addUnchecked(tx2.GetHash(), entry.Fee(20000LL).FromTx(tx2));
+    pool.PrioritiseTransaction(tx2.GetHash(), tx2.GetHash().ToString(), 0, 5000LL);
+
+    CTxMemPool snapshot(CFeeRate(0));
+    pool.Snapshot(snapshot);
+    BOOST_CHECK_EQUAL(snapshot.size(), 2);
+    BOOST_CHECK_EQUAL(snapshot.GetTotalTxSize(), pool.GetTotalTxSize());
+    BOOST_CHECK_EQUAL(snapshot.GetTransactionsUpdated(), pool.GetTransactionsUpdated());
+
+    // The links point into the snapshot, not the pool
+    CTxMemPool::txiter it1 = snapshot.mapTx.find(tx1.GetHash());
+    CTxMemPool::txiter it2 = snapshot.mapTx.find(tx2.GetHash());
+    BOOST_CHECK(snapshot.GetMemPoolChildren(it1).size() == 1 && *snapshot.GetMemPoolChildren(it1).begin() == it2);
+    BOOST_CHECK(snapshot.GetMemPoolParents(it2).size() == 1 && *snapshot.GetMemPoolParents(it2).begin() == it1);
+    BOOST_CHECK_EQUAL(it2->GetModifiedFee(), 25000LL);
+    BOOST_CHECK_EQUAL(it1->GetModFeesWithDescendants(), 26000LL);
+    double dPriorityDelta = 0;
+    CAmount nFeeDelta = 0;
+    snapshot.ApplyDeltas(tx2.GetHash(), dPriorityDelta, nFeeDelta);
+    BOOST_CHECK_EQUAL(nFeeDelta, 5000LL);
+
+    // Later changes to the pool do not show up in the snapshot
+    std::list<CTransaction> removed;
+    pool.removeRecursive(tx1, removed);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+    BOOST_CHECK_EQUAL(snapshot.size(), 2);
+    BOOST_CHECK(it1->GetTx().GetHash() == tx1.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolClusterTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    uint64_t nCount, nSize;
+    CAmount nFees;
+
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vin.resize(1);
+    tx1.vin[0].scriptSig = CScript() << OP_1;
+    tx1.vout.resize(2);
+    tx1.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    tx1.vout[1].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx1.vout[1].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), entry.Fee(1000LL).FromTx(tx1));
+
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vin.resize(1);
+    tx2.vin[0].prevout = COutPoint(tx1.GetHash(), 0);
+    tx2.vin[0].scriptSig = CScript() << OP_2;
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+    tx2.vout[0].nValue = 9 * COIN;
+
+    CMutableTransaction tx3 = CMutableTransaction();
+    tx3.vin.resize(1);
+    tx3.vin[0].prevout = COutPoint(tx1.GetHash(), 1);
+    tx3.vin[0].scriptSig = CScript() << OP_3;
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_3 << OP_EQUAL;
+    tx3.vout[0].nValue = 9 * COIN;
+
+    CMutableTransaction tx4 = CMutableTransaction();
+    tx4.vin.resize(1);
+    tx4.vin[0].scriptSig = CScript() << OP_4;
+    tx4.vout.resize(1);
+    tx4.vout[0].scriptPubKey = CScript() << OP_4 << OP_EQUAL;
+    tx4.vout[0].nValue = 10 * COIN;
+
+    // A child joins the cluster of its parent
+    CTxMemPool::setEntries setAncestors;
+    setAncestors.insert(pool.mapTx.find(tx1.GetHash()));
+    BOOST_CHECK_EQUAL(pool.CalculateClusterCount(setAncestors), 2);
+    pool.addUnchecked(tx2.GetHash(), entry.Fee(2000LL).FromTx(tx2));
+    pool.addUnchecked(tx3.GetHash(), entry.Fee(3000LL).FromTx(tx3));
+    pool.addUnchecked(tx4.GetHash(), entry.Fee(4000LL).FromTx(tx4));
+    BOOST_CHECK_EQUAL(pool.CalculateClusterCount(setAncestors), 4);
+
+    CTxMemPool::txiter it2 = pool.mapTx.find(tx2.GetHash());
+    CTxMemPool::txiter it3 = pool.mapTx.find(tx3.GetHash());
+    CTxMemPool::txiter it4 = pool.mapTx.find(tx4.GetHash());
+    pool.GetClusterStats(it2, nCount, nSize, nFees);
+    BOOST_CHECK_EQUAL(nCount, 3);
+    BOOST_CHECK_EQUAL(nSize, it2->GetSizeWithAncestors() + it3->GetTxSize());
+    BOOST_CHECK_EQUAL(nFees, 6000LL);
+    pool.GetClusterStats(it4, nCount, nSize, nFees);
+    BOOST_CHECK_EQUAL(nCount, 1);
+    BOOST_CHECK_EQUAL(nSize, it4->GetTxSize());
+    BOOST_CHECK_EQUAL(nFees, 4000LL);
+
+    // Fee deltas are reflected in the cluster fees
+    pool.PrioritiseTransaction(tx3.GetHash(), tx3.GetHash().ToString(), 0, 500LL);
+    pool.GetClusterStats(it2, nCount, nSize, nFees);
+    BOOST_CHECK_EQUAL(nFees, 6500LL);
+
+    // Confirming the shared parent splits the cluster in two
+    std::vector<CTransaction> vtx;
+    vtx.push_back(tx1);
+    std::list<CTransaction> conflicts;
+    pool.removeForBlock(vtx, 1, conflicts);
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+    pool.GetClusterStats(it2, nCount, nSize, nFees);
+    BOOST_CHECK_EQUAL(nCount, 1);
+    BOOST_CHECK_EQUAL(nSize, it2->GetTxSize());
+    BOOST_CHECK_EQUAL(nFees, 2000LL);
+    pool.GetClusterStats(it3, nCount, nSize, nFees);
+    BOOST_CHECK_EQUAL(nCount, 1);
+    BOOST_CHECK_EQUAL(nFees, 3500LL);
+    BOOST_CHECK(pool.GetMemPoolParents(it2).empty() && pool.GetMemPoolParents(it3).empty());
+
+    // A transaction with parents in two clusters joins them, relabelling one
+    // of them entirely, including tx4 which is only reached through tx6.
+    CMutableTransaction tx5 = CMutableTransaction();
+    tx5.vin.resize(1);
+    tx5.vin[0].prevout = COutPoint(tx2.GetHash(), 0);
+    tx5.vin[0].scriptSig = CScript() << OP_5;
+    tx5.vout.resize(1);
+    tx5.vout[0].scriptPubKey = CScript() << OP_5 << OP_EQUAL;
+    tx5.vout[0].nValue = 8 * COIN;
+    pool.addUnchecked(tx5.GetHash(), entry.Fee(5000LL).FromTx(tx5));
+
+    CMutableTransaction tx6 = CMutableTransaction();
+    tx6.vin.resize(2);
+    tx6.vin[0].prevout = COutPoint(tx4.GetHash(), 0);
+    tx6.vin[0].scriptSig = CScript() << OP_6;
+    tx6.vin[1].prevout = COutPoint(tx5.GetHash(), 0);
+    tx6.vin[1].scriptSig = CScript() << OP_6;
+    tx6.vout.resize(1);
+    tx6.vout[0].scriptPubKey = CScript() << OP_6 << OP_EQUAL;
+    tx6.vout[0].nValue = 17 * COIN;
+    setAncestors.clear();
+    setAncestors.insert(it4);
+    setAncestors.insert(pool.mapTx.find(tx5.GetHash()));
+    setAncestors.insert(it2);
+    BOOST_CHECK_EQUAL(pool.CalculateClusterCount(setAncestors), 4);
+    pool.addUnchecked(tx6.GetHash(), entry.Fee(6000LL).FromTx(tx6));
+
+    CTxMemPool::txiter it6 = pool.mapTx.find(tx6.GetHash());
+    BOOST_FOREACH(CTxMemPool::txiter it, setAncestors) {
+        pool.GetClusterStats(it, nCount, nSize, nFees);
+        BOOST_CHECK_EQUAL(nCount, 4);
+        BOOST_CHECK_EQUAL(nSize, it6->GetSizeWithAncestors());
+        BOOST_CHECK_EQUAL(nFees, 17000LL);
+    }
+    pool.GetClusterStats(it3, nCount, nSize, nFees);
+    BOOST_CHECK_EQUAL(nCount, 1);
+
+    // Removing the joining transaction splits them again
+    std::list<CTransaction> removed;
+    pool.removeRecursive(tx6, removed);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    pool.GetClusterStats(it4, nCount, nSize, nFees);
+    BOOST_CHECK_EQUAL(nCount, 1);
+    pool.GetClusterStats(it2, nCount, nSize, nFees);
+    BOOST_CHECK_EQUAL(nCount, 2);
+    BOOST_CHECK_EQUAL(nFees, 7000LL);
+
+    // Removing a chain tx4 -> tx7 -> tx8 <- tx3 from tx7 down leaves each
+    // removed entry with a single link, yet splits tx4 from tx3.
+    CMutableTransaction tx7 = CMutableTransaction();
+    tx7.vin.resize(1);
+    tx7.vin[0].prevout = COutPoint(tx4.GetHash(), 0);
+    tx7.vin[0].scriptSig = CScript() << OP_7;
+    tx7.vout.resize(1);
+    tx7.vout[0].scriptPubKey = CScript() << OP_7 << OP_EQUAL;
+    tx7.vout[0].nValue = 9 * COIN;
+    pool.addUnchecked(tx7.GetHash(), entry.Fee(7000LL).FromTx(tx7));
+
+    CMutableTransaction tx8 = CMutableTransaction();
+    tx8.vin.resize(2);
+    tx8.vin[0].prevout = COutPoint(tx7.GetHash(), 0);
+    tx8.vin[0].scriptSig = CScript() << OP_8;
+    tx8.vin[1].prevout = COutPoint(tx3.GetHash(), 0);
+    tx8.vin[1].scriptSig = CScript() << OP_8;
+    tx8.vout.resize(1);
+    tx8.vout[0].scriptPubKey = CScript() << OP_8 << OP_EQUAL;
+    tx8.vout[0].nValue = 17 * COIN;
+    pool.addUnchecked(tx8.GetHash(), entry.Fee(8000LL).FromTx(tx8));
+    pool.GetClusterStats(it3, nCount, nSize, nFees);
+    BOOST_CHECK_EQUAL(nCount, 4);
+
+    removed.clear();
+    pool.removeRecursive(tx7, removed);
+    BOOST_CHECK_EQUAL(removed.size(), 2);
+    pool.GetClusterStats(it3, nCount, nSize, nFees);
+    BOOST_CHECK_EQUAL(nCount, 1);
+    BOOST_CHECK_EQUAL(nFees, 3500LL);
+    pool.GetClusterStats(it4, nCount, nSize, nFees);
+    BOOST_CHECK_EQUAL(nCount, 1);
+    BOOST_CHECK_EQUAL(nFees, 4000LL);
+
+    // ... and each side can then go on its own
+    removed.clear();
+    pool.removeRecursive(tx3, removed);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    pool.GetClusterStats(it4, nCount, nSize, nFees);
+    BOOST_CHECK_EQUAL(nCount, 1);
+    BOOST_CHECK_EQUAL(nSize, it4->GetTxSize());
+    BOOST_CHECK_EQUAL(nFees, 4000LL);
+}
+
+// Outputs are pay-to-script-hash of OP_TRUE, so they stay standard and are
+// spent by pushing the redeem script.
+static CMutableTransaction SpendToOutputs(const CTransaction& txPrev, unsigned int nOut, unsigned int nOutputs, const CScript& scriptSig)
+{
+    CScript redeemScript = CScript() << OP_TRUE;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(txPrev.GetHash(), nOut);
+    tx.vin[0].scriptSig = scriptSig;
+    tx.vout.resize(nOutputs);
+    for (unsigned int i = 0; i < nOutputs; i++) {
+        tx.vout[i].scriptPubKey = GetScriptForDestination(CScriptID(redeemScript));
+        tx.vout[i].nValue = (txPrev.vout[nOut].nValue - COIN / 100) / nOutputs;
+    }
+    return tx;
+}
+
+// Spend the output of a coinbase paying to key.
+static CMutableTransaction SpendCoinbase(const CTransaction& coinbase, const CKey& key, unsigned int nOutputs)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+    unsigned int nOut = 0;
+    while (nOut < coinbase.vout.size() && coinbase.vout[nOut].scriptPubKey != scriptPubKey)
+        nOut++;
+    BOOST_REQUIRE(nOut < coinbase.vout.size());
+
+    CMutableTransaction tx = SpendToOutputs(coinbase, nOut, nOutputs, CScript());
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, tx, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_REQUIRE(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig << vchSig;
+    return tx;
+}
+
+BOOST_FIXTURE_TEST_CASE(MempoolClusterLimitTest, TestChain100Setup)
+{
+    CMutableTransaction parent = SpendCoinbase(coinbaseTxns[0], coinbaseKey, 3);
+
+    // Siblings do not count as ancestors or descendants of each other, but
+    // they do share a cluster.
+    mapArgs["-limitclustercount"] = "3";
+    LOCK(cs_main);
+    CValidationState state;
+    BOOST_CHECK(AcceptToMemoryPool(mempool, state, parent, false, NULL, true, 0));
+    for (unsigned int i = 0; i < 3; i++) {
+        CMutableTransaction child = SpendToOutputs(parent, i, 1, CScript() << ToByteVector(CScript() << OP_TRUE));
+        bool fAccepted = AcceptToMemoryPool(mempool, state, child, false, NULL, true, 0);
+        BOOST_CHECK_EQUAL(fAccepted, i < 2);
+    }
+    BOOST_CHECK_EQUAL(mempool.size(), 3);
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "too-long-mempool-chain");
+    BOOST_CHECK(state.GetDebugMessage().find("cluster") != std::string::npos);
+    mapArgs.erase("-limitclustercount");
+    mempool.clear();
+}
+
+BOOST_FIXTURE_TEST_CASE(MempoolPersistReloadTest, TestChain100Setup)
+{
+    // A transaction and a child spending it come back after a restart.
+    CMutableTransaction parent = SpendCoinbase(coinbaseTxns[0], coinbaseKey, 1);
+    CMutableTransaction child = SpendToOutputs(parent, 0, 1, CScript() << ToByteVector(CScript() << OP_TRUE));
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, parent, false, NULL, true, 0));
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, child, false, NULL, true, 0));
+    }
+    BOOST_CHECK_EQUAL(mempool.size(), 2U);
+    BOOST_CHECK(DumpMempool());
+
+    mempool.clear();
+    BOOST_CHECK(LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), 2U);
+    BOOST_CHECK(mempool.exists(parent.GetHash()));
+    BOOST_CHECK(mempool.exists(child.GetHash()));
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
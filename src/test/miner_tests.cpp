@@ -10,6 +10,8 @@
 #include "main.h"
 #include "miner.h"
 #include "pubkey.h"
+#include "random.h"
+#include "script/interpreter.h"
 #include "script/standard.h"
 #include "txmempool.h"
 #include "uint256.h"
@@ -502,4 +504,87 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+BOOST_FIXTURE_TEST_CASE(BlockTemplateUpdater, TestChain100Setup)
+{
+    // Changed templates are checked against the chain, so the transactions
+    // appended spend a mature coinbase.
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    TestMemPoolEntryHelper entry;
+
+    LOCK(cs_main);
+    mempool.clear();
+    CBlockTemplateUpdater updater(chainparams, scriptPubKey);
+    CBlockTemplate *pblocktemplate = updater.Update(0);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+
+    // A new transaction is appended without a rebuild
+    CScript scriptCoinbase = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    const CTransaction& coinbase = coinbaseTxns[0];
+    unsigned int nOut = 0;
+    while (nOut < coinbase.vout.size() && coinbase.vout[nOut].scriptPubKey != scriptCoinbase)
+        nOut++;
+    BOOST_REQUIRE(nOut < coinbase.vout.size());
+    CScript redeemScript = CScript() << OP_TRUE;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(coinbase.GetHash(), nOut);
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = GetScriptForDestination(CScriptID(redeemScript));
+    tx.vout[0].nValue = coinbase.vout[nOut].nValue - 1000000;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptCoinbase, tx, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_REQUIRE(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig = CScript() << vchSig;
+    CTransaction txParent(tx);
+    mempool.addUnchecked(txParent.GetHash(), entry.Fee(1000000).Time(GetTime()).FromTx(txParent));
+    pblocktemplate = updater.Update(3600);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2);
+    BOOST_CHECK(pblocktemplate->block.vtx[1].GetHash() == txParent.GetHash());
+
+    // So is a child of a transaction in the block, and the coinbase pays both fees
+    tx.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+    tx.vin[0].scriptSig = CScript() << ToByteVector(redeemScript);
+    tx.vout[0].nValue -= 1000000;
+    uint256 hashChildTx = tx.GetHash();
+    mempool.addUnchecked(hashChildTx, entry.Fee(1000000).FromTx(tx));
+    pblocktemplate = updater.Update(3600);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3);
+    BOOST_CHECK(pblocktemplate->block.vtx[2].GetHash() == hashChildTx);
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -2000000);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx[0].GetValueOut(), GetBlockSubsidy(chainActive.Height() + 1, chainparams.GetConsensus()) + 2000000);
+    BOOST_CHECK_EQUAL(updater.GetTransactionsUpdated(), mempool.GetTransactionsUpdated());
+
+    // Removing the parent takes the child out of the block as well
+    std::list<CTransaction> removed;
+    mempool.removeRecursive(txParent, removed);
+    pblocktemplate = updater.Update(3600);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], 0);
+
+    // A child whose free parent was left out is not appended
+    tx.vin[0].prevout.hash = GetRandHash();
+    tx.vout[0].nValue = 5000000000LL;
+    CTransaction txFree(tx);
+    mempool.addUnchecked(txFree.GetHash(), entry.Fee(0).FromTx(txFree));
+    tx.vin[0].prevout.hash = txFree.GetHash();
+    tx.vout[0].nValue -= 1000000;
+    mempool.addUnchecked(tx.GetHash(), entry.Fee(1000000).FromTx(tx));
+    pblocktemplate = updater.Update(3600);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+
+    // A transaction that does not fit the chain is not served appended; the
+    // rebuild then runs into it too
+    tx.vin[0].prevout.hash = GetRandHash();
+    mempool.addUnchecked(tx.GetHash(), entry.Fee(1000000).FromTx(tx));
+    BOOST_CHECK_THROW(updater.Update(3600), std::runtime_error);
+
+    // Changes the updater was not told about are picked up by a rebuild
+    mempool.clear();
+    pblocktemplate = updater.Update(0);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+    BOOST_CHECK_EQUAL(updater.GetTransactionsUpdated(), mempool.GetTransactionsUpdated());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
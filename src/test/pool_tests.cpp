@@ -0,0 +1,76 @@
+// Copyright (c) 2017 The Einsteinium Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "support/allocators/pool.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/unordered_map.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(pool_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(pool_resource_reuse)
+{
+    PoolResource resource(1024);
+
+    // Freed blocks are handed out again for the same size class.
+    void* a = resource.Allocate(24, 8);
+    void* b = resource.Allocate(24, 8);
+    BOOST_CHECK(a != b);
+    BOOST_CHECK_EQUAL(resource.BlocksInUse(), 2U);
+    BOOST_CHECK_EQUAL(resource.BytesInUse(), 2 * PoolResource::BlockSize(24));
+    resource.Deallocate(a, 24, 8);
+    BOOST_CHECK(resource.Allocate(20, 8) == a);
+    BOOST_CHECK_EQUAL(resource.ChunkCount(), 1U);
+    BOOST_CHECK_EQUAL(resource.BytesAllocated(), 1024U);
+
+    // Filling the first chunk starts a second one.
+    std::vector<void*> blocks;
+    for (int i = 0; i < 64; i++)
+        blocks.push_back(resource.Allocate(64, 8));
+    BOOST_CHECK(resource.ChunkCount() > 1);
+
+    // Large or overaligned requests do not touch the pool.
+    size_t nInUse = resource.BlocksInUse();
+    void* big = resource.Allocate(PoolResource::MAX_BLOCK_SIZE + 1, 8);
+    resource.Deallocate(big, PoolResource::MAX_BLOCK_SIZE + 1, 8);
+    BOOST_CHECK_EQUAL(resource.BlocksInUse(), nInUse);
+
+    // Chunks are only released once everything was given back.
+    BOOST_CHECK(!resource.Release());
+    for (size_t i = 0; i < blocks.size(); i++)
+        resource.Deallocate(blocks[i], 64, 8);
+    resource.Deallocate(a, 20, 8);
+    resource.Deallocate(b, 24, 8);
+    BOOST_CHECK_EQUAL(resource.BlocksInUse(), 0U);
+    BOOST_CHECK_EQUAL(resource.BytesInUse(), 0U);
+    BOOST_CHECK_EQUAL(resource.BytesAllocated(), resource.ChunkCount() * 1024);
+    BOOST_CHECK(resource.Release());
+    BOOST_CHECK_EQUAL(resource.ChunkCount(), 0U);
+    BOOST_CHECK_EQUAL(resource.BytesAllocated(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(pool_allocator_map)
+{
+    typedef boost::unordered_map<int, uint64_t, boost::hash<int>, std::equal_to<int>, PoolAllocator<std::pair<const int, uint64_t> > > PooledMap;
+    PoolResource resource;
+    {
+        PooledMap map(0, boost::hash<int>(), std::equal_to<int>(), PooledMap::allocator_type(&resource));
+        for (int i = 0; i < 10000; i++)
+            map[i] = i;
+        for (int i = 0; i < 10000; i += 2)
+            map.erase(i);
+        BOOST_CHECK_EQUAL(map.size(), 5000U);
+        BOOST_CHECK_EQUAL(resource.BlocksInUse(), 5000U);
+        // Erasing does not shrink the pool.
+        BOOST_CHECK(resource.BytesAllocated() >= 2 * resource.BytesInUse());
+        for (int i = 1; i < 10000; i += 2)
+            BOOST_CHECK_EQUAL(map[i], (uint64_t)i);
+    }
+    BOOST_CHECK_EQUAL(resource.BlocksInUse(), 0U);
+    BOOST_CHECK(resource.Release());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -6,13 +6,97 @@
 #include "chainparams.h"
 #include "pow.h"
 #include "random.h"
+#include "txdb.h"
 #include "util.h"
 #include "test/test_bitcoin.h"
 
 #include <boost/test/unit_test.hpp>
 
+#include <math.h>
+
 using namespace std;
 
+/** Straightforward Kimoto Gravity Well as originally written, to compare the optimized one against. */
+static unsigned int ReferenceKimotoGravityWell(const CBlockIndex* pindexLast, uint64_t TargetBlocksSpacingSeconds, uint64_t PastBlocksMin, uint64_t PastBlocksMax, const Consensus::Params& params)
+{
+    const CBlockIndex *BlockLastSolved = pindexLast;
+    const CBlockIndex *BlockReading = pindexLast;
+    uint64_t PastBlocksMass = 0;
+    int64_t PastRateActualSeconds = 0;
+    int64_t PastRateTargetSeconds = 0;
+    double PastRateAdjustmentRatio = double(1);
+    arith_uint256 PastDifficultyAverage;
+    arith_uint256 PastDifficultyAveragePrev;
+    const arith_uint256 bnProofOfWorkLimit = UintToArith256(params.powLimit);
+
+    if (BlockLastSolved == NULL || BlockLastSolved->nHeight == 0 || (uint64_t)BlockLastSolved->nHeight < PastBlocksMin)
+        return bnProofOfWorkLimit.GetCompact();
+
+    for (unsigned int i = 1; BlockReading && BlockReading->nHeight > 0; i++) {
+        if (PastBlocksMax > 0 && i > PastBlocksMax)
+            break;
+        PastBlocksMass++;
+
+        if (i == 1) {
+            PastDifficultyAverage.SetCompact(BlockReading->nBits);
+        } else {
+            arith_uint256 nBitsCompact = arith_uint256().SetCompact(BlockReading->nBits);
+            if (nBitsCompact > PastDifficultyAveragePrev)
+                PastDifficultyAverage = PastDifficultyAveragePrev + ((nBitsCompact - PastDifficultyAveragePrev) / i);
+            else
+                PastDifficultyAverage = PastDifficultyAveragePrev - ((PastDifficultyAveragePrev - nBitsCompact) / i);
+        }
+        PastDifficultyAveragePrev = PastDifficultyAverage;
+
+        PastRateActualSeconds = BlockLastSolved->GetBlockTime() - BlockReading->GetBlockTime();
+        PastRateTargetSeconds = TargetBlocksSpacingSeconds * PastBlocksMass;
+        PastRateAdjustmentRatio = double(1);
+        if (PastRateActualSeconds < 0)
+            PastRateActualSeconds = 0;
+        if (PastRateActualSeconds != 0 && PastRateTargetSeconds != 0)
+            PastRateAdjustmentRatio = double(PastRateTargetSeconds) / double(PastRateActualSeconds);
+        double EventHorizonDeviation = 1 + (0.7084 * pow((double(PastBlocksMass)/double(144)), -1.228));
+        double EventHorizonDeviationFast = EventHorizonDeviation;
+        double EventHorizonDeviationSlow = 1 / EventHorizonDeviation;
+
+        if (PastBlocksMass >= PastBlocksMin) {
+            if ((PastRateAdjustmentRatio <= EventHorizonDeviationSlow) || (PastRateAdjustmentRatio >= EventHorizonDeviationFast))
+                break;
+        }
+        if (BlockReading->pprev == NULL)
+            break;
+        BlockReading = BlockReading->pprev;
+    }
+
+    arith_uint256 bnNew(PastDifficultyAverage);
+    if (PastRateActualSeconds != 0 && PastRateTargetSeconds != 0) {
+        bnNew *= PastRateActualSeconds;
+        bnNew /= PastRateTargetSeconds;
+    }
+    if (bnNew > bnProofOfWorkLimit)
+        bnNew = bnProofOfWorkLimit;
+    return bnNew.GetCompact();
+}
+
+/** Straightforward DigiShield retarget (one block interval) as originally written. */
+static unsigned int ReferenceDigiShield(const CBlockIndex* pindexLast, const Consensus::Params& params)
+{
+    const int64_t retargetTimespan = 60;
+    int64_t nActualTimespan = pindexLast->GetBlockTime() - pindexLast->pprev->GetBlockTime();
+    arith_uint256 bnNew;
+    bnNew.SetCompact(pindexLast->nBits);
+    nActualTimespan = retargetTimespan + (nActualTimespan - retargetTimespan)/8;
+    if (nActualTimespan < (retargetTimespan - (retargetTimespan/4)))
+        nActualTimespan = (retargetTimespan - (retargetTimespan/4));
+    if (nActualTimespan > (retargetTimespan + (retargetTimespan/2)))
+        nActualTimespan = (retargetTimespan + (retargetTimespan/2));
+    bnNew *= nActualTimespan;
+    bnNew /= retargetTimespan;
+    if (bnNew > UintToArith256(params.powLimit))
+        bnNew = UintToArith256(params.powLimit);
+    return bnNew.GetCompact();
+}
+
 BOOST_FIXTURE_TEST_SUITE(pow_tests, BasicTestingSetup)
 
 /* Test calculation of next difficulty target with no constraints applying */
@@ -95,4 +179,121 @@ BOOST_AUTO_TEST_CASE(GetBlockProofEquivalentTime_test)
     }
 }
 
+/* Compare GetNextWorkRequired with the reference retargets on random chains spanning the KGW/DigiShield switch */
+BOOST_AUTO_TEST_CASE(get_next_work_matches_reference)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = Params().GetConsensus();
+    const arith_uint256 bnPowLimit = UintToArith256(params.powLimit);
+
+    for (int nChain = 0; nChain < 4; nChain++) {
+        // Start some chains at genesis so that short KGW windows are covered as well.
+        const int nStartHeight = nChain % 2 ? 0 : 53000;
+        std::vector<CBlockIndex> blocks(4000);
+        for (unsigned int i = 0; i < blocks.size(); i++) {
+            blocks[i].pprev = i ? &blocks[i - 1] : NULL;
+            blocks[i].nHeight = nStartHeight + i;
+            // Mostly forward, sometimes backwards timestamps, with bursts of fast and slow blocks.
+            int64_t nSpacing = (insecure_rand() % 8 == 0) ? -int64_t(insecure_rand() % 120) : int64_t(insecure_rand() % (i % 500 < 250 ? 40 : 300));
+            blocks[i].nTime = i ? blocks[i - 1].nTime + nSpacing : 1390000000;
+            blocks[i].nBits = arith_uint256(bnPowLimit >> (insecure_rand() % 24)).GetCompact();
+        }
+
+        for (int j = 0; j < 100; j++) {
+            const CBlockIndex* pindexLast = &blocks[insecure_rand() % blocks.size()];
+            unsigned int nExpected;
+            if (pindexLast->nHeight + 1 >= 56000)
+                nExpected = ReferenceDigiShield(pindexLast, params);
+            else
+                nExpected = ReferenceKimotoGravityWell(pindexLast, 60, 360, 10080, params);
+            BOOST_CHECK_EQUAL(GetNextWorkRequired(pindexLast, NULL, params), nExpected);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(retarget_trace)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = Params().GetConsensus();
+
+    std::vector<CBlockIndex> blocks(5);
+    for (unsigned int i = 0; i < blocks.size(); i++) {
+        blocks[i].pprev = i ? &blocks[i - 1] : NULL;
+        blocks[i].nHeight = 60000 + i;
+        blocks[i].nTime = 1450000000 + i * 90;
+        blocks[i].nBits = 0x1c0ac141;
+    }
+
+    unsigned int nBits = 0;
+    for (unsigned int i = 1; i < blocks.size(); i++) {
+        nBits = GetNextWorkRequired(&blocks[i], NULL, params);
+        // Repeated evaluation for the same tip is only recorded once.
+        GetNextWorkRequired(&blocks[i], NULL, params);
+    }
+
+    std::vector<CRetargetTrace> trace = GetRetargetTrace(2);
+    BOOST_CHECK_EQUAL(trace.size(), 2U);
+    BOOST_CHECK_EQUAL(trace[0].nHeight, 60004);
+    BOOST_CHECK_EQUAL(trace[1].nHeight, 60005);
+    BOOST_CHECK_EQUAL(trace[1].strAlgorithm, "digishield");
+    BOOST_CHECK_EQUAL(trace[1].nActualTimespan, 90);
+    BOOST_CHECK_EQUAL(trace[1].nBitsBefore, 0x1c0ac141U);
+    BOOST_CHECK_EQUAL(trace[1].nBitsAfter, nBits);
+    BOOST_CHECK(GetRetargetTrace(RETARGET_TRACE_SIZE + 1).size() <= RETARGET_TRACE_SIZE);
+}
+
+static std::map<uint256, CBlockIndex> mapLoadedIndex;
+
+static CBlockIndex* InsertLoadedIndex(const uint256& hash)
+{
+    if (hash.IsNull())
+        return NULL;
+    std::map<uint256, CBlockIndex>::iterator it = mapLoadedIndex.insert(std::make_pair(hash, CBlockIndex())).first;
+    it->second.phashBlock = &it->first;
+    return &it->second;
+}
+
+BOOST_AUTO_TEST_CASE(stored_pow_hashes)
+{
+    CBlockTreeDB blocktree(1 << 20, true);
+    const Consensus::Params& params = Params().GetConsensus();
+
+    // A genesis entry and three descendants.
+    std::vector<CBlockIndex> blocks(4);
+    std::vector<uint256> hashes(blocks.size());
+    std::vector<const CBlockIndex*> vBlocks;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        blocks[i].pprev = i ? &blocks[i - 1] : NULL;
+        blocks[i].nNonce = i;
+        blocks[i].nBits = UintToArith256(params.powLimit).GetCompact();
+        hashes[i] = blocks[i].GetBlockHeader().GetHash();
+        blocks[i].phashBlock = &hashes[i];
+        vBlocks.push_back(&blocks[i]);
+    }
+    std::vector<std::pair<uint256, uint256> > vPoWHashes;
+    vPoWHashes.push_back(std::make_pair(hashes[1], uint256S("01")));
+    vPoWHashes.push_back(std::make_pair(hashes[3], uint256S("02")));
+    std::vector<std::pair<int, const CBlockFileInfo*> > vFiles;
+    BOOST_CHECK(blocktree.WriteBatchSync(vFiles, 0, vBlocks, vPoWHashes));
+
+    // Only the non-genesis entry without a stored hash is reported.
+    std::vector<uint256> vMissing;
+    BOOST_CHECK(blocktree.LoadBlockIndexGuts(InsertLoadedIndex, vMissing));
+    BOOST_CHECK_EQUAL(mapLoadedIndex.size(), blocks.size());
+    BOOST_CHECK(vMissing.size() == 1 && vMissing[0] == hashes[2]);
+    uint256 hashPoW;
+    BOOST_CHECK(blocktree.ReadPoWHash(hashes[3], hashPoW) && hashPoW == uint256S("02"));
+
+    // A stored hash that misses its target fails the load.
+    vPoWHashes.assign(1, std::make_pair(hashes[2], uint256S("ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff")));
+    BOOST_CHECK(blocktree.WritePoWHashes(vPoWHashes));
+    BOOST_CHECK(!blocktree.LoadBlockIndexGuts(InsertLoadedIndex, vMissing));
+
+    // Hashes stored under another layout version are ignored.
+    BOOST_CHECK(blocktree.WritePoWHashVersion(POW_HASH_INDEX_VERSION + 1));
+    BOOST_CHECK(blocktree.LoadBlockIndexGuts(InsertLoadedIndex, vMissing));
+    BOOST_CHECK_EQUAL(vMissing.size(), blocks.size() - 1);
+    mapLoadedIndex.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -79,6 +79,7 @@ TestingSetup::~TestingSetup()
         UnloadBlockIndex();
         delete pcoinsTip;
         delete pcoinsdbview;
+        pcoinsdbview = NULL;
         delete pblocktree;
         boost::filesystem::remove_all(pathTemp);
 }
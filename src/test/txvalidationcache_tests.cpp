@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "chainparams.h"
 #include "consensus/validation.h"
 #include "key.h"
 #include "main.h"
@@ -9,7 +10,9 @@
 #include "pubkey.h"
 #include "txmempool.h"
 #include "random.h"
+#include "script/interpreter.h"
 #include "script/standard.h"
+#include "util.h"
 #include "test/test_bitcoin.h"
 #include "utiltime.h"
 
@@ -83,4 +86,106 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain100Setup)
     BOOST_CHECK_EQUAL(mempool.size(), 0);
 }
 
+// Point the tip's copy of an output at a script nothing can spend, so any
+// transaction spending it only passes if its scripts are not run again.
+static void BreakTipOutput(const COutPoint& prevout)
+{
+    LOCK(cs_main);
+    CCoinsModifier coins = pcoinsTip->ModifyCoins(prevout.hash);
+    coins->vout[prevout.n].scriptPubKey = CScript() << OP_FALSE;
+}
+
+BOOST_FIXTURE_TEST_CASE(tx_template_script_execution_cache, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    // Split a mature coinbase output into three outputs to spend
+    const CTransaction& coinbase = coinbaseTxns[0];
+    unsigned int nOut = 0;
+    while (nOut < coinbase.vout.size() && coinbase.vout[nOut].scriptPubKey != scriptPubKey)
+        nOut++;
+    BOOST_REQUIRE(nOut < coinbase.vout.size());
+
+    CMutableTransaction split;
+    split.vin.resize(1);
+    split.vin[0].prevout = COutPoint(coinbase.GetHash(), nOut);
+    split.vout.resize(3);
+    for (unsigned int i = 0; i < 3; i++) {
+        split.vout[i].nValue = coinbase.vout[nOut].nValue / 4;
+        split.vout[i].scriptPubKey = scriptPubKey;
+    }
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, split, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_REQUIRE(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    split.vin[0].scriptSig << vchSig;
+    std::vector<CMutableTransaction> splits;
+    splits.push_back(split);
+    CBlock block = CreateAndProcessBlock(splits, scriptPubKey);
+    BOOST_REQUIRE(chainActive.Tip()->GetBlockHash() == block.GetHash());
+
+    std::vector<CMutableTransaction> spends;
+    spends.resize(3);
+    for (unsigned int i = 0; i < 3; i++) {
+        spends[i].vin.resize(1);
+        spends[i].vin[0].prevout = COutPoint(split.GetHash(), i);
+        spends[i].vout.resize(1);
+        spends[i].vout[0].nValue = split.vout[i].nValue - CENT;
+        spends[i].vout[0].scriptPubKey = scriptPubKey;
+
+        vchSig.clear();
+        hash = SignatureHash(scriptPubKey, spends[i], 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        BOOST_REQUIRE(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        spends[i].vin[0].scriptSig << vchSig;
+    }
+
+    // Test 1: scripts AcceptToMemoryPool ran are not run again
+    BOOST_CHECK(ToMemPool(spends[0]));
+    CBlockTemplate* pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2);
+    BreakTipOutput(spends[0].vin[0].prevout);
+    CValidationState state;
+    BOOST_CHECK(TestBlockTemplateValidity(state, chainparams, pblocktemplate->block, chainActive.Tip()));
+    delete pblocktemplate;
+    mempool.clear();
+
+    // Test 2: ... unless the block's script flags are stricter than the ones
+    // they were checked with, in which case the script check queue fails them
+    mapArgs["-promiscuousmempoolflags"] = strprintf("%u", SCRIPT_VERIFY_NONE);
+    BOOST_CHECK(ToMemPool(spends[1]));
+    mapArgs.erase("-promiscuousmempoolflags");
+    pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2);
+    BreakTipOutput(spends[1].vin[0].prevout);
+    state = CValidationState();
+    BOOST_CHECK(!TestBlockTemplateValidity(state, chainparams, pblocktemplate->block, chainActive.Tip()));
+    BOOST_CHECK(state.IsInvalid());
+    // Failures from the queue carry no reject reason, unlike inline checks
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "");
+    delete pblocktemplate;
+    mempool.clear();
+
+    // Test 3: transactions that did not go through AcceptToMemoryPool have
+    // their scripts checked by the queue too
+    TestMemPoolEntryHelper entry;
+    {
+        LOCK(mempool.cs);
+        mempool.addUnchecked(spends[2].GetHash(), entry.Fee(CENT).FromTx(spends[2]));
+    }
+    pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2);
+    BreakTipOutput(spends[2].vin[0].prevout);
+    state = CValidationState();
+    BOOST_CHECK(!TestBlockTemplateValidity(state, chainparams, pblocktemplate->block, chainActive.Tip()));
+    BOOST_CHECK(state.IsInvalid());
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "");
+    delete pblocktemplate;
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -7,35 +7,160 @@
 
 #include "chainparams.h"
 #include "hash.h"
+#include "init.h"
 #include "pow.h"
+#include "ui_interface.h"
 #include "uint256.h"
+#include "util.h"
 
 #include <stdint.h>
 
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
 
 static const char DB_COINS = 'c';
+static const char DB_COIN_OUTPUTS = 'C';
+static const char DB_COINS_LAYOUT = 'L';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
 static const char DB_BLOCK_INDEX = 'b';
+static const char DB_POW_HASH = 'p';
 
 static const char DB_BEST_BLOCK = 'B';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_POW_HASH_VERSION = 'P';
+static const char DB_UTXO_COMMITMENT = 'H';
+static const char DB_TXOUTSET_SNAPSHOT = 'S';
 
+//! Values of DB_COINS_LAYOUT; a database without it is per transaction
+static const int COINS_LAYOUT_PER_OUTPUT = 1;
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
+//! Number of transactions converted per batch by CCoinsViewDB::Upgrade
+static const size_t UPGRADE_BATCH_TXS = 10000;
+//! Number of records erased per batch by CCoinsViewDB::EraseCoins
+static const size_t ERASE_BATCH_KEYS = 100000;
+
+namespace {
+
+/** Key of an output in the per-output layout. */
+struct CCoinsOutputKey
 {
+    char chType;
+    uint256 txid;
+    uint32_t n;
+
+    CCoinsOutputKey() : chType(0), n(0) {}
+    CCoinsOutputKey(const uint256 &txidIn, uint32_t nIn) : chType(DB_COIN_OUTPUTS), txid(txidIn), n(nIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(chType);
+        READWRITE(txid);
+        READWRITE(VARINT(n));
+    }
+};
+
+/**
+ * Value of an output in the per-output layout. The transaction properties
+ * are repeated for every output, so that each record stands on its own.
+ */
+struct CCoinsOutputRecord
+{
+    int nTxVersion;
+    unsigned int nHeight;
+    bool fCoinBase;
+    CTxOut txout;
+
+    CCoinsOutputRecord() : nTxVersion(0), nHeight(0), fCoinBase(false) {}
+    CCoinsOutputRecord(const CCoins &coins, uint32_t n) : nTxVersion(coins.nVersion), nHeight(coins.nHeight), fCoinBase(coins.fCoinBase), txout(coins.vout[n]) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        unsigned int nCode = nHeight * 2 + fCoinBase;
+        READWRITE(VARINT(nCode));
+        nHeight = nCode / 2;
+        fCoinBase = nCode & 1;
+        READWRITE(VARINT(nTxVersion));
+        READWRITE(REF(CTxOutCompressor(txout)));
+    }
+
+    void AddTo(CCoins &coins, uint32_t n) const
+    {
+        coins.nVersion = nTxVersion;
+        coins.nHeight = nHeight;
+        coins.fCoinBase = fCoinBase;
+        if (coins.vout.size() <= n)
+            coins.vout.resize(n + 1);
+        coins.vout[n] = txout;
+    }
+};
+
+}
+
+
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe, const CDBOptions& dbopts, const std::string& strName) : db(GetDataDir() / strName, nCacheSize, fMemory, fWipe, true, dbopts)
+{
+    int nLayout = 0;
+    fPerOutput = db.Read(DB_COINS_LAYOUT, nLayout) && nLayout == COINS_LAYOUT_PER_OUTPUT;
+}
+
+bool CCoinsViewDB::GetOutputs(const uint256 &txid, CCoins &coins) const {
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewLookupIterator());
+    pcursor->Seek(CCoinsOutputKey(txid, 0));
+    coins.Clear();
+    bool fFound = false;
+    CCoinsOutputKey key;
+    CCoinsOutputRecord record;
+    while (pcursor->Valid() && pcursor->GetKey(key) && key.chType == DB_COIN_OUTPUTS && key.txid == txid) {
+        if (!pcursor->GetValue(record))
+            throw std::runtime_error("Unreadable coin database entry");
+        record.AddTo(coins, key.n);
+        fFound = true;
+        pcursor->Next();
+    }
+    return fFound;
+}
+
+void CCoinsViewDB::WriteOutputs(CDBBatch &batch, const uint256 &txid, const CCoins &coins, uint32_t nOutputsOld) const {
+    // The outputs of a transaction never change once created, but without
+    // looking them up it is not known which ones the database has already;
+    // rewriting them is a cheap sequential write, unlike the lookup.
+    CCoins coinsOld;
+    if (nOutputsOld == CCoinsCacheEntry::UNKNOWN_OUTPUTS) {
+        GetOutputs(txid, coinsOld);
+        nOutputsOld = coinsOld.vout.size();
+    }
+    for (uint32_t n = 0; n < nOutputsOld; n++) {
+        if (!coins.IsAvailable(n))
+            batch.Erase(CCoinsOutputKey(txid, n));
+    }
+    for (uint32_t n = 0; n < coins.vout.size(); n++) {
+        if (!coins.vout[n].IsNull())
+            batch.Write(CCoinsOutputKey(txid, n), CCoinsOutputRecord(coins, n));
+    }
 }
 
 bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
+    if (fPerOutput)
+        return GetOutputs(txid, coins);
     return db.Read(make_pair(DB_COINS, txid), coins);
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
+    if (fPerOutput) {
+        boost::scoped_ptr<CDBIterator> pcursor(db.NewLookupIterator());
+        pcursor->Seek(CCoinsOutputKey(txid, 0));
+        CCoinsOutputKey key;
+        return pcursor->Valid() && pcursor->GetKey(key) && key.chType == DB_COIN_OUTPUTS && key.txid == txid;
+    }
     return db.Exists(make_pair(DB_COINS, txid));
 }
 
@@ -46,30 +171,117 @@ uint256 CCoinsViewDB::GetBestBlock() const {
     return hashBestChain;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            if (it->second.coins.IsPruned())
+            if (fPerOutput)
+                WriteOutputs(batch, it->first, it->second.coins, (it->second.flags & CCoinsCacheEntry::FRESH) ? 0 : it->second.nBaseOutputs);
+            else if (it->second.coins.IsPruned())
                 batch.Erase(make_pair(DB_COINS, it->first));
             else
                 batch.Write(make_pair(DB_COINS, it->first), it->second.coins);
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (fErase) {
+            CCoinsMap::iterator itOld = it++;
+            mapCoins.erase(itOld);
+        } else {
+            ++it;
+        }
     }
-    if (!hashBlock.IsNull())
+    if (!hashBlock.IsNull()) {
         batch.Write(DB_BEST_BLOCK, hashBlock);
+        // An older commitment is left alone; it names the block it is for.
+        if (hashCommitmentBlock == hashBlock)
+            batch.Write(DB_UTXO_COMMITMENT, make_pair(hashCommitmentBlock, commitment));
+    }
 
     LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
     return db.WriteBatch(batch);
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+void CCoinsViewDB::SetCommitment(const CUTXOCommitment &commitmentIn, const uint256 &hashBlock) {
+    commitment = commitmentIn;
+    hashCommitmentBlock = hashBlock;
+}
+
+bool CCoinsViewDB::GetCommitment(CUTXOCommitment &commitmentOut, uint256 &hashBlock) const {
+    std::pair<uint256, CUTXOCommitment> value;
+    if (!db.Read(DB_UTXO_COMMITMENT, value))
+        return false;
+    hashBlock = value.first;
+    commitmentOut = value.second;
+    return true;
+}
+
+bool CCoinsViewDB::WriteFreshCoins(const std::vector<std::pair<uint256, CCoins> > &vCoins) {
+    CDBBatch batch(db);
+    for (std::vector<std::pair<uint256, CCoins> >::const_iterator it = vCoins.begin(); it != vCoins.end(); ++it) {
+        if (fPerOutput)
+            WriteOutputs(batch, it->first, it->second, 0);
+        else
+            batch.Write(make_pair(DB_COINS, it->first), it->second);
+    }
+    return db.WriteBatch(batch);
+}
+
+bool CCoinsViewDB::EraseCoins() {
+    // The cursor reads from the state at its creation, so erasing behind it is fine.
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    if (fPerOutput)
+        pcursor->Seek(CCoinsOutputKey(uint256(), 0));
+    else
+        pcursor->Seek(make_pair(DB_COINS, uint256()));
+    CDBBatch batch(db);
+    size_t nBatchKeys = 0;
+    for (; pcursor->Valid(); pcursor->Next()) {
+        if (fPerOutput) {
+            CCoinsOutputKey key;
+            if (!pcursor->GetKey(key) || key.chType != DB_COIN_OUTPUTS)
+                break;
+            batch.Erase(key);
+        } else {
+            std::pair<char, uint256> key;
+            if (!pcursor->GetKey(key) || key.first != DB_COINS)
+                break;
+            batch.Erase(key);
+        }
+        if (++nBatchKeys >= ERASE_BATCH_KEYS) {
+            if (!db.WriteBatch(batch))
+                return false;
+            batch.Clear();
+            nBatchKeys = 0;
+        }
+    }
+    return db.WriteBatch(batch);
+}
+
+bool CCoinsViewDB::ReadSnapshot(CTxOutSetSnapshot &snapshot) const {
+    return db.Read(DB_TXOUTSET_SNAPSHOT, snapshot);
+}
+
+bool CCoinsViewDB::WriteSnapshot(const CTxOutSetSnapshot &snapshot) {
+    return db.Write(DB_TXOUTSET_SNAPSHOT, snapshot, true);
+}
+
+void CCoinsViewDB::CompactSlice(int nSlice, int nSlices) const {
+    // Coin keys are the layout's prefix followed by the txid, so slicing by
+    // the first txid byte gives parts of about the same size.
+    const char chPrefix = fPerOutput ? DB_COIN_OUTPUTS : DB_COINS;
+    uint256 txidBegin, txidEnd;
+    *txidBegin.begin() = nSlice * 256 / nSlices;
+    *txidEnd.begin() = (nSlice + 1) * 256 / nSlices;
+    if (nSlice + 1 < nSlices)
+        db.CompactRange(make_pair(chPrefix, txidBegin), make_pair(chPrefix, txidEnd));
+    else
+        db.CompactRange(make_pair(chPrefix, txidBegin), make_pair((char)(chPrefix + 1), uint256()));
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe, const CDBOptions& dbopts) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe, false, dbopts) {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -92,22 +304,248 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read(DB_LAST_BLOCK, nFile);
 }
 
+bool CCoinsViewDB::Upgrade(bool fPerOutputWanted) {
+    if (!fPerOutput) {
+        if (!fPerOutputWanted)
+            return true;
+        if (!db.Write(DB_COINS_LAYOUT, COINS_LAYOUT_PER_OUTPUT, true))
+            return false;
+        fPerOutput = true;
+    }
+
+    // Convert whatever per-transaction records are left, which after an
+    // interruption is only part of them.
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(make_pair(DB_COINS, uint256()));
+    std::pair<char, uint256> key;
+    if (!pcursor->Valid() || !pcursor->GetKey(key) || key.first != DB_COINS)
+        return true;
+
+    LogPrintf("Upgrading chain state database to one record per unspent output...\n");
+    uiInterface.ShowProgress(_("Upgrading chain state database..."), 0);
+    CDBBatch batch(db);
+    size_t nBatchTxs = 0;
+    uint64_t nTxs = 0, nOutputs = 0;
+    int nReportDone = 0;
+    while (pcursor->Valid()) {
+        // This runs on the init thread, which is never interrupted. Stopping
+        // between batches is safe: each one converts its transactions and
+        // erases their old records atomically, and the next start resumes.
+        if (ShutdownRequested()) {
+            db.WriteBatch(batch, true);
+            uiInterface.ShowProgress("", 100);
+            LogPrintf("Interrupted after converting %u transactions; the upgrade resumes at the next start.\n", nTxs);
+            return true;
+        }
+        if (!pcursor->GetKey(key) || key.first != DB_COINS)
+            break;
+        CCoins coins;
+        if (!pcursor->GetValue(coins))
+            return error("%s: unable to read coins of %s", __func__, key.second.ToString());
+        for (uint32_t n = 0; n < coins.vout.size(); n++) {
+            if (!coins.vout[n].IsNull()) {
+                batch.Write(CCoinsOutputKey(key.second, n), CCoinsOutputRecord(coins, n));
+                nOutputs++;
+            }
+        }
+        batch.Erase(key);
+        nTxs++;
+        if (++nBatchTxs >= UPGRADE_BATCH_TXS) {
+            db.WriteBatch(batch);
+            batch.Clear();
+            nBatchTxs = 0;
+            // Txids are uniformly distributed, so their first byte tells how far along we are.
+            int nDone = (int)*key.second.begin() * 100 / 256;
+            if (nDone >= nReportDone + 10) {
+                LogPrintf("[%d%%]...", nDone);
+                uiInterface.ShowProgress(_("Upgrading chain state database..."), nDone);
+                nReportDone = nDone;
+            }
+        }
+        pcursor->Next();
+    }
+    db.WriteBatch(batch, true);
+    uiInterface.ShowProgress("", 100);
+    LogPrintf("[DONE]. Converted %u transactions into %u outputs.\n", nTxs, nOutputs);
+    return true;
+}
+
 CCoinsViewCursor *CCoinsViewDB::Cursor() const
 {
-    CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper*>(&db)->NewIterator(), GetBestBlock());
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
-    i->pcursor->Seek(DB_COINS);
+    return Cursor(const_cast<CDBWrapper*>(&db)->NewIterator(), GetBestBlock(), uint256());
+}
+
+CCoinsViewDBCursor *CCoinsViewDB::Cursor(CDBIterator *pcursor, const uint256 &hashBlock, const uint256 &txidFrom) const
+{
+    CCoinsViewDBCursor *i = new CCoinsViewDBCursor(pcursor, hashBlock, fPerOutput);
+    if (fPerOutput) {
+        i->pcursor->Seek(CCoinsOutputKey(txidFrom, 0));
+        i->ReadOutputs();
+        return i;
+    }
+    i->pcursor->Seek(make_pair(DB_COINS, txidFrom));
     // Cache key of first record
-    i->pcursor->GetKey(i->keyTmp);
+    if (!i->pcursor->Valid() || !i->pcursor->GetKey(i->keyTmp))
+        i->keyTmp.first = 0;
     return i;
 }
 
+/** State shared between the threads of CCoinsViewDB::ScanCoins. */
+struct CCoinsScanState
+{
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    //! Finished chunks of each part of the key range, and whether the part is complete
+    std::vector<std::deque<CCoinsScanChunk*> > vChunks;
+    std::vector<bool> vDone;
+    int nNextPart;
+    int nConsumePart;
+    size_t nBuffered;
+    bool fAbort;
+    bool fError;
+
+    CCoinsScanState(int nParts) : vChunks(nParts), vDone(nParts, false), nNextPart(0), nConsumePart(0), nBuffered(0), fAbort(false), fError(false) {}
+
+    ~CCoinsScanState()
+    {
+        for (size_t i = 0; i < vChunks.size(); i++) {
+            BOOST_FOREACH(CCoinsScanChunk *pchunk, vChunks[i])
+                delete pchunk;
+        }
+    }
+
+    //! Stop the workers, e.g. because the scan is over
+    void Abort()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fAbort = true;
+        cond.notify_all();
+    }
+};
+
+namespace {
+//! The key range is split by the first byte of the txid
+const int SCAN_PARTS = 256;
+//! Size at which a chunk is handed over (bytes)
+const size_t SCAN_CHUNK_SIZE = 1 << 20;
+}
+
+void CCoinsViewDB::ThreadScanCoins(CCoinsScanState &state, const leveldb::Snapshot *snapshot, const uint256 &hashBlock, int nType, int nVersion, const ScanEncoder& encode) const
+{
+    try {
+        while (true) {
+            int nPart;
+            {
+                boost::unique_lock<boost::mutex> lock(state.mutex);
+                if (state.fAbort || state.nNextPart == SCAN_PARTS)
+                    return;
+                nPart = state.nNextPart++;
+            }
+            uint256 txidFrom;
+            *txidFrom.begin() = nPart * 256 / SCAN_PARTS;
+            const int nEnd = (nPart + 1) * 256 / SCAN_PARTS;
+            boost::scoped_ptr<CCoinsViewDBCursor> pcursor(Cursor(db.NewIterator(snapshot), hashBlock, txidFrom));
+            CCoinsScanChunk *pchunk = new CCoinsScanChunk(nType, nVersion);
+            while (true) {
+                uint256 txid;
+                CCoins coins;
+                bool fLast = !pcursor->Valid() || !pcursor->GetKey(txid) || *txid.begin() >= nEnd;
+                if (!fLast) {
+                    if (!pcursor->GetValue(coins)) {
+                        delete pchunk;
+                        throw std::runtime_error("Unreadable coin database entry");
+                    }
+                    encode(txid, coins, pcursor->GetValueSize(), *pchunk);
+                    pcursor->Next();
+                    if (pchunk->data.size() < SCAN_CHUNK_SIZE)
+                        continue;
+                }
+                boost::unique_lock<boost::mutex> lock(state.mutex);
+                // Parts ahead of the consumer wait for room; the one it is on never does.
+                while (!state.fAbort && nPart != state.nConsumePart && state.nBuffered > MAX_SCAN_BUFFER)
+                    state.cond.wait(lock);
+                if (state.fAbort) {
+                    delete pchunk;
+                    return;
+                }
+                state.nBuffered += pchunk->data.size();
+                state.vChunks[nPart].push_back(pchunk);
+                state.vDone[nPart] = fLast;
+                state.cond.notify_all();
+                if (fLast)
+                    break;
+                pchunk = new CCoinsScanChunk(nType, nVersion);
+            }
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+        boost::unique_lock<boost::mutex> lock(state.mutex);
+        state.fError = state.fAbort = true;
+        state.cond.notify_all();
+    }
+}
+
+bool CCoinsViewDB::ScanCoins(int nThreads, int nType, int nVersion, const ScanEncoder& encode, const ScanConsumer& consume, uint256 &hashBlock) const
+{
+    const leveldb::Snapshot *snapshot = db.GetSnapshot();
+    {
+        boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator(snapshot));
+        pcursor->Seek(DB_BEST_BLOCK);
+        char chKey;
+        if (!pcursor->Valid() || !pcursor->GetKey(chKey) || chKey != DB_BEST_BLOCK || !pcursor->GetValue(hashBlock))
+            hashBlock.SetNull();
+    }
+
+    CCoinsScanState state(SCAN_PARTS);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < std::max(nThreads, 1); i++)
+        threadGroup.create_thread(boost::bind(&CCoinsViewDB::ThreadScanCoins, this, boost::ref(state), snapshot, boost::cref(hashBlock), nType, nVersion, boost::cref(encode)));
+
+    bool fOk = true;
+    try {
+        for (int nPart = 0; nPart < SCAN_PARTS && fOk; ) {
+            if (ShutdownRequested()) {
+                fOk = false;
+                break;
+            }
+            boost::scoped_ptr<CCoinsScanChunk> pchunk;
+            {
+                boost::unique_lock<boost::mutex> lock(state.mutex);
+                while (!state.fError && state.vChunks[nPart].empty())
+                    state.cond.wait(lock);
+                if (state.fError) {
+                    fOk = false;
+                    break;
+                }
+                pchunk.reset(state.vChunks[nPart].front());
+                state.vChunks[nPart].pop_front();
+                state.nBuffered -= pchunk->data.size();
+                if (state.vChunks[nPart].empty() && state.vDone[nPart])
+                    state.nConsumePart = ++nPart;
+                state.cond.notify_all();
+            }
+            fOk = consume(*pchunk);
+        }
+    } catch (...) {
+        state.Abort();
+        threadGroup.join_all();
+        db.ReleaseSnapshot(snapshot);
+        throw;
+    }
+
+    state.Abort();
+    threadGroup.join_all();
+    db.ReleaseSnapshot(snapshot);
+    return fOk;
+}
+
 bool CCoinsViewDBCursor::GetKey(uint256 &key) const
 {
     // Return cached key
-    if (keyTmp.first == DB_COINS) {
+    if (keyTmp.first == (fPerOutput ? DB_COIN_OUTPUTS : DB_COINS)) {
         key = keyTmp.second;
         return true;
     }
@@ -116,27 +554,59 @@ bool CCoinsViewDBCursor::GetKey(uint256 &key) const
 
 bool CCoinsViewDBCursor::GetValue(CCoins &coins) const
 {
+    if (fPerOutput) {
+        coins = coinsTmp;
+        return true;
+    }
     return pcursor->GetValue(coins);
 }
 
 unsigned int CCoinsViewDBCursor::GetValueSize() const
 {
+    if (fPerOutput)
+        return nValueSizeTmp;
     return pcursor->GetValueSize();
 }
 
 bool CCoinsViewDBCursor::Valid() const
 {
-    return keyTmp.first == DB_COINS;
+    return keyTmp.first == (fPerOutput ? DB_COIN_OUTPUTS : DB_COINS);
 }
 
 void CCoinsViewDBCursor::Next()
 {
+    if (fPerOutput) {
+        ReadOutputs();
+        return;
+    }
     pcursor->Next();
     if (!pcursor->Valid() || !pcursor->GetKey(keyTmp))
         keyTmp.first = 0; // Invalidate cached key after last record so that Valid() and GetKey() return false
 }
 
-bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
+void CCoinsViewDBCursor::ReadOutputs()
+{
+    // Gather the outputs of the transaction at the current position, leaving
+    // the cursor at the first output of the next one.
+    keyTmp.first = 0;
+    coinsTmp.Clear();
+    CCoinsOutputKey key;
+    CCoinsOutputRecord record;
+    while (pcursor->Valid() && pcursor->GetKey(key) && key.chType == DB_COIN_OUTPUTS) {
+        if (keyTmp.first == DB_COIN_OUTPUTS && key.txid != keyTmp.second)
+            break;
+        if (!pcursor->GetValue(record))
+            throw std::runtime_error("Unreadable coin database entry");
+        keyTmp = make_pair(DB_COIN_OUTPUTS, key.txid);
+        record.AddTo(coinsTmp, key.n);
+        pcursor->Next();
+    }
+    // Report the size the transaction has in the per-transaction layout, so
+    // that statistics do not depend on the layout.
+    nValueSizeTmp = Valid() ? ::GetSerializeSize(coinsTmp, SER_DISK, CLIENT_VERSION) : 0;
+}
+
+bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo, const std::vector<std::pair<uint256, uint256> >& powhashes) {
     CDBBatch batch(*this);
     for (std::vector<std::pair<int, const CBlockFileInfo*> >::const_iterator it=fileInfo.begin(); it != fileInfo.end(); it++) {
         batch.Write(make_pair(DB_BLOCK_FILES, it->first), *it->second);
@@ -145,9 +615,31 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
         batch.Write(make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it));
     }
+    for (std::vector<std::pair<uint256, uint256> >::const_iterator it=powhashes.begin(); it != powhashes.end(); it++) {
+        batch.Write(make_pair(DB_POW_HASH, it->first), it->second);
+    }
     return WriteBatch(batch, true);
 }
 
+bool CBlockTreeDB::ReadPoWHash(const uint256 &hash, uint256 &hashPoW) {
+    return Read(make_pair(DB_POW_HASH, hash), hashPoW);
+}
+
+bool CBlockTreeDB::WritePoWHashes(const std::vector<std::pair<uint256, uint256> >& powhashes) {
+    CDBBatch batch(*this);
+    for (std::vector<std::pair<uint256, uint256> >::const_iterator it=powhashes.begin(); it != powhashes.end(); it++)
+        batch.Write(make_pair(DB_POW_HASH, it->first), it->second);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadPoWHashVersion(int &nVersion) {
+    return Read(DB_POW_HASH_VERSION, nVersion);
+}
+
+bool CBlockTreeDB::WritePoWHashVersion(int nVersion) {
+    return Write(DB_POW_HASH_VERSION, nVersion);
+}
+
 bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
     return Read(make_pair(DB_TXINDEX, txid), pos);
 }
@@ -171,12 +663,38 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
-bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex)
+/**
+ * Advance pcursor through the PoW hash keyspace up to hash, which must not be
+ * lower than the previous one asked for, and read the PoW hash stored for it.
+ */
+static bool FindPoWHash(CDBIterator& pcursor, const uint256& hash, uint256& hashPoW)
+{
+    std::pair<char, uint256> key;
+    while (pcursor.Valid() && pcursor.GetKey(key) && key.first == DB_POW_HASH) {
+        if (hash < key.second)
+            return false;
+        if (key.second == hash)
+            return pcursor.GetValue(hashPoW);
+        pcursor.Next();
+    }
+    return false;
+}
+
+bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex, std::vector<uint256>& vMissingPoWHash)
 {
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
     pcursor->Seek(make_pair(DB_BLOCK_INDEX, uint256()));
 
+    // Both keyspaces are ordered by block hash, so the stored PoW hashes can
+    // be matched up with the index entries by walking a second cursor along.
+    // Hashes written under a different layout version are not trusted.
+    int nPoWHashVersion = 0;
+    boost::scoped_ptr<CDBIterator> pcursorPoW(NewIterator());
+    if (!ReadPoWHashVersion(nPoWHashVersion) || nPoWHashVersion == POW_HASH_INDEX_VERSION)
+        pcursorPoW->Seek(make_pair(DB_POW_HASH, uint256()));
+    vMissingPoWHash.clear();
+
     // Load mapBlockIndex
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
@@ -199,14 +717,18 @@ bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256
                 pindexNew->nStatus        = diskindex.nStatus;
                 pindexNew->nTx            = diskindex.nTx;
 
-                // Einsteinium: Disable PoW Sanity check while loading block index from disk.
-                // We use the sha256 hash for the block index for performance reasons, which is recorded for later use.
-                // CheckProofOfWork() uses the scrypt hash which is discarded after a block is accepted.
-                // While it is technically feasible to verify the PoW, doing so takes several minutes as it
-                // requires recomputing every PoW hash during every Einsteinium startup.
-                // We opt instead to simply trust the data that is on your local disk.
-                //if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, Params().GetConsensus()))
-                //    return error("LoadBlockIndex(): CheckProofOfWork failed: %s", pindexNew->ToString());
+                // Einsteinium: The block index is keyed by the sha256 hash, while the proof of work
+                // is checked against the scrypt hash. Recomputing scrypt for every entry takes several
+                // minutes, so check the target against the PoW hash recorded when the header was
+                // accepted instead. Entries without one are back-filled by ThreadCheckPoWHashes.
+                // The genesis block is never checked.
+                uint256 hashPoW;
+                if (pindexNew->pprev != NULL) {
+                    if (!FindPoWHash(*pcursorPoW, pindexNew->GetBlockHash(), hashPoW))
+                        vMissingPoWHash.push_back(pindexNew->GetBlockHash());
+                    else if (!CheckProofOfWork(hashPoW, pindexNew->nBits, Params().GetConsensus()))
+                        return error("LoadBlockIndex(): CheckProofOfWork failed: %s", pindexNew->ToString());
+                }
 
                 pcursor->Next();
             } else {
@@ -219,3 +741,119 @@ bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256
 
     return true;
 }
+
+CCoinsViewPrefetch::CCoinsViewPrefetch(CCoinsView *viewIn, size_t nMaxUsageIn) : CCoinsViewBacked(viewIn), nStagedUsage(0), nGeneration(0), nThreads(0), nMaxUsage(nMaxUsageIn)
+{
+}
+
+void CCoinsViewPrefetch::ClearStaged() const
+{
+    mapStaged.clear();
+    nStagedUsage = 0;
+}
+
+bool CCoinsViewPrefetch::GetCoins(const uint256 &txid, CCoins &coins) const
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        StagedMap::iterator it = mapStaged.find(txid);
+        if (it != mapStaged.end()) {
+            nStagedUsage -= it->second.DynamicMemoryUsage() + sizeof(StagedMap::value_type);
+            coins.swap(it->second);
+            mapStaged.erase(it);
+            return true;
+        }
+    }
+    return base->GetCoins(txid, coins);
+}
+
+bool CCoinsViewPrefetch::HaveCoins(const uint256 &txid) const
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (mapStaged.count(txid))
+            return true;
+    }
+    return base->HaveCoins(txid);
+}
+
+bool CCoinsViewPrefetch::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nGeneration++;
+        ClearStaged();
+    }
+    bool ret = base->BatchWrite(mapCoins, hashBlock, fErase);
+    // Reads that were in flight during the write may have seen either state.
+    boost::unique_lock<boost::mutex> lock(mutex);
+    nGeneration++;
+    ClearStaged();
+    return ret;
+}
+
+void CCoinsViewPrefetch::Prefetch(const std::vector<uint256>& vTxid)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (nThreads == 0)
+        return;
+    BOOST_FOREACH(const uint256& txid, vTxid) {
+        if (queue.size() >= MAX_PREFETCH_QUEUE)
+            break;
+        if (!mapStaged.count(txid))
+            queue.push_back(txid);
+    }
+    cond.notify_all();
+}
+
+size_t CCoinsViewPrefetch::StagedUsage() const
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return nStagedUsage;
+}
+
+void CCoinsViewPrefetch::ThreadPrefetch()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nThreads++;
+    }
+    try {
+        while (true) {
+            uint256 txid;
+            uint64_t nGenerationRead;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (queue.empty())
+                    cond.wait(lock);
+                txid = queue.front();
+                queue.pop_front();
+                if (mapStaged.count(txid))
+                    continue;
+                nGenerationRead = nGeneration;
+            }
+            CCoins coins;
+            if (!base->GetCoins(txid, coins))
+                continue;
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (nGenerationRead != nGeneration)
+                continue;
+            // Coins nobody asked for pile up if blocks turn out invalid; start over then.
+            size_t nUsage = coins.DynamicMemoryUsage() + sizeof(StagedMap::value_type);
+            if (nStagedUsage + nUsage > nMaxUsage)
+                ClearStaged();
+            std::pair<StagedMap::iterator, bool> ret = mapStaged.insert(std::make_pair(txid, CCoins()));
+            if (ret.second) {
+                ret.first->second.swap(coins);
+                nStagedUsage += nUsage;
+            }
+        }
+    } catch (...) {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (--nThreads == 0) {
+            queue.clear();
+            ClearStaged();
+        }
+        throw;
+    }
+}
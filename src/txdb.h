@@ -10,15 +10,21 @@
 #include "dbwrapper.h"
 #include "chain.h"
 
+#include <deque>
 #include <map>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
 
 class CBlockIndex;
 class CCoinsViewDBCursor;
+struct CCoinsScanState;
+class CTxOutSetSnapshot;
 class uint256;
 
 //! -dbcache default (MiB)
@@ -35,6 +41,26 @@ static const int64_t nMaxBlockDBCache = 2;
 static const int64_t nMaxBlockDBAndTxIndexCache = 1024;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
+//! -coinsperoutput default
+static const bool DEFAULT_COINS_PER_OUTPUT = false;
+//! -prefetchthreads default
+static const int DEFAULT_PREFETCH_THREADS = 4;
+//! Maximum number of coin prefetch threads
+static const int MAX_PREFETCH_THREADS = 16;
+//! Memory the prefetched but not yet used coins may take up (bytes)
+static const size_t MAX_PREFETCH_USAGE = 32 << 20;
+//! Maximum number of txids waiting to be prefetched; the rest is read on demand
+static const size_t MAX_PREFETCH_QUEUE = 100000;
+//! Maximum number of threads a parallel coins scan uses
+static const int MAX_SCAN_THREADS = 16;
+//! Memory the output of a parallel coins scan may take up while waiting to be consumed (bytes)
+static const size_t MAX_SCAN_BUFFER = 64 << 20;
+//! -compactinterval default (minutes, 0 = never)
+static const int DEFAULT_COMPACT_INTERVAL = 0;
+//! Parts of the txid range the scheduled chain state compaction works through, one per run
+static const int COMPACT_SLICES = 16;
+//! Layout version of the PoW hashes stored alongside the block index
+static const int POW_HASH_INDEX_VERSION = 1;
 
 struct CDiskTxPos : public CDiskBlockPos
 {
@@ -61,19 +87,148 @@ struct CDiskTxPos : public CDiskBlockPos
     }
 };
 
-/** CCoinsView backed by the coin database (chainstate/) */
+/** What a parallel coins scan produced for a stretch of transactions, see CCoinsViewDB::ScanCoins(). */
+struct CCoinsScanChunk
+{
+    CDataStream data;
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nSerializedSize;
+    CAmount nTotalAmount;
+
+    CCoinsScanChunk(int nType, int nVersion) : data(nType, nVersion), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
+};
+
+/**
+ * CCoinsView backed by the coin database (chainstate/)
+ *
+ * The database comes in two layouts. The original one stores a CCoins record
+ * per transaction, the per-output one stores every unspent output under its
+ * own key, so that spending an output does not rewrite its siblings. Both are
+ * presented as CCoins to the caches above.
+ */
 class CCoinsViewDB : public CCoinsView
 {
+public:
+    //! Encodes the coins of a transaction (and the size of their record) into a chunk
+    typedef boost::function<void(const uint256&, const CCoins&, unsigned int, CCoinsScanChunk&)> ScanEncoder;
+    //! Takes the finished chunks, in key order; returning false stops the scan
+    typedef boost::function<bool(const CCoinsScanChunk&)> ScanConsumer;
+
 protected:
     CDBWrapper db;
+    bool fPerOutput;
+    //! Written along with the next best block, if that is the block it is for
+    CUTXOCommitment commitment;
+    uint256 hashCommitmentBlock;
+
+    bool GetOutputs(const uint256 &txid, CCoins &coins) const;
+    void WriteOutputs(CDBBatch &batch, const uint256 &txid, const CCoins &coins, uint32_t nOutputsOld) const;
+    //! Cursor over the coins in pcursor, starting at the first transaction not before txidFrom
+    CCoinsViewDBCursor *Cursor(CDBIterator *pcursor, const uint256 &hashBlock, const uint256 &txidFrom) const;
+    void ThreadScanCoins(CCoinsScanState &state, const leveldb::Snapshot *snapshot, const uint256 &hashBlock, int nType, int nVersion, const ScanEncoder& encode) const;
 public:
-    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const CDBOptions& dbopts = CDBOptions(), const std::string& strName = "chainstate");
 
     bool GetCoins(const uint256 &txid, CCoins &coins) const;
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase = true);
     CCoinsViewCursor *Cursor() const;
+
+    //! The underlying database, for statistics
+    const CDBWrapper& GetDB() const { return db; }
+
+    //! Whether the database uses the per-output layout
+    bool IsPerOutput() const { return fPerOutput; }
+
+    /**
+     * Switch to the per-output layout if fPerOutputWanted and the database is
+     * empty or uses the per-transaction one, and finish a conversion that was
+     * interrupted before. There is no way back short of rebuilding.
+     */
+    bool Upgrade(bool fPerOutputWanted);
+
+    //! Set the UTXO commitment to store with the best block hashBlock
+    void SetCommitment(const CUTXOCommitment &commitmentIn, const uint256 &hashBlock);
+    //! Read the stored UTXO commitment and the block it is for
+    bool GetCommitment(CUTXOCommitment &commitmentOut, uint256 &hashBlock) const;
+
+    /**
+     * Write coins of transactions the database does not have yet as one
+     * batch, bypassing the caches. Used to bulk load a UTXO snapshot, which
+     * comes in txid and so in key order.
+     */
+    bool WriteFreshCoins(const std::vector<std::pair<uint256, CCoins> > &vCoins);
+
+    //! Erase all coins, bypassing the caches, in batches of ERASE_BATCH_KEYS records
+    bool EraseCoins();
+
+    //! Read or write the record of the UTXO snapshot the database was loaded from
+    bool ReadSnapshot(CTxOutSetSnapshot &snapshot) const;
+    bool WriteSnapshot(const CTxOutSetSnapshot &snapshot);
+
+    //! Compact the coins of part nSlice of nSlices equal parts of the txid range
+    void CompactSlice(int nSlice, int nSlices) const;
+
+    /**
+     * Walk all coins on nThreads threads, each reading its share of the txid
+     * range from one snapshot of the database. encode runs on the workers,
+     * which fill chunks of nType/nVersion data; consume gets the chunks on the
+     * calling thread in key order, so the result is the same as with a single
+     * cursor. hashBlock is set to the best block of the snapshot.
+     */
+    bool ScanCoins(int nThreads, int nType, int nVersion, const ScanEncoder& encode, const ScanConsumer& consume, uint256 &hashBlock) const;
+};
+
+/**
+ * CCoinsView that reads coins ahead of time on worker threads.
+ *
+ * Sits between the tip cache and the database. Prefetch() queues txids which
+ * the threads running ThreadPrefetch() read from the backing view into a
+ * staging area, from which GetCoins() then hands them out without touching the
+ * disk. The tip cache itself is not thread safe, so nothing is ever written
+ * into it from the workers.
+ *
+ * A BatchWrite invalidates everything staged or in flight, so a read that
+ * raced with the write can never be served.
+ */
+class CCoinsViewPrefetch : public CCoinsViewBacked
+{
+private:
+    typedef boost::unordered_map<uint256, CCoins, SaltedTxidHasher> StagedMap;
+
+    mutable boost::mutex mutex;
+    boost::condition_variable cond;
+    std::deque<uint256> queue;
+    mutable StagedMap mapStaged;
+    mutable size_t nStagedUsage;
+    //! Bumped by every write, to discard reads that started before it
+    uint64_t nGeneration;
+    int nThreads;
+    //! Staged coins past this usage are dropped
+    size_t nMaxUsage;
+
+    void ClearStaged() const;
+
+public:
+    CCoinsViewPrefetch(CCoinsView *viewIn, size_t nMaxUsageIn = MAX_PREFETCH_USAGE);
+
+    bool GetCoins(const uint256 &txid, CCoins &coins) const;
+    bool HaveCoins(const uint256 &txid) const;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase = true);
+
+    /**
+     * Queue txids to be read. Does nothing if no worker thread is running.
+     * Txids past MAX_PREFETCH_QUEUE waiting ones are dropped.
+     */
+    void Prefetch(const std::vector<uint256>& vTxid);
+
+    /** Memory taken up by coins read but not handed out yet */
+    size_t StagedUsage() const;
+
+    /** Worker loop; runs until the thread is interrupted. */
+    void ThreadPrefetch();
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -90,11 +245,17 @@ public:
     void Next();
 
 private:
-    CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn):
-        CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn) {}
+    CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn, bool fPerOutputIn):
+        CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn), fPerOutput(fPerOutputIn), nValueSizeTmp(0) {}
     boost::scoped_ptr<CDBIterator> pcursor;
     std::pair<char, uint256> keyTmp;
 
+    //! In the per-output layout, the outputs of a transaction are gathered into coinsTmp
+    bool fPerOutput;
+    CCoins coinsTmp;
+    unsigned int nValueSizeTmp;
+    void ReadOutputs();
+
     friend class CCoinsViewDB;
 };
 
@@ -102,12 +263,12 @@ private:
 class CBlockTreeDB : public CDBWrapper
 {
 public:
-    CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const CDBOptions& dbopts = CDBOptions());
 private:
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
 public:
-    bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo);
+    bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo, const std::vector<std::pair<uint256, uint256> >& powhashes);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &fileinfo);
     bool ReadLastBlockFile(int &nFile);
     bool WriteReindexing(bool fReindex);
@@ -116,7 +277,75 @@ public:
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
-    bool LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex);
+    bool ReadPoWHash(const uint256 &hash, uint256 &hashPoW);
+    bool WritePoWHashes(const std::vector<std::pair<uint256, uint256> >& powhashes);
+    bool ReadPoWHashVersion(int &nVersion);
+    bool WritePoWHashVersion(int nVersion);
+    /** Load the block index, checking each entry against its stored PoW hash. Entries without one are returned in vMissingPoWHash. */
+    bool LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex, std::vector<uint256>& vMissingPoWHash);
+};
+
+/**
+ * Header of a file with a dump of the UTXO set (see the dumptxoutset RPC). It
+ * is followed by nTransactions pairs of txid and CCoins as stored in the
+ * per-transaction layout, in txid order, and the hash of those.
+ */
+class CTxOutSetHeader
+{
+public:
+    static const int CURRENT_VERSION = 1;
+
+    unsigned char pchMagic[4];
+    int nVersion;
+    uint256 hashBlock;
+    uint64_t nTransactions;
+
+    CTxOutSetHeader() : nVersion(CURRENT_VERSION), nTransactions(0)
+    {
+        memcpy(pchMagic, "utxo", sizeof(pchMagic));
+    }
+
+    bool IsValid() const { return memcmp(pchMagic, "utxo", sizeof(pchMagic)) == 0 && nVersion == CURRENT_VERSION; }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(FLATDATA(pchMagic));
+        READWRITE(this->nVersion);
+        READWRITE(hashBlock);
+        READWRITE(nTransactions);
+    }
+};
+
+/**
+ * The UTXO snapshot a chain state database was bootstrapped from with
+ * -loadtxoutset. It is written before the first coin of the snapshot, so a
+ * load that did not finish can be told from one that did.
+ */
+class CTxOutSetSnapshot
+{
+public:
+    //! The block the snapshot is of
+    uint256 hashBlock;
+    //! Commitment to the coins of the snapshot
+    CUTXOCommitment commitment;
+    //! Whether all coins of the snapshot were written
+    bool fLoaded;
+    //! Whether connecting the blocks up to hashBlock led to the same commitment
+    bool fValidated;
+
+    CTxOutSetSnapshot() : fLoaded(false), fValidated(false) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(hashBlock);
+        READWRITE(commitment);
+        READWRITE(fLoaded);
+        READWRITE(fValidated);
+    }
 };
 
 #endif // BITCOIN_TXDB_H
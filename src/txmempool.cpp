@@ -83,15 +83,14 @@ size_t CTxMemPoolEntry::GetTxSize() const
 // descendants.
 void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendants, const std::set<uint256> &setExclude)
 {
-    setEntries stageEntries, setAllDescendants;
-    stageEntries = GetMemPoolChildren(updateIt);
+    vecEntries stageEntries = GetMemPoolChildren(updateIt);
+    setEntries setAllDescendants(stageEntries.begin(), stageEntries.end());
 
     while (!stageEntries.empty()) {
-        const txiter cit = *stageEntries.begin();
-        setAllDescendants.insert(cit);
-        stageEntries.erase(cit);
-        const setEntries &setChildren = GetMemPoolChildren(cit);
-        BOOST_FOREACH(const txiter childEntry, setChildren) {
+        const txiter cit = stageEntries.back();
+        stageEntries.pop_back();
+        const vecEntries &vChildren = GetMemPoolChildren(cit);
+        BOOST_FOREACH(const txiter childEntry, vChildren) {
             cacheMap::iterator cacheIt = cachedDescendants.find(childEntry);
             if (cacheIt != cachedDescendants.end()) {
                 // We've already calculated this one, just add the entries for this set
@@ -99,9 +98,9 @@ void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendan
                 BOOST_FOREACH(const txiter cacheEntry, cacheIt->second) {
                     setAllDescendants.insert(cacheEntry);
                 }
-            } else if (!setAllDescendants.count(childEntry)) {
+            } else if (setAllDescendants.insert(childEntry).second) {
                 // Schedule for later processing
-                stageEntries.insert(childEntry);
+                stageEntries.push_back(childEntry);
             }
         }
     }
@@ -165,6 +164,7 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
             if (setChildren.insert(childIter).second && !setAlreadyIncluded.count(childHash)) {
                 UpdateChild(it, childIter, true);
                 UpdateParent(childIter, it, true);
+                MergeClusters(it, childIter);
             }
         }
         UpdateForDescendants(it, mapMemPoolDescendantsToUpdate, setAlreadyIncluded);
@@ -173,7 +173,9 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
 
 bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents /* = true */) const
 {
-    setEntries parentHashes;
+    // setAncestors doubles as the set of entries already scheduled, so that
+    // parentHashes is a plain stack without duplicates.
+    vecEntries parentHashes;
     const CTransaction &tx = entry.GetTx();
 
     if (fSearchForParents) {
@@ -182,8 +184,8 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
         // iterate mapTx to find parents.
         for (unsigned int i = 0; i < tx.vin.size(); i++) {
             txiter piter = mapTx.find(tx.vin[i].prevout.hash);
-            if (piter != mapTx.end()) {
-                parentHashes.insert(piter);
+            if (piter != mapTx.end() && setAncestors.insert(piter).second) {
+                parentHashes.push_back(piter);
                 if (parentHashes.size() + 1 > limitAncestorCount) {
                     errString = strprintf("too many unconfirmed parents [limit: %u]", limitAncestorCount);
                     return false;
@@ -195,15 +197,14 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
         // entry in the mempool already.
         txiter it = mapTx.iterator_to(entry);
         parentHashes = GetMemPoolParents(it);
+        setAncestors.insert(parentHashes.begin(), parentHashes.end());
     }
 
     size_t totalSizeWithAncestors = entry.GetTxSize();
 
     while (!parentHashes.empty()) {
-        txiter stageit = *parentHashes.begin();
-
-        setAncestors.insert(stageit);
-        parentHashes.erase(stageit);
+        txiter stageit = parentHashes.back();
+        parentHashes.pop_back();
         totalSizeWithAncestors += stageit->GetTxSize();
 
         if (stageit->GetSizeWithDescendants() + entry.GetTxSize() > limitDescendantSize) {
@@ -217,13 +218,13 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
             return false;
         }
 
-        const setEntries & setMemPoolParents = GetMemPoolParents(stageit);
-        BOOST_FOREACH(const txiter &phash, setMemPoolParents) {
+        const vecEntries & vMemPoolParents = GetMemPoolParents(stageit);
+        BOOST_FOREACH(const txiter &phash, vMemPoolParents) {
             // If this is a new ancestor, add it.
-            if (setAncestors.count(phash) == 0) {
-                parentHashes.insert(phash);
+            if (setAncestors.insert(phash).second) {
+                parentHashes.push_back(phash);
             }
-            if (parentHashes.size() + setAncestors.size() + 1 > limitAncestorCount) {
+            if (setAncestors.size() + 1 > limitAncestorCount) {
                 errString = strprintf("too many unconfirmed ancestors [limit: %u]", limitAncestorCount);
                 return false;
             }
@@ -235,7 +236,7 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
 
 void CTxMemPool::UpdateAncestorsOf(bool add, txiter it, setEntries &setAncestors)
 {
-    setEntries parentIters = GetMemPoolParents(it);
+    const vecEntries &parentIters = GetMemPoolParents(it);
     // add or remove this tx as a child of each parent
     BOOST_FOREACH(txiter piter, parentIters) {
         UpdateChild(piter, it, add);
@@ -264,8 +265,8 @@ void CTxMemPool::UpdateEntryForAncestors(txiter it, const setEntries &setAncesto
 
 void CTxMemPool::UpdateChildrenForRemoval(txiter it)
 {
-    const setEntries &setMemPoolChildren = GetMemPoolChildren(it);
-    BOOST_FOREACH(txiter updateIt, setMemPoolChildren) {
+    const vecEntries &vMemPoolChildren = GetMemPoolChildren(it);
+    BOOST_FOREACH(txiter updateIt, vMemPoolChildren) {
         UpdateParent(updateIt, it, false);
     }
 }
@@ -349,7 +350,7 @@ void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee,
 }
 
 CTxMemPool::CTxMemPool(const CFeeRate& _minReasonableRelayFee) :
-    nTransactionsUpdated(0)
+    nTransactionsUpdated(0), nNextClusterId(0)
 {
     _clear(); //lock free clear
 
@@ -411,6 +412,11 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
             mapTx.modify(newit, update_fee_delta(deltas.second));
         }
     }
+    TxCluster &cluster = mapClusters[nNextClusterId];
+    cluster.nCount = 1;
+    cluster.nTxSize = newit->GetTxSize();
+    cluster.nModFees = newit->GetModifiedFee();
+    mapLinks[newit].nCluster = nNextClusterId++;
 
     // Update cachedInnerUsage to include contained transaction's usage.
     // (When we update the entry for in-mempool parents, memory usage will be
@@ -435,12 +441,14 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
         txiter pit = mapTx.find(phash);
         if (pit != mapTx.end()) {
             UpdateParent(newit, pit, true);
+            MergeClusters(pit, newit);
         }
     }
     UpdateAncestorsOf(true, newit, setAncestors);
     UpdateEntryForAncestors(newit, setAncestors);
 
     nTransactionsUpdated++;
+    NotifyEntryAdded(hash);
     totalTxSize += entry.GetTxSize();
     minerPolicyEstimator->processTransaction(entry, fCurrentEstimate);
 
@@ -467,10 +475,19 @@ void CTxMemPool::removeUnchecked(txiter it)
 
     totalTxSize -= it->GetTxSize();
     cachedInnerUsage -= it->DynamicMemoryUsage();
-    cachedInnerUsage -= memusage::DynamicUsage(mapLinks[it].parents) + memusage::DynamicUsage(mapLinks[it].children);
+    const TxLinks &links = mapLinks[it];
+    TxCluster &cluster = mapClusters[links.nCluster];
+    if (--cluster.nCount == 0) {
+        mapClusters.erase(links.nCluster);
+    } else {
+        cluster.nTxSize -= it->GetTxSize();
+        cluster.nModFees -= it->GetModifiedFee();
+    }
+    cachedInnerUsage -= memusage::DynamicUsage(links.parents) + memusage::DynamicUsage(links.children);
     mapLinks.erase(it);
     mapTx.erase(it);
     nTransactionsUpdated++;
+    NotifyEntryRemoved(hash);
     minerPolicyEstimator->removeTx(hash);
 }
 
@@ -482,22 +499,21 @@ void CTxMemPool::removeUnchecked(txiter it)
 // can save time by not iterating over those entries.
 void CTxMemPool::CalculateDescendants(txiter entryit, setEntries &setDescendants)
 {
-    setEntries stage;
-    if (setDescendants.count(entryit) == 0) {
-        stage.insert(entryit);
+    vecEntries stage;
+    if (setDescendants.insert(entryit).second) {
+        stage.push_back(entryit);
     }
     // Traverse down the children of entry, only adding children that are not
     // accounted for in setDescendants already (because those children have either
     // already been walked, or will be walked in this iteration).
     while (!stage.empty()) {
-        txiter it = *stage.begin();
-        setDescendants.insert(it);
-        stage.erase(it);
-
-        const setEntries &setChildren = GetMemPoolChildren(it);
-        BOOST_FOREACH(const txiter &childiter, setChildren) {
-            if (!setDescendants.count(childiter)) {
-                stage.insert(childiter);
+        txiter it = stage.back();
+        stage.pop_back();
+
+        const vecEntries &vChildren = GetMemPoolChildren(it);
+        BOOST_FOREACH(const txiter &childiter, vChildren) {
+            if (setDescendants.insert(childiter).second) {
+                stage.push_back(childiter);
             }
         }
     }
@@ -627,6 +643,7 @@ void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned i
 void CTxMemPool::_clear()
 {
     mapLinks.clear();
+    mapClusters.clear();
     mapTx.clear();
     mapNextTx.clear();
     totalTxSize = 0;
@@ -660,6 +677,8 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
 
     LOCK(cs);
     list<const CTxMemPoolEntry*> waitingOnDependants;
+    std::map<uint64_t, TxCluster> mapClustersCheck;
+    std::map<uint64_t, txiter> mapClusterMembers;
     for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
         unsigned int i = 0;
         checkTotal += it->GetTxSize();
@@ -695,7 +714,18 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             assert(it3->second == &tx);
             i++;
         }
-        assert(setParentCheck == GetMemPoolParents(it));
+        assert(setParentCheck.size() == links.parents.size());
+        assert(setParentCheck == setEntries(links.parents.begin(), links.parents.end()));
+        // Check cluster membership; parents must share the entry's cluster.
+        BOOST_FOREACH(txiter parentit, links.parents) {
+            assert(mapLinks.find(parentit)->second.nCluster == links.nCluster);
+        }
+        TxCluster &clusterCheck = mapClustersCheck[links.nCluster];
+        if (clusterCheck.nCount == 0)
+            mapClusterMembers.insert(std::make_pair(links.nCluster, mapTx.project<0>(it)));
+        clusterCheck.nCount++;
+        clusterCheck.nTxSize += it->GetTxSize();
+        clusterCheck.nModFees += it->GetModifiedFee();
         // Verify ancestor state is correct.
         setEntries setAncestors;
         uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
@@ -728,7 +758,8 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
                 childSizes += childit->GetTxSize();
             }
         }
-        assert(setChildrenCheck == GetMemPoolChildren(it));
+        assert(setChildrenCheck.size() == links.children.size());
+        assert(setChildrenCheck == setEntries(links.children.begin(), links.children.end()));
         // Also check to make sure size is greater than sum with immediate children.
         // just a sanity check, not definitive that this calc is correct...
         assert(it->GetSizeWithDescendants() >= childSizes + it->GetTxSize());
@@ -766,10 +797,59 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
         assert(&tx == it->second);
     }
 
+    assert(mapClustersCheck.size() == mapClusters.size());
+    for (std::map<uint64_t, TxCluster>::const_iterator it = mapClusters.begin(); it != mapClusters.end(); it++) {
+        const TxCluster &clusterCheck = mapClustersCheck[it->first];
+        assert(it->second.nCount == clusterCheck.nCount);
+        assert(it->second.nTxSize == clusterCheck.nTxSize);
+        assert(it->second.nModFees == clusterCheck.nModFees);
+        // A cluster is exactly what can be reached from any one member.
+        setEntries setReached;
+        vecEntries stage(1, mapClusterMembers[it->first]);
+        setReached.insert(stage.back());
+        while (!stage.empty()) {
+            const TxLinks &links = mapLinks.find(stage.back())->second;
+            stage.pop_back();
+            BOOST_FOREACH(txiter parentit, links.parents) {
+                if (setReached.insert(parentit).second)
+                    stage.push_back(parentit);
+            }
+            BOOST_FOREACH(txiter childit, links.children) {
+                if (setReached.insert(childit).second)
+                    stage.push_back(childit);
+            }
+        }
+        assert(setReached.size() == it->second.nCount);
+    }
+
     assert(totalTxSize == checkTotal);
     assert(innerUsage == cachedInnerUsage);
 }
 
+void CTxMemPool::Snapshot(CTxMemPool& snapshot) const
+{
+    LOCK2(cs, snapshot.cs);
+    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); ++it)
+        snapshot.mapTx.insert(*it);
+    // mapLinks is ordered by txid, so its copy can be built with end() as the
+    // insertion hint.
+    for (txlinksMap::const_iterator it = mapLinks.begin(); it != mapLinks.end(); ++it) {
+        TxLinks& links = snapshot.mapLinks.insert(snapshot.mapLinks.end(), std::make_pair(snapshot.mapTx.find(it->first->GetTx().GetHash()), TxLinks()))->second;
+        links.nCluster = it->second.nCluster;
+        links.parents.reserve(it->second.parents.size());
+        BOOST_FOREACH(txiter parent, it->second.parents)
+            links.parents.push_back(snapshot.mapTx.find(parent->GetTx().GetHash()));
+        links.children.reserve(it->second.children.size());
+        BOOST_FOREACH(txiter child, it->second.children)
+            links.children.push_back(snapshot.mapTx.find(child->GetTx().GetHash()));
+    }
+    snapshot.mapClusters = mapClusters;
+    snapshot.nNextClusterId = nNextClusterId;
+    snapshot.mapDeltas = mapDeltas;
+    snapshot.totalTxSize = totalTxSize;
+    snapshot.nTransactionsUpdated = nTransactionsUpdated;
+}
+
 bool CTxMemPool::CompareDepthAndScore(const uint256& hasha, const uint256& hashb)
 {
     LOCK(cs);
@@ -926,6 +1006,7 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash,
         txiter it = mapTx.find(hash);
         if (it != mapTx.end()) {
             mapTx.modify(it, update_fee_delta(deltas.second));
+            mapClusters[mapLinks[it].nCluster].nModFees += nFeeDelta;
             // Now update all ancestors' modified fees with descendants
             setEntries setAncestors;
             uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
@@ -934,6 +1015,7 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash,
             BOOST_FOREACH(txiter ancestorIt, setAncestors) {
                 mapTx.modify(ancestorIt, update_descendant_state(0, nFeeDelta, 0));
             }
+            ++nTransactionsUpdated;
         }
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", strHash, dPriorityDelta, FormatMoney(nFeeDelta));
@@ -985,15 +1067,45 @@ bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) const {
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
     // Estimate the overhead of mapTx to be 15 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(mapClusters) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
 }
 
 void CTxMemPool::RemoveStaged(setEntries &stage, bool updateDescendants) {
     AssertLockHeld(cs);
+    // Every part a cluster may fall apart into is linked to one of the
+    // removed entries, so their remaining neighbours are where to rebuild
+    // clusters from. The links have to be read before
+    // UpdateForRemoveFromMempool() drops those between staged entries: a
+    // cluster that loses any entry with a neighbour left behind is split.
+    vecEntries vNeighbours;
+    std::set<uint64_t> setClustersToSplit;
+    BOOST_FOREACH(const txiter& it, stage) {
+        const TxLinks &links = mapLinks[it];
+        BOOST_FOREACH(txiter parentit, links.parents) {
+            if (!stage.count(parentit)) {
+                vNeighbours.push_back(parentit);
+                setClustersToSplit.insert(links.nCluster);
+            }
+        }
+        BOOST_FOREACH(txiter childit, links.children) {
+            if (!stage.count(childit)) {
+                vNeighbours.push_back(childit);
+                setClustersToSplit.insert(links.nCluster);
+            }
+        }
+    }
     UpdateForRemoveFromMempool(stage, updateDescendants);
     BOOST_FOREACH(const txiter& it, stage) {
         removeUnchecked(it);
     }
+    BOOST_FOREACH(txiter it, vNeighbours) {
+        uint64_t nCluster = mapLinks[it].nCluster;
+        if (setClustersToSplit.count(nCluster))
+            MoveToCluster(it, nCluster, nNextClusterId++);
+    }
+    BOOST_FOREACH(uint64_t nCluster, setClustersToSplit) {
+        mapClusters.erase(nCluster);
+    }
 }
 
 int CTxMemPool::Expire(int64_t time) {
@@ -1022,27 +1134,108 @@ bool CTxMemPool::addUnchecked(const uint256&hash, const CTxMemPoolEntry &entry,
     return addUnchecked(hash, entry, setAncestors, fCurrentEstimate);
 }
 
-void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
+// Add or remove an element of an unordered link vector, keeping
+// cachedInnerUsage in step with the vector's allocation.
+static void UpdateLinkVector(CTxMemPool::vecEntries& v, CTxMemPool::txiter it, bool add, uint64_t& cachedInnerUsage)
 {
-    setEntries s;
-    if (add && mapLinks[entry].children.insert(child).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && mapLinks[entry].children.erase(child)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
+    cachedInnerUsage -= memusage::DynamicUsage(v);
+    CTxMemPool::vecEntries::iterator pos = std::find(v.begin(), v.end(), it);
+    if (add && pos == v.end()) {
+        v.push_back(it);
+    } else if (!add && pos != v.end()) {
+        *pos = v.back();
+        v.pop_back();
+        if (v.size() * 2 < v.capacity())
+            v.shrink_to_fit();
     }
+    cachedInnerUsage += memusage::DynamicUsage(v);
+}
+
+void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
+{
+    UpdateLinkVector(mapLinks[entry].children, child, add, cachedInnerUsage);
 }
 
 void CTxMemPool::UpdateParent(txiter entry, txiter parent, bool add)
 {
-    setEntries s;
-    if (add && mapLinks[entry].parents.insert(parent).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && mapLinks[entry].parents.erase(parent)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
+    UpdateLinkVector(mapLinks[entry].parents, parent, add, cachedInnerUsage);
+}
+
+void CTxMemPool::MoveToCluster(txiter entry, uint64_t nFrom, uint64_t nTo)
+{
+    TxCluster &cluster = mapClusters[nTo];
+    vecEntries stage(1, entry);
+    mapLinks[entry].nCluster = nTo;
+    while (!stage.empty()) {
+        txiter it = stage.back();
+        stage.pop_back();
+        cluster.nCount++;
+        cluster.nTxSize += it->GetTxSize();
+        cluster.nModFees += it->GetModifiedFee();
+
+        const TxLinks &links = mapLinks[it];
+        BOOST_FOREACH(txiter parentit, links.parents) {
+            TxLinks &parentlinks = mapLinks[parentit];
+            if (parentlinks.nCluster == nFrom) {
+                parentlinks.nCluster = nTo;
+                stage.push_back(parentit);
+            }
+        }
+        BOOST_FOREACH(txiter childit, links.children) {
+            TxLinks &childlinks = mapLinks[childit];
+            if (childlinks.nCluster == nFrom) {
+                childlinks.nCluster = nTo;
+                stage.push_back(childit);
+            }
+        }
+    }
+}
+
+void CTxMemPool::MergeClusters(txiter a, txiter b)
+{
+    uint64_t nClusterA = mapLinks[a].nCluster;
+    uint64_t nClusterB = mapLinks[b].nCluster;
+    if (nClusterA == nClusterB)
+        return;
+    if (mapClusters[nClusterA].nCount < mapClusters[nClusterB].nCount) {
+        std::swap(a, b);
+        std::swap(nClusterA, nClusterB);
+    }
+    // The link between a and b is already in place, so walking from b visits
+    // all of its old cluster and stops at a's.
+    mapClusters.erase(nClusterB);
+    MoveToCluster(b, nClusterB, nClusterA);
+}
+
+void CTxMemPool::GetClusterStats(txiter it, uint64_t& nCount, uint64_t& nSize, CAmount& nModFees) const
+{
+    LOCK(cs);
+    txlinksMap::const_iterator linksit = mapLinks.find(it);
+    assert(linksit != mapLinks.end());
+    std::map<uint64_t, TxCluster>::const_iterator clusterit = mapClusters.find(linksit->second.nCluster);
+    assert(clusterit != mapClusters.end());
+    nCount = clusterit->second.nCount;
+    nSize = clusterit->second.nTxSize;
+    nModFees = clusterit->second.nModFees;
+}
+
+uint64_t CTxMemPool::CalculateClusterCount(const setEntries& setAncestors) const
+{
+    LOCK(cs);
+    // Ancestors share clusters with the direct parents, so summing the sizes of
+    // their distinct clusters counts every transaction that would be joined.
+    std::set<uint64_t> setClusters;
+    uint64_t nCount = 1;
+    BOOST_FOREACH(txiter it, setAncestors) {
+        txlinksMap::const_iterator linksit = mapLinks.find(it);
+        assert(linksit != mapLinks.end());
+        if (setClusters.insert(linksit->second.nCluster).second)
+            nCount += mapClusters.find(linksit->second.nCluster)->second.nCount;
     }
+    return nCount;
 }
 
-const CTxMemPool::setEntries & CTxMemPool::GetMemPoolParents(txiter entry) const
+const CTxMemPool::vecEntries & CTxMemPool::GetMemPoolParents(txiter entry) const
 {
     assert (entry != mapTx.end());
     txlinksMap::const_iterator it = mapLinks.find(entry);
@@ -1050,7 +1243,7 @@ const CTxMemPool::setEntries & CTxMemPool::GetMemPoolParents(txiter entry) const
     return it->second.parents;
 }
 
-const CTxMemPool::setEntries & CTxMemPool::GetMemPoolChildren(txiter entry) const
+const CTxMemPool::vecEntries & CTxMemPool::GetMemPoolChildren(txiter entry) const
 {
     assert (entry != mapTx.end());
     txlinksMap::const_iterator it = mapLinks.find(entry);
@@ -21,6 +21,8 @@
 #include "boost/multi_index/ordered_index.hpp"
 #include "boost/multi_index/hashed_index.hpp"
 
+#include <boost/signals2/signal.hpp>
+
 class CAutoFile;
 class CBlockIndex;
 
@@ -224,7 +226,7 @@ struct mempoolentry_txid
 class CompareTxMemPoolEntryByDescendantScore
 {
 public:
-    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b)
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
     {
         bool fUseADescendants = UseDescendantScore(a);
         bool fUseBDescendants = UseDescendantScore(b);
@@ -246,7 +248,7 @@ public:
     }
 
     // Calculate which score to use for an entry (avoiding division).
-    bool UseDescendantScore(const CTxMemPoolEntry &a)
+    bool UseDescendantScore(const CTxMemPoolEntry &a) const
     {
         double f1 = (double)a.GetModifiedFee() * a.GetSizeWithDescendants();
         double f2 = (double)a.GetModFeesWithDescendants() * a.GetTxSize();
@@ -261,7 +263,7 @@ public:
 class CompareTxMemPoolEntryByScore
 {
 public:
-    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b)
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
     {
         double f1 = (double)a.GetModifiedFee() * b.GetTxSize();
         double f2 = (double)b.GetModifiedFee() * a.GetTxSize();
@@ -275,7 +277,7 @@ public:
 class CompareTxMemPoolEntryByEntryTime
 {
 public:
-    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b)
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
     {
         return a.GetTime() < b.GetTime();
     }
@@ -284,7 +286,7 @@ public:
 class CompareTxMemPoolEntryByAncestorFee
 {
 public:
-    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b)
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
     {
         double aFees = a.GetModFeesWithAncestors();
         double aSize = a.GetSizeWithAncestors();
@@ -372,6 +374,16 @@ struct TxMempoolInfo
  * be in an inconsistent state where it's impossible to walk the ancestors of
  * a transaction.)
  *
+ * Transactions connected through mapLinks form clusters, which are kept in
+ * mapClusters together with their count, total size and modified fees.  A new
+ * transaction merges the clusters of its parents into one (relabelling the
+ * members of the smaller clusters), and removing transactions re-partitions
+ * the clusters they held together, so both cost time proportional to the
+ * clusters involved.  -limitclustercount bounds how large a cluster may grow
+ * through AcceptToMemoryPool() only: like the ancestor and descendant limits,
+ * it is not applied to transactions re-added from disconnected blocks, whose
+ * clusters UpdateTransactionsFromBlock() merges whatever their size.
+ *
  * In the event of a reorg, the assumption that a newly added tx has no
  * in-mempool children is false.  In particular, the mempool is in an
  * inconsistent state while new transactions are being added, because there may
@@ -470,29 +482,56 @@ public:
         }
     };
     typedef std::set<txiter, CompareIteratorByHash> setEntries;
+    typedef std::vector<txiter> vecEntries;
 
-    const setEntries & GetMemPoolParents(txiter entry) const;
-    const setEntries & GetMemPoolChildren(txiter entry) const;
+    const vecEntries & GetMemPoolParents(txiter entry) const;
+    const vecEntries & GetMemPoolChildren(txiter entry) const;
 private:
     typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
 
     struct TxLinks {
-        setEntries parents;
-        setEntries children;
+        vecEntries parents;
+        vecEntries children;
+        uint64_t nCluster; //!< id of the cluster in mapClusters holding this entry
+
+        TxLinks() : nCluster(0) {}
     };
 
     typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
     txlinksMap mapLinks;
 
+    /** Aggregate state of a connected component of the graph formed by
+     *  mapLinks.  Its members are found by walking the links. */
+    struct TxCluster {
+        uint64_t nCount;
+        uint64_t nTxSize;
+        CAmount nModFees;
+
+        TxCluster() : nCount(0), nTxSize(0), nModFees(0) {}
+    };
+
+    std::map<uint64_t, TxCluster> mapClusters;
+    uint64_t nNextClusterId;
+
     void UpdateParent(txiter entry, txiter parent, bool add);
     void UpdateChild(txiter entry, txiter child, bool add);
 
+    /** Move entry and everything reachable from it that is still in cluster
+     *  nFrom into cluster nTo, creating nTo if needed. */
+    void MoveToCluster(txiter entry, uint64_t nFrom, uint64_t nTo);
+    /** Join the clusters of two newly linked entries, moving the smaller one. */
+    void MergeClusters(txiter a, txiter b);
+
     std::vector<indexed_transaction_set::const_iterator> GetSortedDepthAndScore() const;
 
 public:
     indirectmap<COutPoint, const CTransaction*> mapNextTx;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
 
+    /** Fired with cs held for every transaction added to or removed from mapTx. */
+    boost::signals2::signal<void (const uint256&)> NotifyEntryAdded;
+    boost::signals2::signal<void (const uint256&)> NotifyEntryRemoved;
+
     /** Create a new CTxMemPool.
      *  minReasonableRelayFee should be a feerate which is, roughly, somewhere
      *  around what it "costs" to relay a transaction around the network and
@@ -526,6 +565,12 @@ public:
     void _clear(); //lock free
     bool CompareDepthAndScore(const uint256& hasha, const uint256& hashb);
     void queryHashes(std::vector<uint256>& vtxid);
+    /**
+     * Copy the entries, their in-mempool links and the fee deltas into the
+     * empty pool snapshot, which can then be read without holding cs. The
+     * copy has no mapNextTx and does not track fee estimates.
+     */
+    void Snapshot(CTxMemPool& snapshot) const;
     void pruneSpent(const uint256& hash, CCoins &coins);
     unsigned int GetTransactionsUpdated() const;
     void AddTransactionsUpdated(unsigned int n);
@@ -558,6 +603,8 @@ public:
      *  child transactions present in hashesToUpdate, which are already accounted
      *  for).  Note: hashesToUpdate should be the set of transactions from the
      *  disconnected block that have been accepted back into the mempool.
+     *  Their clusters are merged with those of their children without
+     *  checking -limitclustercount.
      */
     void UpdateTransactionsFromBlock(const std::vector<uint256> &hashesToUpdate);
 
@@ -595,6 +642,14 @@ public:
     /** Expire all transaction (and their dependencies) in the mempool older than time. Return the number of removed transactions. */
     int Expire(int64_t time);
 
+    /** Count, size and modified fees of the cluster containing it, i.e. of all
+     *  transactions connected to it through in-mempool parents or children. */
+    void GetClusterStats(txiter it, uint64_t& nCount, uint64_t& nSize, CAmount& nModFees) const;
+
+    /** Number of transactions in the cluster a new transaction with the given
+     *  in-mempool ancestors would end up in, including itself. */
+    uint64_t CalculateClusterCount(const setEntries& setAncestors) const;
+
     /** Returns false if the transaction is in the mempool and not within the chain limit specified. */
     bool TransactionWithinChainLimit(const uint256& txid, size_t chainLimit) const;
 
@@ -678,7 +733,8 @@ private:
      *  CTxMemPoolEntry's setMemPoolParents in order to walk ancestors of a
      *  given transaction that is removed, so we can't remove intermediate
      *  transactions in a chain before we've updated all the state for the
-     *  removal.
+     *  removal.  Splitting the clusters that removal leaves behind is up
+     *  to RemoveStaged.
      */
     void removeUnchecked(txiter entry);
 };
@@ -703,7 +759,7 @@ typedef std::pair<double, CTxMemPool::txiter> TxCoinAgePriority;
 
 struct TxCoinAgePriorityCompare
 {
-    bool operator()(const TxCoinAgePriority& a, const TxCoinAgePriority& b)
+    bool operator()(const TxCoinAgePriority& a, const TxCoinAgePriority& b) const
     {
         if (a.first == b.first)
             return CompareTxMemPoolEntryByScore()(*(b.second), *(a.second)); //Reverse order to make sort less than